@@ -0,0 +1,131 @@
+/*
+ * Test kernel for script/bench.sh
+ *
+ * Reports the loader's stage timestamps and its own entry TSC over COM1, then exits QEMU through isa-debug-exit
+ * Runs with whatever the loader left us, so no globals that need relocating and nothing in bss
+ */
+
+#include <stdint.h>
+
+#define COM1                0x3F8
+#define DEBUG_EXIT_PORT     0xF4
+#define DEBUG_EXIT_OK       0x10 // QEMU exits with (0x10 << 1) | 1 = 33
+#define RESET_CONTROL_PORT  0xCF9
+#define RESET_CONTROL_RESET 0x06 // Full reset, QEMU treats it as system_reset and keeps guest RAM
+
+// Mirrors stage_table_t and boot_info_t in include/info.h, only the parts we read
+struct stage_table {
+    uint64_t    tsc_hz;
+    uint32_t    num_stages;
+    uint32_t    reserved;
+    uint64_t    tsc[16];
+};
+
+struct boot_info {
+    void                *rtservice;
+    void                *gpu_config;
+    void                *mem_map;
+    void                *rsdp;
+    void                *acpi_dir;
+    void                *pci_info;
+    void                *console;
+    void                *log;
+    struct stage_table  *stages;
+    void                *reclaim;
+    uint32_t            flags;
+};
+
+#define BOOT_INFO_KERNEL_CACHE  0x1
+#define BOOT_INFO_KERNEL_CACHED 0x2
+
+static inline void outb(uint16_t port, uint8_t value)
+{
+    __asm__ volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port)
+{
+    uint8_t value;
+
+    __asm__ volatile ("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t) hi << 32) | lo;
+}
+
+static void serial_putc(char c)
+{
+    // Wait for the transmit holding register to empty
+    while (!(inb(COM1 + 5) & 0x20)) ;
+    outb(COM1, (uint8_t) c);
+}
+
+static void serial_puts(const char *s)
+{
+    while (*s) {
+        serial_putc(*s++);
+    }
+}
+
+static void serial_putu(uint64_t value)
+{
+    char buf[21];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    serial_puts(&buf[i]);
+}
+
+/*
+ * UBBENCH hz=<tsc hz> now=<tsc at entry> flags=<boot_info flags> stages=<tsc>,<tsc>,...
+ * Built with WARM_RESET, a boot that had to read the kernel from disk resets the machine instead of exiting
+ * so the run ends on a warm boot that can reuse the cached copy
+ */
+__attribute__((section(".text.kmain")))
+void kmain(void *mem_map, void *gfx_info, struct boot_info *boot_info)
+{
+    uint64_t now = rdtsc();
+    struct stage_table *stages = boot_info ? boot_info->stages : 0;
+
+    (void) mem_map;
+    (void) gfx_info;
+
+    serial_puts("\r\nUBBENCH hz=");
+    serial_putu(stages ? stages->tsc_hz : 0);
+    serial_puts(" now=");
+    serial_putu(now);
+    serial_puts(" flags=");
+    serial_putu(boot_info ? boot_info->flags : 0);
+    serial_puts(" stages=");
+    for (uint32_t i = 0; stages && i < stages->num_stages && i < 16; i++) {
+        if (i) {
+            serial_putc(',');
+        }
+        serial_putu(stages->tsc[i]);
+    }
+    serial_puts("\r\n");
+
+#ifdef WARM_RESET
+    if (boot_info && (boot_info->flags & BOOT_INFO_KERNEL_CACHE) && !(boot_info->flags & BOOT_INFO_KERNEL_CACHED)) {
+        outb(RESET_CONTROL_PORT, RESET_CONTROL_RESET);
+    }
+#endif
+
+    outb(DEBUG_EXIT_PORT, DEBUG_EXIT_OK);
+
+    for (;;) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
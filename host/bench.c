@@ -0,0 +1,322 @@
+/*
+ * Microbenchmarks of the loader core on Linux, built by script/build_host.sh
+ *
+ *   ./host_bench [-n ITERATIONS] [-f FILTER]
+ *
+ * Times the hot paths of the loader sources the firmware build uses, over host/shim.c, on the large
+ * synthetic inputs from host/fixture.c (ELF image, tar archive, ACPI tables, QOI image, LZ4 frame).
+ * Whether they get the right answer is host_test's job, run it first. Exit status is nonzero if an
+ * input couldn't be set up.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Uefi.h>
+
+#include "arena.h"
+#include "fixture.h"
+#include "info.h"
+#include "loadelf.h"
+#include "lz4.h"
+#include "qoi.h"
+#include "shim.h"
+#include "tar.h"
+#include "uefi_acpi.h"
+
+typedef struct {
+    const char  *name;
+    int         (*setup)(); // Builds the input, 0 on success
+    void        (*run)(); // One timed iteration
+    void        (*teardown)();
+    UINT64      bytes; // Input bytes per iteration, for throughput
+} bench_t;
+
+static int iterations = 20;
+
+static UINT64 now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (UINT64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    UINT64 x = *(const UINT64 *) a;
+    UINT64 y = *(const UINT64 *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * ELF loading
+ */
+
+static EFI_FILE *elf_file;
+
+static int elf_setup()
+{
+    elf_build(0);
+
+    elf_file = shim_file_from_buffer(elf_image, elf_size);
+    CHECK(elf_file != NULL);
+
+    return 0;
+}
+
+// The fixed address loaders take p_paddr literally, so they get an image linked at ELF_FIXED_BASE
+static int elf_fixed_setup()
+{
+    elf_build(ELF_FIXED_BASE);
+
+    elf_file = shim_file_from_buffer(elf_image, elf_size);
+    CHECK(elf_file != NULL);
+
+    return 0;
+}
+
+static void elf_teardown()
+{
+    if (elf_file) {
+        elf_file->Close(elf_file);
+        elf_file = NULL;
+    }
+    free(elf_image);
+    free_all_pages();
+}
+
+static void elf_mem_relo_run()
+{
+    elf_load_mem_relo(elf_image, elf_size);
+    free_all_pages();
+}
+
+static void elf_file_relo_run()
+{
+    elf_load_file_relo(elf_file);
+    free_all_pages();
+}
+
+static void elf_mem_aligned_run()
+{
+    elf_load_mem_aligned(elf_image, elf_size);
+    free_all_pages();
+}
+
+static void elf_file_aligned_run()
+{
+    elf_load_file_aligned(elf_file);
+    free_all_pages();
+}
+
+static void elf_mem_fixed_run()
+{
+    elf_load_mem(elf_image, elf_size);
+    free_all_pages();
+}
+
+static void elf_file_fixed_run()
+{
+    elf_load_file(elf_file);
+    free_all_pages();
+}
+
+/*
+ * Tar lookup
+ */
+
+static int tar_setup()
+{
+    tar_build();
+
+    return 0;
+}
+
+static void tar_teardown()
+{
+    tar_free();
+}
+
+static void tar_run()
+{
+    tar_get_fileaddr(tar_image, tar_last, tar_image + tar_image_size);
+}
+
+/*
+ * ACPI directory and checksums
+ */
+
+static acpi_dir_t acpi_dir;
+
+static int acpi_setup()
+{
+    acpi_build();
+
+    return 0;
+}
+
+static void acpi_teardown()
+{
+    acpi_free();
+    free_all_pages();
+}
+
+static void acpi_dir_run()
+{
+    acpi_build_dir(&acpi.rsdp, &acpi_dir, FALSE);
+}
+
+static void acpi_pack_run()
+{
+    acpi_build_dir(&acpi.rsdp, &acpi_dir, TRUE);
+    free_all_pages();
+}
+
+static void acpi_checksum_run()
+{
+    acpi_build_dir(&acpi.rsdp, &acpi_dir, FALSE);
+    acpi_checksum_dir(&acpi_dir, NULL);
+    arena_reset(&arena_scratch);
+}
+
+/*
+ * QOI decoding
+ */
+
+static UINT32 qoi_out[QOI_WIDTH];
+
+static int qoi_setup()
+{
+    qoi_build();
+
+    return 0;
+}
+
+static void qoi_teardown()
+{
+    qoi_free();
+}
+
+static void qoi_run()
+{
+    qoi_state_t qs;
+    const UINT8 *p = qoi_image + QOI_HEADER_SIZE;
+
+    qoi_init(&qs);
+    for (UINT32 y = 0; y < QOI_HEIGHT; y++) {
+        p = qoi_decode_span(&qs, p, qoi_image + qoi_size - QOI_END_SIZE, qoi_out, QOI_WIDTH);
+    }
+}
+
+/*
+ * LZ4 frames
+ */
+
+static UINT8 *lz4_out;
+
+static int lz4_setup()
+{
+    lz4_build();
+    lz4_out = malloc(LZ4_DATA_SIZE);
+    CHECK(lz4_data != NULL && lz4_frame != NULL && lz4_out != NULL);
+
+    return 0;
+}
+
+static void lz4_teardown()
+{
+    lz4_free();
+    free(lz4_out);
+}
+
+static void lz4_run()
+{
+    lz4_decode_frame(lz4_frame, lz4_frame_len, lz4_out, LZ4_DATA_SIZE);
+}
+
+static bench_t benches[] = {
+    { "elf_load_mem_relo",  elf_setup,          elf_mem_relo_run,   elf_teardown,   ELF_SEGMENTS * ELF_SEGMENT_SIZE },
+    { "elf_load_file_relo", elf_setup,          elf_file_relo_run,  elf_teardown,   ELF_SEGMENTS * ELF_SEGMENT_SIZE },
+    { "elf_load_mem_aligned", elf_setup,        elf_mem_aligned_run, elf_teardown,  ELF_SEGMENTS * ELF_SEGMENT_SIZE },
+    { "elf_load_file_aligned", elf_setup,       elf_file_aligned_run, elf_teardown, ELF_SEGMENTS * ELF_SEGMENT_SIZE },
+    { "elf_load_mem",       elf_fixed_setup,    elf_mem_fixed_run,  elf_teardown,   ELF_SEGMENTS * ELF_SEGMENT_SIZE },
+    { "elf_load_file",      elf_fixed_setup,    elf_file_fixed_run, elf_teardown,   ELF_SEGMENTS * ELF_SEGMENT_SIZE },
+    { "tar_lookup_last",    tar_setup,          tar_run,            tar_teardown,   0 },
+    { "acpi_build_dir",     acpi_setup,         acpi_dir_run,       acpi_teardown,  0 },
+    { "acpi_build_dir_pack", acpi_setup,        acpi_pack_run,      acpi_teardown,  0 },
+    { "acpi_checksum_dir",  acpi_setup,         acpi_checksum_run,  acpi_teardown,  0 },
+    { "qoi_decode",         qoi_setup,          qoi_run,            qoi_teardown,   (UINT64) QOI_WIDTH * QOI_HEIGHT * 4 },
+    { "lz4_decode",         lz4_setup,          lz4_run,            lz4_teardown,   LZ4_DATA_SIZE },
+};
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    UINT64 *times;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n ITERATIONS] [-f FILTER]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    times = calloc(iterations, sizeof(UINT64));
+
+    printf("%-22s %8s %12s %12s %12s\n", "bench", "iters", "min_us", "p50_us", "MB/s");
+
+    for (UINTN i = 0; i < ARRAY_SIZE(benches); i++) {
+        bench_t *b = &benches[i];
+
+        if (filter && !strstr(b->name, filter)) {
+            continue;
+        }
+
+        if (b->setup()) {
+            printf("%-22s FAILED\n", b->name);
+            failures++;
+            b->teardown();
+            continue;
+        }
+
+        for (int n = 0; n < iterations; n++) {
+            UINT64 start = now_ns();
+            b->run();
+            times[n] = now_ns() - start;
+        }
+        qsort(times, iterations, sizeof(UINT64), cmp_u64);
+
+        printf("%-22s %8d %12.1f %12.1f", b->name, iterations, times[0] / 1e3, times[iterations / 2] / 1e3);
+        if (b->bytes) {
+            printf(" %12.1f", b->bytes / (times[iterations / 2] / 1e9) / 1e6);
+        }
+        printf("\n");
+
+        b->teardown();
+    }
+
+    free(times);
+
+    return failures ? 1 : 0;
+}
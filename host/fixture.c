@@ -0,0 +1,484 @@
+/*
+ * Synthetic inputs for host_bench and host_test, built by script/build_host.sh
+ *
+ * Every builder is deterministic, the same rng() sequence gives the same bytes in both binaries
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Uefi.h>
+
+#include "arena.h"
+#include "fixture.h"
+#include "lz4.h"
+#include "qoi.h"
+#include "shim.h"
+#include "tar.h"
+#include "uefi_acpi.h"
+
+UINT8 *elf_image;
+UINTN elf_size;
+
+UINT8 *tar_image;
+UINTN tar_image_size;
+char tar_last[100];
+
+acpi_image_t acpi;
+
+UINT32 *qoi_pixels;
+UINT8 *qoi_image;
+UINTN qoi_size;
+
+UINT8 *lz4_data;
+UINT8 *lz4_frame;
+UINTN lz4_frame_len;
+
+void free_all_pages()
+{
+    arena_reset(&arena_scratch);
+    shim_free_all_pages();
+}
+
+static UINT32 rng_state = 0x12345678;
+
+UINT32 rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    return rng_state;
+}
+
+void fill_random(UINT8 *p, UINTN size)
+{
+    for (UINTN i = 0; i < size; i++) {
+        p[i] = (UINT8) rng();
+    }
+}
+
+/*
+ * ELF image
+ */
+
+void elf_build(EFI_PHYSICAL_ADDRESS paddr_base)
+{
+    Elf64_Ehdr *hdr;
+    Elf64_Phdr *phdrs;
+    UINTN offset = EFI_PAGE_SIZE;
+
+    elf_size = EFI_PAGE_SIZE + ELF_SEGMENTS * ELF_SEGMENT_SIZE;
+    elf_image = calloc(1, elf_size);
+
+    hdr = (Elf64_Ehdr *) elf_image;
+    memcpy(hdr->e_ident, ELFMAG, SELFMAG);
+    hdr->e_ident[EI_CLASS] = ELFCLASS64;
+    hdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    hdr->e_ident[EI_VERSION] = EV_CURRENT;
+    hdr->e_type = ET_DYN;
+    hdr->e_machine = EM_X86_64;
+    hdr->e_version = EV_CURRENT;
+    hdr->e_entry = EFI_PAGE_SIZE + 0x40;
+    hdr->e_phoff = sizeof(Elf64_Ehdr);
+    hdr->e_ehsize = sizeof(Elf64_Ehdr);
+    hdr->e_phentsize = sizeof(Elf64_Phdr);
+    hdr->e_phnum = ELF_SEGMENTS;
+
+    phdrs = (Elf64_Phdr *) (elf_image + hdr->e_phoff);
+    for (UINTN i = 0; i < ELF_SEGMENTS; i++) {
+        Elf64_Phdr *phdr = &phdrs[i];
+
+        phdr->p_type = PT_LOAD;
+        phdr->p_flags = PF_R;
+        phdr->p_offset = offset;
+        phdr->p_vaddr = offset;
+        phdr->p_paddr = paddr_base + offset;
+        phdr->p_filesz = ELF_SEGMENT_SIZE;
+        phdr->p_memsz = ELF_SEGMENT_SIZE + ((i == ELF_SEGMENTS - 1) ? ELF_BSS_SIZE : 0);
+        phdr->p_align = ELF_ALIGN;
+
+        fill_random(elf_image + offset, ELF_SEGMENT_SIZE);
+        offset += ELF_SEGMENT_SIZE;
+    }
+}
+
+/*
+ * Tar archive
+ */
+
+static void tar_octal(char *field, UINTN width, UINT64 value)
+{
+    snprintf(field, width, "%0*llo", (int) width - 1, (unsigned long long) value);
+}
+
+void tar_build()
+{
+    UINTN offset = 0;
+
+    tar_image_size = (UINTN) TAR_FILES * 4 * TAR_BLOCK + 2 * TAR_BLOCK;
+    tar_image = calloc(1, tar_image_size);
+
+    for (UINTN i = 0; i < TAR_FILES; i++) {
+        tar_header_t *hdr = (tar_header_t *) (tar_image + offset);
+        UINTN size = rng() % (2 * TAR_BLOCK + 1); // Empty, partial and exact multiples of a block
+
+        snprintf(hdr->name, sizeof(hdr->name), "modules/mod%05zu.ko", (size_t) i);
+        tar_octal(hdr->mode, sizeof(hdr->mode), 0644);
+        tar_octal(hdr->size, sizeof(hdr->size), size);
+        hdr->typeflag[0] = '0';
+
+        offset += TAR_BLOCK + ALIGN_VALUE(size, TAR_BLOCK);
+    }
+    tar_image_size = offset + 2 * TAR_BLOCK;
+
+    snprintf(tar_last, sizeof(tar_last), "modules/mod%05u.ko", TAR_FILES - 1);
+}
+
+void tar_free()
+{
+    free(tar_image);
+}
+
+/*
+ * ACPI tables
+ */
+
+UINT8 acpi_sum(const UINT8 *p, UINTN size)
+{
+    UINT8 sum = 0;
+
+    for (UINTN i = 0; i < size; i++) {
+        sum += p[i];
+    }
+
+    return sum;
+}
+
+static UINT8 *acpi_make_table(UINT32 signature, UINT32 length)
+{
+    acpi_sdt_header_t *hdr = calloc(1, length);
+
+    fill_random((UINT8 *) hdr, length);
+    hdr->signature = signature;
+    hdr->length = length;
+    hdr->revision = 2;
+    hdr->checksum = 0;
+    hdr->checksum = -acpi_sum((UINT8 *) hdr, length);
+
+    return (UINT8 *) hdr;
+}
+
+UINTN acpi_build()
+{
+    static const UINT32 sigs[] = { ACPI_SIG_MADT, ACPI_SIG_HPET, ACPI_SIG_MCFG, ACPI_SIG_SRAT, ACPI_SIG_SLIT };
+    acpi_sdt_header_t *xsdt;
+    acpi_sdt_header_t *fadt;
+    UINTN xsdt_size = sizeof(acpi_sdt_header_t) + ACPI_TABLES * sizeof(UINT64);
+    UINTN ssdts = 0;
+
+    memset(&acpi, 0, sizeof(acpi));
+
+    // DSDT is only reachable through the FADT's X_DSDT
+    acpi.tables[ACPI_TABLES] = acpi_make_table(ACPI_SIG_DSDT, ACPI_TABLE_SIZE);
+
+    for (UINTN i = 0; i < ACPI_TABLES; i++) {
+        if (i == 0) {
+            acpi.tables[i] = acpi_make_table(ACPI_SIG_FADT, 276);
+            fadt = (acpi_sdt_header_t *) acpi.tables[i];
+            memset((UINT8 *) fadt + ACPI_FADT_DSDT_OFFSET, 0, sizeof(UINT32));
+            memcpy((UINT8 *) fadt + ACPI_FADT_XDSDT_OFFSET, &acpi.tables[ACPI_TABLES], sizeof(UINT64));
+            fadt->checksum = 0;
+            fadt->checksum = -acpi_sum((UINT8 *) fadt, fadt->length);
+        } else if (i < ARRAY_SIZE(sigs) + 1) {
+            acpi.tables[i] = acpi_make_table(sigs[i - 1], ACPI_TABLE_SIZE);
+        } else {
+            acpi.tables[i] = acpi_make_table(ACPI_SIG_SSDT, (i == ACPI_TABLES - 1) ? ACPI_BIG_TABLE_SIZE : ACPI_TABLE_SIZE);
+            ssdts++;
+        }
+    }
+
+    acpi.xsdt = calloc(1, xsdt_size);
+    xsdt = (acpi_sdt_header_t *) acpi.xsdt;
+    xsdt->signature = ACPI_SIG_XSDT;
+    xsdt->length = xsdt_size;
+    xsdt->revision = 1;
+    memcpy(acpi.xsdt + sizeof(acpi_sdt_header_t), acpi.tables, ACPI_TABLES * sizeof(UINT64));
+    xsdt->checksum = -acpi_sum(acpi.xsdt, xsdt_size);
+
+    memcpy(acpi.rsdp.rsdp_descriptor10.signature, "RSD PTR ", 8);
+    memcpy(acpi.rsdp.rsdp_descriptor10.oemid, "UBUTT ", 6);
+    acpi.rsdp.rsdp_descriptor10.revision = 2;
+    acpi.rsdp.length = sizeof(rsdp_descriptor20_t);
+    acpi.rsdp.xsdt_address = (UINT64) acpi.xsdt;
+    acpi.rsdp.rsdp_descriptor10.checksum = -acpi_sum((UINT8 *) &acpi.rsdp, sizeof(rsdp_descriptor_t));
+    acpi.rsdp.extended_checksum = -acpi_sum((UINT8 *) &acpi.rsdp.length,
+            sizeof(rsdp_descriptor20_t) - sizeof(rsdp_descriptor_t));
+
+    return ssdts;
+}
+
+void acpi_free()
+{
+    for (UINTN i = 0; i < ACPI_TABLES + 1; i++) {
+        free(acpi.tables[i]);
+    }
+    free(acpi.xsdt);
+}
+
+/*
+ * QOI image
+ */
+
+static void qoi_put32(UINT8 *p, UINT32 v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Straight port of the reference encoder, pixels are 0xAARRGGBB
+static UINTN qoi_encode(const UINT32 *pixels, UINT32 width, UINT32 height, UINT8 *out)
+{
+    static const UINT8 end[QOI_END_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    UINT32 index[64] = { 0 };
+    UINT32 prev = 0xFF000000;
+    UINTN run = 0;
+    UINTN n = QOI_HEADER_SIZE;
+    UINTN count = (UINTN) width * height;
+
+    qoi_put32(out, QOI_MAGIC);
+    qoi_put32(out + 4, width);
+    qoi_put32(out + 8, height);
+    out[12] = 4;
+    out[13] = 0;
+
+    for (UINTN i = 0; i < count; i++) {
+        UINT32 px = pixels[i];
+
+        if (px == prev) {
+            run++;
+            if (run == 62 || i == count - 1) {
+                out[n++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run) {
+            out[n++] = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        UINT8 r = px >> 16, g = px >> 8, b = px, a = px >> 24;
+        UINT32 hash = (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+
+        if (index[hash] == px) {
+            out[n++] = QOI_OP_INDEX | hash;
+        } else if ((px >> 24) == (prev >> 24)) {
+            INT8 vr = r - (UINT8) (prev >> 16);
+            INT8 vg = g - (UINT8) (prev >> 8);
+            INT8 vb = b - (UINT8) prev;
+            INT8 vg_r = vr - vg;
+            INT8 vg_b = vb - vg;
+
+            if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                out[n++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+            } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                out[n++] = QOI_OP_LUMA | (vg + 32);
+                out[n++] = (vg_r + 8) << 4 | (vg_b + 8);
+            } else {
+                out[n++] = QOI_OP_RGB;
+                out[n++] = r;
+                out[n++] = g;
+                out[n++] = b;
+            }
+        } else {
+            out[n++] = QOI_OP_RGBA;
+            out[n++] = r;
+            out[n++] = g;
+            out[n++] = b;
+            out[n++] = a;
+        }
+
+        index[hash] = px;
+        prev = px;
+    }
+
+    memcpy(out + n, end, QOI_END_SIZE);
+
+    return n + QOI_END_SIZE;
+}
+
+// Splash-like content: smooth gradients with noisy patches, flat runs and a few alpha changes, so every op shows up
+void qoi_build()
+{
+    qoi_pixels = malloc((UINTN) QOI_WIDTH * QOI_HEIGHT * sizeof(UINT32));
+    for (UINT32 y = 0; y < QOI_HEIGHT; y++) {
+        for (UINT32 x = 0; x < QOI_WIDTH; x++) {
+            UINT32 px = 0xFF000000 | ((x * 255 / QOI_WIDTH) << 16) | ((y * 255 / QOI_HEIGHT) << 8) | ((x ^ y) & 0xFF);
+
+            if ((x / 64 + y / 64) % 5 == 0) {
+                px ^= rng() & 0x0F0F0F;
+            } else if ((x / 128) % 7 == 3) {
+                px = 0xFF202020;
+            } else if ((y / 32) % 11 == 5 && x % 3 == 0) {
+                px = (px & 0x00FFFFFF) | 0x80000000;
+            }
+            qoi_pixels[(UINTN) y * QOI_WIDTH + x] = px;
+        }
+    }
+
+    qoi_image = malloc((UINTN) QOI_WIDTH * QOI_HEIGHT * 5 + QOI_HEADER_SIZE + QOI_END_SIZE);
+    qoi_size = qoi_encode(qoi_pixels, QOI_WIDTH, QOI_HEIGHT, qoi_image);
+}
+
+void qoi_free()
+{
+    free(qoi_pixels);
+    free(qoi_image);
+}
+
+/*
+ * LZ4 frame
+ */
+
+static UINT8 *lz4_put_len(UINT8 *o, UINTN len)
+{
+    for (; len >= 255; len -= 255) {
+        *o++ = 255;
+    }
+    *o++ = (UINT8) len;
+
+    return o;
+}
+
+static UINT8 *lz4_put_sequence(UINT8 *o, const UINT8 *lit, UINTN nlit, UINTN offset, UINTN mlen)
+{
+    UINT8 *token = o++;
+
+    *token = (UINT8) (MIN(nlit, 15) << 4);
+    if (nlit >= 15) {
+        o = lz4_put_len(o, nlit - 15);
+    }
+    memcpy(o, lit, nlit);
+    o += nlit;
+
+    if (mlen) {
+        *o++ = (UINT8) offset;
+        *o++ = (UINT8) (offset >> 8);
+        *token |= (UINT8) MIN(mlen - LZ4_MIN_MATCH, 15);
+        if (mlen - LZ4_MIN_MATCH >= 15) {
+            o = lz4_put_len(o, mlen - LZ4_MIN_MATCH - 15);
+        }
+    }
+
+    return o;
+}
+
+// Greedy single probe compressor, follows the end of block rules (last 5 bytes literal, no match in the last 12)
+static UINTN lz4_encode_block(const UINT8 *src, UINTN n, UINT8 *out)
+{
+    static UINT32 table[1 << LZ4_HASH_BITS];
+    UINT8 *o = out;
+    UINTN anchor = 0;
+    UINTN i = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (n >= 12 && i < n - 12) {
+        UINT32 v;
+        UINT32 h;
+        UINTN cand;
+
+        memcpy(&v, src + i, 4);
+        h = (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+        cand = table[h];
+        table[h] = (UINT32) i + 1;
+
+        if (cand && i - (cand - 1) <= 65535 && memcmp(src + cand - 1, src + i, 4) == 0) {
+            UINTN m = cand - 1;
+            UINTN len = 4;
+
+            while (i + len < n - 5 && src[m + len] == src[i + len]) {
+                len++;
+            }
+
+            o = lz4_put_sequence(o, src + anchor, i - anchor, i - m, len);
+            i += len;
+            anchor = i;
+        } else {
+            i++;
+        }
+    }
+
+    o = lz4_put_sequence(o, src + anchor, n - anchor, 0, 0);
+
+    return o - out;
+}
+
+void lz4_put32(UINT8 *p, UINT32 v)
+{
+    p[0] = (UINT8) v;
+    p[1] = (UINT8) (v >> 8);
+    p[2] = (UINT8) (v >> 16);
+    p[3] = (UINT8) (v >> 24);
+}
+
+// Independent 4MB blocks with the content size in the header, what lz4 --content-size -B4 writes
+UINTN lz4_encode_frame(const UINT8 *src, UINTN n, UINT8 *out)
+{
+    UINT8 *o = out;
+
+    lz4_put32(o, LZ4_MAGIC);
+    o[4] = LZ4_FLG_VERSION | 0x20 | LZ4_FLG_CONTENT_SIZE;
+    o[5] = 0x70;
+    lz4_put32(o + 6, (UINT32) n);
+    lz4_put32(o + 10, (UINT32) ((UINT64) n >> 32));
+    o[14] = 0; // Header checksum, not checked
+    o += 15;
+
+    for (UINTN off = 0; off < n; off += LZ4_BLOCK_MAX) {
+        UINTN len = lz4_encode_block(src + off, MIN(LZ4_BLOCK_MAX, n - off), o + 4);
+
+        lz4_put32(o, (UINT32) len);
+        o += 4 + len;
+    }
+
+    lz4_put32(o, 0);
+
+    return o + 4 - out;
+}
+
+void lz4_build()
+{
+    UINTN i = 0;
+
+    // Random words repeated at random distances, with runs of zeroes for overlapping matches
+    lz4_data = malloc(LZ4_DATA_SIZE);
+    while (i < LZ4_DATA_SIZE) {
+        UINTN len = MIN(4 + rng() % 60, LZ4_DATA_SIZE - i);
+        UINT32 kind = rng() % 8;
+
+        if (kind < 2 || i < SIZE_64KB) {
+            fill_random(lz4_data + i, len);
+        } else if (kind == 2) {
+            memset(lz4_data + i, 0, len);
+        } else {
+            memcpy(lz4_data + i, lz4_data + i - 1 - rng() % (SIZE_64KB - len), len);
+        }
+        i += len;
+    }
+
+    lz4_frame = malloc(LZ4_DATA_SIZE + LZ4_DATA_SIZE / 64 + SIZE_4KB);
+    lz4_frame_len = lz4_encode_frame(lz4_data, LZ4_DATA_SIZE, lz4_frame);
+}
+
+void lz4_free()
+{
+    free(lz4_data);
+    free(lz4_frame);
+}
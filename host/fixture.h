@@ -0,0 +1,106 @@
+// Synthetic inputs shared by host_bench and host_test
+#pragma once
+
+#ifndef FIXTURE_H
+#define FIXTURE_H
+
+#include <stdio.h>
+
+#include <Uefi.h>
+
+#include "uefi_acpi.h"
+
+// ELF image, segments spread over a few MB like a real kernel's text/rodata/data
+#define ELF_SEGMENTS        8
+#define ELF_SEGMENT_SIZE    (4 * SIZE_1MB)
+#define ELF_BSS_SIZE        SIZE_1MB
+#define ELF_ALIGN           SIZE_2MB // p_align of every segment, what the aligned loaders honour
+#define ELF_FIXED_BASE      0x600000000000ULL // Free on any ordinary x86-64 Linux process
+
+// Tar archive, the file looked up is the last one so the whole archive is walked
+#define TAR_FILES           20000
+#define TAR_BLOCK           512
+
+// ACPI, enough tables to fill a fair part of the directory and one big SSDT that gets chunked
+#define ACPI_TABLES         40
+#define ACPI_TABLE_SIZE     SIZE_4KB
+#define ACPI_BIG_TABLE_SIZE (8 * SIZE_1MB)
+
+#define QOI_WIDTH           1920
+#define QOI_HEIGHT          1080
+
+// LZ4, a module sized frame of data that compresses about as well as a kernel does
+#define LZ4_DATA_SIZE       (16 * SIZE_1MB)
+#define LZ4_BLOCK_MAX       (4 * SIZE_1MB)
+#define LZ4_HASH_BITS       12
+
+// Fail the enclosing int function with the file and line of the condition that didn't hold
+#define CHECK(cond)                                                                             \
+    do {                                                                                        \
+        if (!(cond)) {                                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);           \
+            return 1;                                                                           \
+        }                                                                                       \
+    } while (0)
+
+typedef struct {
+    rsdp_descriptor20_t rsdp;
+    UINT8               *xsdt;
+    UINT8               *tables[ACPI_TABLES + 1]; // + 1 for the DSDT
+} acpi_image_t;
+
+extern UINT8 *elf_image;
+extern UINTN elf_size;
+
+extern UINT8 *tar_image;
+extern UINTN tar_image_size;
+extern char tar_last[100];
+
+extern acpi_image_t acpi;
+
+extern UINT32 *qoi_pixels;
+extern UINT8 *qoi_image;
+extern UINTN qoi_size;
+
+extern UINT8 *lz4_data;
+extern UINT8 *lz4_frame;
+extern UINTN lz4_frame_len;
+
+// Arena chunks are page allocations too, drop them before the shim unmaps everything under them
+void free_all_pages();
+
+// Deterministic filler, the same every run
+UINT32 rng();
+
+void fill_random(UINT8 *p, UINTN size);
+
+// ET_DYN x86-64 image with ELF_SEGMENTS PT_LOAD segments of random bytes, the last one with bss
+void elf_build(EFI_PHYSICAL_ADDRESS paddr_base);
+
+// TAR_FILES members of assorted sizes, tar_last names the last one
+void tar_build();
+
+void tar_free();
+
+// RSDP, XSDT, FADT pointing at a DSDT, a few fixed tables and SSDTs, returns the number of SSDTs
+UINTN acpi_build();
+
+void acpi_free();
+
+UINT8 acpi_sum(const UINT8 *p, UINTN size);
+
+// Splash-like QOI_WIDTH x QOI_HEIGHT image, qoi_pixels holds what it decodes to
+void qoi_build();
+
+void qoi_free();
+
+// LZ4_DATA_SIZE bytes of compressible data and the frame lz4 --content-size -B4 would make of it
+void lz4_build();
+
+void lz4_free();
+
+UINTN lz4_encode_frame(const UINT8 *src, UINTN n, UINT8 *out);
+
+void lz4_put32(UINT8 *p, UINT32 v);
+
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for BaseLib
+#pragma once
+
+#ifndef HOST_BASE_LIB_H
+#define HOST_BASE_LIB_H
+
+#include <Uefi.h>
+
+UINT64 AsmReadTsc(void);
+
+UINT32 AsmCpuid(UINT32 index, UINT32 *eax, UINT32 *ebx, UINT32 *ecx, UINT32 *edx);
+
+UINT32 AsmCpuidEx(UINT32 index, UINT32 sub_index, UINT32 *eax, UINT32 *ebx, UINT32 *ecx, UINT32 *edx);
+
+#endif
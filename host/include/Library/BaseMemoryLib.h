@@ -0,0 +1,14 @@
+// Host stand-in for BaseMemoryLib, backed by libc
+#pragma once
+
+#ifndef HOST_BASE_MEMORY_LIB_H
+#define HOST_BASE_MEMORY_LIB_H
+
+#include <Uefi.h>
+
+void *CopyMem(void *dst, const void *src, UINTN length);
+void *SetMem(void *buffer, UINTN length, UINT8 value);
+void *ZeroMem(void *buffer, UINTN length);
+INTN CompareMem(const void *a, const void *b, UINTN length);
+
+#endif
@@ -0,0 +1,13 @@
+// Host stand-in for MemoryAllocationLib, pool memory is the process heap
+#pragma once
+
+#ifndef HOST_MEMORY_ALLOCATION_LIB_H
+#define HOST_MEMORY_ALLOCATION_LIB_H
+
+#include <Uefi.h>
+
+void *AllocatePool(UINTN size);
+void *AllocateZeroPool(UINTN size);
+void FreePool(void *buffer);
+
+#endif
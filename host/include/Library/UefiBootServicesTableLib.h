@@ -0,0 +1,11 @@
+// Host stand-in, gBS is NULL on the host and only the MP checksum path would touch it
+#pragma once
+
+#ifndef HOST_UEFI_BOOT_SERVICES_TABLE_LIB_H
+#define HOST_UEFI_BOOT_SERVICES_TABLE_LIB_H
+
+#include <Uefi.h>
+
+extern EFI_BOOT_SERVICES *gBS;
+
+#endif
@@ -0,0 +1,12 @@
+// Host stand-in for UefiLib, Print goes nowhere on the host
+#pragma once
+
+#ifndef HOST_UEFI_LIB_H
+#define HOST_UEFI_LIB_H
+
+#include <Uefi.h>
+#include <Protocol/GraphicsOutput.h>
+
+UINTN Print(const CHAR16 *format, ...);
+
+#endif
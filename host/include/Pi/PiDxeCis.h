@@ -0,0 +1,4 @@
+// Host stand-in, nothing from the PI headers is used by the shared sources
+#pragma once
+
+#include <Uefi.h>
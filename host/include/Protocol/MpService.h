@@ -0,0 +1,37 @@
+// Host stand-in for MP services, the host runs everything on one thread, only the bench builds an instance
+#pragma once
+
+#ifndef HOST_MP_SERVICE_H
+#define HOST_MP_SERVICE_H
+
+#include <Uefi.h>
+
+#define PROCESSOR_AS_BSP_BIT            0x00000001
+#define PROCESSOR_ENABLED_BIT           0x00000002
+#define PROCESSOR_HEALTH_STATUS_BIT     0x00000004
+
+typedef struct {
+    UINT32  Package;
+    UINT32  Core;
+    UINT32  Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+    UINT64                      ProcessorId;
+    UINT32                      StatusFlag;
+    EFI_CPU_PHYSICAL_LOCATION   Location;
+} EFI_PROCESSOR_INFORMATION;
+
+typedef void (EFIAPI *EFI_AP_PROCEDURE)(void *arg);
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+
+// Same member order as the real protocol for the members the loader calls
+struct _EFI_MP_SERVICES_PROTOCOL {
+    EFI_STATUS  (EFIAPI *GetNumberOfProcessors)(EFI_MP_SERVICES_PROTOCOL *self, UINTN *num_cpus, UINTN *num_enabled);
+    EFI_STATUS  (EFIAPI *GetProcessorInfo)(EFI_MP_SERVICES_PROTOCOL *self, UINTN cpu, EFI_PROCESSOR_INFORMATION *info);
+    EFI_STATUS  (EFIAPI *StartupAllAPs)(EFI_MP_SERVICES_PROTOCOL *self, EFI_AP_PROCEDURE procedure, BOOLEAN single_thread,
+                        EFI_EVENT event, UINTN timeout_us, void *arg, UINTN **failed);
+};
+
+#endif
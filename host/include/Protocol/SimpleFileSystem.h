@@ -0,0 +1,29 @@
+// Host stand-in for the file protocol, host/shim.c implements it over files read into memory
+#pragma once
+
+#ifndef HOST_SIMPLE_FILE_SYSTEM_H
+#define HOST_SIMPLE_FILE_SYSTEM_H
+
+#include <Uefi.h>
+
+#define EFI_FILE_MODE_READ      0x0000000000000001ULL
+#define EFI_FILE_READ_ONLY      0x0000000000000001ULL
+
+typedef struct _EFI_FILE_PROTOCOL EFI_FILE_PROTOCOL;
+typedef EFI_FILE_PROTOCOL EFI_FILE;
+
+struct _EFI_FILE_PROTOCOL {
+    UINT64      Revision;
+    EFI_STATUS  (EFIAPI *Open)(EFI_FILE_PROTOCOL *self, EFI_FILE_PROTOCOL **file, CHAR16 *name, UINT64 mode, UINT64 attr);
+    EFI_STATUS  (EFIAPI *Close)(EFI_FILE_PROTOCOL *self);
+    EFI_STATUS  (EFIAPI *Delete)(EFI_FILE_PROTOCOL *self);
+    EFI_STATUS  (EFIAPI *Read)(EFI_FILE_PROTOCOL *self, UINTN *size, void *buffer);
+    EFI_STATUS  (EFIAPI *Write)(EFI_FILE_PROTOCOL *self, UINTN *size, void *buffer);
+    EFI_STATUS  (EFIAPI *GetPosition)(EFI_FILE_PROTOCOL *self, UINT64 *position);
+    EFI_STATUS  (EFIAPI *SetPosition)(EFI_FILE_PROTOCOL *self, UINT64 position);
+    EFI_STATUS  (EFIAPI *GetInfo)(EFI_FILE_PROTOCOL *self, EFI_GUID *type, UINTN *size, void *buffer);
+    EFI_STATUS  (EFIAPI *SetInfo)(EFI_FILE_PROTOCOL *self, EFI_GUID *type, UINTN size, void *buffer);
+    EFI_STATUS  (EFIAPI *Flush)(EFI_FILE_PROTOCOL *self);
+};
+
+#endif
@@ -0,0 +1,173 @@
+// Host stand-in for the EDK2 base headers, just enough of them for the shared loader sources
+#pragma once
+
+#ifndef HOST_UEFI_H
+#define HOST_UEFI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t    UINT64;
+typedef int64_t     INT64;
+typedef uint32_t    UINT32;
+typedef int32_t     INT32;
+typedef uint16_t    UINT16;
+typedef int16_t     INT16;
+typedef uint8_t     UINT8;
+typedef int8_t      INT8;
+typedef UINT64      UINTN;
+typedef INT64       INTN;
+typedef UINT8       BOOLEAN;
+typedef char        CHAR8;
+typedef UINT16      CHAR16; // Built with -fshort-wchar so L"" strings match
+
+#define VOID        void
+#define CONST       const
+#define STATIC      static
+#define IN
+#define OUT
+#define OPTIONAL
+#define EFIAPI      __attribute__((ms_abi))
+#define TRUE        ((BOOLEAN) 1)
+#define FALSE       ((BOOLEAN) 0)
+
+typedef UINTN       RETURN_STATUS;
+typedef UINTN       EFI_STATUS;
+typedef void        *EFI_HANDLE;
+typedef void        *EFI_EVENT;
+typedef UINTN       EFI_TPL;
+typedef UINT64      EFI_PHYSICAL_ADDRESS;
+typedef UINT64      EFI_VIRTUAL_ADDRESS;
+
+typedef struct {
+    UINT32  Data1;
+    UINT16  Data2;
+    UINT16  Data3;
+    UINT8   Data4[8];
+} EFI_GUID;
+
+#define MAX_BIT                     0x8000000000000000ULL
+#define ENCODE_ERROR(a)             ((RETURN_STATUS) (MAX_BIT | (a)))
+#define EFI_ERROR(a)                (((INTN) (RETURN_STATUS) (a)) < 0)
+#define RETURN_ERROR(a)             EFI_ERROR(a)
+
+#define EFI_SUCCESS                 0
+#define EFI_LOAD_ERROR              ENCODE_ERROR(1)
+#define EFI_INVALID_PARAMETER       ENCODE_ERROR(2)
+#define EFI_UNSUPPORTED             ENCODE_ERROR(3)
+#define EFI_BAD_BUFFER_SIZE         ENCODE_ERROR(4)
+#define EFI_BUFFER_TOO_SMALL        ENCODE_ERROR(5)
+#define EFI_NOT_READY               ENCODE_ERROR(6)
+#define EFI_DEVICE_ERROR            ENCODE_ERROR(7)
+#define EFI_OUT_OF_RESOURCES        ENCODE_ERROR(9)
+#define EFI_VOLUME_CORRUPTED        ENCODE_ERROR(10)
+#define EFI_NOT_FOUND               ENCODE_ERROR(14)
+#define EFI_ABORTED                 ENCODE_ERROR(21)
+#define EFI_CRC_ERROR               ENCODE_ERROR(27)
+#define EFI_END_OF_FILE             ENCODE_ERROR(31)
+#define EFI_COMPROMISED_DATA        ENCODE_ERROR(33)
+
+#define SIZE_1KB                    0x00000400
+#define SIZE_4KB                    0x00001000
+#define SIZE_16KB                   0x00004000
+#define SIZE_64KB                   0x00010000
+#define SIZE_1MB                    0x00100000
+#define SIZE_2MB                    0x00200000
+#define SIZE_1GB                    0x40000000
+#define SIZE_2GB                    0x80000000ULL
+#define BASE_1MB                    0x00100000
+#define BASE_4GB                    0x0000000100000000ULL
+
+#define MAX_UINT16                  0xFFFF
+#define MAX_UINT32                  0xFFFFFFFF
+#define MAX_UINT64                  0xFFFFFFFFFFFFFFFFULL
+#define MAX_UINTN                   MAX_UINT64
+#define MAX_ADDRESS                 MAX_UINT64
+
+#define EFI_PAGE_SIZE               0x1000
+#define EFI_PAGE_MASK               0xFFF
+#define EFI_PAGE_SHIFT              12
+#define EFI_SIZE_TO_PAGES(a)        (((a) >> EFI_PAGE_SHIFT) + (((a) & EFI_PAGE_MASK) ? 1 : 0))
+#define EFI_PAGES_TO_SIZE(a)        ((a) << EFI_PAGE_SHIFT)
+
+#define ALIGN_VALUE(v, a)           ((v) + (((a) - (v)) & ((a) - 1)))
+#define ARRAY_SIZE(a)               (sizeof(a) / sizeof((a)[0]))
+#define OFFSET_OF(t, f)             __builtin_offsetof(t, f)
+#define SIGNATURE_16(a, b)          ((a) | ((b) << 8))
+#define SIGNATURE_32(a, b, c, d)    (SIGNATURE_16(a, b) | (SIGNATURE_16(c, d) << 16))
+#define MIN(a, b)                   (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)                   (((a) > (b)) ? (a) : (b))
+
+#define TPL_APPLICATION             4
+#define TPL_CALLBACK                8
+#define TPL_NOTIFY                  16
+#define TPL_HIGH_LEVEL              31
+
+typedef enum {
+    EfiReservedMemoryType,
+    EfiLoaderCode,
+    EfiLoaderData,
+    EfiBootServicesCode,
+    EfiBootServicesData,
+    EfiRuntimeServicesCode,
+    EfiRuntimeServicesData,
+    EfiConventionalMemory,
+    EfiUnusableMemory,
+    EfiACPIReclaimMemory,
+    EfiACPIMemoryNVS,
+    EfiMemoryMappedIO,
+    EfiMemoryMappedIOPortSpace,
+    EfiPalCode,
+    EfiPersistentMemory,
+    EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+typedef enum {
+    AllocateAnyPages,
+    AllocateMaxAddress,
+    AllocateAddress,
+    MaxAllocateType
+} EFI_ALLOCATE_TYPE;
+
+#define EFI_MEMORY_UC               0x0000000000000001ULL
+#define EFI_MEMORY_WC               0x0000000000000002ULL
+#define EFI_MEMORY_WT               0x0000000000000004ULL
+#define EFI_MEMORY_WB               0x0000000000000008ULL
+#define EFI_MEMORY_RUNTIME          0x8000000000000000ULL
+
+#define EFI_MEMORY_DESCRIPTOR_VERSION 1
+
+typedef struct {
+    UINT32                  Type;
+    EFI_PHYSICAL_ADDRESS    PhysicalStart;
+    EFI_VIRTUAL_ADDRESS     VirtualStart;
+    UINT64                  NumberOfPages;
+    UINT64                  Attribute;
+} EFI_MEMORY_DESCRIPTOR;
+
+typedef struct {
+    UINT16  Year;
+    UINT8   Month;
+    UINT8   Day;
+    UINT8   Hour;
+    UINT8   Minute;
+    UINT8   Second;
+    UINT8   Pad1;
+    UINT32  Nanosecond;
+    INT16   TimeZone;
+    UINT8   Daylight;
+    UINT8   Pad2;
+} EFI_TIME;
+
+// Only handed around by pointer in the shared sources
+typedef struct _EFI_RUNTIME_SERVICES EFI_RUNTIME_SERVICES;
+typedef struct _EFI_SYSTEM_TABLE EFI_SYSTEM_TABLE;
+
+// The event calls acpi_checksum_dir makes when given MP services, the host never passes any
+typedef struct {
+    EFI_STATUS  (EFIAPI *CreateEvent)(UINT32 type, EFI_TPL tpl, void *notify, void *context, EFI_EVENT *event);
+    EFI_STATUS  (EFIAPI *WaitForEvent)(UINTN count, EFI_EVENT *events, UINTN *index);
+    EFI_STATUS  (EFIAPI *CloseEvent)(EFI_EVENT event);
+} EFI_BOOT_SERVICES;
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * Boot services, memory and file libraries for running the loader core as a Linux process
+ *
+ * Pages come from mmap so page allocations are page aligned and AllocateAddress can be honoured when
+ * that range of the address space is free. Every outstanding allocation is one memory map entry.
+ * Files are read into memory up front and served through an EFI_FILE, so loaders see the same
+ * Read/SetPosition/GetPosition calls they make in firmware.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <cpuid.h>
+#include <x86intrin.h>
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiLib.h>
+
+#include "boot_services.h"
+#include "log.h"
+#include "shim.h"
+
+typedef struct {
+    EFI_PHYSICAL_ADDRESS    base;
+    UINTN                   pages;
+    EFI_MEMORY_TYPE         type;
+} shim_alloc_t;
+
+typedef struct {
+    EFI_FILE    proto; // Must stay first, the protocol pointer is the file
+    UINT8       *data;
+    UINTN       size;
+    UINT64      pos;
+} shim_file_t;
+
+// Sorted by base, same order firmware reports the memory map in
+static shim_alloc_t allocs[SHIM_MAX_ALLOCS];
+static UINTN num_allocs = 0;
+static UINTN map_key = 1;
+
+EFI_BOOT_SERVICES *gBS = NULL;
+
+/*
+ * Libraries
+ */
+
+UINTN Print(const CHAR16 *format, ...)
+{
+    return 0;
+}
+
+UINT64 AsmReadTsc(void)
+{
+    return __rdtsc();
+}
+
+// Any output can be NULL, same as BaseLib
+UINT32 AsmCpuidEx(UINT32 index, UINT32 sub_index, UINT32 *eax, UINT32 *ebx, UINT32 *ecx, UINT32 *edx)
+{
+    UINT32 a, b, c, d;
+
+    __cpuid_count(index, sub_index, a, b, c, d);
+
+    if (eax) {
+        *eax = a;
+    }
+    if (ebx) {
+        *ebx = b;
+    }
+    if (ecx) {
+        *ecx = c;
+    }
+    if (edx) {
+        *edx = d;
+    }
+
+    return index;
+}
+
+UINT32 AsmCpuid(UINT32 index, UINT32 *eax, UINT32 *ebx, UINT32 *ecx, UINT32 *edx)
+{
+    return AsmCpuidEx(index, 0, eax, ebx, ecx, edx);
+}
+
+void *CopyMem(void *dst, const void *src, UINTN length)
+{
+    return memmove(dst, src, length);
+}
+
+void *SetMem(void *buffer, UINTN length, UINT8 value)
+{
+    return memset(buffer, value, length);
+}
+
+void *ZeroMem(void *buffer, UINTN length)
+{
+    return memset(buffer, 0, length);
+}
+
+INTN CompareMem(const void *a, const void *b, UINTN length)
+{
+    return memcmp(a, b, length);
+}
+
+void *AllocatePool(UINTN size)
+{
+    return malloc(size);
+}
+
+void *AllocateZeroPool(UINTN size)
+{
+    return calloc(1, size);
+}
+
+void FreePool(void *buffer)
+{
+    free(buffer);
+}
+
+BOOLEAN shim_log_errors = TRUE;
+
+// log.c isn't built for the host, errors still go to stderr so a failing bench says why
+void log_write(UINT8 level, UINT16 code, const UINT64 *args, UINTN nargs)
+{
+    if (level < LOG_ERROR || !shim_log_errors) {
+        return;
+    }
+
+    fprintf(stderr, "log: code %u", code);
+    for (UINTN i = 0; i < nargs; i++) {
+        fprintf(stderr, " 0x%llx", (unsigned long long) args[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+/*
+ * Boot services
+ */
+
+static EFI_STATUS shim_allocate_pages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE mem_type, UINTN pages,
+        IN OUT EFI_PHYSICAL_ADDRESS *address)
+{
+    UINTN size = EFI_PAGES_TO_SIZE(pages);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *hint = NULL;
+    void *mem;
+    UINTN i;
+
+    // Same as firmware, types between the spec's and the OEM/OS-defined ranges are invalid
+    if (!pages || !address || (mem_type >= EfiMaxMemoryType && (UINT32) mem_type < 0x70000000)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    if (num_allocs == SHIM_MAX_ALLOCS) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    if (type == AllocateAddress) {
+        if (*address & EFI_PAGE_MASK) {
+            return EFI_INVALID_PARAMETER;
+        }
+        hint = (void *) *address;
+        flags |= MAP_FIXED_NOREPLACE;
+    } else if (type == AllocateMaxAddress && *address < BASE_4GB) {
+        flags |= MAP_32BIT;
+    } else if (type != AllocateAnyPages && type != AllocateMaxAddress) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    mem = mmap(hint, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (mem == MAP_FAILED) {
+        return (type == AllocateAddress) ? EFI_NOT_FOUND : EFI_OUT_OF_RESOURCES;
+    }
+
+    if (type == AllocateMaxAddress && (EFI_PHYSICAL_ADDRESS) mem + size - 1 > *address) {
+        munmap(mem, size);
+        return EFI_NOT_FOUND;
+    }
+
+    for (i = num_allocs; i > 0 && allocs[i - 1].base > (EFI_PHYSICAL_ADDRESS) mem; i--) {
+        allocs[i] = allocs[i - 1];
+    }
+    allocs[i].base = (EFI_PHYSICAL_ADDRESS) mem;
+    allocs[i].pages = pages;
+    allocs[i].type = mem_type;
+    num_allocs++;
+    map_key++;
+
+    *address = (EFI_PHYSICAL_ADDRESS) mem;
+
+    return EFI_SUCCESS;
+}
+
+// Like firmware, any page range inside one allocation can be freed, splitting it if needed
+static EFI_STATUS shim_free_pages(EFI_PHYSICAL_ADDRESS address, UINTN pages)
+{
+    EFI_PHYSICAL_ADDRESS end = address + EFI_PAGES_TO_SIZE(pages);
+
+    if (!pages) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    for (UINTN i = 0; i < num_allocs; i++) {
+        shim_alloc_t *a = &allocs[i];
+        EFI_PHYSICAL_ADDRESS a_end = a->base + EFI_PAGES_TO_SIZE(a->pages);
+
+        if (address < a->base || end > a_end) {
+            continue;
+        }
+
+        if (address > a->base && end < a_end) {
+            if (num_allocs == SHIM_MAX_ALLOCS) {
+                return EFI_OUT_OF_RESOURCES;
+            }
+            memmove(&allocs[i + 2], &allocs[i + 1], (num_allocs - i - 1) * sizeof(shim_alloc_t));
+            allocs[i + 1].base = end;
+            allocs[i + 1].pages = EFI_SIZE_TO_PAGES(a_end - end);
+            allocs[i + 1].type = a->type;
+            a->pages = EFI_SIZE_TO_PAGES(address - a->base);
+            num_allocs++;
+        } else if (address > a->base) {
+            a->pages -= pages;
+        } else if (end < a_end) {
+            a->base = end;
+            a->pages -= pages;
+        } else {
+            memmove(&allocs[i], &allocs[i + 1], (num_allocs - i - 1) * sizeof(shim_alloc_t));
+            num_allocs--;
+        }
+
+        munmap((void *) address, EFI_PAGES_TO_SIZE(pages));
+        map_key++;
+        return EFI_SUCCESS;
+    }
+
+    return EFI_NOT_FOUND;
+}
+
+static EFI_STATUS shim_get_memory_map(IN OUT UINTN *size, OUT EFI_MEMORY_DESCRIPTOR *map, OUT UINTN *key,
+        OUT UINTN *desc_size, OUT UINT32 *desc_version)
+{
+    UINTN needed = num_allocs * sizeof(EFI_MEMORY_DESCRIPTOR);
+
+    if (!size || !desc_size || !desc_version) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    *desc_size = sizeof(EFI_MEMORY_DESCRIPTOR);
+    *desc_version = EFI_MEMORY_DESCRIPTOR_VERSION;
+
+    if (*size < needed) {
+        *size = needed;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    for (UINTN i = 0; i < num_allocs; i++) {
+        map[i].Type = allocs[i].type;
+        map[i].PhysicalStart = allocs[i].base;
+        map[i].VirtualStart = 0;
+        map[i].NumberOfPages = allocs[i].pages;
+        map[i].Attribute = EFI_MEMORY_WB;
+    }
+
+    *size = needed;
+    *key = map_key;
+
+    return EFI_SUCCESS;
+}
+
+static const boot_services_t shim_boot_services = {
+    .allocate_pages = shim_allocate_pages,
+    .free_pages = shim_free_pages,
+    .get_memory_map = shim_get_memory_map,
+};
+
+const boot_services_t *bs = &shim_boot_services;
+
+void shim_free_all_pages()
+{
+    for (UINTN i = 0; i < num_allocs; i++) {
+        munmap((void *) allocs[i].base, EFI_PAGES_TO_SIZE(allocs[i].pages));
+    }
+
+    num_allocs = 0;
+    map_key++;
+}
+
+UINTN shim_allocated_pages()
+{
+    UINTN pages = 0;
+
+    for (UINTN i = 0; i < num_allocs; i++) {
+        pages += allocs[i].pages;
+    }
+
+    return pages;
+}
+
+/*
+ * Files
+ */
+
+static EFI_STATUS EFIAPI shim_file_close(EFI_FILE *self)
+{
+    shim_file_t *file = (shim_file_t *) self;
+
+    free(file->data);
+    free(file);
+
+    return EFI_SUCCESS;
+}
+
+// Reads stop at the end of the file, reading at the end returns nothing
+static EFI_STATUS EFIAPI shim_file_read(EFI_FILE *self, UINTN *size, void *buffer)
+{
+    shim_file_t *file = (shim_file_t *) self;
+    UINTN left = (file->pos < file->size) ? file->size - file->pos : 0;
+
+    if (*size > left) {
+        *size = left;
+    }
+
+    memcpy(buffer, file->data + file->pos, *size);
+    file->pos += *size;
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI shim_file_get_position(EFI_FILE *self, UINT64 *position)
+{
+    *position = ((shim_file_t *) self)->pos;
+
+    return EFI_SUCCESS;
+}
+
+// All ones moves to the end of the file, same as the spec
+static EFI_STATUS EFIAPI shim_file_set_position(EFI_FILE *self, UINT64 position)
+{
+    shim_file_t *file = (shim_file_t *) self;
+
+    file->pos = (position == MAX_UINT64) ? file->size : position;
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI shim_file_unsupported()
+{
+    return EFI_UNSUPPORTED;
+}
+
+EFI_FILE *shim_file_from_buffer(const void *data, UINTN size)
+{
+    shim_file_t *file = calloc(1, sizeof(shim_file_t));
+
+    if (!file) {
+        return NULL;
+    }
+
+    file->data = malloc(size ? size : 1);
+    if (!file->data) {
+        free(file);
+        return NULL;
+    }
+
+    memcpy(file->data, data, size);
+    file->size = size;
+
+    file->proto.Revision = 0x00010000;
+    file->proto.Open = (void *) shim_file_unsupported;
+    file->proto.Close = shim_file_close;
+    file->proto.Delete = (void *) shim_file_unsupported;
+    file->proto.Read = shim_file_read;
+    file->proto.Write = (void *) shim_file_unsupported;
+    file->proto.GetPosition = shim_file_get_position;
+    file->proto.SetPosition = shim_file_set_position;
+    file->proto.GetInfo = (void *) shim_file_unsupported;
+    file->proto.SetInfo = (void *) shim_file_unsupported;
+    file->proto.Flush = (void *) shim_file_unsupported;
+
+    return &file->proto;
+}
+
+EFI_FILE *shim_file_open(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    EFI_FILE *file = NULL;
+    void *data = NULL;
+    long size;
+
+    if (!f) {
+        return NULL;
+    }
+
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+        data = malloc(size ? size : 1);
+        if (data && fread(data, 1, size, f) == (size_t) size) {
+            file = shim_file_from_buffer(data, size);
+        }
+    }
+
+    free(data);
+    fclose(f);
+
+    return file;
+}
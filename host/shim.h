@@ -0,0 +1,30 @@
+// Linux stand-ins for the firmware services the loader core uses
+#pragma once
+
+#ifndef SHIM_H
+#define SHIM_H
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include "boot_services.h"
+
+// Page allocations the shim can track at once, each is one memory map entry
+#define SHIM_MAX_ALLOCS     4096
+
+// Set to FALSE around calls that are expected to log an error
+extern BOOLEAN shim_log_errors;
+
+// EFI_FILE reading from a copy of data, Close frees it
+EFI_FILE *shim_file_from_buffer(const void *data, UINTN size);
+
+// EFI_FILE over the whole of a host file read into memory, NULL if it can't be read
+EFI_FILE *shim_file_open(const char *path);
+
+// Release every page allocation still outstanding, the memory map is empty afterwards
+void shim_free_all_pages();
+
+// Pages currently allocated through bs
+UINTN shim_allocated_pages();
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Per-stage boot latency report from the StageHistory variable the loader keeps
+ *
+ *   cc -O2 -Iinclude -o stage_report host/stage_report.c
+ *   ./stage_report [/sys/firmware/efi/efivars/StageHistory-6d656d65-6c6f-7264-6d65-6d656c796665]
+ *
+ * Also accepts a raw dump of the variable without the 4 byte efivarfs attribute header
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stage_history.h"
+
+enum {
+#define STAGE(id, name) STAGE_##id,
+#include "stage_list.h"
+#undef STAGE
+    STAGE_COUNT
+};
+
+static const char *stage_names[] = {
+#define STAGE(id, name) name,
+#include "stage_list.h"
+#undef STAGE
+};
+
+// EFI_GUID, for spelling STAGE_HISTORY_GUID the way efivarfs names files
+struct efi_guid {
+    uint32_t    data1;
+    uint16_t    data2;
+    uint16_t    data3;
+    uint8_t     data4[8];
+};
+
+// Mirrors stage_history_t in include/stage.h
+struct stage_history {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    num_stages;
+    uint32_t    next;
+    uint32_t    count;
+    uint32_t    usec[STAGE_HISTORY_BOOTS][STAGE_COUNT];
+} __attribute__((packed));
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of n sorted values
+static uint32_t percentile(const uint32_t *sorted, size_t n, unsigned int p)
+{
+    size_t rank = (p * n + 99) / 100;
+
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void report_row(const char *name, uint32_t *values, size_t n)
+{
+    uint64_t sum = 0;
+
+    if (!n) {
+        printf("%-20s %5d %10s\n", name, 0, "-");
+        return;
+    }
+
+    qsort(values, n, sizeof(*values), cmp_u32);
+    for (size_t i = 0; i < n; i++) {
+        sum += values[i];
+    }
+
+    printf("%-20s %5zu %10u %10u %10u %10u %10u %10llu\n", name, n, values[0], percentile(values, n, 50),
+            percentile(values, n, 90), percentile(values, n, 99), values[n - 1], (unsigned long long) (sum / n));
+}
+
+int main(int argc, char **argv)
+{
+    static const struct efi_guid guid = STAGE_HISTORY_GUID;
+    char default_path[128];
+    const char *path = default_path;
+    unsigned char buf[sizeof(struct stage_history) + 4];
+    struct stage_history hist;
+    uint32_t values[STAGE_HISTORY_BOOTS];
+    uint32_t totals[STAGE_HISTORY_BOOTS];
+    size_t len;
+    FILE *f;
+
+    snprintf(default_path, sizeof(default_path),
+            "/sys/firmware/efi/efivars/%s-%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x", STAGE_HISTORY_NAME,
+            guid.data1, guid.data2, guid.data3, guid.data4[0], guid.data4[1], guid.data4[2], guid.data4[3],
+            guid.data4[4], guid.data4[5], guid.data4[6], guid.data4[7]);
+    if (argc > 1) {
+        path = argv[1];
+    }
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    // efivarfs prefixes the data with the variable's attributes
+    if (len == sizeof(hist) + 4) {
+        memcpy(&hist, buf + 4, sizeof(hist));
+    } else if (len == sizeof(hist)) {
+        memcpy(&hist, buf, sizeof(hist));
+    } else {
+        fprintf(stderr, "%s: %zu bytes, expected %zu\n", path, len, sizeof(hist));
+        return 1;
+    }
+
+    if (hist.magic != STAGE_HISTORY_MAGIC || hist.version != STAGE_HISTORY_VERSION || hist.num_stages != STAGE_COUNT) {
+        fprintf(stderr, "%s: not a version %d stage history with %d stages\n", path, STAGE_HISTORY_VERSION, STAGE_COUNT);
+        return 1;
+    }
+
+    if (hist.count > STAGE_HISTORY_BOOTS) {
+        hist.count = STAGE_HISTORY_BOOTS;
+    }
+
+    printf("%u boots, times in usec\n\n", hist.count);
+    printf("%-20s %5s %10s %10s %10s %10s %10s %10s\n", "stage", "boots", "min", "p50", "p90", "p99", "max", "mean");
+
+    memset(totals, 0, sizeof(totals));
+
+    // The first stage only marks the start, it has no duration of its own
+    for (int stage = 1; stage < STAGE_COUNT; stage++) {
+        size_t n = 0;
+
+        for (uint32_t boot = 0; boot < hist.count; boot++) {
+            uint32_t usec = hist.usec[boot][stage];
+
+            totals[boot] += usec;
+            if (usec) {
+                values[n++] = usec;
+            }
+        }
+
+        report_row(stage_names[stage], values, n);
+    }
+
+    report_row("total", totals, hist.count);
+
+    return 0;
+}
@@ -0,0 +1,1050 @@
+/*
+ * Correctness tests of the loader core on Linux, built by script/build_host.sh
+ *
+ *   ./host_test [-f FILTER]
+ *
+ * Runs the same loader sources the firmware build uses over host/shim.c against synthetic inputs (the
+ * host/fixture.c ones host_bench times, plus allocation sizes, kernel image to hash, boot manifest,
+ * SMBIOS table, MADT and NUMA memory map), including the inputs each of them has to turn away.
+ * Exit status is nonzero on a failure.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Uefi.h>
+
+#include "arena.h"
+#include "fixture.h"
+#include "info.h"
+#include "kcache.h"
+#include "loadelf.h"
+#include "lz4.h"
+#include "manifest.h"
+#include "qoi.h"
+#include "reserve.h"
+#include "shim.h"
+#include "smbios.h"
+#include "tar.h"
+#include "topology.h"
+#include "uefi_acpi.h"
+
+// Kernel cache, hashing a kernel sized image
+#define KCACHE_IMAGE_SIZE   (16 * SIZE_1MB + 13) // Odd size so the tail loops run too
+
+// Arena, a loader's worth of small temporaries with the odd big buffer mixed in
+#define ARENA_ALLOCS        4096
+#define ARENA_SMALL_MAX     512
+#define ARENA_BIG_EVERY     1024
+#define ARENA_BIG_SIZE      (3 * SIZE_1MB / 2)
+
+// SMBIOS, a two socket server's table with the slot, OEM and port structures the walk has to skip
+#define SMBIOS_SOCKETS      2
+#define SMBIOS_DIMMS        24
+#define SMBIOS_OTHER        400
+#define SMBIOS_TABLE_MAX    (64 * SIZE_1KB)
+
+// Topology, two 64 core SMT packages listed first threads first like most firmware, plus a hot-plug socket
+#define TOPO_PACKAGES       2
+#define TOPO_CORES          64
+#define TOPO_HOTPLUG        4
+#define TOPO_MADT_SIZE      (16 * SIZE_1KB)
+
+// Reservations, a four node memory map cut into 128MB descriptors, node 3 too fragmented for 1GB regions
+#define RESERVE_NODES       4
+#define RESERVE_NODE_SIZE   (64ULL * SIZE_1GB)
+#define RESERVE_CHUNK       (128ULL * SIZE_1MB)
+#define RESERVE_CHUNKS      (RESERVE_NODE_SIZE / RESERVE_CHUNK)
+#define RESERVE_NODE_BASE(n) (BASE_4GB + (n) * RESERVE_NODE_SIZE)
+
+typedef struct {
+    const char  *name;
+    int         (*run)(); // 0 on success
+} test_t;
+
+/*
+ * ELF loading
+ */
+
+// Every segment's file bytes made it to base + p_vaddr
+static int elf_check_loaded(EFI_PHYSICAL_ADDRESS base)
+{
+    Elf64_Ehdr *hdr = (Elf64_Ehdr *) elf_image;
+    Elf64_Phdr *phdrs = (Elf64_Phdr *) (elf_image + hdr->e_phoff);
+
+    for (UINTN i = 0; i < hdr->e_phnum; i++) {
+        CHECK(memcmp((void *) (base + phdrs[i].p_vaddr), elf_image + phdrs[i].p_offset, phdrs[i].p_filesz) == 0);
+    }
+
+    return 0;
+}
+
+static int elf_test()
+{
+    Elf64_Ehdr *hdr;
+    EFI_FILE *elf_file;
+    EFI_PHYSICAL_ADDRESS entry;
+
+    elf_build(0);
+    hdr = (Elf64_Ehdr *) elf_image;
+
+    CHECK(elf_verify_hdr_mem(elf_image, elf_size) == EFI_SUCCESS);
+
+    // A big endian image has to be turned away before anything is allocated
+    hdr->e_ident[EI_DATA] = ELFDATA2MSB;
+    CHECK(elf_verify_hdr_mem(elf_image, elf_size) == EFI_LOAD_ERROR);
+    hdr->e_ident[EI_DATA] = ELFDATA2LSB;
+
+    entry = elf_load_mem_relo(elf_image, elf_size);
+    CHECK(entry != 0);
+    CHECK(elf_check_loaded(entry - hdr->e_entry) == 0);
+    free_all_pages();
+
+    // A segment running past the end of the image is caught before anything is allocated
+    shim_log_errors = FALSE;
+    CHECK(elf_load_mem_relo(elf_image, elf_size - 1) == 0);
+    shim_log_errors = TRUE;
+    CHECK(shim_allocated_pages() == 0);
+
+    entry = elf_load_mem_aligned(elf_image, elf_size);
+    CHECK(entry != 0 && ((entry - hdr->e_entry) & (ELF_ALIGN - 1)) == 0);
+    CHECK(elf_check_loaded(entry - hdr->e_entry) == 0);
+    CHECK(shim_allocated_pages() == EFI_SIZE_TO_PAGES(ELF_SEGMENTS * ELF_SEGMENT_SIZE + ELF_BSS_SIZE));
+    free_all_pages();
+
+    elf_file = shim_file_from_buffer(elf_image, elf_size);
+    CHECK(elf_file != NULL);
+    CHECK(elf_verify_hdr_file(elf_file) == EFI_SUCCESS);
+
+    entry = elf_load_file_relo(elf_file);
+    CHECK(entry != 0);
+    CHECK(elf_check_loaded(entry - hdr->e_entry) == 0);
+    free_all_pages();
+
+    entry = elf_load_file_aligned(elf_file);
+    CHECK(entry != 0 && ((entry - hdr->e_entry) & (ELF_ALIGN - 1)) == 0);
+    CHECK(elf_check_loaded(entry - hdr->e_entry) == 0);
+
+    elf_file->Close(elf_file);
+    free(elf_image);
+
+    return 0;
+}
+
+// The fixed address loaders take p_paddr literally, so they get an image linked at ELF_FIXED_BASE
+static int elf_fixed_test()
+{
+    EFI_FILE *elf_file;
+    EFI_PHYSICAL_ADDRESS entry;
+
+    elf_build(ELF_FIXED_BASE);
+
+    entry = elf_load_mem(elf_image, elf_size);
+    CHECK(entry == ((Elf64_Ehdr *) elf_image)->e_entry);
+    CHECK(elf_check_loaded(ELF_FIXED_BASE) == 0);
+    CHECK(shim_allocated_pages() == EFI_SIZE_TO_PAGES(ELF_SEGMENTS * ELF_SEGMENT_SIZE + ELF_BSS_SIZE));
+    free_all_pages();
+
+    elf_file = shim_file_from_buffer(elf_image, elf_size);
+    CHECK(elf_file != NULL);
+
+    entry = elf_load_file(elf_file);
+    CHECK(entry == ((Elf64_Ehdr *) elf_image)->e_entry);
+    CHECK(elf_check_loaded(ELF_FIXED_BASE) == 0);
+    free_all_pages();
+
+    elf_file->Close(elf_file);
+    free(elf_image);
+
+    return 0;
+}
+
+/*
+ * Tar lookup
+ */
+
+static int tar_test()
+{
+    UINT8 *found;
+    char name[100];
+
+    tar_build();
+
+    found = tar_get_fileaddr(tar_image, tar_last, tar_image + tar_image_size);
+    CHECK(found != NULL);
+    CHECK(strcmp(((tar_header_t *) found)->name, tar_last) == 0);
+
+    snprintf(name, sizeof(name), "modules/mod%05u.ko", TAR_FILES / 2);
+    found = tar_get_fileaddr(tar_image, name, tar_image + tar_image_size);
+    CHECK(found != NULL);
+    CHECK(strcmp(((tar_header_t *) found)->name, name) == 0);
+
+    CHECK(tar_get_fileaddr(tar_image, "modules/missing.ko", tar_image + tar_image_size) == NULL);
+
+    tar_free();
+
+    return 0;
+}
+
+/*
+ * ACPI directory and checksums
+ */
+
+static int acpi_test()
+{
+    acpi_dir_t acpi_dir;
+    acpi_table_t *table;
+    UINTN ssdts = acpi_build();
+
+    CHECK(validate_acpi_table(&acpi.rsdp) == EFI_SUCCESS);
+    acpi.rsdp.extended_checksum++;
+    CHECK(validate_acpi_table(&acpi.rsdp) == EFI_INVALID_PARAMETER);
+    acpi.rsdp.extended_checksum--;
+
+    CHECK(acpi_build_dir(&acpi.rsdp, &acpi_dir, TRUE) == EFI_SUCCESS);
+    CHECK(acpi_dir.num_tables == ACPI_TABLES + 1);
+    CHECK(acpi_dir.packed_base != 0);
+
+    table = acpi_find_table(&acpi_dir, ACPI_SIG_DSDT);
+    CHECK(table && table->fw_address == (EFI_PHYSICAL_ADDRESS) acpi.tables[ACPI_TABLES]);
+    CHECK(memcmp((void *) table->address, acpi.tables[ACPI_TABLES], table->length) == 0);
+
+    // SSDTs are chained off the first one
+    table = acpi_find_table(&acpi_dir, ACPI_SIG_SSDT);
+    for (UINTN n = 1; n < ssdts; n++) {
+        CHECK(table && table->next);
+        table = &acpi_dir.tables[table->next - 1];
+    }
+    CHECK(table && !table->next);
+
+    CHECK(acpi_checksum_dir(&acpi_dir, NULL) == EFI_SUCCESS);
+    CHECK(acpi_dir.num_invalid == 0);
+
+    // A single flipped byte in the chunked table has to be caught
+    ((UINT8 *) table->address)[ACPI_BIG_TABLE_SIZE / 2]++;
+    CHECK(acpi_checksum_dir(&acpi_dir, NULL) == EFI_SUCCESS);
+    CHECK(acpi_dir.num_invalid == 1 && !table->valid);
+    ((UINT8 *) table->address)[ACPI_BIG_TABLE_SIZE / 2]--;
+
+    free_all_pages();
+    acpi_free();
+
+    return 0;
+}
+
+/*
+ * QOI decoding
+ */
+
+static int qoi_test()
+{
+    static UINT32 qoi_out[QOI_WIDTH];
+    qoi_state_t qs;
+    const UINT8 *p;
+    UINT32 width;
+    UINT32 height;
+
+    qoi_build();
+
+    CHECK(qoi_info(qoi_image, qoi_size, &width, &height) == EFI_SUCCESS);
+    CHECK(width == QOI_WIDTH && height == QOI_HEIGHT);
+
+    qoi_init(&qs);
+    p = qoi_image + QOI_HEADER_SIZE;
+    for (UINT32 y = 0; y < QOI_HEIGHT; y++) {
+        p = qoi_decode_span(&qs, p, qoi_image + qoi_size - QOI_END_SIZE, qoi_out, QOI_WIDTH);
+        CHECK(memcmp(qoi_out, qoi_pixels + (UINTN) y * QOI_WIDTH, sizeof(qoi_out)) == 0);
+    }
+    CHECK(p == qoi_image + qoi_size - QOI_END_SIZE);
+
+    qoi_free();
+
+    return 0;
+}
+
+/*
+ * Arena allocation
+ */
+
+static int arena_test()
+{
+    UINTN arena_sizes[ARENA_ALLOCS];
+    UINT64 arena_bytes = 0;
+    UINT8 *prev = NULL;
+
+    for (UINTN i = 0; i < ARENA_ALLOCS; i++) {
+        arena_sizes[i] = (i % ARENA_BIG_EVERY == ARENA_BIG_EVERY - 1) ? ARENA_BIG_SIZE : 1 + rng() % ARENA_SMALL_MAX;
+        arena_bytes += arena_sizes[i];
+    }
+
+    // Aligned, zeroed when asked, and never overlapping the allocation before it
+    for (UINTN i = 0; i < ARENA_ALLOCS; i++) {
+        UINT8 *p = arena_alloc_zero(&arena_scratch, arena_sizes[i]);
+
+        CHECK(p != NULL);
+        CHECK(((UINTN) p & (ARENA_ALIGN - 1)) == 0);
+        CHECK(p[0] == 0 && p[arena_sizes[i] - 1] == 0);
+        CHECK(!prev || p >= prev + arena_sizes[i - 1] || p + arena_sizes[i] <= prev);
+        memset(p, 0xA5, arena_sizes[i]);
+        prev = p;
+    }
+
+    // Every chunk is reported and the chunks cover what was handed out
+    {
+        mem_range_t ranges[ARENA_MAX_CHUNKS];
+        UINT32 num_ranges = 0;
+        UINT64 covered = 0;
+
+        arena_report(&arena_scratch, ranges, &num_ranges);
+        CHECK(num_ranges == arena_scratch.num_chunks && num_ranges > 1);
+        for (UINT32 i = 0; i < num_ranges; i++) {
+            covered += ranges[i].size;
+        }
+        CHECK(covered >= arena_scratch.allocated && arena_scratch.allocated >= arena_bytes);
+        CHECK(shim_allocated_pages() == EFI_SIZE_TO_PAGES(covered));
+    }
+
+    arena_reset(&arena_scratch);
+    CHECK(shim_allocated_pages() == 0);
+
+    return 0;
+}
+
+/*
+ * Kernel cache
+ */
+
+static int kcache_test()
+{
+    UINT8 *kcache_image;
+    EFI_TIME mtime = { 2026, 1, 2, 3, 4, 5 };
+    EFI_TIME later = mtime;
+    kcache_t cache;
+    UINT64 hash;
+    UINT8 *copy;
+
+    kcache_image = malloc(KCACHE_IMAGE_SIZE);
+    CHECK(kcache_image != NULL);
+    fill_random(kcache_image, KCACHE_IMAGE_SIZE);
+
+    // Same bytes at any alignment hash the same, any single flipped bit or a shorter length doesn't
+    hash = kcache_hash(kcache_image, KCACHE_IMAGE_SIZE);
+    copy = malloc(KCACHE_IMAGE_SIZE + 1);
+    CHECK(copy != NULL);
+    memcpy(copy + 1, kcache_image, KCACHE_IMAGE_SIZE);
+    CHECK(kcache_hash(copy + 1, KCACHE_IMAGE_SIZE) == hash);
+    free(copy);
+
+    for (UINTN off = 0; off < KCACHE_IMAGE_SIZE; off += KCACHE_IMAGE_SIZE / 7) {
+        kcache_image[off] ^= 0x10;
+        CHECK(kcache_hash(kcache_image, KCACHE_IMAGE_SIZE) != hash);
+        kcache_image[off] ^= 0x10;
+    }
+    kcache_image[KCACHE_IMAGE_SIZE - 1] ^= 0x01;
+    CHECK(kcache_hash(kcache_image, KCACHE_IMAGE_SIZE) != hash);
+    kcache_image[KCACHE_IMAGE_SIZE - 1] ^= 0x01;
+    CHECK(kcache_hash(kcache_image, KCACHE_IMAGE_SIZE - 1) != hash);
+
+    // A cached copy is only used for the same file, and only if its pages are free and still match
+    {
+        UINT8 *buf = kcache_alloc(KCACHE_IMAGE_SIZE);
+
+        CHECK(buf != NULL);
+        memcpy(buf, kcache_image, KCACHE_IMAGE_SIZE);
+        kcache_record(&cache, buf, KCACHE_IMAGE_SIZE, &mtime);
+        CHECK(cache.base == (UINTN) buf && cache.hash == hash);
+
+        later.Second++;
+        CHECK(kcache_lookup(&cache, KCACHE_IMAGE_SIZE, &later) == NULL);
+        CHECK(kcache_lookup(&cache, KCACHE_IMAGE_SIZE + 1, &mtime) == NULL);
+        CHECK(kcache_lookup(&cache, KCACHE_IMAGE_SIZE, &mtime) == NULL); // Still allocated
+
+        // The shim hands freed pages back zeroed, like RAM something else scribbled over
+        free_all_pages();
+        CHECK(kcache_lookup(&cache, KCACHE_IMAGE_SIZE, &mtime) == NULL);
+        CHECK(shim_allocated_pages() == 0);
+    }
+
+    free(kcache_image);
+
+    return 0;
+}
+
+/*
+ * LZ4 frames
+ */
+
+static int lz4_test()
+{
+    static const UINT8 bad_block[] = { 0x40, 'a', 'b', 'c', 'd', 0x08, 0x09 }; // 4 literals, match at offset 0x908
+    UINT8 raw[15 + 4 + 9 + 4];
+    UINT64 size = 0;
+    UINT8 *lz4_out = malloc(LZ4_DATA_SIZE);
+
+    CHECK(lz4_out != NULL);
+    lz4_build();
+    CHECK(lz4_data != NULL && lz4_frame != NULL);
+    CHECK(lz4_frame_len < LZ4_DATA_SIZE);
+
+    CHECK(lz4_frame_size(lz4_frame, lz4_frame_len, &size) == EFI_SUCCESS && size == LZ4_DATA_SIZE);
+    CHECK(lz4_decode_frame(lz4_frame, lz4_frame_len, lz4_out, LZ4_DATA_SIZE) == EFI_SUCCESS);
+    CHECK(memcmp(lz4_out, lz4_data, LZ4_DATA_SIZE) == 0);
+
+    // Truncated frames, wrong output sizes and offsets reaching before the output all fail cleanly
+    CHECK(lz4_decode_frame(lz4_frame, lz4_frame_len - 5, lz4_out, LZ4_DATA_SIZE) == EFI_COMPROMISED_DATA);
+    CHECK(lz4_decode_frame(lz4_frame, lz4_frame_len, lz4_out, LZ4_DATA_SIZE - 1) == EFI_COMPROMISED_DATA);
+    CHECK(lz4_decode_frame(lz4_data, SIZE_4KB, lz4_out, LZ4_DATA_SIZE) == EFI_UNSUPPORTED);
+
+    // Stored block, and a match reaching back past the 4 bytes written so far
+    lz4_encode_frame((const UINT8 *) "", 0, raw);
+    lz4_put32(raw + 6, 9);
+    lz4_put32(raw + 15, 9 | LZ4_BLOCK_UNCOMPRESSED);
+    memcpy(raw + 19, "uefibutt!", 9);
+    lz4_put32(raw + 28, 0);
+    CHECK(lz4_decode_frame(raw, sizeof(raw), lz4_out, 9) == EFI_SUCCESS && memcmp(lz4_out, "uefibutt!", 9) == 0);
+
+    lz4_put32(raw + 15, sizeof(bad_block));
+    memcpy(raw + 19, bad_block, sizeof(bad_block));
+    lz4_put32(raw + 19 + sizeof(bad_block), 0);
+    CHECK(lz4_decode_frame(raw, 19 + sizeof(bad_block) + 4, lz4_out, 9) == EFI_COMPROMISED_DATA);
+
+    lz4_free();
+    free(lz4_out);
+
+    return 0;
+}
+
+/*
+ * Boot manifest
+ */
+
+static manifest_t manifest;
+
+// The error it logs is the expected outcome, keep it off stderr
+static int manifest_expect_bad(const char *text)
+{
+    EFI_STATUS status;
+
+    shim_log_errors = FALSE;
+    status = manifest_parse((const CHAR8 *) text, strlen(text), &manifest);
+    shim_log_errors = TRUE;
+
+    return status == EFI_INVALID_PARAMETER;
+}
+
+static int manifest_test()
+{
+    static const char sample[] =
+        "# kernel first\n"
+        "\\test\\kernel.elf   kernel\r\n"
+        "\n"
+        "  \\test\\initrd.tar  bundle, required,align=2M   # trailing comment\n"
+        "\\test\\font.lz4 compressed,lazy\n"
+        "\\last";
+    static char manifest_text[MANIFEST_MAX_ENTRIES * 48];
+    const manifest_entry_t *e = manifest.entries;
+    UINTN manifest_len = 0;
+
+    CHECK(manifest_parse((const CHAR8 *) sample, strlen(sample), &manifest) == EFI_SUCCESS);
+    CHECK(manifest.num_entries == 4);
+    CHECK(strcmp((char *) e[0].path, "\\test\\kernel.elf") == 0 && e[0].flags == (MODULE_KERNEL | MODULE_REQUIRED));
+    CHECK(e[0].line == 2 && e[0].align == EFI_PAGE_SIZE);
+    CHECK(strcmp((char *) e[1].path, "\\test\\initrd.tar") == 0 && e[1].line == 4);
+    CHECK(e[1].flags == (MODULE_BUNDLE | MODULE_REQUIRED) && e[1].align == SIZE_2MB);
+    CHECK(e[2].flags == (MODULE_COMPRESSED | MODULE_LAZY));
+    CHECK(strcmp((char *) e[3].path, "\\last") == 0 && e[3].flags == 0 && e[3].line == 6);
+    CHECK(manifest_kernel(&manifest) == &e[0]);
+
+    CHECK(manifest_expect_bad("\\a requried\n"));
+    CHECK(manifest_expect_bad("relative/path\n"));
+    CHECK(manifest_expect_bad("\\k kernel,lazy\n"));
+    CHECK(manifest_expect_bad("\\b bundle,compressed\n"));
+    CHECK(manifest_expect_bad("\\a align=3K\n"));
+    CHECK(manifest_expect_bad("\\a align=\n"));
+    CHECK(manifest_expect_bad("\\a align=2X\n"));
+
+    // As many entries as the manifest has room for
+    for (UINTN i = 0; i < MANIFEST_MAX_ENTRIES; i++) {
+        manifest_len += snprintf(manifest_text + manifest_len, sizeof(manifest_text) - manifest_len,
+                "\\mod\\m%02lu.bin required,align=64K\n", (unsigned long) i);
+    }
+    CHECK(manifest_parse((const CHAR8 *) manifest_text, manifest_len, &manifest) == EFI_SUCCESS);
+    CHECK(manifest.num_entries == MANIFEST_MAX_ENTRIES);
+
+    return 0;
+}
+
+/*
+ * SMBIOS
+ */
+
+static UINT8 smbios_table[SMBIOS_TABLE_MAX];
+static UINTN smbios_len;
+static smbios3_entry_t smbios_entry3;
+static smbios_entry_t smbios_entry2;
+static smbios_info_t smbios;
+
+// Append a structure, its formatted area from fields and then its strings, NULL ends the list
+static void *smbios_add(UINT8 type, UINT8 length, UINT16 handle, const void *fields, ...)
+{
+    UINT8 *s = smbios_table + smbios_len;
+    smbios_header_t *header = (smbios_header_t *) s;
+    const char *str;
+    va_list ap;
+
+    if (fields) {
+        memcpy(s, fields, length);
+    }
+    header->type = type;
+    header->length = length;
+    header->handle = handle;
+    smbios_len += length;
+
+    va_start(ap, fields);
+    while ((str = va_arg(ap, const char *))) {
+        memcpy(smbios_table + smbios_len, str, strlen(str) + 1);
+        smbios_len += strlen(str) + 1;
+    }
+    va_end(ap);
+
+    // An empty string set is still two NULs
+    if (smbios_len == (UINTN) (s - smbios_table) + length) {
+        smbios_table[smbios_len++] = 0;
+    }
+    smbios_table[smbios_len++] = 0;
+
+    return s;
+}
+
+static UINT8 smbios_sum(const void *data, UINTN length)
+{
+    UINT8 sum = 0;
+
+    for (UINTN i = 0; i < length; i++) {
+        sum += ((const UINT8 *) data)[i];
+    }
+
+    return sum;
+}
+
+static int smbios_test()
+{
+    smbios_processor_t proc;
+    smbios_cache_entry_t cache;
+    smbios_memory_device_t dev;
+    smbios_mapped_range_t range;
+    UINT8 other[32];
+    EFI_PHYSICAL_ADDRESS table;
+    UINT32 length;
+    UINT16 handle = 0x100;
+
+    smbios_len = 0;
+
+    for (UINTN i = 0; i < SMBIOS_OTHER / 2; i++) {
+        fill_random(other, sizeof(other));
+        smbios_add(9 + (i % 3) * 32, sizeof(other), handle++, other, "PCIe Slot", "OEM string", NULL);
+    }
+
+    // Each socket has an L1 data cache, a 2MB L2 and an L3 big enough to need the 32 bit size
+    for (UINTN i = 0; i < SMBIOS_SOCKETS; i++) {
+        memset(&cache, 0, sizeof(cache));
+        cache.socket = 1;
+        cache.configuration = 0x80 | 0; // Enabled, L1
+        cache.installed_size = cache.max_size = 48;
+        cache.system_type = 4;
+        cache.associativity = 9;
+        smbios_add(SMBIOS_TYPE_CACHE, sizeof(cache), 0x10 + i * 4, &cache, "L1 Cache", NULL);
+
+        cache.configuration = 0x80 | 1;
+        cache.installed_size = cache.max_size = 0x8000 | 32; // 64KB granularity
+        cache.system_type = 5;
+        smbios_add(SMBIOS_TYPE_CACHE, sizeof(cache), 0x11 + i * 4, &cache, "L2 Cache", NULL);
+
+        cache.configuration = 0x80 | 2;
+        cache.installed_size = cache.max_size = 0xFFFF;
+        cache.installed_size2 = cache.max_size2 = 0x80000000 | 5120; // 320MB
+        smbios_add(SMBIOS_TYPE_CACHE, sizeof(cache), 0x12 + i * 4, &cache, "L3 Cache", NULL);
+    }
+
+    for (UINTN i = 0; i < SMBIOS_SOCKETS; i++) {
+        memset(&proc, 0, sizeof(proc));
+        proc.socket = 1;
+        proc.version = 3;
+        proc.processor_type = 3;
+        proc.family = 0xFE;
+        proc.family2 = 0x6B;
+        proc.id = 0xBFEBFBFF000806F8ULL;
+        proc.max_speed = 4000;
+        proc.current_speed = 2100;
+        proc.status = 0x41;
+        proc.l1_handle = 0x10 + i * 4;
+        proc.l2_handle = 0x11 + i * 4;
+        proc.l3_handle = 0x12 + i * 4;
+        proc.core_count = proc.core_enabled = proc.thread_count = 0xFF;
+        proc.core_count2 = 288;
+        proc.core_enabled2 = 256;
+        proc.thread_count2 = 512;
+        smbios_add(SMBIOS_TYPE_PROCESSOR, sizeof(proc), handle++, &proc,
+                i ? "CPU1" : "CPU0", "Manufacturer", "Some Processor Brand String                ", NULL);
+    }
+
+    // A quarter of the slots empty, one 256GB device that needs the extended size
+    for (UINTN i = 0; i < SMBIOS_DIMMS; i++) {
+        char locator[16];
+
+        memset(&dev, 0, sizeof(dev));
+        snprintf(locator, sizeof(locator), "DIMM_%c%lu", (char) ('A' + i / 2), (unsigned long) (i % 2));
+        dev.locator = 1;
+        dev.bank_locator = 2;
+        dev.part_number = 3;
+        dev.data_width = 64;
+        dev.form_factor = 9;
+        dev.type = 0x22;
+        dev.size = (i % 4 == 3) ? 0 : 16 * 1024; // MB, 32GB would already set the KB bit
+        if (i == 0) {
+            dev.size = 0x7FFF;
+            dev.extended_size = 256 * 1024;
+        }
+        dev.speed = 6400;
+        dev.configured_speed = 5600;
+        dev.attributes = 2;
+        smbios_add(SMBIOS_TYPE_MEMORY_DEVICE, sizeof(dev), handle++, &dev, locator, "P0_NODE0", "M321R8GA0PB0", NULL);
+    }
+
+    // Below 4GB in KB, above it through the extended fields
+    memset(&range, 0, sizeof(range));
+    range.start = 0;
+    range.end = 2 * 1024 * 1024 - 1;
+    smbios_add(SMBIOS_TYPE_MAPPED_RANGE, sizeof(range), handle++, &range, NULL);
+    range.start = 0xFFFFFFFF;
+    range.extended_start = BASE_4GB;
+    range.extended_end = BASE_4GB + 1024ULL * SIZE_1GB - 1;
+    smbios_add(SMBIOS_TYPE_MAPPED_RANGE, sizeof(range), handle++, &range, NULL);
+
+    for (UINTN i = 0; i < SMBIOS_OTHER / 2; i++) {
+        fill_random(other, sizeof(other));
+        smbios_add(8, sizeof(other), handle++, other, "J1", "USB", NULL);
+    }
+    smbios_add(SMBIOS_TYPE_END, sizeof(smbios_header_t), handle++, NULL, NULL);
+    CHECK(smbios_len <= SMBIOS_TABLE_MAX);
+
+    memcpy(smbios_entry3.anchor, "_SM3_", 5);
+    smbios_entry3.length = sizeof(smbios_entry3);
+    smbios_entry3.major = 3;
+    smbios_entry3.minor = 6;
+    smbios_entry3.revision = 1;
+    smbios_entry3.table_max_size = SMBIOS_TABLE_MAX; // The walk has to stop at type 127, not the size
+    smbios_entry3.table_address = (UINT64) (UINTN) smbios_table;
+    smbios_entry3.checksum = -smbios_sum(&smbios_entry3, sizeof(smbios_entry3));
+
+    memcpy(smbios_entry2.anchor, "_SM_", 4);
+    memcpy(smbios_entry2.intermediate_anchor, "_DMI_", 5);
+    smbios_entry2.length = sizeof(smbios_entry2);
+    smbios_entry2.major = 2;
+    smbios_entry2.minor = 8;
+    smbios_entry2.table_length = smbios_len;
+    smbios_entry2.table_address = (UINT32) 0x1000; // Only validated, not decoded
+    smbios_entry2.intermediate_checksum = -smbios_sum(smbios_entry2.intermediate_anchor, 15);
+    smbios_entry2.checksum = -smbios_sum(&smbios_entry2, sizeof(smbios_entry2));
+
+    CHECK(smbios_validate_entry(&smbios_entry2, &table, &length) == EFI_SUCCESS);
+    CHECK(table == 0x1000 && length == smbios_len);
+    smbios_entry2.minor++;
+    CHECK(smbios_validate_entry(&smbios_entry2, &table, &length) == EFI_COMPROMISED_DATA);
+
+    CHECK(smbios_build_info(&smbios_entry3, &smbios) == EFI_SUCCESS);
+    CHECK(smbios.major == 3 && smbios.minor == 6);
+    CHECK(smbios.num_sockets == SMBIOS_SOCKETS && smbios.num_cpus == SMBIOS_SOCKETS && smbios.dropped == 0);
+    CHECK(smbios.num_populated == SMBIOS_SOCKETS && smbios.num_cores == 2 * 256 && smbios.num_threads == 2 * 512);
+    CHECK(strcmp((char *) smbios.cpus[1].socket, "CPU1") == 0);
+    CHECK(strcmp((char *) smbios.cpus[0].version, "Some Processor Brand String") == 0);
+    CHECK(smbios.cpus[0].family == 0x6B && smbios.cpus[0].cores == 288 && smbios.cpus[0].cpu_status == 1);
+    CHECK(smbios.num_caches == 3 * SMBIOS_SOCKETS);
+    CHECK(smbios.cpus[1].cache[0] == 4 && smbios.cpus[1].cache[1] == 5 && smbios.cpus[1].cache[2] == 6);
+    CHECK(smbios.caches[0].level == 1 && smbios.caches[0].size == 48 * SIZE_1KB && smbios.caches[0].enabled);
+    CHECK(smbios.caches[1].level == 2 && smbios.caches[1].size == SIZE_2MB);
+    CHECK(smbios.caches[2].level == 3 && smbios.caches[2].size == 320 * SIZE_1MB);
+    CHECK(smbios.num_dimms == SMBIOS_DIMMS);
+    CHECK(smbios.dimms[0].size == 256ULL * SIZE_1GB && smbios.dimms[3].size == 0);
+    CHECK(smbios.dimm_bytes == 256ULL * SIZE_1GB + (SMBIOS_DIMMS * 3 / 4 - 1) * 16ULL * SIZE_1GB);
+    CHECK(strcmp((char *) smbios.dimms[5].locator, "DIMM_C1") == 0);
+    CHECK(strcmp((char *) smbios.dimms[5].part_number, "M321R8GA0PB0") == 0);
+    CHECK(smbios.dimms[5].configured_speed == 5600 && smbios.dimms[5].rank == 2);
+    CHECK(smbios.num_ranges == 2 && smbios.ranges[0].size == SIZE_2GB && smbios.ranges[1].base == BASE_4GB);
+    CHECK(smbios.mapped_bytes == SIZE_2GB + 1024ULL * SIZE_1GB);
+
+    // A structure running off the end of the table is caught and what came before it kept
+    memset(&smbios, 0, sizeof(smbios));
+    CHECK(smbios_decode(smbios_table, smbios_len - 1, &smbios) == EFI_COMPROMISED_DATA);
+    CHECK(smbios.num_dimms == SMBIOS_DIMMS && smbios.num_ranges == 2);
+    memset(&smbios, 0, sizeof(smbios));
+    CHECK(smbios_decode(smbios_table, smbios_len - 3, &smbios) == EFI_COMPROMISED_DATA);
+    CHECK(smbios.num_dimms == SMBIOS_DIMMS && smbios.num_ranges == 2);
+
+    return 0;
+}
+
+/*
+ * CPU topology
+ */
+
+static UINT8 topo_madt[TOPO_MADT_SIZE];
+static UINT32 topo_mp_ids[TOPO_PACKAGES * TOPO_CORES * 2];
+static topo_info_t topo;
+
+// APIC ID layout the tests use: 1 thread bit, 6 core bits, package above
+#define TOPO_APIC_ID(package, core, thread)  (((package) << 7) | ((core) << 1) | (thread))
+
+static EFI_STATUS EFIAPI topo_mp_count(EFI_MP_SERVICES_PROTOCOL *self, UINTN *num_cpus, UINTN *num_enabled)
+{
+    *num_cpus = *num_enabled = ARRAY_SIZE(topo_mp_ids);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI topo_mp_info(EFI_MP_SERVICES_PROTOCOL *self, UINTN cpu, EFI_PROCESSOR_INFORMATION *info)
+{
+    if (cpu >= ARRAY_SIZE(topo_mp_ids)) {
+        return EFI_NOT_FOUND;
+    }
+
+    info->ProcessorId = topo_mp_ids[cpu];
+    info->StatusFlag = PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT | (cpu ? 0 : PROCESSOR_AS_BSP_BIT);
+
+    return EFI_SUCCESS;
+}
+
+static EFI_MP_SERVICES_PROTOCOL topo_mps = {
+    .GetNumberOfProcessors = topo_mp_count,
+    .GetProcessorInfo = topo_mp_info,
+};
+
+static void *topo_madt_add(UINTN *len, UINT8 type, UINT8 length)
+{
+    acpi_madt_entry_t *entry = (acpi_madt_entry_t *) (topo_madt + *len);
+
+    entry->type = type;
+    entry->length = length;
+    *len += length;
+
+    return entry;
+}
+
+// xAPIC entries below 255 and x2APIC entries from there on, same as firmware has to
+static void topo_madt_cpu(UINTN *len, UINT32 apic_id, UINT32 uid, UINT32 flags, BOOLEAN x2apic)
+{
+    if (!x2apic && apic_id < 0xFF) {
+        acpi_madt_local_apic_t *lapic = topo_madt_add(len, ACPI_MADT_LOCAL_APIC, sizeof(acpi_madt_local_apic_t));
+
+        lapic->acpi_uid = uid;
+        lapic->apic_id = apic_id;
+        lapic->flags = flags;
+    } else {
+        acpi_madt_x2apic_t *x2apic = topo_madt_add(len, ACPI_MADT_LOCAL_X2APIC, sizeof(acpi_madt_x2apic_t));
+
+        x2apic->x2apic_id = apic_id;
+        x2apic->acpi_uid = uid;
+        x2apic->flags = flags;
+    }
+}
+
+static void topo_prepare()
+{
+    memset(&topo, 0, sizeof(topo));
+    topo.smt_shift = 1;
+    topo.package_shift = 7;
+    topo.llc_shift = 7;
+    topo.num_caches = 2;
+    topo.caches[0] = (topo_cache_t) { .level = 1, .type = 1, .share_shift = 1, .size = 48 * SIZE_1KB };
+    topo.caches[1] = (topo_cache_t) { .level = 3, .type = 3, .share_shift = 7, .size = 256 * SIZE_1MB };
+}
+
+static int topo_test()
+{
+    acpi_madt_t *madt = (acpi_madt_t *) topo_madt;
+    UINTN len = sizeof(acpi_madt_t);
+    UINT32 uid = 0;
+    UINTN n = 0;
+    topo_cpu_t *cpu;
+    topo_info_t host;
+
+    for (UINT32 thread = 0; thread < 2; thread++) {
+        for (UINT32 package = 0; package < TOPO_PACKAGES; package++) {
+            for (UINT32 core = 0; core < TOPO_CORES; core++) {
+                topo_madt_cpu(&len, TOPO_APIC_ID(package, core, thread), uid++, ACPI_MADT_ENABLED, FALSE);
+                topo_mp_ids[n++] = TOPO_APIC_ID(package, core, thread);
+            }
+        }
+
+        // An I/O APIC between the processors, skipped
+        topo_madt_add(&len, 1, 12);
+    }
+
+    // The BSP listed a second time as x2APIC, hot-plug slots, and an entry nobody may use
+    topo_madt_cpu(&len, 0, 0, ACPI_MADT_ENABLED, TRUE);
+    for (UINT32 i = 0; i < TOPO_HOTPLUG; i++) {
+        topo_madt_cpu(&len, TOPO_APIC_ID(TOPO_PACKAGES, i / 2, i % 2), uid++, ACPI_MADT_ONLINE_CAPABLE, TRUE);
+    }
+    topo_madt_cpu(&len, 0x7FFF, uid++, 0, TRUE);
+
+    memcpy(&madt->header.signature, "APIC", 4);
+    madt->header.length = len;
+    CHECK(len <= TOPO_MADT_SIZE);
+
+    topo_prepare();
+    CHECK(topo_add_madt(&topo, madt) == EFI_SUCCESS);
+    CHECK(topo_add_mp(&topo, &topo_mps) == EFI_SUCCESS);
+    topo_finish(&topo);
+
+    CHECK(topo.sources == (TOPO_SOURCE_MADT | TOPO_SOURCE_MP) && topo.dropped == 0);
+    CHECK(topo.num_cpus == ARRAY_SIZE(topo_mp_ids) + TOPO_HOTPLUG);
+    CHECK(topo.num_enabled == ARRAY_SIZE(topo_mp_ids));
+    CHECK(topo.num_packages == TOPO_PACKAGES + 1);
+    CHECK(topo.num_cores == TOPO_PACKAGES * TOPO_CORES + TOPO_HOTPLUG / 2);
+    CHECK(topo.num_llcs == TOPO_PACKAGES + 1);
+    CHECK(topo.caches[0].num_instances == topo.num_cores && topo.caches[1].num_instances == topo.num_llcs);
+
+    // MADT order is kept, the BSP got its flags from both entries and from MP services
+    CHECK(topo.cpus[0].apic_id == 0 && topo.cpus[0].acpi_uid == 0);
+    CHECK(topo.cpus[0].flags == (TOPO_CPU_ENABLED | TOPO_CPU_BSP | TOPO_CPU_HEALTHY | TOPO_CPU_X2APIC | TOPO_CPU_MP));
+    CHECK(topo.cpus[1].apic_id == TOPO_APIC_ID(0, 1, 0));
+
+    cpu = topo_find_cpu(&topo, TOPO_APIC_ID(1, 5, 1));
+    CHECK(cpu && cpu->package == 1 && cpu->core == 5 && cpu->thread == 1 && cpu->llc == 1);
+    CHECK(cpu->acpi_uid == TOPO_PACKAGES * TOPO_CORES + TOPO_CORES + 5);
+    CHECK(cpu->core_index == TOPO_CORES + 5 && topo_find_cpu(&topo, TOPO_APIC_ID(1, 5, 0))->core_index == cpu->core_index);
+    cpu = topo_find_cpu(&topo, TOPO_APIC_ID(TOPO_PACKAGES, 0, 1));
+    CHECK(cpu && cpu->flags == (TOPO_CPU_ONLINE_CAPABLE | TOPO_CPU_X2APIC) && cpu->llc == TOPO_PACKAGES);
+    CHECK(topo_find_cpu(&topo, 0x7FFF) == NULL);
+
+    // An entry running past the table is caught
+    memset(&host, 0, sizeof(host));
+    ((acpi_madt_entry_t *) (topo_madt + sizeof(acpi_madt_t)))->length = 0;
+    CHECK(topo_add_madt(&host, madt) == EFI_COMPROMISED_DATA);
+    ((acpi_madt_entry_t *) (topo_madt + sizeof(acpi_madt_t)))->length = sizeof(acpi_madt_local_apic_t);
+
+    // Whatever this machine is, its CPUID gives a usable layout
+    memset(&host, 0, sizeof(host));
+    CHECK(topo_read_cpuid(&host) == EFI_SUCCESS);
+    CHECK(host.smt_shift <= host.package_shift && host.llc_shift <= 32);
+
+    return 0;
+}
+
+/*
+ * Memory reservations
+ */
+
+static EFI_MEMORY_DESCRIPTOR *reserve_map;
+static UINTN reserve_map_size;
+static UINT8 reserve_srat[sizeof(acpi_srat_t) + (RESERVE_NODES + 2) * sizeof(acpi_srat_memory_t)];
+static reserve_config_t reserve_config;
+
+static void reserve_map_add(UINTN *n, EFI_MEMORY_TYPE type, UINT64 base, UINT64 size)
+{
+    reserve_map[*n].Type = type;
+    reserve_map[*n].PhysicalStart = base;
+    reserve_map[*n].NumberOfPages = EFI_SIZE_TO_PAGES(size);
+    (*n)++;
+}
+
+static void reserve_srat_add(UINTN *len, UINT32 domain, UINT64 base, UINT64 size, UINT32 flags)
+{
+    acpi_srat_memory_t *mem = (acpi_srat_memory_t *) (reserve_srat + *len);
+
+    mem->type = ACPI_SRAT_MEMORY;
+    mem->length = sizeof(acpi_srat_memory_t);
+    mem->domain = domain;
+    mem->base = base;
+    mem->size = size;
+    mem->flags = flags;
+    *len += sizeof(acpi_srat_memory_t);
+}
+
+static int reserve_expect_bad(const char *text, EFI_STATUS expected)
+{
+    EFI_STATUS status;
+
+    shim_log_errors = FALSE;
+    status = reserve_parse((const CHAR8 *) text, strlen(text), &reserve_config);
+    shim_log_errors = TRUE;
+
+    return status == expected;
+}
+
+// Where entry lands, trying its node first like reserve_claim does
+static EFI_PHYSICAL_ADDRESS reserve_place(const reserve_entry_t *entry)
+{
+    const acpi_srat_t *srat = (const acpi_srat_t *) reserve_srat;
+    EFI_PHYSICAL_ADDRESS base = 0;
+
+    if (EFI_ERROR(reserve_find(reserve_map, reserve_map_size, sizeof(EFI_MEMORY_DESCRIPTOR), srat, entry, TRUE, &base)) &&
+            EFI_ERROR(reserve_find(reserve_map, reserve_map_size, sizeof(EFI_MEMORY_DESCRIPTOR), srat, entry, FALSE, &base))) {
+        return 0;
+    }
+
+    return base;
+}
+
+static int reserve_test()
+{
+    static const char sample[] =
+        "# hugepage pools\n"
+        "4x1G node=0,required\n"
+        "\n"
+        "  3M   type=7 # not a power of two, aligned to 1MB\r\n"
+        "2x256M dma32,align=2M,type=1\n"
+        "64K";
+    const reserve_entry_t *e = reserve_config.entries;
+    acpi_srat_t *srat = (acpi_srat_t *) reserve_srat;
+    UINTN srat_len = sizeof(acpi_srat_t);
+    reserve_entry_t entry = { 0 };
+    reserve_info_t info;
+    UINTN n = 0;
+
+    CHECK(reserve_parse((const CHAR8 *) sample, strlen(sample), &reserve_config) == EFI_SUCCESS);
+    CHECK(reserve_config.num_entries == 4 && reserve_config.num_regions == 8);
+    CHECK(e[0].count == 4 && e[0].size == SIZE_1GB && e[0].align == SIZE_1GB && e[0].node == 0);
+    CHECK(e[0].flags == RESERVE_REQUIRED && e[0].line == 2);
+    CHECK(e[1].count == 1 && e[1].size == 3 * SIZE_1MB && e[1].align == SIZE_1MB && e[1].type == 7);
+    CHECK(e[1].node == RESERVE_NODE_ANY && e[1].line == 4);
+    CHECK(e[2].flags == RESERVE_DMA32 && e[2].align == SIZE_2MB && e[2].count == 2);
+    CHECK(e[3].size == SIZE_64KB && e[3].align == SIZE_64KB && e[3].line == 6);
+
+    CHECK(reserve_expect_bad("1G requried\n", EFI_INVALID_PARAMETER));
+    CHECK(reserve_expect_bad("1000\n", EFI_INVALID_PARAMETER));
+    CHECK(reserve_expect_bad("0x1G\n", EFI_INVALID_PARAMETER));
+    CHECK(reserve_expect_bad("1G align=3M\n", EFI_INVALID_PARAMETER));
+    CHECK(reserve_expect_bad("1G node=\n", EFI_INVALID_PARAMETER));
+    CHECK(reserve_expect_bad("2048G\n", EFI_INVALID_PARAMETER));
+    CHECK(reserve_expect_bad("17179869185G\n", EFI_INVALID_PARAMETER)); // 2^64 + 1G, wraps to 1G
+    CHECK(reserve_expect_bad("20x1G\n20x1G\n", EFI_BUFFER_TOO_SMALL));
+
+    /*
+     * Low memory is node 0 and split in three descriptors, every node has 64GB above 4GB. Node 2 has a
+     * firmware page in its top GB and node 3 one every 512MB. Node 3 also lists hot-pluggable memory
+     * above everything else, and it is free, so the fallback search would pick it if it didn't skip it
+     */
+    reserve_map = calloc(RESERVE_NODES * RESERVE_CHUNKS * 2 + 8, sizeof(EFI_MEMORY_DESCRIPTOR));
+    reserve_map_add(&n, EfiBootServicesData, 0, BASE_1MB);
+    reserve_map_add(&n, EfiConventionalMemory, BASE_1MB, SIZE_1GB - BASE_1MB);
+    reserve_map_add(&n, EfiConventionalMemory, SIZE_1GB, SIZE_1GB);
+    reserve_map_add(&n, EfiConventionalMemory, 2ULL * SIZE_1GB, SIZE_1GB);
+    for (UINT64 node = 0; node < RESERVE_NODES; node++) {
+        for (UINT64 i = 0; i < RESERVE_CHUNKS; i++) {
+            UINT64 base = RESERVE_NODE_BASE(node) + i * RESERVE_CHUNK;
+
+            if ((node == 3 && i % 4 == 0) || (node == 2 && i == RESERVE_CHUNKS - 3)) {
+                reserve_map_add(&n, EfiBootServicesData, base, EFI_PAGE_SIZE);
+                reserve_map_add(&n, EfiConventionalMemory, base + EFI_PAGE_SIZE, RESERVE_CHUNK - EFI_PAGE_SIZE);
+            } else {
+                reserve_map_add(&n, EfiConventionalMemory, base, RESERVE_CHUNK);
+            }
+        }
+    }
+    reserve_map_add(&n, EfiConventionalMemory, RESERVE_NODE_BASE(RESERVE_NODES), RESERVE_NODE_SIZE);
+    reserve_map_size = n * sizeof(EFI_MEMORY_DESCRIPTOR);
+
+    reserve_srat_add(&srat_len, 0, 0, 3ULL * SIZE_1GB, ACPI_SRAT_MEMORY_ENABLED);
+    for (UINT32 node = 0; node < RESERVE_NODES; node++) {
+        reserve_srat_add(&srat_len, node, RESERVE_NODE_BASE(node), RESERVE_NODE_SIZE, ACPI_SRAT_MEMORY_ENABLED);
+    }
+    reserve_srat_add(&srat_len, 3, RESERVE_NODE_BASE(RESERVE_NODES), RESERVE_NODE_SIZE,
+            ACPI_SRAT_MEMORY_ENABLED | ACPI_SRAT_MEMORY_HOTPLUG);
+    memcpy(&srat->header.signature, "SRAT", 4);
+    srat->header.length = srat_len;
+
+    // Highest 1GB on the node, under node 2's firmware page, and node 3 spilling over onto node 2
+    entry.size = entry.align = SIZE_1GB;
+    entry.node = 1;
+    CHECK(reserve_place(&entry) == RESERVE_NODE_BASE(2) - SIZE_1GB);
+    entry.node = 2;
+    CHECK(reserve_place(&entry) == RESERVE_NODE_BASE(3) - 2ULL * SIZE_1GB);
+    entry.node = 3;
+    CHECK(reserve_place(&entry) == RESERVE_NODE_BASE(3) - 2ULL * SIZE_1GB);
+    CHECK(reserve_node(srat, RESERVE_NODE_BASE(3) - 2ULL * SIZE_1GB) == 2);
+    CHECK(reserve_node(srat, RESERVE_NODE_BASE(RESERVE_NODES) + SIZE_1GB) == RESERVE_NODE_ANY);
+
+    // No node, still kept out of the hot-pluggable range, in one piece or squeezed between node 3's firmware pages
+    entry.node = RESERVE_NODE_ANY;
+    CHECK(reserve_place(&entry) == RESERVE_NODE_BASE(3) - 2ULL * SIZE_1GB);
+    entry.size = entry.align = SIZE_2MB;
+    CHECK(reserve_place(&entry) == RESERVE_NODE_BASE(RESERVE_NODES) - SIZE_2MB);
+
+    // Below 4GB, across the 1GB/2GB descriptor boundary
+    entry.node = RESERVE_NODE_ANY;
+    entry.flags = RESERVE_DMA32;
+    entry.size = 2ULL * SIZE_1GB;
+    CHECK(reserve_place(&entry) == SIZE_1GB);
+    entry.size = entry.align = 256ULL * SIZE_1MB;
+    CHECK(reserve_place(&entry) == 3ULL * SIZE_1GB - 256ULL * SIZE_1MB);
+
+    // The shim's memory map has no free memory, optional regions fail quietly and required ones fail the claim
+    CHECK(reserve_parse((const CHAR8 *) "2x2M\n", 5, &reserve_config) == EFI_SUCCESS);
+    shim_log_errors = FALSE;
+    CHECK(reserve_claim(&reserve_config, srat, &info) == EFI_SUCCESS && info.num_failed == 2 && info.num_regions == 0);
+    reserve_config.entries[0].flags |= RESERVE_REQUIRED;
+    CHECK(reserve_claim(&reserve_config, srat, &info) == EFI_NOT_FOUND && info.num_failed == 1);
+    shim_log_errors = TRUE;
+    free_all_pages();
+
+    return 0;
+}
+
+static test_t tests[] = {
+    { "elf_load",           elf_test },
+    { "elf_load_fixed",     elf_fixed_test },
+    { "tar_lookup",         tar_test },
+    { "acpi_dir",           acpi_test },
+    { "qoi_decode",         qoi_test },
+    { "arena_alloc",        arena_test },
+    { "kcache",             kcache_test },
+    { "lz4_decode",         lz4_test },
+    { "manifest_parse",     manifest_test },
+    { "smbios_build_info",  smbios_test },
+    { "topo_build",         topo_test },
+    { "reserve_find",       reserve_test },
+};
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f FILTER]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    for (UINTN i = 0; i < ARRAY_SIZE(tests); i++) {
+        test_t *t = &tests[i];
+        int failed;
+
+        if (filter && !strstr(t->name, filter)) {
+            continue;
+        }
+
+        failed = t->run();
+        printf("%-22s %s\n", t->name, failed ? "FAILED" : "ok");
+        failures += failed;
+
+        // A failed check returns early, don't let what it left behind reach the next test
+        shim_log_errors = TRUE;
+        free_all_pages();
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,47 @@
+// Bump allocators for loader memory
+#pragma once
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <Uefi.h>
+
+#include "info.h"
+
+// Smallest page run taken from the firmware at a time, bigger requests get a run of their own
+#define ARENA_CHUNK_SIZE    SIZE_1MB
+
+// Every allocation is aligned to this
+#define ARENA_ALIGN         16
+
+/*
+ * Page runs (chunks) carved up front to back, nothing is ever freed on its own
+ * The last chunk is the one being carved, a request that doesn't fit what is left of it starts a new one
+ * and the tail of the old one is wasted. Requests over ARENA_CHUNK_SIZE get a run to themselves instead
+ */
+typedef struct {
+    EFI_MEMORY_TYPE type;
+    UINT32          num_chunks;
+    UINTN           used; // Bytes taken from the last chunk
+    UINTN           allocated; // Bytes handed out over all chunks
+    mem_range_t     chunks[ARENA_MAX_CHUNKS];
+} arena_t;
+
+#define ARENA_INIT(mem_type)    { .type = (mem_type) }
+
+// Loader temporaries (file buffers, handle lists, scratch tables), reclaimable once the kernel is running
+extern arena_t arena_scratch;
+
+// Anything boot_info points into, kept until the kernel is done with it
+extern arena_t arena_handoff;
+
+void *arena_alloc(arena_t *arena, UINTN size);
+
+void *arena_alloc_zero(arena_t *arena, UINTN size);
+
+// Hand every chunk back to the firmware, only for arenas nothing points into any more
+void arena_reset(arena_t *arena);
+
+void arena_report(const arena_t *arena, OUT mem_range_t *ranges, OUT UINT32 *num_ranges);
+
+#endif
@@ -0,0 +1,25 @@
+// Boot services used by the loader core
+#pragma once
+
+#ifndef BOOT_SERVICES_H
+#define BOOT_SERVICES_H
+
+#include <Uefi.h>
+
+/*
+ * The few boot services ELF loading, tar lookup and ACPI parsing need, kept behind a table
+ * so the same sources also build against host/shim.c and run as an ordinary Linux process
+ * Everything else they use comes from libraries (BaseMemoryLib, MemoryAllocationLib) the shim provides too
+ */
+typedef struct {
+    EFI_STATUS  (*allocate_pages)(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE mem_type, UINTN pages,
+                        IN OUT EFI_PHYSICAL_ADDRESS *address);
+    EFI_STATUS  (*free_pages)(EFI_PHYSICAL_ADDRESS address, UINTN pages);
+    EFI_STATUS  (*get_memory_map)(IN OUT UINTN *size, OUT EFI_MEMORY_DESCRIPTOR *map, OUT UINTN *map_key,
+                        OUT UINTN *desc_size, OUT UINT32 *desc_version);
+} boot_services_t;
+
+// gBS in firmware, process memory in the host shim
+extern const boot_services_t *bs;
+
+#endif
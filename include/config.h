@@ -0,0 +1,36 @@
+// Loader configuration and state kept across boots in one EFI variable
+#pragma once
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Uefi.h>
+
+#include "graphics.h"
+#include "kcache.h"
+
+#define CONFIG_VAR      L"Config"
+#define CONFIG_MAGIC    SIGNATURE_32('U', 'B', 'C', 'F')
+
+// Bump whenever config_t changes layout, a blob with any other version is thrown away
+#define CONFIG_VERSION  2
+
+/*
+ * Everything the loader persists, read once by config_load() and written back once by config_commit()
+ * Fields are changed in memory as the boot goes, and the write is skipped when the bytes end up the same
+ */
+typedef struct {
+    UINT32          magic;
+    UINT16          version;
+    UINT16          size; // sizeof(config_t) when it was written
+    gop_cache_t     gop;
+    kcache_t        kernel;
+} __attribute__((packed)) config_t;
+
+extern config_t config;
+
+EFI_STATUS config_load();
+
+EFI_STATUS config_commit();
+
+#endif
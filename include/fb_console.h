@@ -0,0 +1,53 @@
+// Text console drawn straight onto the framebuffer, works before and after ExitBootServices
+#pragma once
+
+#ifndef FB_CONSOLE_H
+#define FB_CONSOLE_H
+
+#include <Uefi.h>
+
+#include "font8x8.h"
+#include "framebuffer.h"
+#include "info.h"
+
+// Cells are 8x16, each font row is drawn twice so text stays readable at high resolutions
+#define FB_CON_GLYPH_W      8
+#define FB_CON_GLYPH_H      16
+#define FB_CON_TAB          8
+
+// Longest single fb_console_printf() expansion
+#define FB_CON_PRINT_MAX    256
+
+/*
+ * back holds the whole text area in the screen's pixel format so scrolling is a memory move in RAM,
+ * the screen itself is only ever written with row-wide streaming copies of the dirty cells
+ * atlas holds every glyph pre-rendered in the current colors, glyph g row r starts at
+ * atlas + (g * FB_CON_GLYPH_H + r) * FB_CON_GLYPH_W * bpp
+ */
+typedef struct fb_console {
+    fb_surface_t    screen;
+    fb_surface_t    back;
+    UINT8           *atlas;
+    UINT32          cols;
+    UINT32          rows;
+    UINT32          cur_col;
+    UINT32          cur_row;
+    UINT32          fg;
+    UINT32          bg;
+    UINT32          dirty_x0; // Dirty cells, x0 >= x1 when there's nothing to flush
+    UINT32          dirty_y0;
+    UINT32          dirty_x1;
+    UINT32          dirty_y1;
+} fb_console_t;
+
+EFI_STATUS fb_console_init(OUT fb_console_t *con, const gfx_info_t *gfx_info, UINT32 fg, UINT32 bg);
+
+void fb_console_set_color(fb_console_t *con, UINT32 fg, UINT32 bg);
+
+void fb_console_clear(fb_console_t *con);
+
+void fb_console_write(fb_console_t *con, const CHAR8 *str);
+
+void fb_console_printf(fb_console_t *con, const CHAR8 *fmt, ...);
+
+#endif
@@ -0,0 +1,48 @@
+// Shadow back-buffer for the framebuffer
+#pragma once
+
+#ifndef FB_SHADOW_H
+#define FB_SHADOW_H
+
+#include <Uefi.h>
+#include <Protocol/GraphicsOutput.h>
+
+#include "framebuffer.h"
+#include "info.h"
+
+#define FB_SHADOW_MAX_DIRTY 16
+
+typedef struct {
+    UINT32  x;
+    UINT32  y;
+    UINT32  w;
+    UINT32  h;
+} fb_rect_t;
+
+/*
+ * Everything draws into back, flushes copy the dirty parts out to fb
+ * front mirrors what is on the screen so flushes can skip pixels that didn't actually change
+ */
+typedef struct {
+    fb_surface_t                    back;
+    fb_surface_t                    front;
+    fb_surface_t                    fb;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL    *gop; // Flush through Blt while set, cleared once boot services are gone
+    fb_rect_t                       dirty[FB_SHADOW_MAX_DIRTY];
+    UINT32                          num_dirty;
+    UINT64                          bytes_dirty; // Bytes covered by damage when flushed
+    UINT64                          bytes_written; // Bytes that actually went out to the framebuffer
+    UINT64                          bytes_saved; // bytes_dirty - bytes_written
+} fb_shadow_t;
+
+EFI_STATUS fb_shadow_init(OUT fb_shadow_t *shadow, const gfx_info_t *gfx_info, EFI_GRAPHICS_OUTPUT_PROTOCOL *gop);
+
+void fb_shadow_damage(fb_shadow_t *shadow, UINT32 x, UINT32 y, UINT32 w, UINT32 h);
+
+void fb_shadow_fill_rect(fb_shadow_t *shadow, UINT32 x, UINT32 y, UINT32 w, UINT32 h, UINT32 color);
+
+void fb_shadow_flush(fb_shadow_t *shadow);
+
+void fb_shadow_exit_boot_services(fb_shadow_t *shadow);
+
+#endif
@@ -0,0 +1,19 @@
+// 8x8 bitmap font covering printable ASCII
+#pragma once
+
+#ifndef FONT8X8_H
+#define FONT8X8_H
+
+#include <Uefi.h>
+
+#define FONT8X8_FIRST   0x20
+#define FONT8X8_LAST    0x7E
+
+// One glyph per printable character plus a box drawn for anything outside the range
+#define FONT8X8_GLYPHS  (FONT8X8_LAST - FONT8X8_FIRST + 2)
+#define FONT8X8_BOX     (FONT8X8_GLYPHS - 1)
+
+// Row major, bit 0 of each byte is the leftmost pixel
+extern const UINT8 font8x8[FONT8X8_GLYPHS][8];
+
+#endif
@@ -0,0 +1,76 @@
+// Framebuffer drawing primitives
+#pragma once
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <Uefi.h>
+
+#include "info.h"
+
+// Widest row the scaled blit can stage at once, wider rows are done in pieces
+#define FB_ROW_PIXELS       2048
+
+// Pixels converted per batch before being streamed out
+#define FB_CONVERT_CHUNK    64
+
+typedef struct fb_format fb_format_t;
+
+/*
+ * Row routines for one pixel layout, generated at compile time in framebuffer.c
+ * pack turns a canonical 0x00RRGGBB color into the layout's pixel value,
+ * convert_row does the same for a whole row of canonical pixels
+ */
+typedef struct {
+    UINT32  (*pack)(const fb_format_t *fmt, UINT32 color);
+    void    (*fill_row)(void *dst, UINT32 packed, UINTN count);
+    void    (*convert_row)(const fb_format_t *fmt, void *dst, const UINT32 *src, UINTN count);
+} fb_ops_t;
+
+// Each 8 bit channel (r, g, b) is shifted right by rshift to the mask's width, then left by lshift into place
+struct fb_format {
+    const fb_ops_t  *ops;
+    UINT8           bpp; // Bytes per pixel
+    UINT8           rshift[3];
+    UINT8           lshift[3];
+};
+
+/*
+ * A drawing target, either the real framebuffer or a buffer in system RAM
+ * Colors passed to the primitives are always canonical 0x00RRGGBB (BGRX in memory),
+ * RAM surfaces use fb_format_canonical so they can be converted to whatever the screen wants
+ */
+typedef struct {
+    void                *base;
+    UINT32              width;
+    UINT32              height;
+    UINT32              pitch; // Pixels per scanline
+    const fb_format_t   *fmt;
+} fb_surface_t;
+
+// BGRX, the layout colors and RAM surfaces are kept in
+extern const fb_format_t fb_format_canonical;
+
+// Layout of the framebuffer, picked by init_graphics()
+extern fb_format_t fb_format;
+
+EFI_STATUS fb_format_init(EFI_GRAPHICS_PIXEL_FORMAT pixfmt, const EFI_PIXEL_BITMASK *pixmask, OUT fb_format_t *fmt);
+
+void fb_surface_from_gfx(const gfx_info_t *gfx_info, OUT fb_surface_t *surface);
+
+void fb_fill_rect(fb_surface_t *dst, UINT32 x, UINT32 y, UINT32 w, UINT32 h, UINT32 color);
+
+void fb_copy_rect(fb_surface_t *dst, UINT32 dx, UINT32 dy,
+        const fb_surface_t *src, UINT32 sx, UINT32 sy, UINT32 w, UINT32 h);
+
+void fb_blit_scaled(fb_surface_t *dst, UINT32 dx, UINT32 dy, UINT32 dw, UINT32 dh,
+        const fb_surface_t *src, UINT32 sx, UINT32 sy, UINT32 sw, UINT32 sh);
+
+void fb_blend_rect(fb_surface_t *dst, UINT32 dx, UINT32 dy,
+        const fb_surface_t *src, UINT32 sx, UINT32 sy, UINT32 w, UINT32 h);
+
+EFI_STATUS fb_set_write_combining(const gfx_info_t *gfx_info);
+
+void fb_bench(const gfx_info_t *gfx_info);
+
+#endif
@@ -7,17 +7,40 @@
 #include <Uefi.h>
 #include <Library/UefiLib.h>
 
+#include "framebuffer.h"
 #include "info.h"
+#include "qoi.h"
 
 #define DESIRED_H_RES 1024
 #define DESIRED_V_RES 768
 
+// Longest GOP device path the mode cache can remember
+#define GOP_CACHE_DP_MAX    128
+
 extern EFI_GUID gEfiGraphicsOutputProtocolGuid;
 
+/*
+ * Mode chosen on a previous boot and the device path of the GOP handle it was on, kept in config_t
+ * It is trusted only while the device path matches and QueryMode still reports the same resolution and format
+ */
+typedef struct {
+    UINT32  mode;
+    UINT32  hres;
+    UINT32  vres;
+    UINT32  pixfmt;
+    UINT32  dp_size; // 0 when nothing is cached
+    UINT8   dp[GOP_CACHE_DP_MAX];
+} __attribute__((packed)) gop_cache_t;
+
+// Protocol instance init_graphics() set the mode on, NULL until then
+extern EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx_proto;
+
 EFI_STATUS init_graphics(OUT gfx_info_t *gfx_info);
 
 EFI_STATUS find_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx, OUT UINT32 *mode);
 
-void draw_triangle(const gfx_info_t *gfx_info);
+void draw_triangle(fb_surface_t *fb);
+
+EFI_STATUS draw_qoi(fb_surface_t *fb, UINT32 x, UINT32 y, const void *data, UINTN size);
 
 #endif
@@ -22,8 +22,9 @@ typedef struct {
     UINT16                                  fb_hres; // Horizontal Resolution
     UINT16                                  fb_vres; // Vertical Resolution
     EFI_GRAPHICS_PIXEL_FORMAT               fb_pixfmt;
-    EFI_PIXEL_BITMASK                       fb_pixmask; // Currently unused since we don't accept pixelpixelbitmask format
+    EFI_PIXEL_BITMASK                       fb_pixmask; // Only meaningful when fb_pixfmt is PixelBitMask
     UINT32                                  fb_pixline;
+    UINT8                                   fb_bpp; // Bytes per pixel, 2 or 4
     EFI_PHYSICAL_ADDRESS                    fb_base;
     UINTN                                   fb_size;
 } gfx_info_t;
@@ -33,11 +34,371 @@ typedef struct {
     UINT64                               num_protos;
 } gfx_config_t;
 
+/*
+ * Sizes for the ACPI table directory, slot count must stay a power of two larger than the table count
+ * Indices are stored + 1 in a UINT8, so 255 tables at most. Servers with an SSDT per socket or device
+ * publish well over a hundred, anything past the limit is counted in dropped and booting carries on
+ */
+#define ACPI_DIR_MAX_TABLES     240
+#define ACPI_DIR_SLOTS          256
+#define ACPI_DIR_SLOT_SHIFT     24
+
+// Signature hash used to index acpi_dir_t slots, the kernel must use the same one for lookups
+#define ACPI_DIR_HASH(sig)      ((UINT32) ((UINT32) (sig) * 0x9E3779B1U) >> ACPI_DIR_SLOT_SHIFT)
+
+typedef struct {
+    UINT32                  signature;
+    UINT32                  length;
+    UINT8                   revision;
+    UINT8                   next; // Index + 1 of the next table with the same signature (SSDTs), 0 if none
+    UINT8                   valid; // Checksum of the copy at address sums to 0
+    UINT8                   reserved[5];
+    EFI_PHYSICAL_ADDRESS    address; // Packed copy if tables were packed, firmware copy otherwise
+    EFI_PHYSICAL_ADDRESS    fw_address;
+    UINT64                  csum_cycles; // TSC cycles spent summing this table, across all cpus that helped
+} acpi_table_t;
+
+/*
+ * Every table reachable from the XSDT/RSDT (plus the DSDT from the FADT)
+ * slots holds index + 1 into tables for the first table of each signature, 0 is empty, collisions probe linearly
+ */
+typedef struct {
+    UINT32                  num_tables;
+    UINT8                   slots[ACPI_DIR_SLOTS];
+    acpi_table_t            tables[ACPI_DIR_MAX_TABLES];
+    EFI_PHYSICAL_ADDRESS    packed_base; // EfiACPIReclaimMemory block holding the packed copies, 0 if not packed
+    UINTN                   packed_size;
+    UINT32                  num_invalid; // Tables that failed their checksum
+    UINT32                  dropped; // Tables past ACPI_DIR_MAX_TABLES, not in the directory
+    UINT32                  csum_cpus; // Processors that took part in checksumming
+    UINT64                  csum_cycles; // Wall clock TSC cycles for the whole checksum pass
+} acpi_dir_t;
+
+#define PCI_BAR_IO              0x01
+#define PCI_BAR_MEM64           0x02
+#define PCI_BAR_PREFETCH        0x04
+
+typedef struct {
+    EFI_PHYSICAL_ADDRESS    base;
+    UINT64                  length;
+    UINT8                   index; // BAR register number
+    UINT8                   flags; // PCI_BAR_*
+    UINT8                   reserved[6];
+} pci_bar_t;
+
+typedef struct {
+    UINT16                  segment;
+    UINT8                   bus;
+    UINT8                   dev;
+    UINT8                   fn;
+    UINT8                   header_type;
+    UINT16                  vendor_id;
+    UINT16                  device_id;
+    UINT16                  subsys_vendor_id;
+    UINT16                  subsys_id;
+    UINT8                   class_code;
+    UINT8                   subclass;
+    UINT8                   prog_if;
+    UINT8                   revision;
+    UINT16                  first_bar; // Index into pci_info_t.bars
+    UINT8                   num_bars;
+    UINT8                   reserved;
+} pci_device_t;
+
+// Devices are sorted by segment/bus/dev/fn
+typedef struct {
+    UINT32                  num_devices;
+    UINT32                  num_bars;
+    pci_device_t            *devices;
+    pci_bar_t               *bars;
+} pci_info_t;
+
+#define MODULE_NAME_MAX         64
+
+// Manifest flags, kept on each module_t so the kernel knows how it was loaded
+#define MODULE_KERNEL           0x01 // The image efi_main() jumps to, never in module_info_t
+#define MODULE_REQUIRED         0x02 // Boot stops if it can't be loaded
+#define MODULE_LAZY             0x04 // Left on disk, base is 0 and size is the file size
+#define MODULE_COMPRESSED       0x08 // LZ4 frame on disk, base/size are the decompressed data
+#define MODULE_BUNDLE           0x10 // Tar archive read in one go, each member is a module of its own
+
+typedef struct {
+    CHAR8                   name[MODULE_NAME_MAX]; // Manifest path, or the member name for bundle members
+    EFI_PHYSICAL_ADDRESS    base; // Aligned as the manifest asked, EfiLoaderData
+    UINT64                  size;
+    UINT32                  flags; // MODULE_*
+    UINT32                  reserved;
+} module_t;
+
+// Modules in the order they were read
+typedef struct {
+    UINT32                  num_modules;
+    UINT32                  reserved;
+    module_t                *modules;
+} module_info_t;
+
+#define STAGE_MAX               16
+
+// TSC at the end of each boot stage (stage_t in stage.h), 0 for stages that weren't reached or without STAGE_TIMING
+typedef struct {
+    UINT64                  tsc_hz;
+    UINT32                  num_stages;
+    UINT32                  reserved;
+    UINT64                  tsc[STAGE_MAX];
+} stage_table_t;
+
+#define LOG_MAX_ARGS            4
+
+// One log event, codes and levels are listed in log.h
+typedef struct {
+    UINT64                  tsc;
+    UINT16                  code;
+    UINT8                   level;
+    UINT8                   nargs;
+    UINT32                  reserved;
+    UINT64                  args[LOG_MAX_ARGS];
+} log_record_t;
+
+/*
+ * Ring of binary log records, nothing is formatted until it is flushed
+ * head only ever grows, record n lives in records[n & mask] until it is overwritten capacity records later
+ */
+typedef struct {
+    UINT64                  head; // Records ever written
+    UINT64                  flushed; // Records already sent to a sink (or lost)
+    UINT64                  start_tsc;
+    UINT64                  tsc_hz; // 0 if the loader never measured it, the kernel has to calibrate then
+    UINT32                  mask; // Capacity - 1, capacity is a power of two
+    UINT32                  reserved;
+    const CHAR8             **formats; // Format string for each code, lives in the loader image
+    log_record_t            records[];
+} log_ring_t;
+
+// Most page runs either loader arena can grow to, see arena.h
+#define ARENA_MAX_CHUNKS        8
+
+typedef struct {
+    EFI_PHYSICAL_ADDRESS    base;
+    UINT64                  size;
+} mem_range_t;
+
+/*
+ * Exactly where the loader's arenas put things, all of it EfiLoaderData
+ * scratch only held loader temporaries and can be freed as soon as the kernel takes over,
+ * handoff holds what boot_info points into (memory map, PCI inventory) and can go once the kernel has copied it
+ * kernel_cache is the kernel file image with KERNEL_CACHE on, leave it untouched for the next warm boot to reuse it
+ */
+typedef struct {
+    UINT32                  num_scratch;
+    UINT32                  num_handoff;
+    mem_range_t             scratch[ARENA_MAX_CHUNKS];
+    mem_range_t             handoff[ARENA_MAX_CHUNKS];
+    mem_range_t             kernel_cache; // size 0 when there is none
+} reclaim_info_t;
+
+// Sizes for the SMBIOS summary, anything past them is counted in smbios_info_t.dropped but not kept
+#define SMBIOS_MAX_CPUS         8
+#define SMBIOS_MAX_CACHES       24
+#define SMBIOS_MAX_DIMMS        32
+#define SMBIOS_MAX_RANGES       16
+#define SMBIOS_NAME_MAX         32
+
+// Type 4, one per socket whether or not it is populated
+typedef struct {
+    CHAR8                   socket[SMBIOS_NAME_MAX];
+    CHAR8                   version[2 * SMBIOS_NAME_MAX]; // Brand string, cut off if longer
+    UINT64                  id; // CPUID leaf 1 EAX and EDX
+    UINT16                  family;
+    UINT16                  max_speed; // MHz
+    UINT16                  current_speed; // MHz
+    UINT16                  cores;
+    UINT16                  cores_enabled;
+    UINT16                  threads;
+    UINT8                   populated;
+    UINT8                   cpu_status; // 1 enabled, 2 disabled by user, 3 by BIOS, 4 idle
+    UINT8                   cache[3]; // Index + 1 into smbios_info_t.caches of this socket's L1/L2/L3, 0 if none
+    UINT8                   reserved[3];
+} smbios_cpu_t;
+
+// Type 7
+typedef struct {
+    CHAR8                   socket[SMBIOS_NAME_MAX];
+    UINT64                  size; // Installed bytes
+    UINT64                  max_size;
+    UINT8                   level; // 1 is L1
+    UINT8                   type; // 3 instruction, 4 data, 5 unified, 1/2 other/unknown
+    UINT8                   associativity; // SMBIOS encoding, 6 fully associative, 7 is 8-way...
+    UINT8                   enabled;
+    UINT16                  handle;
+    UINT8                   reserved[2];
+} smbios_cache_t;
+
+// Type 17, empty slots are kept with size 0
+typedef struct {
+    CHAR8                   locator[SMBIOS_NAME_MAX];
+    CHAR8                   bank[SMBIOS_NAME_MAX];
+    CHAR8                   part_number[SMBIOS_NAME_MAX];
+    UINT64                  size; // Bytes
+    UINT16                  speed; // MT/s the device is rated for
+    UINT16                  configured_speed; // MT/s it runs at
+    UINT16                  data_width; // Bits
+    UINT8                   type; // SMBIOS memory type, 0x1A DDR4, 0x22 DDR5...
+    UINT8                   form_factor;
+    UINT8                   rank;
+    UINT8                   reserved[7];
+} smbios_dimm_t;
+
+/*
+ * Hardware summary decoded from the SMBIOS structure table (types 4, 7, 17, 19), strings copied in
+ * Type 19 ranges are physical address ranges the memory controllers decode, with size in bytes
+ */
+typedef struct {
+    UINT8                   major;
+    UINT8                   minor;
+    UINT16                  dropped; // Structures that didn't fit in the arrays below
+    UINT32                  table_length;
+    EFI_PHYSICAL_ADDRESS    table; // Structure table, 0 if firmware has no SMBIOS
+    UINT32                  num_sockets;
+    UINT32                  num_populated;
+    UINT32                  num_cores; // Enabled cores over all sockets
+    UINT32                  num_threads;
+    UINT32                  num_cpus;
+    UINT32                  num_caches;
+    UINT32                  num_dimms;
+    UINT32                  num_ranges;
+    UINT64                  dimm_bytes; // Total over populated slots
+    UINT64                  mapped_bytes; // Total over type 19 ranges
+    smbios_cpu_t            cpus[SMBIOS_MAX_CPUS];
+    smbios_cache_t          caches[SMBIOS_MAX_CACHES];
+    smbios_dimm_t           dimms[SMBIOS_MAX_DIMMS];
+    mem_range_t             ranges[SMBIOS_MAX_RANGES];
+} smbios_info_t;
+
+// Sizes for the CPU topology table, slot count must stay a power of two at least twice the cpu count
+#define TOPO_MAX_CPUS           512
+#define TOPO_MAX_CACHES         8
+#define TOPO_SLOTS              1024
+#define TOPO_SLOT_SHIFT         22
+
+// APIC ID hash used to index topo_info_t slots, the kernel must use the same one for lookups
+#define TOPO_HASH(apic_id)      ((UINT32) ((UINT32) (apic_id) * 0x9E3779B1U) >> TOPO_SLOT_SHIFT)
+
+// topo_cpu_t flags
+#define TOPO_CPU_ENABLED        0x01 // Usable now, MADT or MP services says so
+#define TOPO_CPU_ONLINE_CAPABLE 0x02 // Disabled but can be brought online later
+#define TOPO_CPU_BSP            0x04
+#define TOPO_CPU_HEALTHY        0x08 // MP services reports its self test passed
+#define TOPO_CPU_X2APIC         0x10 // Listed by an x2APIC MADT entry
+#define TOPO_CPU_MP             0x20 // Reported by MP services
+
+// topo_info_t sources, where the table came from
+#define TOPO_SOURCE_MADT        0x01
+#define TOPO_SOURCE_MP          0x02
+#define TOPO_SOURCE_CPUID_1F    0x04 // V2 extended topology, module/tile/die levels folded into the package shift
+#define TOPO_SOURCE_CPUID_B     0x08
+#define TOPO_SOURCE_CPUID_LEGACY 0x10 // Leaf 1 and leaf 4 counts, only on parts without leaf 0xB
+
+#define TOPO_UID_NONE           0xFFFFFFFF
+
+/*
+ * One logical processor. package, core and thread are the APIC ID fields, core_index and llc are
+ * dense indices over the whole system numbered in APIC ID order
+ */
+typedef struct {
+    UINT32                  apic_id;
+    UINT32                  acpi_uid; // _UID of the processor device, TOPO_UID_NONE if only MP services knew it
+    UINT16                  package;
+    UINT16                  core;
+    UINT16                  thread;
+    UINT16                  core_index;
+    UINT16                  llc;
+    UINT8                   flags;
+    UINT8                   reserved;
+} topo_cpu_t;
+
+// CPUID leaf 4 (0x8000001D on AMD) cache descriptor, read on the BSP
+typedef struct {
+    UINT8                   level;
+    UINT8                   type; // 1 data, 2 instruction, 3 unified
+    UINT8                   share_shift; // cpus with the same APIC ID >> share_shift share one instance
+    UINT8                   reserved;
+    UINT16                  ways;
+    UINT16                  line_size;
+    UINT32                  sets;
+    UINT32                  size; // Bytes
+    UINT32                  num_instances; // Over the cpus in the table
+} topo_cache_t;
+
+/*
+ * Package/core/thread and cache sharing of every processor the MADT or MP services list, built before any AP
+ * is started. cpus are in MADT order, slots holds index + 1 into cpus by APIC ID, 0 is empty, collisions probe linearly
+ */
+typedef struct {
+    UINT32                  sources;
+    UINT32                  num_cpus;
+    UINT32                  num_enabled;
+    UINT32                  num_packages;
+    UINT32                  num_cores;
+    UINT32                  num_llcs;
+    UINT32                  dropped; // cpus past TOPO_MAX_CPUS
+    UINT8                   smt_shift; // APIC ID bits below the core ID
+    UINT8                   package_shift; // APIC ID bits below the package ID
+    UINT8                   llc_shift; // APIC ID bits below the last level cache ID
+    UINT8                   num_caches;
+    topo_cache_t            caches[TOPO_MAX_CACHES];
+    UINT16                  slots[TOPO_SLOTS];
+    topo_cpu_t              cpus[TOPO_MAX_CPUS];
+} topo_info_t;
+
+// Large contiguous regions claimed during boot services, see reserve.h for the config file
+#define RESERVE_MAX_REGIONS     32
+#define RESERVE_NODE_ANY        0xFFFFFFFF
+
+// OS-defined memory type the reserved pages carry in the memory map, so they are never taken for general use
+#define RESERVE_MEMORY_TYPE     0x80000000
+
+// reserve_region_t flags
+#define RESERVE_REQUIRED        0x1 // Boot fails if it can't be claimed
+#define RESERVE_DMA32           0x2 // Below 4GB
+#define RESERVE_REMOTE          0x4 // Asked for a node none of whose memory fit, placed on another one
+
+typedef struct {
+    EFI_PHYSICAL_ADDRESS    base;
+    UINT64                  size;
+    UINT64                  align;
+    UINT32                  type; // type= from the config, what it means is up to the kernel
+    UINT32                  node; // SRAT proximity domain holding base, RESERVE_NODE_ANY without an SRAT
+    UINT32                  flags;
+    UINT32                  line; // Config line it came from
+} reserve_region_t;
+
+typedef struct {
+    UINT32                  num_regions;
+    UINT32                  num_failed; // Optional regions that didn't fit anywhere
+    UINT64                  total; // Bytes over all regions
+    reserve_region_t        regions[RESERVE_MAX_REGIONS];
+} reserve_info_t;
+
+// boot_info_t flags
+#define BOOT_INFO_KERNEL_CACHE  0x1 // Loader built with KERNEL_CACHE
+#define BOOT_INFO_KERNEL_CACHED 0x2 // Kernel came from the copy a previous boot left in RAM
+
 typedef struct {
     EFI_RUNTIME_SERVICES    *rtservice;
     gfx_config_t            *gpu_config;
     mem_map_t               *mem_map;
     void                    *rsdp;
-}
+    acpi_dir_t              *acpi_dir;
+    pci_info_t              *pci_info;
+    struct fb_console       *console; // Loader text console, NULL if there isn't one
+    log_ring_t              *log;
+    stage_table_t           *stages;
+    reclaim_info_t          *reclaim;
+    UINT32                  flags;
+    module_info_t           *modules;
+    smbios_info_t           *smbios;
+    topo_info_t             *topology;
+    reserve_info_t          *reserve;
+} boot_info_t;
 
 #endif
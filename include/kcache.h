@@ -0,0 +1,31 @@
+// Kernel image kept in RAM across warm reboots
+#pragma once
+
+#ifndef KCACHE_H
+#define KCACHE_H
+
+#include <Uefi.h>
+
+// define this to reuse the kernel file image a previous boot left in memory when it still hashes the same
+//#define KERNEL_CACHE
+
+/*
+ * Where the last cold boot read the kernel file to, kept in config_t
+ * Only trusted while the file on the ESP has the same size and modification time and the pages hash the same
+ */
+typedef struct {
+    UINT64      base; // 0 when nothing is cached
+    UINT64      size;
+    UINT64      hash;
+    EFI_TIME    mtime;
+} __attribute__((packed)) kcache_t;
+
+void *kcache_alloc(UINTN size);
+
+void *kcache_lookup(const kcache_t *cache, UINT64 size, const EFI_TIME *mtime);
+
+void kcache_record(OUT kcache_t *cache, const void *image, UINT64 size, const EFI_TIME *mtime);
+
+UINT64 kcache_hash(const void *data, UINTN size);
+
+#endif
@@ -8,11 +8,31 @@
 
 #define EM_X86_64	62	/* AMD x86-64 architecture */
 
-EFI_STATUS EFIAPI elf_verify_hdr_mem(void *elf_bin); 
-EFI_STATUS EFIAPI elf_load_mem(void *elf_bin);
-EFI_STATUS EFIAPI elf_load_mem_relo(void *elf_bin);
+// PT_LOAD segments one image may have, real kernels have a handful
+#define ELF_MAX_LOADS       16
+
+// Largest p_align the aligned loaders honour, enough to map the kernel with 2MB pages
+#define ELF_MAX_ALIGN       SIZE_2MB
+
+/*
+ * Every loader shares one core, specialised for where the image comes from and where it goes
+ *   mem    the whole file is in memory, size bytes of it
+ *   file   segments are read straight from the file, its position is restored afterwards
+ *
+ *   (none)   segments go to their p_paddr
+ *   _relo    one run anywhere, segments keep their p_vaddr offsets within it
+ *   _aligned as _relo, with the run aligned to the largest p_align up to ELF_MAX_ALIGN
+ *
+ * The file bytes of each segment are copied and the rest up to p_memsz zeroed
+ * Returns the entry point address, or 0 with nothing left allocated if the image is bad or doesn't fit
+ */
+EFI_STATUS EFIAPI elf_verify_hdr_mem(void *elf_bin, UINTN size);
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem(void *elf_bin, UINTN size);
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem_relo(void *elf_bin, UINTN size);
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem_aligned(void *elf_bin, UINTN size);
 EFI_STATUS EFIAPI elf_verify_hdr_file(EFI_FILE *elf_file);
-EFI_STATUS EFIAPI elf_load_file(EFI_FILE *elf_file);
-EFI_STATUS EFIAPI elf_load_file_relo(EFI_FILE *elf_file);
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file(EFI_FILE *elf_file);
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file_relo(EFI_FILE *elf_file);
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file_aligned(EFI_FILE *elf_file);
 
 #endif
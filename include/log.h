@@ -0,0 +1,97 @@
+// Binary log ring, records are cheap to write and only formatted when flushed
+#pragma once
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <Uefi.h>
+
+#include "info.h"
+
+#define LOG_DEBUG   0
+#define LOG_INFO    1
+#define LOG_WARN    2
+#define LOG_ERROR   3
+
+// Where log_flush() sends records
+#define LOG_SINK_CONOUT     0x01
+#define LOG_SINK_SERIAL     0x02
+
+// Must be a power of two, 48KB of records
+#define LOG_RING_RECORDS    1024
+
+// How often the timer event flushes while boot services are up
+#define LOG_FLUSH_PERIOD_MS 100
+
+// Longest formatted line, anything past it is cut off
+#define LOG_LINE_MAX        160
+
+// Message ids, each has a format string in log.c taking up to LOG_MAX_ARGS 64 bit arguments
+typedef enum {
+    LOG_GFX_INIT,
+    LOG_GFX_NO_MODE,
+    LOG_GFX_SET_MODE_FAILED,
+    LOG_GFX_QUERY_FAILED,
+    LOG_GFX_BAD_FORMAT,
+    LOG_GFX_MODE_SET,
+    LOG_GFX_MODE_CACHED,
+    LOG_GFX_LOCATE_FAILED,
+    LOG_GFX_FIND_MODE,
+    LOG_GFX_FIND_MODE_QUERY_FAILED,
+    LOG_GFX_FIND_MODE_DONE,
+    LOG_ELF_ALLOC_FAILED,
+    LOG_ELF_SEEK_FAILED,
+    LOG_ELF_READ_FAILED,
+    LOG_ELF_LOADED,
+    LOG_ELF_BAD_HEADER,
+    LOG_ELF_BAD_SEGMENT,
+    LOG_ELF_TOO_MANY_SEGMENTS,
+    LOG_CFG_LOADED,
+    LOG_CFG_DEFAULTS,
+    LOG_CFG_UNCHANGED,
+    LOG_CFG_WRITTEN,
+    LOG_CFG_WRITE_FAILED,
+    LOG_KCACHE_EMPTY,
+    LOG_KCACHE_FILE_CHANGED,
+    LOG_KCACHE_PAGES_TAKEN,
+    LOG_KCACHE_HASH_MISMATCH,
+    LOG_KCACHE_HIT,
+    LOG_MANIFEST_PARSED,
+    LOG_MANIFEST_BAD_LINE,
+    LOG_MANIFEST_FULL,
+    LOG_MODULE_LOADED,
+    LOG_MODULE_LAZY,
+    LOG_MODULE_BUNDLE,
+    LOG_MODULE_FAILED,
+    LOG_SMBIOS_BAD_ENTRY,
+    LOG_SMBIOS_DECODED,
+    LOG_SMBIOS_FULL,
+    LOG_TOPO_BUILT,
+    LOG_TOPO_FULL,
+    LOG_RESERVE_BAD_LINE,
+    LOG_RESERVE_FULL,
+    LOG_RESERVE_CLAIMED,
+    LOG_RESERVE_FAILED,
+    LOG_ACPI_DIR_FULL,
+    LOG_NUM_CODES
+} log_code_t;
+
+extern log_ring_t *log_ring;
+
+/*
+ * LOG(level, code, args...) with up to LOG_MAX_ARGS integer arguments, pointers need a (UINTN) cast
+ * The leading 0 keeps the array non-empty when there are no arguments and is skipped over
+ */
+#define LOG(level, code, ...)                                                                   \
+    log_write((level), (code), (const UINT64[]) { 0, ##__VA_ARGS__ } + 1,                       \
+            sizeof((const UINT64[]) { 0, ##__VA_ARGS__ }) / sizeof(UINT64) - 1)
+
+EFI_STATUS log_init(UINT32 sinks, BOOLEAN async);
+
+void log_write(UINT8 level, UINT16 code, const UINT64 *args, UINTN nargs);
+
+void log_flush();
+
+void log_exit_boot_services();
+
+#endif
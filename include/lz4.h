@@ -0,0 +1,24 @@
+// LZ4 frame decoder for compressed modules
+#pragma once
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <Uefi.h>
+
+// LZ4 frame format, https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+#define LZ4_MAGIC               0x184D2204
+#define LZ4_FLG_VERSION_MASK    0xC0
+#define LZ4_FLG_VERSION         0x40
+#define LZ4_FLG_BLOCK_CHECKSUM  0x10
+#define LZ4_FLG_CONTENT_SIZE    0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_DICT_ID         0x01
+#define LZ4_BLOCK_UNCOMPRESSED  0x80000000
+#define LZ4_MIN_MATCH           4
+
+EFI_STATUS lz4_frame_size(const void *src, UINTN src_size, OUT UINT64 *size);
+
+EFI_STATUS lz4_decode_frame(const void *src, UINTN src_size, OUT void *dst, UINTN dst_size);
+
+#endif
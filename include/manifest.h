@@ -0,0 +1,39 @@
+// Boot manifest, the list of files the loader reads besides itself
+#pragma once
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <Uefi.h>
+
+#include "info.h"
+
+#define MANIFEST_PATH           L"\\test\\manifest.txt"
+#define MANIFEST_MAX_ENTRIES    32
+#define MANIFEST_PATH_MAX       MODULE_NAME_MAX
+
+/*
+ * One line per file, blank lines and anything after '#' are ignored
+ *
+ *   <path> [flag,flag,...]
+ *
+ * path is absolute on the ESP with '\' separators, flags are kernel, required, lazy, compressed, bundle
+ * and align=<n>[K|M|G] with n a power of two. Flags map onto MODULE_* in info.h
+ */
+typedef struct {
+    CHAR8   path[MANIFEST_PATH_MAX];
+    UINT32  flags; // MODULE_*
+    UINT32  line;
+    UINT64  align; // Bytes, at least EFI_PAGE_SIZE
+} manifest_entry_t;
+
+typedef struct {
+    UINT32              num_entries;
+    manifest_entry_t    entries[MANIFEST_MAX_ENTRIES];
+} manifest_t;
+
+EFI_STATUS manifest_parse(const CHAR8 *text, UINTN size, OUT manifest_t *manifest);
+
+const manifest_entry_t *manifest_kernel(const manifest_t *manifest);
+
+#endif
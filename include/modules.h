@@ -0,0 +1,25 @@
+// Loading the files a boot manifest lists
+#pragma once
+
+#ifndef MODULES_H
+#define MODULES_H
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+#include "info.h"
+#include "manifest.h"
+
+// Most modules handed to the kernel, bundle members count one each
+#define MODULES_MAX             64
+
+// Room for one directory entry with the longest name FAT allows, a short buffer would stall the listing
+#define MODULES_DIR_INFO_SIZE   (SIZE_OF_EFI_FILE_INFO + 256 * sizeof(CHAR16))
+
+void modules_efi_path(const CHAR8 *path, OUT CHAR16 *out);
+
+EFI_STATUS manifest_read(EFI_FILE *root, OUT manifest_t *manifest);
+
+EFI_STATUS modules_load(EFI_FILE *root, const manifest_t *manifest, OUT module_info_t *info);
+
+#endif
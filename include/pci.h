@@ -0,0 +1,22 @@
+#pragma once
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <Uefi.h>
+#include <Protocol/PciIo.h>
+
+#include "info.h"
+
+// Standard header registers we copy out of config space
+#define PCI_CFG_HEADER_SIZE     0x40
+#define PCI_CFG_MAX_BARS        6
+#define PCI_CFG_BRIDGE_BARS     2
+#define PCI_HEADER_TYPE_MASK    0x7F
+#define PCI_HEADER_TYPE_BRIDGE  0x01
+
+EFI_STATUS pci_build_inventory(OUT pci_info_t *pci_info);
+
+void print_pci_inventory(pci_info_t *pci_info);
+
+#endif
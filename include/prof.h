@@ -0,0 +1,85 @@
+// Sampling profiler for the loader itself
+#pragma once
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <Uefi.h>
+#include <Protocol/SimpleFileSystem.h>
+
+// define this to sample which region the loader is in from a timer event, unset and every marker compiles to nothing
+//#define PROF_SAMPLING
+
+// Requested sampling period, the firmware rounds it up to its timer tick
+#define PROF_PERIOD_US      100
+
+// Regions nested deeper than this still count against the ones above them
+#define PROF_MAX_DEPTH      16
+
+// Report is written here on the boot volume as well as to serial
+#define PROF_DUMP_PATH      L"\\test\\profile.txt"
+#define PROF_REPORT_MAX     4096
+
+typedef enum {
+#define PROF(id, name) PROF_##id,
+#include "prof_list.h"
+#undef PROF
+    PROF_COUNT
+} prof_region_t;
+
+/*
+ * Shadow stack of the regions the loader is inside, and what the sampler has seen of it
+ * A timer notify function can't see the interrupted RIP, so PROF_ENTER/PROF_EXIT keep this stack
+ * and each tick charges the innermost region (self) and every region on the stack (total)
+ */
+typedef struct {
+    UINT16  stack[PROF_MAX_DEPTH];
+    UINT32  depth;
+    UINT64  samples;
+    UINT64  unmarked; // Samples taken with nothing on the stack
+    UINT64  first_tsc;
+    UINT64  last_tsc;
+    UINT64  self[PROF_COUNT];
+    UINT64  total[PROF_COUNT];
+} prof_state_t;
+
+extern prof_state_t prof;
+
+static inline void prof_enter(prof_region_t region)
+{
+    UINT32 depth = prof.depth;
+
+    if (depth < PROF_MAX_DEPTH) {
+        prof.stack[depth] = region;
+    }
+
+    // The sampler can run between any two instructions, the region must be in place before depth covers it
+    __atomic_store_n(&prof.depth, depth + 1, __ATOMIC_RELEASE);
+}
+
+static inline void prof_exit(prof_region_t region)
+{
+    __atomic_store_n(&prof.depth, prof.depth - 1, __ATOMIC_RELEASE);
+}
+
+#ifdef PROF_SAMPLING
+#define PROF_ENTER(region)  prof_enter(region)
+#define PROF_EXIT(region)   prof_exit(region)
+#define PROF_START()        prof_start()
+#define PROF_STOP()         prof_stop()
+#define PROF_DUMP(root)     prof_dump(root)
+#else
+#define PROF_ENTER(region)  do { } while (0)
+#define PROF_EXIT(region)   do { } while (0)
+#define PROF_START()        do { } while (0)
+#define PROF_STOP()         do { } while (0)
+#define PROF_DUMP(root)     do { } while (0)
+#endif
+
+EFI_STATUS prof_start();
+
+void prof_stop();
+
+EFI_STATUS prof_dump(EFI_FILE *root);
+
+#endif
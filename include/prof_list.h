@@ -0,0 +1,22 @@
+// Profiler regions, named after the function or firmware call each one brackets
+// No include guard, define PROF(id, name) before each include
+
+PROF(LOADER,            "efi_main")
+PROF(CONFIG,            "config_load/commit")
+PROF(KERNEL_READ,       "kernel EFI_FILE Read")
+PROF(ELF_LOAD,          "elf_load")
+PROF(MODULES,           "modules_load")
+PROF(SPLASH_READ,       "efi_read_file splash")
+PROF(ACPI_DIR,          "acpi_build_dir")
+PROF(ACPI_CHECKSUM,     "acpi_checksum_dir")
+PROF(TOPOLOGY,          "topo_build_info")
+PROF(SMBIOS,            "smbios_build_info")
+PROF(RESERVE,           "reserve_claim")
+PROF(PCI,               "pci_build_inventory")
+PROF(GFX_INIT,          "init_graphics")
+PROF(GFX_FIND_MODE,     "find_mode")
+PROF(GOP_QUERY_MODE,    "GOP QueryMode")
+PROF(GOP_SET_MODE,      "GOP SetMode")
+PROF(FB_CONSOLE_INIT,   "fb_console_init")
+PROF(FB_SHADOW_INIT,    "fb_shadow_init")
+PROF(SPLASH_DRAW,       "draw_qoi")
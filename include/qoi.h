@@ -0,0 +1,36 @@
+// QOI image decoder
+#pragma once
+
+#ifndef QOI_H
+#define QOI_H
+
+#include <Uefi.h>
+
+// QOI image format, https://qoiformat.org/qoi-specification.pdf
+#define QOI_MAGIC           0x716F6966 // "qoif" read big endian
+#define QOI_HEADER_SIZE     14
+#define QOI_END_SIZE        8
+#define QOI_MAX_PIXELS      400000000
+
+#define QOI_OP_INDEX        0x00
+#define QOI_OP_DIFF         0x40
+#define QOI_OP_LUMA         0x80
+#define QOI_OP_RUN          0xC0
+#define QOI_OP_RGB          0xFE
+#define QOI_OP_RGBA         0xFF
+#define QOI_MASK_2          0xC0
+
+// Decoder state carried between spans, an image can be decoded a piece at a time
+typedef struct {
+    UINT32  index[64];
+    UINT32  px; // Previous pixel, 0xAARRGGBB
+    UINT32  run;
+} qoi_state_t;
+
+void qoi_init(OUT qoi_state_t *qs);
+
+EFI_STATUS qoi_info(const void *data, UINTN size, OUT UINT32 *width, OUT UINT32 *height);
+
+const UINT8 *qoi_decode_span(qoi_state_t *qs, const UINT8 *p, const UINT8 *end, UINT32 *out, UINTN count);
+
+#endif
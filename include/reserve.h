@@ -0,0 +1,50 @@
+// Contiguous physical memory reservations for the kernel, configured from the ESP
+#pragma once
+
+#ifndef RESERVE_H
+#define RESERVE_H
+
+#include <Uefi.h>
+
+#include "info.h"
+#include "uefi_acpi.h"
+
+#define RESERVE_PATH            L"\\test\\reserve.txt"
+#define RESERVE_MAX_ENTRIES     16
+#define RESERVE_MAX_SIZE        (1024ULL * SIZE_1GB)
+
+/*
+ * One line per kind of region, blank lines and anything after '#' are ignored
+ *
+ *   [<count>x]<size> [flag,flag,...]
+ *
+ * size is <n>[K|M|G] and a multiple of the page size, flags are required, dma32, node=<n>, type=<n>
+ * and align=<n>[K|M|G] with n a power of two. Without align= a region is aligned to the largest power
+ * of two up to 1GB that divides its size, so 1G regions can be mapped with 1GB pages
+ */
+typedef struct {
+    UINT64  size;
+    UINT64  align;
+    UINT32  count;
+    UINT32  node; // RESERVE_NODE_ANY unless node= is given
+    UINT32  type;
+    UINT32  flags; // RESERVE_REQUIRED, RESERVE_DMA32
+    UINT32  line;
+} reserve_entry_t;
+
+typedef struct {
+    UINT32          num_entries;
+    UINT32          num_regions; // Sum of the counts, at most RESERVE_MAX_REGIONS
+    reserve_entry_t entries[RESERVE_MAX_ENTRIES];
+} reserve_config_t;
+
+EFI_STATUS reserve_parse(const CHAR8 *text, UINTN size, OUT reserve_config_t *config);
+
+EFI_STATUS reserve_find(const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size, const acpi_srat_t *srat,
+        const reserve_entry_t *entry, BOOLEAN local, OUT EFI_PHYSICAL_ADDRESS *base);
+
+UINT32 reserve_node(const acpi_srat_t *srat, EFI_PHYSICAL_ADDRESS address);
+
+EFI_STATUS reserve_claim(const reserve_config_t *config, const acpi_srat_t *srat, OUT reserve_info_t *info);
+
+#endif
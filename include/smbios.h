@@ -0,0 +1,165 @@
+// SMBIOS structure table decoding into smbios_info_t
+#pragma once
+
+#ifndef SMBIOS_H
+#define SMBIOS_H
+
+#include <Uefi.h>
+
+#include "info.h"
+
+// DMTF DSP0134, only the structures the summary uses
+#define SMBIOS_TYPE_PROCESSOR       4
+#define SMBIOS_TYPE_CACHE           7
+#define SMBIOS_TYPE_MEMORY_DEVICE   17
+#define SMBIOS_TYPE_MAPPED_RANGE    19
+#define SMBIOS_TYPE_END             127
+
+// Handle used for "not provided" in cross references
+#define SMBIOS_HANDLE_NONE          0xFFFF
+
+// 2.1 entry point, "_SM_" followed by an "_DMI_" intermediate entry point
+typedef struct {
+    CHAR8   anchor[4];
+    UINT8   checksum;
+    UINT8   length;
+    UINT8   major;
+    UINT8   minor;
+    UINT16  max_structure_size;
+    UINT8   revision;
+    UINT8   formatted_area[5];
+    CHAR8   intermediate_anchor[5];
+    UINT8   intermediate_checksum;
+    UINT16  table_length;
+    UINT32  table_address;
+    UINT16  num_structures;
+    UINT8   bcd_revision;
+} __attribute__((packed)) smbios_entry_t;
+
+// 3.0 entry point, "_SM3_", the table can be above 4GB and only its maximum size is given
+typedef struct {
+    CHAR8   anchor[5];
+    UINT8   checksum;
+    UINT8   length;
+    UINT8   major;
+    UINT8   minor;
+    UINT8   docrev;
+    UINT8   revision;
+    UINT8   reserved;
+    UINT32  table_max_size;
+    UINT64  table_address;
+} __attribute__((packed)) smbios3_entry_t;
+
+// Every structure starts with this, the string set follows the formatted area and ends in two NULs
+typedef struct {
+    UINT8   type;
+    UINT8   length;
+    UINT16  handle;
+} __attribute__((packed)) smbios_header_t;
+
+/*
+ * Structure layouts up to the newest fields read, older tables are shorter and
+ * fields past header.length read as zero
+ */
+typedef struct {
+    smbios_header_t header;
+    UINT8   socket;
+    UINT8   processor_type;
+    UINT8   family;
+    UINT8   manufacturer;
+    UINT64  id;
+    UINT8   version;
+    UINT8   voltage;
+    UINT16  external_clock;
+    UINT16  max_speed;
+    UINT16  current_speed;
+    UINT8   status;
+    UINT8   upgrade;
+    UINT16  l1_handle;
+    UINT16  l2_handle;
+    UINT16  l3_handle;
+    UINT8   serial_number;
+    UINT8   asset_tag;
+    UINT8   part_number;
+    UINT8   core_count;
+    UINT8   core_enabled;
+    UINT8   thread_count;
+    UINT16  characteristics;
+    UINT16  family2;
+    UINT16  core_count2;
+    UINT16  core_enabled2;
+    UINT16  thread_count2;
+} __attribute__((packed)) smbios_processor_t;
+
+typedef struct {
+    smbios_header_t header;
+    UINT8   socket;
+    UINT16  configuration;
+    UINT16  max_size;
+    UINT16  installed_size;
+    UINT16  supported_sram_type;
+    UINT16  current_sram_type;
+    UINT8   speed;
+    UINT8   error_correction;
+    UINT8   system_type;
+    UINT8   associativity;
+    UINT32  max_size2;
+    UINT32  installed_size2;
+} __attribute__((packed)) smbios_cache_entry_t;
+
+typedef struct {
+    smbios_header_t header;
+    UINT16  array_handle;
+    UINT16  error_handle;
+    UINT16  total_width;
+    UINT16  data_width;
+    UINT16  size;
+    UINT8   form_factor;
+    UINT8   device_set;
+    UINT8   locator;
+    UINT8   bank_locator;
+    UINT8   type;
+    UINT16  type_detail;
+    UINT16  speed;
+    UINT8   manufacturer;
+    UINT8   serial_number;
+    UINT8   asset_tag;
+    UINT8   part_number;
+    UINT8   attributes;
+    UINT32  extended_size;
+    UINT16  configured_speed;
+    UINT16  min_voltage;
+    UINT16  max_voltage;
+    UINT16  configured_voltage;
+    UINT8   technology;
+    UINT16  operating_mode;
+    UINT8   firmware_version;
+    UINT16  module_manufacturer;
+    UINT16  module_product;
+    UINT16  controller_manufacturer;
+    UINT16  controller_product;
+    UINT64  non_volatile_size;
+    UINT64  volatile_size;
+    UINT64  cache_size;
+    UINT64  logical_size;
+    UINT32  extended_speed;
+    UINT32  extended_configured_speed;
+} __attribute__((packed)) smbios_memory_device_t;
+
+typedef struct {
+    smbios_header_t header;
+    UINT32  start; // KB, all ones if the extended fields are used
+    UINT32  end; // KB, inclusive
+    UINT16  array_handle;
+    UINT8   partition_width;
+    UINT64  extended_start; // Bytes
+    UINT64  extended_end; // Bytes, inclusive
+} __attribute__((packed)) smbios_mapped_range_t;
+
+EFI_STATUS smbios_validate_entry(const void *entry, OUT EFI_PHYSICAL_ADDRESS *table, OUT UINT32 *length);
+
+EFI_STATUS smbios_decode(const void *table, UINT32 length, OUT smbios_info_t *info);
+
+EFI_STATUS smbios_build_info(const void *entry, OUT smbios_info_t *info);
+
+#endif
@@ -0,0 +1,59 @@
+// Boot stage timestamps
+#pragma once
+
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+
+#include "info.h"
+#include "stage_history.h"
+
+/*
+ * define this to record a TSC timestamp at the end of each boot stage, unset and every marker compiles to nothing
+ * Costs a 10ms calibration Stall and an NV variable write per boot, so it is off unless building for
+ * script/bench.sh, which builds with -D STAGE_TIMING
+ */
+//#define STAGE_TIMING
+
+#define STAGE_HISTORY_VAR       L"" STAGE_HISTORY_NAME
+
+typedef enum {
+#define STAGE(id, name) STAGE_##id,
+#include "stage_list.h"
+#undef STAGE
+    STAGE_COUNT
+} stage_t;
+
+/*
+ * Ring of past boots, newest at boots[(next - 1) % STAGE_HISTORY_BOOTS]
+ * usec[i] is the time from the previous reached stage to the end of stage i, 0 if stage i wasn't reached
+ * Layout is mirrored in host/stage_report.c
+ */
+typedef struct {
+    UINT32  magic;
+    UINT16  version;
+    UINT16  num_stages;
+    UINT32  next;
+    UINT32  count;
+    UINT32  usec[STAGE_HISTORY_BOOTS][STAGE_COUNT];
+} __attribute__((packed)) stage_history_t;
+
+extern stage_table_t stage_table;
+
+#ifdef STAGE_TIMING
+#define STAGE_MARK(stage)   (stage_table.tsc[(stage)] = AsmReadTsc())
+#define STAGE_CALIBRATE()   stage_calibrate()
+#define STAGE_COMMIT()      stage_history_commit()
+#else
+#define STAGE_MARK(stage)   do { } while (0)
+#define STAGE_CALIBRATE()   do { } while (0)
+#define STAGE_COMMIT()      do { } while (0)
+#endif
+
+void stage_calibrate();
+
+EFI_STATUS stage_history_commit();
+
+#endif
@@ -0,0 +1,16 @@
+// StageHistory variable identity, included by host/stage_report.c too so nothing here may need EDK2
+#pragma once
+
+#ifndef STAGE_HISTORY_H
+#define STAGE_HISTORY_H
+
+// Per-boot durations for the last STAGE_HISTORY_BOOTS boots, see stage_history_t in stage.h
+#define STAGE_HISTORY_NAME      "StageHistory"
+#define STAGE_HISTORY_MAGIC     0x54534255 // SIGNATURE_32('U', 'B', 'S', 'T')
+#define STAGE_HISTORY_VERSION   4
+#define STAGE_HISTORY_BOOTS     8
+
+// Vendor GUID of the variable, the same value as gUefibuttGuid in Uefibutt.dec
+#define STAGE_HISTORY_GUID      { 0x6d656d65, 0x6c6f, 0x7264, { 0x6d, 0x65, 0x6d, 0x65, 0x6c, 0x79, 0x66, 0x65 } }
+
+#endif
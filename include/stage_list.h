@@ -0,0 +1,17 @@
+// Boot stages in the order efi_main() reaches them, shared with host/stage_report.c so the names stay in sync
+// No include guard, define STAGE(id, name) before each include
+
+STAGE(ENTRY,                "entry")
+STAGE(FILE_OPEN,            "file open")
+STAGE(ELF_READ,             "elf read")
+STAGE(ELF_LOAD,             "elf load")
+STAGE(MODULES,              "modules")
+STAGE(ACPI,                 "acpi")
+STAGE(TOPOLOGY,             "topology")
+STAGE(RESERVE,              "reserve")
+STAGE(SMBIOS,               "smbios")
+STAGE(PCI,                  "pci")
+STAGE(GRAPHICS,             "graphics")
+STAGE(MEMORY_MAP,           "memory map")
+STAGE(EXIT_BOOT_SERVICES,   "exit boot services")
+STAGE(SET_VIRTUAL_MAP,      "set virtual map")
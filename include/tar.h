@@ -5,6 +5,8 @@
 
 #include "stdint.h"
 
+#define TAR_BLOCK_SIZE  512
+
 typedef struct tar_header {
     char name[100];
     char mode[8];
@@ -17,6 +19,7 @@ typedef struct tar_header {
 
 unsigned int tar_strncmp(const char *s1, const char *s2, UINTN n);
 unsigned int tar_size(const char *insize);
+uint8_t *tar_next(uint8_t *address, uint8_t *max_addr);
 uint8_t *tar_get_fileaddr(uint8_t *address, char *filename, uint8_t *max_addr);
 
 #endif
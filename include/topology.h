@@ -0,0 +1,39 @@
+// CPU and cache topology from the MADT, MP services and CPUID
+#pragma once
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <Uefi.h>
+#include <Pi/PiDxeCis.h>
+#include <Protocol/MpService.h>
+
+#include "info.h"
+#include "uefi_acpi.h"
+
+// CPUID leaves read on the BSP
+#define CPUID_VENDOR                0x00
+#define CPUID_FEATURES              0x01
+#define CPUID_CACHE_PARAMS          0x04
+#define CPUID_EXTENDED_TOPOLOGY     0x0B
+#define CPUID_V2_EXTENDED_TOPOLOGY  0x1F
+#define CPUID_EXTENDED_MAX          0x80000000
+#define CPUID_AMD_CACHE_PARAMS      0x8000001D
+
+// Extended topology level types in ECX[15:8]
+#define CPUID_TOPOLOGY_INVALID      0
+#define CPUID_TOPOLOGY_SMT          1
+
+EFI_STATUS topo_read_cpuid(topo_info_t *topo);
+
+EFI_STATUS topo_add_madt(topo_info_t *topo, const acpi_madt_t *madt);
+
+EFI_STATUS topo_add_mp(topo_info_t *topo, EFI_MP_SERVICES_PROTOCOL *mps);
+
+void topo_finish(topo_info_t *topo);
+
+topo_cpu_t *topo_find_cpu(topo_info_t *topo, UINT32 apic_id);
+
+EFI_STATUS topo_build_info(acpi_dir_t *dir, EFI_MP_SERVICES_PROTOCOL *mps, OUT topo_info_t *topo);
+
+#endif
@@ -3,6 +3,31 @@
 #ifndef UEFI_ACPI_H
 #define UEFI_ACPI_H
 
+#include <Uefi.h>
+#include <Pi/PiDxeCis.h>
+#include <Protocol/MpService.h>
+
+#include "info.h"
+
+#define ACPI_SIG_RSDT   SIGNATURE_32('R', 'S', 'D', 'T')
+#define ACPI_SIG_XSDT   SIGNATURE_32('X', 'S', 'D', 'T')
+#define ACPI_SIG_FADT   SIGNATURE_32('F', 'A', 'C', 'P')
+#define ACPI_SIG_DSDT   SIGNATURE_32('D', 'S', 'D', 'T')
+#define ACPI_SIG_SSDT   SIGNATURE_32('S', 'S', 'D', 'T')
+#define ACPI_SIG_MADT   SIGNATURE_32('A', 'P', 'I', 'C')
+#define ACPI_SIG_HPET   SIGNATURE_32('H', 'P', 'E', 'T')
+#define ACPI_SIG_MCFG   SIGNATURE_32('M', 'C', 'F', 'G')
+#define ACPI_SIG_SRAT   SIGNATURE_32('S', 'R', 'A', 'T')
+#define ACPI_SIG_SLIT   SIGNATURE_32('S', 'L', 'I', 'T')
+
+// Tables at least this big are split into chunks and summed across the APs
+#define ACPI_CSUM_PARALLEL_MIN  SIZE_64KB
+#define ACPI_CSUM_CHUNK_SIZE    SIZE_16KB
+
+// FADT offsets of the 32 and 64 bit DSDT pointers
+#define ACPI_FADT_DSDT_OFFSET   40
+#define ACPI_FADT_XDSDT_OFFSET  140
+
 typedef struct {
     CHAR8   signature[8];
     UINT8   checksum;
@@ -19,6 +44,83 @@ typedef struct {
     UINT8   reserved[3];
 } __attribute__((packed)) rsdp_descriptor20_t;
 
+// Common header at the start of every system description table
+typedef struct {
+    UINT32  signature;
+    UINT32  length;
+    UINT8   revision;
+    UINT8   checksum;
+    CHAR8   oemid[6];
+    CHAR8   oem_table_id[8];
+    UINT32  oem_revision;
+    UINT32  creator_id;
+    UINT32  creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+// MADT interrupt controller structures read for the processor list
+#define ACPI_MADT_LOCAL_APIC        0
+#define ACPI_MADT_LOCAL_X2APIC      9
+
+#define ACPI_MADT_ENABLED           0x1
+#define ACPI_MADT_ONLINE_CAPABLE    0x2
+
+typedef struct {
+    acpi_sdt_header_t header;
+    UINT32  local_apic_address;
+    UINT32  flags;
+} __attribute__((packed)) acpi_madt_t;
+
+// Every MADT entry starts with this
+typedef struct {
+    UINT8   type;
+    UINT8   length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    UINT8   acpi_uid;
+    UINT8   apic_id;
+    UINT32  flags;
+} __attribute__((packed)) acpi_madt_local_apic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    UINT16  reserved;
+    UINT32  x2apic_id;
+    UINT32  flags;
+    UINT32  acpi_uid;
+} __attribute__((packed)) acpi_madt_x2apic_t;
+
+// SRAT memory affinity structures, which physical ranges belong to which proximity domain
+#define ACPI_SRAT_MEMORY            1
+
+#define ACPI_SRAT_MEMORY_ENABLED    0x1
+#define ACPI_SRAT_MEMORY_HOTPLUG    0x2
+
+typedef struct {
+    acpi_sdt_header_t header;
+    UINT32  reserved1;
+    UINT64  reserved2;
+} __attribute__((packed)) acpi_srat_t;
+
+typedef struct {
+    UINT8   type;
+    UINT8   length;
+    UINT32  domain;
+    UINT16  reserved1;
+    UINT64  base;
+    UINT64  size;
+    UINT32  reserved2;
+    UINT32  flags;
+    UINT64  reserved3;
+} __attribute__((packed)) acpi_srat_memory_t;
+
 EFI_STATUS validate_acpi_table(void *acpi_table);
 
+EFI_STATUS acpi_build_dir(void *rsdp, OUT acpi_dir_t *dir, BOOLEAN pack);
+
+acpi_table_t *acpi_find_table(acpi_dir_t *dir, UINT32 signature);
+
+EFI_STATUS acpi_checksum_dir(acpi_dir_t *dir, EFI_MP_SERVICES_PROTOCOL *mps);
+
 #endif
@@ -5,17 +5,28 @@
 
 #include <Uefi.h>
 #include <Library/UefiLib.h>
+#include <Protocol/SimpleFileSystem.h>
 
+#include "arena.h"
+#include "fb_console.h"
 #include "info.h"
 
 int memcmp(const void *a, const void *b, UINTN size);
 
 void print_memory_map(mem_map_t *mem_map);
 
+void print_memory_map_console(fb_console_t *con, mem_map_t *mem_map);
+
 void efi_waitforkey();
 
+UINT64 tsc_frequency();
+
 EFI_STATUS efivar_set(CHAR16 *name, UINTN *size, VOID *data, BOOLEAN persist);
 
 EFI_STATUS efivar_get(CHAR16 *name, UINTN *size, VOID **data);
 
+EFI_STATUS efi_read_file(arena_t *arena, EFI_FILE *root, CHAR16 *path, OUT VOID **data, OUT UINTN *size);
+
+EFI_STATUS efi_read_memory_map(IN OUT mem_map_t *mem_map, IN OUT UINTN *capacity);
+
 #endif
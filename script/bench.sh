@@ -0,0 +1,225 @@
+#!/bin/sh
+#
+# Headless boot latency benchmark
+#
+# Builds the test kernel in bench/, makes a boot image with create_img.sh, boots it RUNS times under QEMU/OVMF
+# and writes time-to-kernel-entry statistics as JSON. The test kernel prints the loader's stage timestamps over
+# serial and exits QEMU through isa-debug-exit, so every run ends on its own.
+#
+# Rebuilds the loader in $WORKSPACE with STAGE_TIMING on (build.sh -D STAGE_TIMING), so the build left behind
+# has it too. Needs $OVMF_DIR like run.sh, and mtools.
+# Set OVMF_CODE and OVMF_VARS to boot from pflash with a writable vars store that persists between runs,
+# otherwise every boot starts from empty NVRAM and never sees the GOP cache or config blob.
+#
+# With -w each run is a warm reboot: the test kernel resets the machine the first time it is booted from disk
+# and only the boot after the reset is timed. Needs the loader built with KERNEL_CACHE to hit the cached kernel.
+
+usage() {
+    cat >&2 <<EOF
+Usage: $0 [-n RUNS] [-s SMP] [-N NUMA_NODES] [-d DISK_MB] [-l LABEL] [-t TIMEOUT] [-o OUT.json] [-w]
+EOF
+    exit 1
+}
+
+runs=20
+smp=1
+numa=0
+disk_mb=128
+label=default
+timeout_s=60
+out=
+warm=0
+
+while getopts "n:s:N:d:l:t:o:wh" opt; do
+    case $opt in
+        n) runs=$OPTARG ;;
+        s) smp=$OPTARG ;;
+        N) numa=$OPTARG ;;
+        d) disk_mb=$OPTARG ;;
+        l) label=$OPTARG ;;
+        t) timeout_s=$OPTARG ;;
+        o) out=$OPTARG ;;
+        w) warm=1 ;;
+        *) usage ;;
+    esac
+done
+
+here=$(cd "$(dirname "$0")" && pwd)
+src=${UEFIBUTT_SRC:-$here/..}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+if [ -z "$OVMF_CODE" ] && [ ! -e "$OVMF_DIR/OVMF-pure-efi.fd" ]; then
+    echo "Set OVMF_DIR (or OVMF_CODE and OVMF_VARS) to an OVMF build" >&2
+    exit 1
+fi
+
+# Warm runs have to survive the kernel's reset, anything else rebooting is a failure
+kflags=
+reboot=-no-reboot
+if [ "$warm" -eq 1 ]; then
+    kflags=-DWARM_RESET
+    reboot=
+fi
+
+# Stage timestamps are off in normal builds, they cost a calibration Stall and a flash write every boot
+(cd "$WORKSPACE" && bash "$here/build.sh" -D STAGE_TIMING) > "$work/build.log" 2>&1 || {
+    cat "$work/build.log" >&2
+    exit 1
+}
+
+# Test kernel, position independent with no relocations since the loader doesn't apply any yet
+cc -O2 $kflags -ffreestanding -fpie -fno-stack-protector -mno-red-zone -nostdlib -static-pie \
+    -Wl,-T,"$src/bench/kernel.ld" -Wl,--no-dynamic-linker -Wl,--build-id=none \
+    -o "$work/kernel.elf" "$src/bench/kernel.c" || exit 1
+
+"$here/create_img.sh" "$work/boot.img" "$disk_mb" > "$work/create_img.log" 2>&1 || {
+    cat "$work/create_img.log" >&2
+    exit 1
+}
+mcopy -o -i "$work/boot.img" "$work/kernel.elf" ::/TEST/kernel.elf || exit 1
+
+set -- -display none $reboot -serial "file:$work/serial.log" \
+    -device isa-debug-exit,iobase=0xf4,iosize=0x04 \
+    -drive format=raw,file="$work/boot.img" -smp "$smp"
+
+if [ -n "$OVMF_CODE" ]; then
+    cp "$OVMF_VARS" "$work/vars.fd" || exit 1
+    set -- "$@" -drive if=pflash,format=raw,readonly=on,file="$OVMF_CODE" \
+        -drive if=pflash,format=raw,file="$work/vars.fd"
+else
+    set -- "$@" -L "$OVMF_DIR" -bios "$OVMF_DIR/OVMF-pure-efi.fd"
+fi
+
+# Split 512MB per node and the cpus as evenly as they go
+if [ "$numa" -gt 0 ]; then
+    set -- "$@" -m $((numa * 512))M
+    node=0
+    while [ $node -lt "$numa" ]; do
+        first=$((node * smp / numa))
+        last=$(((node + 1) * smp / numa - 1))
+        cpus=
+        # More nodes than cpus leaves some nodes memory only
+        if [ $last -ge $first ]; then
+            cpus=",cpus=$first-$last"
+        fi
+        set -- "$@" -object memory-backend-ram,id=mem$node,size=512M -numa node,nodeid=$node,memdev=mem$node$cpus
+        node=$((node + 1))
+    done
+fi
+
+# One line per run: wall_ns exit_code UBBENCH-line
+results="$work/results"
+: > "$results"
+run=0
+while [ $run -lt "$runs" ]; do
+    : > "$work/serial.log"
+    start=$(date +%s%N)
+    timeout "$timeout_s" qemu-system-x86_64 "$@" > /dev/null 2>&1
+    code=$?
+    end=$(date +%s%N)
+    line=$(tr -d '\r' < "$work/serial.log" | grep '^UBBENCH' | tail -n 1)
+    echo "$((end - start)) $code $line" >> "$results"
+    run=$((run + 1))
+done
+
+# Stage names in loader order, straight from the list the loader is built with
+stages=$(sed -n 's/^STAGE([A-Z_]*, *"\(.*\)")$/\1/p' "$src/include/stage_list.h" | paste -sd '|' -)
+commit=$(git -C "$src" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+json=$(awk -v label="$label" -v commit="$commit" -v smp="$smp" -v numa="$numa" -v disk_mb="$disk_mb" \
+        -v runs="$runs" -v warm="$warm" -v stage_list="$stages" '
+function sort(a, n,    i, j, v) {
+    for (i = 2; i <= n; i++) {
+        v = a[i]
+        for (j = i - 1; j >= 1 && a[j] > v; j--) {
+            a[j + 1] = a[j]
+        }
+        a[j + 1] = v
+    }
+}
+
+# Nearest rank percentile, a has to be sorted
+function pct(a, n, p,    r) {
+    r = int((p * n + 99) / 100)
+    return a[r < 1 ? 1 : r]
+}
+
+function stats(a, n,    i, sum) {
+    if (n == 0) {
+        return "null"
+    }
+    sort(a, n)
+    for (i = 1; i <= n; i++) {
+        sum += a[i]
+    }
+    return sprintf("{\"n\": %d, \"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f, \"mean\": %.1f}",
+            n, a[1], pct(a, n, 50), pct(a, n, 90), pct(a, n, 99), a[n], sum / n)
+}
+
+BEGIN {
+    num_stages = split(stage_list, names, "|")
+}
+
+{
+    # 33 is the test kernel writing DEBUG_EXIT_OK, anything else never reached it
+    if ($2 != 33 || $3 != "UBBENCH") {
+        failures++
+        next
+    }
+
+    wall[++nwall] = $1 / 1e6
+
+    for (i = 4; i <= NF; i++) {
+        split($i, kv, "=")
+        f[kv[1]] = kv[2]
+    }
+    hz = f["hz"]
+    nts = split(f["stages"], ts, ",")
+
+    # Timed boot still read the kernel from disk, BOOT_INFO_KERNEL_CACHED is bit 1 of flags
+    if (warm && int(f["flags"] / 2) % 2 == 0) {
+        cache_misses++
+    }
+
+    # Loader timing needs STAGE_TIMING, without it the table is all zeroes
+    if (hz > 0 && ts[1] > 0) {
+        loader[++nloader] = (f["now"] - ts[1]) * 1e6 / hz
+        prev = ts[1]
+        for (i = 2; i <= nts && i <= num_stages; i++) {
+            if (ts[i] > 0) {
+                nstage[i]++
+                stage[i, nstage[i]] = (ts[i] - prev) * 1e6 / hz
+                prev = ts[i]
+            }
+        }
+    }
+}
+
+END {
+    printf("{\n")
+    printf("  \"label\": \"%s\",\n  \"commit\": \"%s\",\n", label, commit)
+    printf("  \"smp\": %d,\n  \"numa_nodes\": %d,\n  \"disk_mb\": %d,\n", smp, numa, disk_mb)
+    printf("  \"runs\": %d,\n  \"warm\": %d,\n  \"failures\": %d,\n", runs, warm, failures)
+    if (warm) {
+        # wall_ms covers both boots of a warm run
+        printf("  \"cache_misses\": %d,\n", cache_misses)
+    }
+    printf("  \"wall_ms\": %s,\n", stats(wall, nwall))
+    printf("  \"loader_us\": %s,\n", stats(loader, nloader))
+    printf("  \"stages_us\": {")
+    for (i = 2; i <= num_stages; i++) {
+        delete v
+        for (j = 1; j <= nstage[i]; j++) {
+            v[j] = stage[i, j]
+        }
+        printf("%s\n    \"%s\": %s", i > 2 ? "," : "", names[i], stats(v, nstage[i] + 0))
+    }
+    printf("\n  }\n}\n")
+}' "$results")
+
+if [ -n "$out" ]; then
+    echo "$json" > "$out"
+else
+    echo "$json"
+fi
@@ -1,4 +1,4 @@
 #!/bin/bash
 
 . ./edksetup.sh BaseTools
-build
+build "$@"
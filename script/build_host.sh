@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Build the Linux side tools: the loader core tests and microbenchmarks over host/shim.c, and stage_report
+#
+# Usage: build_host.sh [OUT_DIR]    (default build/host, CC and CFLAGS are honoured)
+#
+# The loader sources are compiled unchanged against the stand-in EDK2 headers in host/include, with
+# Uefi.h forced in the way the EDK2 build forces AutoGen.h. Run $OUT_DIR/host_test, then
+# $OUT_DIR/host_bench for timings.
+
+here=$(cd "$(dirname "$0")" && pwd)
+src=$here/..
+out=${1:-$src/build/host}
+cc=${CC:-cc}
+cflags=${CFLAGS:--O2 -g}
+
+mkdir -p "$out" || exit 1
+
+# Loader sources that build for the host, everything else still needs firmware
+core="src/arena.c src/kcache.c src/loadelf.c src/lz4.c src/manifest.c src/tar.c src/uefi_acpi.c src/qoi.c src/smbios.c src/topology.c src/reserve.c"
+
+cd "$src" || exit 1
+
+host_cflags="-std=gnu11 -fshort-wchar -msse2 -Wall -Ihost/include -Ihost -Iinclude -include Uefi.h"
+
+$cc $cflags $host_cflags -o "$out/host_test" host/test.c host/fixture.c host/shim.c $core || exit 1
+$cc $cflags $host_cflags -o "$out/host_bench" host/bench.c host/fixture.c host/shim.c $core || exit 1
+
+$cc $cflags -Iinclude -o "$out/stage_report" host/stage_report.c || exit 1
+
+echo "Built $out/host_test, $out/host_bench and $out/stage_report"
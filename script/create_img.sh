@@ -2,8 +2,8 @@
 
 UEFIBUTT=$WORKSPACE/Build/Uefibutt/RELEASE_GCC5/X64
 
-if [ "$#" -ne 1 ]; then
-    echo "Usage: $0 OUTPUT_BASE_NAME" >&2
+if [ "$#" -lt 1 ] || [ "$#" -gt 2 ]; then
+    echo "Usage: $0 OUTPUT_BASE_NAME [SIZE_MB]" >&2
     exit 1
 fi
 
@@ -14,8 +14,9 @@ fi
 
 # Create img file
 target="$1"
+size_mb="${2:-128}"
 
-dd if=/dev/zero of=$target bs=1M count=128
+dd if=/dev/zero of=$target bs=1M count=$size_mb
 mkfs.vfat -F 32 $target
 mmd -i $target ::/EFI
 mmd -i $target ::/EFI/BOOT
@@ -7,4 +7,6 @@ if [ ! -d $BASE_BUILD ]; then
     exit 1
 fi
 
-qemu-system-x86_64 -L $OVMF_DIR -bios $OVMF_DIR/OVMF-pure-efi.fd -cdrom $BASE_BUILD/Uefibutt.img
+# Any extra arguments go straight to QEMU, e.g. to check the PCI inventory against a few emulated devices:
+#   run.sh -device e1000 -device virtio-blk-pci,drive=d0 -drive if=none,id=d0,file=disk.img -device qemu-xhci
+qemu-system-x86_64 -L $OVMF_DIR -bios $OVMF_DIR/OVMF-pure-efi.fd -cdrom $BASE_BUILD/Uefibutt.img "$@"
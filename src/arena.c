@@ -0,0 +1,101 @@
+// Bump allocators that replace pool allocations for everything the loader allocates itself
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "arena.h"
+#include "boot_services.h"
+#include "info.h"
+
+arena_t arena_scratch = ARENA_INIT(EfiLoaderData);
+arena_t arena_handoff = ARENA_INIT(EfiLoaderData);
+
+// Add a chunk big enough for size, at least ARENA_CHUNK_SIZE, NULL when out of chunks or pages
+static mem_range_t *arena_new_chunk(arena_t *arena, UINTN size)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS base = 0;
+    UINTN pages = EFI_SIZE_TO_PAGES(MAX(size, ARENA_CHUNK_SIZE));
+    mem_range_t *chunk;
+
+    if (arena->num_chunks == ARENA_MAX_CHUNKS) {
+        return NULL;
+    }
+
+    status = bs->allocate_pages(AllocateAnyPages, arena->type, pages, &base);
+    if (EFI_ERROR(status)) {
+        return NULL;
+    }
+
+    chunk = &arena->chunks[arena->num_chunks++];
+    chunk->base = base;
+    chunk->size = EFI_PAGES_TO_SIZE(pages);
+
+    return chunk;
+}
+
+// Uninitialized memory, NULL if the firmware is out of pages or the arena is out of chunks
+void *arena_alloc(arena_t *arena, UINTN size)
+{
+    mem_range_t *cur = arena->num_chunks ? &arena->chunks[arena->num_chunks - 1] : NULL;
+    mem_range_t *chunk;
+    mem_range_t tmp;
+
+    size = ALIGN_VALUE(MAX(size, 1), ARENA_ALIGN);
+
+    if (cur && cur->size - arena->used >= size) {
+        arena->used += size;
+        arena->allocated += size;
+        return (void *) (UINTN) (cur->base + arena->used - size);
+    }
+
+    chunk = arena_new_chunk(arena, size);
+    if (!chunk) {
+        return NULL;
+    }
+    arena->allocated += size;
+
+    // Too big to share a chunk anyway, slot it in under the current one so that one keeps filling
+    if (cur && size > ARENA_CHUNK_SIZE) {
+        tmp = *cur;
+        *cur = *chunk;
+        *chunk = tmp;
+        return (void *) (UINTN) cur->base;
+    }
+
+    arena->used = size;
+
+    return (void *) (UINTN) chunk->base;
+}
+
+void *arena_alloc_zero(arena_t *arena, UINTN size)
+{
+    void *mem = arena_alloc(arena, size);
+
+    if (mem) {
+        ZeroMem(mem, size);
+    }
+
+    return mem;
+}
+
+void arena_reset(arena_t *arena)
+{
+    for (UINT32 i = 0; i < arena->num_chunks; i++) {
+        bs->free_pages(arena->chunks[i].base, EFI_SIZE_TO_PAGES(arena->chunks[i].size));
+    }
+
+    arena->num_chunks = 0;
+    arena->used = 0;
+    arena->allocated = 0;
+}
+
+// Page runs backing the arena, ranges needs room for ARENA_MAX_CHUNKS
+void arena_report(const arena_t *arena, OUT mem_range_t *ranges, OUT UINT32 *num_ranges)
+{
+    for (UINT32 i = 0; i < arena->num_chunks; i++) {
+        ranges[i] = arena->chunks[i];
+    }
+
+    *num_ranges = arena->num_chunks;
+}
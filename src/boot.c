@@ -7,8 +7,9 @@
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 
-// ACPI
+// ACPI and SMBIOS
 #include <Guid/Acpi.h>
+#include <Guid/SmBios.h>
 
 // Filesystem
 #include <Protocol/SimpleFileSystem.h>
@@ -19,22 +20,76 @@
 #include <Pi/PiDxeCis.h>
 #include <Protocol/MpService.h>
 
+#include "arena.h"
+#include "config.h"
+#include "fb_console.h"
+#include "fb_shadow.h"
+#include "framebuffer.h"
 #include "graphics.h"
 #include "info.h"
+#include "kcache.h"
 #include "loadelf.h"
+#include "manifest.h"
+#include "modules.h"
+#include "log.h"
+#include "pci.h"
+#include "prof.h"
+#include "reserve.h"
+#include "smbios.h"
+#include "stage.h"
+#include "topology.h"
 #include "uefi_acpi.h"
 #include "util.h"
 
 mem_map_t mem_map;
 gfx_info_t gfx_info;
+fb_shadow_t fb_shadow;
+fb_console_t fb_console;
+acpi_dir_t acpi_dir;
+pci_info_t pci_info;
+boot_info_t boot_info;
+reclaim_info_t reclaim_info;
+manifest_t manifest;
+module_info_t module_info;
+smbios_info_t smbios_info;
+topo_info_t topo_info;
+reserve_config_t reserve_config;
+reserve_info_t reserve_info;
 void *acpi_table = NULL;
+void *smbios_entry = NULL;
 
 // Entry point for kernel, pass it some args
-typedef void entry(mem_map_t *, gfx_info_t *);
+typedef void entry(mem_map_t *, gfx_info_t *, boot_info_t *);
 
 // define this to copy full elf into memory then parse, unset to read straight from file
 #define USE_BUFFER
 
+// KERNEL_CACHE (kcache.h) keeps the buffer USE_BUFFER reads the kernel into
+#if defined(KERNEL_CACHE) && !defined(USE_BUFFER)
+#error "KERNEL_CACHE needs USE_BUFFER"
+#endif
+
+// define this to copy all ACPI tables into one contiguous reclaimable block for the kernel
+#define PACK_ACPI_TABLES
+
+// define this to draw through a system RAM shadow of the framebuffer and flush only what changed
+#define USE_SHADOW_FB
+
+// define this to log to a text console on the framebuffer, it keeps working after ExitBootServices
+#define USE_FB_CONSOLE
+
+// define this to draw splash_path from the ESP once graphics are up, carries on without it if the file is missing
+#define SHOW_SPLASH
+
+// define this to flush the log to ConOut and serial from a timer as it fills, otherwise only errors get flushed
+//#define LOG_ECHO
+
+// define this to print MB/s for each framebuffer primitive before handing off
+//#define FB_BENCH
+
+// define this to dump the PCI inventory to the console, handy with extra -device args to run.sh
+//#define PRINT_PCI_DEVICES
+
 /*
  * EFI stub
  *
@@ -46,7 +101,6 @@ typedef void entry(mem_map_t *, gfx_info_t *);
  *
  * TODO before we exit bootservices:
  * * setup graphics (do mode detection in boot services)
- * * Get handles to pci devices
  * * Populate the memory map
  * * Load in kernel and put it in memory somewhere
  * * Set up GDT and disable interrupts - firmware handles this, but we can also just do it ourselves an set up non-identity mapping
@@ -68,8 +122,13 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
 {
     EFI_STATUS status;
     UINTN size;
+    BOOLEAN acpi20 = FALSE;
+    BOOLEAN smbios3 = FALSE;
+    BOOLEAN have_gfx = FALSE;
 
-    EFI_MP_SERVICES_PROTOCOL *mps;
+    EFI_MP_SERVICES_PROTOCOL *mps = NULL;
+
+    STAGE_MARK(STAGE_ENTRY);
     
     // Load up global variables
     if (!(gST = SystemTable)) {
@@ -84,6 +143,21 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
         return EFI_LOAD_ERROR;
     }
 
+    // Not fatal, LOG() just drops records without a ring
+#ifdef LOG_ECHO
+    log_init(LOG_SINK_CONOUT | LOG_SINK_SERIAL, TRUE);
+#else
+    log_init(LOG_SINK_CONOUT | LOG_SINK_SERIAL, FALSE);
+#endif
+
+    // Only with PROF_SAMPLING, samples from here until just before ExitBootServices
+    PROF_START();
+    PROF_ENTER(PROF_LOADER);
+
+    PROF_ENTER(PROF_CONFIG);
+    config_load();
+    PROF_EXIT(PROF_CONFIG);
+
     /*
      * load in kernel from filesystem then parse ELF headers and relocate it into memory
      * do this first so we don't run into potential issues where our desired memory location
@@ -91,11 +165,14 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
      */
 
     EFI_PHYSICAL_ADDRESS entry_point = 0;
-    CHAR16 kpath[] = L"\\test\\info.h";
+    CHAR16 kpath[MANIFEST_PATH_MAX] = L"\\test\\kernel.elf";
+    CHAR16 splash_path[] = L"\\test\\splash.qoi";
+    void *splash = NULL;
+    UINTN splash_size = 0;
+    EFI_FILE *root = NULL;
     {
         EFI_LOADED_IMAGE_PROTOCOL *ld_image = NULL;
         EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs = NULL;
-        EFI_FILE *root = NULL;
         EFI_FILE *kfile = NULL;
         EFI_FILE_INFO *finfo = NULL;
         void *kernel = NULL;
@@ -117,18 +194,57 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
 
         fs->OpenVolume(fs, &root);
 
+        // No manifest just means no modules, one that can't be read or doesn't parse could be hiding a required module
+        status = manifest_read(root, &manifest);
+        if (EFI_ERROR(status) && status != EFI_NOT_FOUND) {
+            if (status == EFI_INVALID_PARAMETER || status == EFI_BUFFER_TOO_SMALL) {
+                Print(L"Boot manifest %s is malformed\n", MANIFEST_PATH);
+            } else {
+                Print(L"Failed to read boot manifest %s: %r\n", MANIFEST_PATH, status);
+            }
+            efi_waitforkey();
+            return status;
+        } else if (!EFI_ERROR(status) && manifest_kernel(&manifest)) {
+            modules_efi_path(manifest_kernel(&manifest)->path, kpath);
+        }
+
+        // Same for reservations, parsed now so a bad file stops the boot before anything is loaded
+        {
+            void *text = NULL;
+            UINTN text_size = 0;
+
+            // Only a missing file means no reservations, anything else could be losing a required region
+            status = efi_read_file(&arena_scratch, root, RESERVE_PATH, &text, &text_size);
+            if (EFI_ERROR(status) && status != EFI_NOT_FOUND) {
+                Print(L"Failed to read reservation config %s: %r\n", RESERVE_PATH, status);
+                efi_waitforkey();
+                return status;
+            }
+
+            status = EFI_ERROR(status) ? EFI_SUCCESS : reserve_parse(text, text_size, &reserve_config);
+            if (EFI_ERROR(status)) {
+                Print(L"Reservation config %s is malformed\n", RESERVE_PATH);
+                efi_waitforkey();
+                return status;
+            }
+        }
+
         status = root->Open(root, &kfile, kpath, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
         if (EFI_ERROR(status)) {
             Print(L"Failed to open file %s\n", kpath);
             efi_waitforkey();
             return status;
         }
+        STAGE_MARK(STAGE_FILE_OPEN);
 
 #ifdef USE_BUFFER
         size = 0;
         status = kfile->GetInfo(kfile, &gEfiFileInfoGuid, &size, NULL);
         if (status == EFI_BUFFER_TOO_SMALL) {
-            finfo = AllocateZeroPool(size);
+            finfo = arena_alloc_zero(&arena_scratch, size);
+            if (!finfo) {
+                return EFI_OUT_OF_RESOURCES;
+            }
             status = kfile->GetInfo(kfile, &gEfiFileInfoGuid, &size, finfo);
             if (EFI_ERROR(status)) {
                 Print(L"GetInfo failed\n");
@@ -142,58 +258,116 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
         }
 
         size = finfo->FileSize;
-        kernel = AllocateZeroPool(size);
-        status = kfile->Read(kfile, &size, kernel);
-        if (EFI_ERROR(status)) {
-            Print(L"Read failed\n");
+#ifdef KERNEL_CACHE
+        boot_info.flags |= BOOT_INFO_KERNEL_CACHE;
+
+        // A warm reset leaves RAM alone, the file is only read when last boot's copy is gone or stale
+        kernel = kcache_lookup(&config.kernel, size, &finfo->ModificationTime);
+        if (kernel) {
+            boot_info.flags |= BOOT_INFO_KERNEL_CACHED;
+        } else {
+            kernel = kcache_alloc(size);
+        }
+#else
+        kernel = arena_alloc(&arena_scratch, size);
+#endif
+        if (!kernel) {
+            Print(L"Failed to allocate kernel buffer\n");
             efi_waitforkey();
-            return status;
+            return EFI_OUT_OF_RESOURCES;
         }
 
-        FreePool(finfo);
-        finfo = NULL;
+        if (!(boot_info.flags & BOOT_INFO_KERNEL_CACHED)) {
+            PROF_ENTER(PROF_KERNEL_READ);
+            status = kfile->Read(kfile, &size, kernel);
+            PROF_EXIT(PROF_KERNEL_READ);
+            if (EFI_ERROR(status)) {
+                Print(L"Read failed\n");
+                efi_waitforkey();
+                return status;
+            }
+        }
+        STAGE_MARK(STAGE_ELF_READ);
 
-        status = elf_verify_hdr_mem(kernel);
+        status = elf_verify_hdr_mem(kernel, size);
         if (EFI_ERROR(status)) {
             Print(L"ELF failed to verify\n");
-            FreePool(kernel);
-            kernel = NULL;
             return status;
         }
 
-        entry_point = elf_load_mem_relo(kernel);
+#ifdef KERNEL_CACHE
+        // Unchanged when this boot hit the cache, so config_commit() has nothing new to write
+        if (!(boot_info.flags & BOOT_INFO_KERNEL_CACHED)) {
+            kcache_record(&config.kernel, kernel, size, &finfo->ModificationTime);
+        }
+        reclaim_info.kernel_cache.base = (UINTN) kernel;
+        reclaim_info.kernel_cache.size = size;
+#endif
+
+        PROF_ENTER(PROF_ELF_LOAD);
+        entry_point = elf_load_mem_relo(kernel, size);
+        PROF_EXIT(PROF_ELF_LOAD);
         if (!entry_point) {
             Print(L"Elf failed to load");
             return EFI_OUT_OF_RESOURCES;
         }
-
-        FreePool(kernel);
-        kernel = NULL;
+        STAGE_MARK(STAGE_ELF_LOAD);
 #else
         status = elf_verify_hdr_file(kfile);
         if (EFI_ERROR(status)) {
             Print(L"ELF failed to verify\n");
             return status;
         }
+        STAGE_MARK(STAGE_ELF_READ);
 
+        PROF_ENTER(PROF_ELF_LOAD);
         entry_point = elf_load_file_relo(kfile);
+        PROF_EXIT(PROF_ELF_LOAD);
         if (!entry_point) {
             Print(L"Elf failed to load");
             return EFI_OUT_OF_RESOURCES;
         }
+        STAGE_MARK(STAGE_ELF_LOAD);
+#endif
+
+        PROF_ENTER(PROF_MODULES);
+        status = modules_load(root, &manifest, &module_info);
+        PROF_EXIT(PROF_MODULES);
+        if (EFI_ERROR(status)) {
+            Print(L"Failed to load a required module\n");
+            efi_waitforkey();
+            return status;
+        }
+        STAGE_MARK(STAGE_MODULES);
+
+#ifdef SHOW_SPLASH
+        // Read it now while we have the volume open, it is decoded once the mode is set
+        PROF_ENTER(PROF_SPLASH_READ);
+        status = efi_read_file(&arena_scratch, root, splash_path, &splash, &splash_size);
+        PROF_EXIT(PROF_SPLASH_READ);
+        if (EFI_ERROR(status)) {
+            splash = NULL;
+        }
 #endif
     }
 
     /* 
-     * Find ACPI tables
-     * Check for both ACPI v1 and v2 rsdp header
+     * Find ACPI and SMBIOS tables in one pass
+     * Check for both ACPI v1 and v2 rsdp header, preferring v2 since it gives us the XSDT
+     * Likewise prefer the SMBIOS 3.0 entry point, its table can sit above 4GB and isn't limited to 64KB
      */
     for(size = 0; size < gST->NumberOfTableEntries; size++) {
         EFI_CONFIGURATION_TABLE *cfg = &(gST->ConfigurationTable[size]);
-        if (memcmp(&cfg->VendorGuid, &gEfiAcpiTableGuid, sizeof(cfg->VendorGuid)) == 0 {
-         || memcmp(&cfg->VendorGuid, &gEfiAcpi20TableGuid, sizeof(cfg->VendorGuid)) == 0)) {
-            acpi_table = &(cfg->VendorTable);
-            break;
+        if (memcmp(&cfg->VendorGuid, &gEfiAcpi20TableGuid, sizeof(cfg->VendorGuid)) == 0) {
+            acpi_table = cfg->VendorTable;
+            acpi20 = TRUE;
+        } else if (!acpi20 && memcmp(&cfg->VendorGuid, &gEfiAcpiTableGuid, sizeof(cfg->VendorGuid)) == 0) {
+            acpi_table = cfg->VendorTable;
+        } else if (memcmp(&cfg->VendorGuid, &gEfiSmbios3TableGuid, sizeof(cfg->VendorGuid)) == 0) {
+            smbios_entry = cfg->VendorTable;
+            smbios3 = TRUE;
+        } else if (!smbios3 && memcmp(&cfg->VendorGuid, &gEfiSmbiosTableGuid, sizeof(cfg->VendorGuid)) == 0) {
+            smbios_entry = cfg->VendorTable;
         }
     }
 
@@ -211,50 +385,207 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
         return status;
     }
 
+    // Index every table once here so the kernel doesn't have to walk the XSDT again
+    PROF_ENTER(PROF_ACPI_DIR);
+#ifdef PACK_ACPI_TABLES
+    status = acpi_build_dir(acpi_table, &acpi_dir, TRUE);
+#else
+    status = acpi_build_dir(acpi_table, &acpi_dir, FALSE);
+#endif
+    PROF_EXIT(PROF_ACPI_DIR);
+    if (EFI_ERROR(status)) {
+        Print(L"Failed to build ACPI table directory\n");
+        efi_waitforkey();
+        return status;
+    }
+
     /*
-     * Read memory map from UEFI
+     * Load Pi MpService protocol, only used to spread work over the APs so carry on without it
      */
+    status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (void **) &mps);
+    if (EFI_ERROR(status)) {
+        mps = NULL;
+    }
 
-    size = 0;
-    status = gBS->GetMemoryMap(&size, mem_map.memory_map, &mem_map.map_key, &mem_map.desc_size, &mem_map.desc_version);
-    if (status == EFI_BUFFER_TOO_SMALL) {
-        // This is expected, add a little headroom on the size requested and allocate pool
-        size += SIZE_1KB;
-        mem_map.memory_map = AllocateZeroPool(size);
-        status = gBS->GetMemoryMap(&size, mem_map.memory_map, &mem_map.map_key, &mem_map.desc_size, &mem_map.desc_version);
+    // Checksum every table now so the kernel can trust them without summing them again
+    PROF_ENTER(PROF_ACPI_CHECKSUM);
+    status = acpi_checksum_dir(&acpi_dir, mps);
+    PROF_EXIT(PROF_ACPI_CHECKSUM);
+    if (EFI_ERROR(status)) {
+        Print(L"ACPI table checksumming failed\n");
+        efi_waitforkey();
+        return status;
+    }
+
+    if (acpi_dir.num_invalid) {
+        Print(L"%d ACPI tables failed their checksum\n", acpi_dir.num_invalid);
+    }
+    STAGE_MARK(STAGE_ACPI);
+
+    // Package/core/thread and LLC sharing for the kernel's scheduler, from the MADT, MP services and CPUID
+    PROF_ENTER(PROF_TOPOLOGY);
+    status = topo_build_info(&acpi_dir, mps, &topo_info);
+    PROF_EXIT(PROF_TOPOLOGY);
+    if (EFI_ERROR(status)) {
+        Print(L"Failed to build CPU topology\n");
+    }
+    STAGE_MARK(STAGE_TOPOLOGY);
+
+    /*
+     * Claim the configured contiguous regions, after the kernel has its fixed address but before graphics
+     * and the rest of boot services fragment memory further
+     */
+    {
+        acpi_table_t *srat = acpi_find_table(&acpi_dir, ACPI_SIG_SRAT);
+
+        PROF_ENTER(PROF_RESERVE);
+        status = reserve_claim(&reserve_config, (srat && srat->valid) ? (acpi_srat_t *) (UINTN) srat->address : NULL,
+                &reserve_info);
+        PROF_EXIT(PROF_RESERVE);
         if (EFI_ERROR(status)) {
+            Print(L"Failed to claim a required memory reservation\n");
+            efi_waitforkey();
             return status;
         }
-        mem_map.num_entries = size / mem_map.desc_size;
-    } else {
-        // Something is wrong, just exit
-        return status;
     }
+    STAGE_MARK(STAGE_RESERVE);
+
+    // Processor, cache and DIMM summary from SMBIOS, not fatal, the kernel gets an empty summary without it
+    PROF_ENTER(PROF_SMBIOS);
+    status = smbios_build_info(smbios_entry, &smbios_info);
+    PROF_EXIT(PROF_SMBIOS);
+    if (EFI_ERROR(status) && status != EFI_NOT_FOUND) {
+        Print(L"SMBIOS decoding failed\n");
+    }
+    STAGE_MARK(STAGE_SMBIOS);
 
     /*
-     * Load Pi MpService protocol
-
-    status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (void **) &mps);
+     * Inventory PCI devices while PciIo is still around so the kernel doesn't have to probe config space
+     */
+    PROF_ENTER(PROF_PCI);
+    status = pci_build_inventory(&pci_info);
+    PROF_EXIT(PROF_PCI);
     if (EFI_ERROR(status)) {
-        Print(L"Failed to locate MPService");
-        return status;
+        Print(L"PCI enumeration failed\n");
     }
-    */
+
+#ifdef PRINT_PCI_DEVICES
+    print_pci_inventory(&pci_info);
+#endif
+    STAGE_MARK(STAGE_PCI);
 
     /*
      * Initialize graphics
      */
 
+    PROF_ENTER(PROF_GFX_INIT);
     status = init_graphics(&gfx_info);
+    PROF_EXIT(PROF_GFX_INIT);
+    if (!EFI_ERROR(status)) {
+        have_gfx = TRUE;
+
+        // Not fatal, the streaming stores still work on an uncached framebuffer, just slower
+        status = fb_set_write_combining(&gfx_info);
+        if (EFI_ERROR(status)) {
+            Print(L"Failed to map framebuffer write-combining\n");
+        }
+
+#ifdef FB_BENCH
+        fb_bench(&gfx_info);
+#endif
+
+#ifdef USE_FB_CONSOLE
+        PROF_ENTER(PROF_FB_CONSOLE_INIT);
+        status = fb_console_init(&fb_console, &gfx_info, 0x00AAAAAA, 0x00000000);
+        PROF_EXIT(PROF_FB_CONSOLE_INIT);
+        if (EFI_ERROR(status)) {
+            Print(L"Failed to set up framebuffer console\n");
+        }
+#endif
+
+#ifdef USE_SHADOW_FB
+        PROF_ENTER(PROF_FB_SHADOW_INIT);
+        status = fb_shadow_init(&fb_shadow, &gfx_info, gfx_proto);
+        PROF_EXIT(PROF_FB_SHADOW_INIT);
+        if (EFI_ERROR(status)) {
+            Print(L"Failed to allocate framebuffer shadow\n");
+        }
+#endif
+    }
+
+#ifdef SHOW_SPLASH
+    // Nothing to draw with unless init_graphics found a mode with blitters
+    if (have_gfx && splash) {
+        UINT32 w = 0;
+        UINT32 h = 0;
+        fb_surface_t fb;
+
+        fb_surface_from_gfx(&gfx_info, &fb);
+
+        // Centered, and drawn through the shadow when there is one so it knows what is on screen
+        if (!EFI_ERROR(qoi_info(splash, splash_size, &w, &h)) && w <= fb.width && h <= fb.height) {
+            UINT32 x = (fb.width - w) / 2;
+            UINT32 y = (fb.height - h) / 2;
+
+#ifdef USE_SHADOW_FB
+            PROF_ENTER(PROF_SPLASH_DRAW);
+            if (fb_shadow.back.base) {
+                draw_qoi(&fb_shadow.back, x, y, splash, splash_size);
+                fb_shadow_damage(&fb_shadow, x, y, w, h);
+                fb_shadow_flush(&fb_shadow);
+            }
+            PROF_EXIT(PROF_SPLASH_DRAW);
+#else
+            PROF_ENTER(PROF_SPLASH_DRAW);
+            draw_qoi(&fb, x, y, splash, splash_size);
+            PROF_EXIT(PROF_SPLASH_DRAW);
+#endif
+        }
+    }
+#endif
+
+    STAGE_MARK(STAGE_GRAPHICS);
+
+    // The only variable write before ExitBootServices, and skipped entirely when nothing changed
+    PROF_ENTER(PROF_CONFIG);
+    config_commit();
+    PROF_EXIT(PROF_CONFIG);
+
+    PROF_EXIT(PROF_LOADER);
+    PROF_STOP();
+    PROF_DUMP(root);
 
-    // Some efivar setting test code 
-    CHAR16 str[] = L"string";
-    UINTN ts = sizeof(str);
+    STAGE_CALIBRATE();
+    log_exit_boot_services();
 
-    status = efivar_set(L"test", &ts, str, FALSE);
+    /*
+     * Read memory map from UEFI
+     * Last thing before ExitBootServices, anything that allocates or frees after this makes the key stale
+     */
+    size = 0;
+    status = efi_read_memory_map(&mem_map, &size);
+    if (EFI_ERROR(status)) {
+        Print(L"Failed to read memory map\n");
+        efi_waitforkey();
+        return status;
+    }
+    STAGE_MARK(STAGE_MEMORY_MAP);
 
     status = gBS->ExitBootServices(ImageHandle, mem_map.map_key);
-    //TODO error handling
+    if (status == EFI_INVALID_PARAMETER) {
+        // Firmware changed the map under us (an event firing), read it again into the same buffer and retry once
+        status = efi_read_memory_map(&mem_map, &size);
+        if (!EFI_ERROR(status)) {
+            status = gBS->ExitBootServices(ImageHandle, mem_map.map_key);
+        }
+    }
+
+    if (EFI_ERROR(status)) {
+        Print(L"ExitBootServices failed\n");
+        efi_waitforkey();
+        return status;
+    }
+    STAGE_MARK(STAGE_EXIT_BOOT_SERVICES);
     
     /*
      * OLD: ignore this, left it here for now for reference
@@ -270,16 +601,63 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
      * letting it set up IDT/GDT. Be sure to pass it some things like gfx_info and mem_map though
      */
     
+    // Keep runtime services at their physical addresses so gRT can still be called through the identity map
+    for (UINTN i = 0; i < mem_map.num_entries; i++) {
+        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *) ((UINT8 *) mem_map.memory_map + i * mem_map.desc_size);
+        if (desc->Attribute & EFI_MEMORY_RUNTIME) {
+            desc->VirtualStart = desc->PhysicalStart;
+        }
+    }
+
     status = gRT->SetVirtualAddressMap(mem_map.num_entries, mem_map.desc_size, mem_map.desc_version, mem_map.memory_map);
     //TODO error handling
+    STAGE_MARK(STAGE_SET_VIRTUAL_MAP);
+
+    // Only with STAGE_TIMING, an extra NV write on every boot
+    STAGE_COMMIT();
+
+#ifdef USE_FB_CONSOLE
+    print_memory_map_console(&fb_console, &mem_map);
+#endif
+
+#ifdef USE_SHADOW_FB
+    if (fb_shadow.back.base) {
+        fb_shadow_exit_boot_services(&fb_shadow);
+        draw_triangle(&fb_shadow.back);
+        fb_shadow_damage(&fb_shadow, 0, 0, fb_shadow.back.width, fb_shadow.back.height);
+        fb_shadow_flush(&fb_shadow);
+    }
+#else
+    if (have_gfx) {
+        fb_surface_t fb;
+        fb_surface_from_gfx(&gfx_info, &fb);
+        draw_triangle(&fb);
+    }
+#endif
 
-    //print_memory_map(&mem_map);
-    draw_triangle(&gfx_info);
+    boot_info.rtservice = gRT;
+    boot_info.gpu_config = NULL;
+    boot_info.mem_map = &mem_map;
+    boot_info.rsdp = acpi_table;
+    boot_info.acpi_dir = &acpi_dir;
+    boot_info.pci_info = &pci_info;
+    boot_info.console = fb_console.back.base ? &fb_console : NULL;
+    boot_info.log = log_ring;
+    boot_info.stages = &stage_table;
+    boot_info.reclaim = &reclaim_info;
+    boot_info.modules = &module_info;
+    boot_info.smbios = &smbios_info;
+    boot_info.topology = &topo_info;
+    boot_info.reserve = &reserve_info;
+
+    // Nothing allocates after the memory map is read so these are final
+    arena_report(&arena_scratch, reclaim_info.scratch, &reclaim_info.num_scratch);
+    arena_report(&arena_handoff, reclaim_info.handoff, &reclaim_info.num_handoff);
 
     if (entry_point)
     {
         entry *ep = (entry *)entry_point;
-        ep(&mem_map, &gfx_info);
+        ep(&mem_map, &gfx_info, &boot_info);
     }
 
     return status;
@@ -0,0 +1,31 @@
+// Firmware side of the loader core's boot services table
+
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "boot_services.h"
+
+static EFI_STATUS efi_allocate_pages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE mem_type, UINTN pages,
+        IN OUT EFI_PHYSICAL_ADDRESS *address)
+{
+    return gBS->AllocatePages(type, mem_type, pages, address);
+}
+
+static EFI_STATUS efi_free_pages(EFI_PHYSICAL_ADDRESS address, UINTN pages)
+{
+    return gBS->FreePages(address, pages);
+}
+
+static EFI_STATUS efi_get_memory_map(IN OUT UINTN *size, OUT EFI_MEMORY_DESCRIPTOR *map, OUT UINTN *map_key,
+        OUT UINTN *desc_size, OUT UINT32 *desc_version)
+{
+    return gBS->GetMemoryMap(size, map, map_key, desc_size, desc_version);
+}
+
+static const boot_services_t efi_boot_services = {
+    .allocate_pages = efi_allocate_pages,
+    .free_pages = efi_free_pages,
+    .get_memory_map = efi_get_memory_map,
+};
+
+const boot_services_t *bs = &efi_boot_services;
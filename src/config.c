@@ -0,0 +1,79 @@
+// Loader configuration blob, one GetVariable at startup and at most one SetVariable before ExitBootServices
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+config_t config;
+
+// What the variable held at load, commit compares against this so unchanged state is never rewritten
+static config_t config_stored;
+
+static void config_defaults(OUT config_t *cfg)
+{
+    ZeroMem(cfg, sizeof(*cfg));
+    cfg->magic = CONFIG_MAGIC;
+    cfg->version = CONFIG_VERSION;
+    cfg->size = sizeof(*cfg);
+}
+
+/*
+ * Read the blob, anything missing, corrupt or from another version falls back to defaults
+ * Defaults are never an error, the first commit writes them out
+ */
+EFI_STATUS config_load()
+{
+    EFI_STATUS status;
+    config_t *stored = NULL;
+    UINTN size = 0;
+    UINT64 start = AsmReadTsc();
+
+    config_defaults(&config);
+    ZeroMem(&config_stored, sizeof(config_stored));
+
+    status = efivar_get(CONFIG_VAR, &size, (VOID **) &stored);
+    if (!EFI_ERROR(status) && size == sizeof(config_t) && stored->magic == CONFIG_MAGIC &&
+            stored->version == CONFIG_VERSION && stored->size == sizeof(config_t)) {
+        CopyMem(&config, stored, sizeof(config));
+        CopyMem(&config_stored, stored, sizeof(config_stored));
+        LOG(LOG_INFO, LOG_CFG_LOADED, size, AsmReadTsc() - start);
+    } else {
+        LOG(LOG_INFO, LOG_CFG_DEFAULTS, status, size, AsmReadTsc() - start);
+    }
+
+    if (stored) {
+        FreePool(stored);
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Write the blob back if anything in it changed since config_load()
+EFI_STATUS config_commit()
+{
+    EFI_STATUS status;
+    UINTN size = sizeof(config);
+    UINT64 start;
+
+    if (CompareMem(&config, &config_stored, sizeof(config)) == 0) {
+        LOG(LOG_DEBUG, LOG_CFG_UNCHANGED, size);
+        return EFI_SUCCESS;
+    }
+
+    start = AsmReadTsc();
+    status = efivar_set(CONFIG_VAR, &size, &config, TRUE);
+    if (EFI_ERROR(status)) {
+        LOG(LOG_ERROR, LOG_CFG_WRITE_FAILED, status);
+        return status;
+    }
+
+    CopyMem(&config_stored, &config, sizeof(config_stored));
+    LOG(LOG_INFO, LOG_CFG_WRITTEN, size, AsmReadTsc() - start);
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,233 @@
+// Framebuffer text console, glyphs come out of a pre-rendered atlas so drawing text is just copies
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/PrintLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <emmintrin.h>
+
+#include "fb_console.h"
+#include "font8x8.h"
+#include "framebuffer.h"
+#include "info.h"
+
+static inline UINT8 *fb_console_cell(const fb_console_t *con, UINT32 col, UINT32 row)
+{
+    UINTN y = (UINTN) row * FB_CON_GLYPH_H;
+    UINTN x = (UINTN) col * FB_CON_GLYPH_W;
+
+    return (UINT8 *) con->back.base + (y * con->back.pitch + x) * con->back.fmt->bpp;
+}
+
+static void fb_console_damage(fb_console_t *con, UINT32 x0, UINT32 y0, UINT32 x1, UINT32 y1)
+{
+    if (con->dirty_x0 >= con->dirty_x1) {
+        con->dirty_x0 = x0;
+        con->dirty_y0 = y0;
+        con->dirty_x1 = x1;
+        con->dirty_y1 = y1;
+        return;
+    }
+
+    con->dirty_x0 = MIN(con->dirty_x0, x0);
+    con->dirty_y0 = MIN(con->dirty_y0, y0);
+    con->dirty_x1 = MAX(con->dirty_x1, x1);
+    con->dirty_y1 = MAX(con->dirty_y1, y1);
+}
+
+// Copy the dirty cells from back to the screen, same pixel format on both sides so this is a raw streaming copy
+static void fb_console_flush(fb_console_t *con)
+{
+    if (con->dirty_x0 >= con->dirty_x1) {
+        return;
+    }
+
+    fb_copy_rect(&con->screen, con->dirty_x0 * FB_CON_GLYPH_W, con->dirty_y0 * FB_CON_GLYPH_H, &con->back,
+            con->dirty_x0 * FB_CON_GLYPH_W, con->dirty_y0 * FB_CON_GLYPH_H,
+            (con->dirty_x1 - con->dirty_x0) * FB_CON_GLYPH_W, (con->dirty_y1 - con->dirty_y0) * FB_CON_GLYPH_H);
+
+    con->dirty_x0 = con->dirty_x1 = 0;
+}
+
+/*
+ * Render every glyph in fg on bg into the atlas, in the screen's pixel format
+ * 96 glyphs of 8x16 pixels, cheap enough to just redo whenever the colors change
+ */
+void fb_console_set_color(fb_console_t *con, UINT32 fg, UINT32 bg)
+{
+    const fb_format_t *fmt = con->back.fmt;
+    UINT32 fg_px = fmt->ops->pack(fmt, fg);
+    UINT32 bg_px = fmt->ops->pack(fmt, bg);
+    UINT8 *out = con->atlas;
+
+    for (UINT32 g = 0; g < FONT8X8_GLYPHS; g++) {
+        for (UINT32 row = 0; row < FB_CON_GLYPH_H; row++) {
+            UINT8 bits = font8x8[g][row * 8 / FB_CON_GLYPH_H];
+
+            for (UINT32 px = 0; px < FB_CON_GLYPH_W; px++, out += fmt->bpp) {
+                UINT32 value = (bits >> px) & 1 ? fg_px : bg_px;
+
+                if (fmt->bpp == sizeof(UINT32)) {
+                    *(UINT32 *) out = value;
+                } else {
+                    *(UINT16 *) out = (UINT16) value;
+                }
+            }
+        }
+    }
+
+    con->fg = fg;
+    con->bg = bg;
+}
+
+/*
+ * Set up a console covering as many whole cells as fit on the screen
+ * back and the atlas are EfiLoaderData so the console keeps working after ExitBootServices
+ */
+EFI_STATUS fb_console_init(OUT fb_console_t *con, const gfx_info_t *gfx_info, UINT32 fg, UINT32 bg)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS mem = 0;
+    UINTN back_bytes;
+    UINTN atlas_bytes;
+
+    fb_surface_from_gfx(gfx_info, &con->screen);
+    con->cols = con->screen.width / FB_CON_GLYPH_W;
+    con->rows = con->screen.height / FB_CON_GLYPH_H;
+    if (!con->cols || !con->rows) {
+        return EFI_UNSUPPORTED;
+    }
+
+    con->back = con->screen;
+    con->back.width = con->cols * FB_CON_GLYPH_W;
+    con->back.height = con->rows * FB_CON_GLYPH_H;
+    con->back.pitch = con->back.width;
+
+    back_bytes = (UINTN) con->back.pitch * con->back.height * con->back.fmt->bpp;
+    atlas_bytes = (UINTN) FONT8X8_GLYPHS * FB_CON_GLYPH_H * FB_CON_GLYPH_W * con->back.fmt->bpp;
+
+    status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(back_bytes + atlas_bytes), &mem);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    con->back.base = (void *) (UINTN) mem;
+    con->atlas = (UINT8 *) (UINTN) mem + back_bytes;
+
+    fb_console_set_color(con, fg, bg);
+    fb_console_clear(con);
+
+    return EFI_SUCCESS;
+}
+
+void fb_console_clear(fb_console_t *con)
+{
+    fb_fill_rect(&con->back, 0, 0, con->back.width, con->back.height, con->bg);
+    fb_console_damage(con, 0, 0, con->cols, con->rows);
+    fb_console_flush(con);
+
+    con->cur_col = 0;
+    con->cur_row = 0;
+}
+
+// Move the text up a line in RAM and blank the bottom one, the screen catches up on the next flush
+static void fb_console_scroll(fb_console_t *con)
+{
+    UINTN line_bytes = (UINTN) con->back.pitch * FB_CON_GLYPH_H * con->back.fmt->bpp;
+
+    CopyMem(con->back.base, (UINT8 *) con->back.base + line_bytes, line_bytes * (con->rows - 1));
+    fb_fill_rect(&con->back, 0, (con->rows - 1) * FB_CON_GLYPH_H, con->back.width, FB_CON_GLYPH_H, con->bg);
+    fb_console_damage(con, 0, 0, con->cols, con->rows);
+}
+
+static void fb_console_newline(fb_console_t *con)
+{
+    con->cur_col = 0;
+    if (++con->cur_row == con->rows) {
+        fb_console_scroll(con);
+        con->cur_row--;
+    }
+}
+
+// Copy one glyph out of the atlas into a cell of back, rows are 16 or 32 bytes so two vector moves at most
+static void fb_console_draw_glyph(fb_console_t *con, UINT32 glyph, UINT32 col, UINT32 row)
+{
+    UINTN glyph_row = (UINTN) FB_CON_GLYPH_W * con->back.fmt->bpp;
+    UINTN pitch = (UINTN) con->back.pitch * con->back.fmt->bpp;
+    const UINT8 *in = con->atlas + glyph * FB_CON_GLYPH_H * glyph_row;
+    UINT8 *out = fb_console_cell(con, col, row);
+
+    for (UINT32 r = 0; r < FB_CON_GLYPH_H; r++, in += glyph_row, out += pitch) {
+        _mm_storeu_si128((__m128i *) out, _mm_loadu_si128((const __m128i *) in));
+        if (glyph_row > 16) {
+            _mm_storeu_si128((__m128i *) (out + 16), _mm_loadu_si128((const __m128i *) (in + 16)));
+        }
+    }
+}
+
+static void fb_console_putc(fb_console_t *con, CHAR8 c)
+{
+    UINT32 glyph;
+
+    switch (c) {
+        case '\n':
+            fb_console_newline(con);
+            return;
+
+        case '\r':
+            con->cur_col = 0;
+            return;
+
+        case '\t':
+            do {
+                fb_console_putc(con, ' ');
+            } while (con->cur_col % FB_CON_TAB);
+            return;
+
+        default:
+            break;
+    }
+
+    if (con->cur_col == con->cols) {
+        fb_console_newline(con);
+    }
+
+    if (c >= FONT8X8_FIRST && c <= FONT8X8_LAST) {
+        glyph = c - FONT8X8_FIRST;
+    } else {
+        glyph = FONT8X8_BOX;
+    }
+
+    fb_console_draw_glyph(con, glyph, con->cur_col, con->cur_row);
+    fb_console_damage(con, con->cur_col, con->cur_row, con->cur_col + 1, con->cur_row + 1);
+    con->cur_col++;
+}
+
+// Draw a whole string into back and push the changed cells out in one go
+void fb_console_write(fb_console_t *con, const CHAR8 *str)
+{
+    if (!con->back.base) {
+        return;
+    }
+
+    while (*str) {
+        fb_console_putc(con, *str++);
+    }
+
+    fb_console_flush(con);
+}
+
+// PrintLib formatting, %a for ASCII strings and %s for CHAR16 ones
+void fb_console_printf(fb_console_t *con, const CHAR8 *fmt, ...)
+{
+    CHAR8 buf[FB_CON_PRINT_MAX];
+    VA_LIST args;
+
+    VA_START(args, fmt);
+    AsciiVSPrint(buf, sizeof(buf), fmt, args);
+    VA_END(args);
+
+    fb_console_write(con, buf);
+}
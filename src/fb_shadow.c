@@ -0,0 +1,252 @@
+// Shadow back-buffer for the framebuffer
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include <emmintrin.h>
+
+#include "fb_shadow.h"
+#include "framebuffer.h"
+#include "info.h"
+
+// Touching counts as overlapping, merging neighbours gives fewer and longer runs to flush
+static BOOLEAN fb_rect_touches(const fb_rect_t *a, const fb_rect_t *b)
+{
+    return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+           a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void fb_rect_union(fb_rect_t *a, const fb_rect_t *b)
+{
+    UINT32 x1 = MAX(a->x + a->w, b->x + b->w);
+    UINT32 y1 = MAX(a->y + a->h, b->y + b->h);
+
+    a->x = MIN(a->x, b->x);
+    a->y = MIN(a->y, b->y);
+    a->w = x1 - a->x;
+    a->h = y1 - a->y;
+}
+
+static UINT64 fb_rect_area(const fb_rect_t *r)
+{
+    return (UINT64) r->w * r->h;
+}
+
+static inline UINT32 *fb_shadow_pixel(const fb_surface_t *surface, UINT32 x, UINT32 y)
+{
+    return (UINT32 *) surface->base + (UINTN) y * surface->pitch + x;
+}
+
+/*
+ * Set up back and front buffers matching the framebuffer and clear the screen so front starts out accurate
+ * back holds 0x00RRGGBB, which is EFI_GRAPHICS_OUTPUT_BLT_PIXEL, so Blt can take it whatever the screen's format is
+ */
+EFI_STATUS fb_shadow_init(OUT fb_shadow_t *shadow, const gfx_info_t *gfx_info, EFI_GRAPHICS_OUTPUT_PROTOCOL *gop)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS mem = 0;
+    UINTN bytes;
+    UINTN pages;
+
+    fb_surface_from_gfx(gfx_info, &shadow->fb);
+    bytes = (UINTN) shadow->fb.pitch * shadow->fb.height * sizeof(UINT32);
+    pages = EFI_SIZE_TO_PAGES(bytes);
+
+    // EfiLoaderData so the buffers are still ours after ExitBootServices
+    status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, pages * 2, &mem);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // Both buffers hold canonical pixels, conversion to the screen's layout happens on the way out
+    shadow->back = shadow->fb;
+    shadow->back.base = (void *) (UINTN) mem;
+    shadow->back.fmt = &fb_format_canonical;
+    shadow->front = shadow->back;
+    shadow->front.base = (void *) (UINTN) (mem + EFI_PAGES_TO_SIZE(pages));
+    ZeroMem(shadow->back.base, bytes);
+    ZeroMem(shadow->front.base, bytes);
+
+    shadow->gop = gop;
+    shadow->num_dirty = 0;
+    shadow->bytes_dirty = 0;
+    shadow->bytes_written = 0;
+    shadow->bytes_saved = 0;
+
+    fb_fill_rect(&shadow->fb, 0, 0, shadow->fb.width, shadow->fb.height, 0);
+
+    return EFI_SUCCESS;
+}
+
+// Mark a region of back as changed, merging it with whatever it touches
+void fb_shadow_damage(fb_shadow_t *shadow, UINT32 x, UINT32 y, UINT32 w, UINT32 h)
+{
+    fb_rect_t rect;
+
+    if (x >= shadow->back.width || y >= shadow->back.height || !w || !h) {
+        return;
+    }
+
+    rect.x = x;
+    rect.y = y;
+    rect.w = MIN(w, shadow->back.width - x);
+    rect.h = MIN(h, shadow->back.height - y);
+
+    // A merge can make the rect touch ones we already passed, so start over after each one
+    for (UINT32 i = 0; i < shadow->num_dirty;) {
+        if (fb_rect_touches(&shadow->dirty[i], &rect)) {
+            fb_rect_union(&rect, &shadow->dirty[i]);
+            shadow->dirty[i] = shadow->dirty[--shadow->num_dirty];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (shadow->num_dirty < FB_SHADOW_MAX_DIRTY) {
+        shadow->dirty[shadow->num_dirty++] = rect;
+        return;
+    }
+
+    // Out of slots, grow whichever rect gets the least bigger
+    {
+        UINT32 best = 0;
+        UINT64 best_growth = MAX_UINT64;
+
+        for (UINT32 i = 0; i < shadow->num_dirty; i++) {
+            fb_rect_t tmp = shadow->dirty[i];
+            UINT64 growth;
+
+            fb_rect_union(&tmp, &rect);
+            growth = fb_rect_area(&tmp) - fb_rect_area(&shadow->dirty[i]);
+            if (growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+
+        fb_rect_union(&shadow->dirty[best], &rect);
+    }
+}
+
+void fb_shadow_fill_rect(fb_shadow_t *shadow, UINT32 x, UINT32 y, UINT32 w, UINT32 h, UINT32 color)
+{
+    fb_fill_rect(&shadow->back, x, y, w, h, color);
+    fb_shadow_damage(shadow, x, y, w, h);
+}
+
+// Find the part of a row span that differs between back and front, FALSE if none of it does
+static BOOLEAN fb_shadow_row_diff(const UINT32 *back, const UINT32 *front, UINT32 w, UINT32 *start, UINT32 *count)
+{
+    UINT32 lo = 0;
+    UINT32 hi = w;
+
+    while (lo + 4 <= w) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (back + lo)),
+                _mm_loadu_si128((const __m128i *) (front + lo)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            break;
+        }
+        lo += 4;
+    }
+
+    while (lo < w && back[lo] == front[lo]) {
+        lo++;
+    }
+
+    if (lo == w) {
+        return FALSE;
+    }
+
+    while (hi - lo >= 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (back + hi - 4)),
+                _mm_loadu_si128((const __m128i *) (front + hi - 4)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            break;
+        }
+        hi -= 4;
+    }
+
+    // back[lo] differs, so this always stops
+    while (back[hi - 1] == front[hi - 1]) {
+        hi--;
+    }
+
+    *start = lo;
+    *count = hi - lo;
+
+    return TRUE;
+}
+
+// Push one region of back out to the screen and record it in front
+static void fb_shadow_write(fb_shadow_t *shadow, UINT32 x, UINT32 y, UINT32 w, UINT32 h)
+{
+    if (shadow->gop) {
+        shadow->gop->Blt(shadow->gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *) shadow->back.base, EfiBltBufferToVideo,
+                x, y, x, y, w, h, shadow->back.pitch * sizeof(UINT32));
+    } else {
+        fb_copy_rect(&shadow->fb, x, y, &shadow->back, x, y, w, h);
+    }
+
+    // front is read on every flush so it stays cached, plain copies rather than streaming ones
+    for (UINT32 row = 0; row < h; row++) {
+        CopyMem(fb_shadow_pixel(&shadow->front, x, y + row), fb_shadow_pixel(&shadow->back, x, y + row), w * sizeof(UINT32));
+    }
+
+    shadow->bytes_written += (UINT64) w * h * sizeof(UINT32);
+}
+
+/*
+ * Write out every dirty rect, only the pixels that differ from what is already on screen go out
+ * Direct writes are done per row, Blt calls are expensive so consecutive changed rows are grouped into one band
+ */
+void fb_shadow_flush(fb_shadow_t *shadow)
+{
+    for (UINT32 i = 0; i < shadow->num_dirty; i++) {
+        fb_rect_t *r = &shadow->dirty[i];
+        UINT32 band_y = 0;
+        UINT32 band_h = 0;
+        UINT32 band_x0 = MAX_UINT32;
+        UINT32 band_x1 = 0;
+
+        shadow->bytes_dirty += fb_rect_area(r) * sizeof(UINT32);
+
+        for (UINT32 row = 0; row < r->h; row++) {
+            UINT32 start;
+            UINT32 count;
+            BOOLEAN changed = fb_shadow_row_diff(fb_shadow_pixel(&shadow->back, r->x, r->y + row),
+                    fb_shadow_pixel(&shadow->front, r->x, r->y + row), r->w, &start, &count);
+
+            if (changed && !shadow->gop) {
+                fb_shadow_write(shadow, r->x + start, r->y + row, count, 1);
+            } else if (changed) {
+                if (!band_h) {
+                    band_y = r->y + row;
+                }
+                band_x0 = MIN(band_x0, r->x + start);
+                band_x1 = MAX(band_x1, r->x + start + count);
+                band_h++;
+            } else if (band_h) {
+                fb_shadow_write(shadow, band_x0, band_y, band_x1 - band_x0, band_h);
+                band_h = 0;
+                band_x0 = MAX_UINT32;
+                band_x1 = 0;
+            }
+        }
+
+        if (band_h) {
+            fb_shadow_write(shadow, band_x0, band_y, band_x1 - band_x0, band_h);
+        }
+    }
+
+    shadow->num_dirty = 0;
+    shadow->bytes_saved = shadow->bytes_dirty - shadow->bytes_written;
+}
+
+// Blt is a boot service, after this flushes go straight to the framebuffer
+void fb_shadow_exit_boot_services(fb_shadow_t *shadow)
+{
+    shadow->gop = NULL;
+}
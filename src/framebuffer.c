@@ -0,0 +1,541 @@
+// Framebuffer drawing primitives, all surface writes are non-temporal stores so video memory is never read back
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/DxeServicesTableLib.h>
+
+#include <emmintrin.h>
+
+#include "framebuffer.h"
+#include "info.h"
+#include "util.h"
+
+#define FB_CACHE_ATTR_MASK  (EFI_MEMORY_UC | EFI_MEMORY_WC | EFI_MEMORY_WT | EFI_MEMORY_WB | EFI_MEMORY_UCE)
+#define FB_BENCH_ITERS      16
+
+// Staging row for the scaled blit, built once per source row and streamed out for every destination row it covers
+static UINT32 fb_row[FB_ROW_PIXELS] __attribute__((aligned(16)));
+
+fb_format_t fb_format;
+
+static inline void fb_stream_bytes(void *dst, const void *src, UINTN bytes)
+{
+    UINT8 *d = (UINT8 *) dst;
+    const UINT8 *s = (const UINT8 *) src;
+    UINTN head = MIN((16 - ((UINTN) d & 15)) & 15, bytes);
+
+    // Plain stores for the unaligned ends, there are at most 15 bytes of each
+    CopyMem(d, s, head);
+    d += head;
+    s += head;
+    bytes -= head;
+
+    for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) s);
+        __m128i b = _mm_loadu_si128((const __m128i *) (s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *) (s + 48));
+        _mm_stream_si128((__m128i *) d, a);
+        _mm_stream_si128((__m128i *) (d + 16), b);
+        _mm_stream_si128((__m128i *) (d + 32), c);
+        _mm_stream_si128((__m128i *) (d + 48), e);
+    }
+
+    for (; bytes >= 16; bytes -= 16, d += 16, s += 16) {
+        _mm_stream_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+    }
+
+    CopyMem(d, s, bytes);
+}
+
+static void fb_fill_row32(void *dst, UINT32 packed, UINTN count)
+{
+    UINT32 *out = (UINT32 *) dst;
+    __m128i v = _mm_set1_epi32((int) packed);
+
+    // Single pixels until we hit a 16 byte boundary
+    while (count && ((UINTN) out & 15)) {
+        _mm_stream_si32((int *) out++, (int) packed);
+        count--;
+    }
+
+    for (; count >= 16; count -= 16, out += 16) {
+        _mm_stream_si128((__m128i *) out, v);
+        _mm_stream_si128((__m128i *) (out + 4), v);
+        _mm_stream_si128((__m128i *) (out + 8), v);
+        _mm_stream_si128((__m128i *) (out + 12), v);
+    }
+
+    for (; count >= 4; count -= 4, out += 4) {
+        _mm_stream_si128((__m128i *) out, v);
+    }
+
+    while (count--) {
+        _mm_stream_si32((int *) out++, (int) packed);
+    }
+}
+
+static void fb_fill_row16(void *dst, UINT32 packed, UINTN count)
+{
+    UINT16 *out = (UINT16 *) dst;
+    __m128i v = _mm_set1_epi16((short) packed);
+
+    while (count && ((UINTN) out & 15)) {
+        *out++ = (UINT16) packed;
+        count--;
+    }
+
+    for (; count >= 32; count -= 32, out += 32) {
+        _mm_stream_si128((__m128i *) out, v);
+        _mm_stream_si128((__m128i *) (out + 8), v);
+        _mm_stream_si128((__m128i *) (out + 16), v);
+        _mm_stream_si128((__m128i *) (out + 24), v);
+    }
+
+    for (; count >= 8; count -= 8, out += 8) {
+        _mm_stream_si128((__m128i *) out, v);
+    }
+
+    while (count--) {
+        *out++ = (UINT16) packed;
+    }
+}
+
+/*
+ * Generates pack and convert_row for one pixel layout, PACK is the expression turning canonical color c into a pixel
+ * Expanding it per layout gives every format its own straight-line inner loop with no per pixel format checks
+ */
+#define FB_DEFINE_LAYOUT(name, pixel_t, PACK)                                                           \
+    static UINT32 fb_pack_##name(const fb_format_t *fmt, UINT32 c)                                      \
+    {                                                                                                   \
+        (void) fmt;                                                                                     \
+        return (pixel_t) (PACK);                                                                        \
+    }                                                                                                   \
+                                                                                                        \
+    static void fb_convert_row_##name(const fb_format_t *fmt, void *dst, const UINT32 *src, UINTN count) \
+    {                                                                                                   \
+        pixel_t chunk[FB_CONVERT_CHUNK] __attribute__((aligned(16)));                                  \
+        UINT8 *out = (UINT8 *) dst;                                                                     \
+                                                                                                        \
+        (void) fmt;                                                                                     \
+        while (count) {                                                                                 \
+            UINTN n = MIN(count, FB_CONVERT_CHUNK);                                                     \
+                                                                                                        \
+            for (UINTN i = 0; i < n; i++) {                                                             \
+                UINT32 c = src[i];                                                                      \
+                chunk[i] = (pixel_t) (PACK);                                                            \
+            }                                                                                           \
+                                                                                                        \
+            fb_stream_bytes(out, chunk, n * sizeof(pixel_t));                                           \
+            out += n * sizeof(pixel_t);                                                                 \
+            src += n;                                                                                   \
+            count -= n;                                                                                 \
+        }                                                                                               \
+    }
+
+// Shift each channel of canonical color c into the position the mask table describes
+#define FB_PACK_MASK(c, fmt)                                                    \
+    (((((c) >> 16) & 0xFF) >> (fmt)->rshift[0]) << (fmt)->lshift[0] |          \
+     ((((c) >> 8) & 0xFF) >> (fmt)->rshift[1]) << (fmt)->lshift[1] |           \
+     (((c) & 0xFF) >> (fmt)->rshift[2]) << (fmt)->lshift[2])
+
+FB_DEFINE_LAYOUT(rgbx, UINT32, ((c & 0xFF) << 16) | ((c >> 16) & 0xFF) | (c & 0xFF00))
+FB_DEFINE_LAYOUT(mask32, UINT32, FB_PACK_MASK(c, fmt))
+FB_DEFINE_LAYOUT(mask16, UINT16, FB_PACK_MASK(c, fmt))
+
+// Canonical layout needs no conversion at all, rows go out as they are
+static UINT32 fb_pack_bgrx(const fb_format_t *fmt, UINT32 c)
+{
+    (void) fmt;
+    return c;
+}
+
+static void fb_convert_row_bgrx(const fb_format_t *fmt, void *dst, const UINT32 *src, UINTN count)
+{
+    (void) fmt;
+    fb_stream_bytes(dst, src, count * sizeof(UINT32));
+}
+
+static const fb_ops_t fb_ops_bgrx = { fb_pack_bgrx, fb_fill_row32, fb_convert_row_bgrx };
+static const fb_ops_t fb_ops_rgbx = { fb_pack_rgbx, fb_fill_row32, fb_convert_row_rgbx };
+static const fb_ops_t fb_ops_mask32 = { fb_pack_mask32, fb_fill_row32, fb_convert_row_mask32 };
+static const fb_ops_t fb_ops_mask16 = { fb_pack_mask16, fb_fill_row16, fb_convert_row_mask16 };
+
+const fb_format_t fb_format_canonical = { &fb_ops_bgrx, 4, { 0, 0, 0 }, { 16, 8, 0 } };
+
+// Work out the shifts for one channel mask, it has to be a single run of bits
+static EFI_STATUS fb_mask_shifts(UINT32 mask, OUT UINT8 *rshift, OUT UINT8 *lshift)
+{
+    INTN lo;
+    INTN width;
+
+    if (!mask) {
+        return EFI_UNSUPPORTED;
+    }
+
+    lo = LowBitSet32(mask);
+    width = HighBitSet32(mask) - lo + 1;
+    if ((mask >> lo) != (UINT32) ((1ULL << width) - 1)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // Narrow channels drop low bits, wide ones put our 8 bits at the top of the field
+    if (width <= 8) {
+        *rshift = (UINT8) (8 - width);
+        *lshift = (UINT8) lo;
+    } else {
+        *rshift = 0;
+        *lshift = (UINT8) (lo + width - 8);
+    }
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Pick the row routines and shift table for a GOP pixel format
+ * Bitmask formats are supported at 16 and 32 bits per pixel, BltOnly has no framebuffer so it is never usable
+ */
+EFI_STATUS fb_format_init(EFI_GRAPHICS_PIXEL_FORMAT pixfmt, const EFI_PIXEL_BITMASK *pixmask, OUT fb_format_t *fmt)
+{
+    EFI_STATUS status;
+    UINT32 all;
+
+    switch (pixfmt) {
+        case PixelBlueGreenRedReserved8BitPerColor:
+            *fmt = fb_format_canonical;
+            return EFI_SUCCESS;
+
+        case PixelRedGreenBlueReserved8BitPerColor:
+            *fmt = fb_format_canonical;
+            fmt->ops = &fb_ops_rgbx;
+            fmt->lshift[0] = 0;
+            fmt->lshift[2] = 16;
+            return EFI_SUCCESS;
+
+        case PixelBitMask:
+            all = pixmask->RedMask | pixmask->GreenMask | pixmask->BlueMask | pixmask->ReservedMask;
+            fmt->bpp = (UINT8) ((HighBitSet32(all) + 8) / 8);
+            if (fmt->bpp == 4) {
+                fmt->ops = &fb_ops_mask32;
+            } else if (fmt->bpp == 2) {
+                fmt->ops = &fb_ops_mask16;
+            } else {
+                return EFI_UNSUPPORTED;
+            }
+
+            status = fb_mask_shifts(pixmask->RedMask, &fmt->rshift[0], &fmt->lshift[0]);
+            if (!EFI_ERROR(status)) {
+                status = fb_mask_shifts(pixmask->GreenMask, &fmt->rshift[1], &fmt->lshift[1]);
+            }
+            if (!EFI_ERROR(status)) {
+                status = fb_mask_shifts(pixmask->BlueMask, &fmt->rshift[2], &fmt->lshift[2]);
+            }
+            return status;
+
+        default:
+            return EFI_UNSUPPORTED;
+    }
+}
+
+void fb_surface_from_gfx(const gfx_info_t *gfx_info, OUT fb_surface_t *surface)
+{
+    surface->base = (void *) gfx_info->fb_base;
+    surface->width = gfx_info->fb_hres;
+    surface->height = gfx_info->fb_vres;
+    surface->pitch = gfx_info->fb_pixline;
+    surface->fmt = &fb_format;
+}
+
+// Clip a w x h rect at (x, y) to the surface, returns FALSE if nothing is left
+static BOOLEAN fb_clip(const fb_surface_t *surface, UINT32 x, UINT32 y, UINT32 *w, UINT32 *h)
+{
+    if (x >= surface->width || y >= surface->height) {
+        return FALSE;
+    }
+
+    *w = MIN(*w, surface->width - x);
+    *h = MIN(*h, surface->height - y);
+
+    return *w && *h;
+}
+
+static inline UINT8 *fb_pixel(const fb_surface_t *surface, UINT32 x, UINT32 y)
+{
+    return (UINT8 *) surface->base + ((UINTN) y * surface->pitch + x) * surface->fmt->bpp;
+}
+
+static BOOLEAN fb_same_format(const fb_format_t *a, const fb_format_t *b)
+{
+    return a == b || (a->ops == b->ops && a->bpp == b->bpp &&
+            CompareMem(a->rshift, b->rshift, sizeof(a->rshift)) == 0 &&
+            CompareMem(a->lshift, b->lshift, sizeof(a->lshift)) == 0);
+}
+
+/*
+ * Blend 4 source pixels over 4 destination pixels using the source's top byte as alpha
+ * (s * a + d * (255 - a)) / 255 per channel, worked in 16 bit lanes with the usual exact divide by 255
+ */
+static inline __m128i fb_blend4(__m128i s, __m128i d)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i max = _mm_set1_epi16(255);
+    __m128i round = _mm_set1_epi16(128);
+    __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+    __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+    __m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i r_lo = _mm_add_epi16(_mm_mullo_epi16(s_lo, a_lo), _mm_mullo_epi16(d_lo, _mm_sub_epi16(max, a_lo)));
+    __m128i r_hi = _mm_add_epi16(_mm_mullo_epi16(s_hi, a_hi), _mm_mullo_epi16(d_hi, _mm_sub_epi16(max, a_hi)));
+
+    r_lo = _mm_add_epi16(r_lo, round);
+    r_hi = _mm_add_epi16(r_hi, round);
+    r_lo = _mm_srli_epi16(_mm_add_epi16(r_lo, _mm_srli_epi16(r_lo, 8)), 8);
+    r_hi = _mm_srli_epi16(_mm_add_epi16(r_hi, _mm_srli_epi16(r_hi, 8)), 8);
+
+    return _mm_packus_epi16(r_lo, r_hi);
+}
+
+void fb_fill_rect(fb_surface_t *dst, UINT32 x, UINT32 y, UINT32 w, UINT32 h, UINT32 color)
+{
+    UINT32 packed;
+
+    if (!fb_clip(dst, x, y, &w, &h)) {
+        return;
+    }
+
+    // Convert once for the whole rect, the row loop only stores
+    packed = dst->fmt->ops->pack(dst->fmt, color);
+
+    for (UINT32 row = 0; row < h; row++) {
+        dst->fmt->ops->fill_row(fb_pixel(dst, x, y + row), packed, w);
+    }
+
+    _mm_sfence();
+}
+
+/*
+ * Copy between surfaces of the same format, or from a canonical surface into any format
+ * Anything else (reading pixels back out of a non canonical surface) isn't supported
+ */
+void fb_copy_rect(fb_surface_t *dst, UINT32 dx, UINT32 dy,
+        const fb_surface_t *src, UINT32 sx, UINT32 sy, UINT32 w, UINT32 h)
+{
+    BOOLEAN same = (dst->base == src->base);
+    UINTN bytes;
+
+    if (!fb_clip(dst, dx, dy, &w, &h) || !fb_clip(src, sx, sy, &w, &h)) {
+        return;
+    }
+
+    if (!fb_same_format(dst->fmt, src->fmt)) {
+        if (src->fmt->ops != &fb_ops_bgrx) {
+            return;
+        }
+
+        for (UINT32 row = 0; row < h; row++) {
+            dst->fmt->ops->convert_row(dst->fmt, fb_pixel(dst, dx, dy + row), (const UINT32 *) fb_pixel(src, sx, sy + row), w);
+        }
+
+        _mm_sfence();
+        return;
+    }
+
+    bytes = (UINTN) w * dst->fmt->bpp;
+
+    // Moving a region down its own surface has to go bottom up so rows aren't overwritten before they are read
+    if (same && dy > sy) {
+        for (UINT32 row = h; row-- > 0;) {
+            fb_stream_bytes(fb_pixel(dst, dx, dy + row), fb_pixel(src, sx, sy + row), bytes);
+        }
+    } else if (same && dy == sy && dx > sx) {
+        // Overlapping sideways move within the same rows, let CopyMem deal with the overlap
+        // BaseMemoryLib rather than gBS so this still works after ExitBootServices
+        for (UINT32 row = 0; row < h; row++) {
+            CopyMem(fb_pixel(dst, dx, dy + row), fb_pixel(src, sx, sy + row), bytes);
+        }
+    } else {
+        for (UINT32 row = 0; row < h; row++) {
+            fb_stream_bytes(fb_pixel(dst, dx, dy + row), fb_pixel(src, sx, sy + row), bytes);
+        }
+    }
+
+    _mm_sfence();
+}
+
+// Nearest neighbour scale of a sw x sh canonical source rect onto a dw x dh destination rect, 16.16 fixed point steps
+void fb_blit_scaled(fb_surface_t *dst, UINT32 dx, UINT32 dy, UINT32 dw, UINT32 dh,
+        const fb_surface_t *src, UINT32 sx, UINT32 sy, UINT32 sw, UINT32 sh)
+{
+    UINT64 x_step;
+    UINT64 y_step;
+    UINT32 cw = dw;
+    UINT32 ch = dh;
+
+    if (src->fmt->ops != &fb_ops_bgrx) {
+        return;
+    }
+
+    if (!dw || !dh || !fb_clip(src, sx, sy, &sw, &sh) || !fb_clip(dst, dx, dy, &cw, &ch)) {
+        return;
+    }
+
+    x_step = ((UINT64) sw << 16) / dw;
+    y_step = ((UINT64) sh << 16) / dh;
+
+    for (UINT32 col = 0; col < cw; col += FB_ROW_PIXELS) {
+        UINT32 span = MIN(FB_ROW_PIXELS, cw - col);
+        UINT32 last_row = MAX_UINT32;
+
+        for (UINT32 row = 0; row < ch; row++) {
+            UINT32 src_row = (UINT32) ((row * y_step) >> 16);
+
+            // Only rebuild the staging row when we move on to a new source row
+            if (src_row != last_row) {
+                const UINT32 *in = (const UINT32 *) fb_pixel(src, sx, sy + src_row);
+                UINT64 pos = col * x_step;
+
+                for (UINT32 i = 0; i < span; i++, pos += x_step) {
+                    fb_row[i] = in[pos >> 16];
+                }
+
+                last_row = src_row;
+            }
+
+            dst->fmt->ops->convert_row(dst->fmt, fb_pixel(dst, dx + col, dy + row), fb_row, span);
+        }
+    }
+
+    _mm_sfence();
+}
+
+/*
+ * Alpha blend a source rect over the destination using the source's top byte as alpha
+ * Both surfaces need the same 32 bit format, and this reads the destination so it is slow straight on the framebuffer
+ */
+void fb_blend_rect(fb_surface_t *dst, UINT32 dx, UINT32 dy,
+        const fb_surface_t *src, UINT32 sx, UINT32 sy, UINT32 w, UINT32 h)
+{
+    if (!fb_same_format(dst->fmt, src->fmt) || dst->fmt->bpp != sizeof(UINT32)) {
+        return;
+    }
+
+    if (!fb_clip(dst, dx, dy, &w, &h) || !fb_clip(src, sx, sy, &w, &h)) {
+        return;
+    }
+
+    for (UINT32 row = 0; row < h; row++) {
+        UINT32 *out = (UINT32 *) fb_pixel(dst, dx, dy + row);
+        const UINT32 *in = (const UINT32 *) fb_pixel(src, sx, sy + row);
+        UINT32 i = 0;
+
+        for (; i + 4 <= w; i += 4) {
+            __m128i s = _mm_loadu_si128((const __m128i *) (in + i));
+            __m128i d = _mm_loadu_si128((const __m128i *) (out + i));
+            _mm_storeu_si128((__m128i *) (out + i), fb_blend4(s, d));
+        }
+
+        // Tail goes through the same vector path one pixel at a time
+        for (; i < w; i++) {
+            __m128i r = fb_blend4(_mm_cvtsi32_si128((int) in[i]), _mm_cvtsi32_si128((int) out[i]));
+            out[i] = (UINT32) _mm_cvtsi128_si32(r);
+        }
+    }
+}
+
+/*
+ * Map the framebuffer write-combining so our streaming stores get merged into full bursts
+ * Firmware page tables map it WB through the PAT, so the MTRR type is the one that takes effect
+ * Only the GCD will do, the cpu driver behind it programs the MTRRs on every processor. MtrrLib would only
+ * change the BSP's and x86 needs them identical on all of them, so without GCD support the framebuffer stays uncached
+ */
+EFI_STATUS fb_set_write_combining(const gfx_info_t *gfx_info)
+{
+    EFI_STATUS status;
+    EFI_GCD_MEMORY_SPACE_DESCRIPTOR desc;
+    EFI_PHYSICAL_ADDRESS base = gfx_info->fb_base & ~((EFI_PHYSICAL_ADDRESS) EFI_PAGE_MASK);
+    UINT64 size = ALIGN_VALUE(gfx_info->fb_base + gfx_info->fb_size, EFI_PAGE_SIZE) - base;
+
+    if (!gfx_info->fb_base || !gfx_info->fb_size) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    status = gDS->GetMemorySpaceDescriptor(base, &desc);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    if (!(desc.Capabilities & EFI_MEMORY_WC)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    return gDS->SetMemorySpaceAttributes(base, size, (desc.Attributes & ~FB_CACHE_ATTR_MASK) | EFI_MEMORY_WC);
+}
+
+static UINT64 fb_mbps(UINT64 bytes, UINT64 cycles, UINT64 hz)
+{
+    if (!cycles) {
+        return 0;
+    }
+
+    return (bytes * (hz / SIZE_1MB)) / cycles;
+}
+
+// Time each primitive over the whole screen and print the throughput, needs boot services for Print and Stall
+void fb_bench(const gfx_info_t *gfx_info)
+{
+    fb_surface_t fb;
+    fb_surface_t ram;
+    UINT64 hz = tsc_frequency();
+    UINT64 bytes;
+    UINT64 start;
+
+    fb_surface_from_gfx(gfx_info, &fb);
+    bytes = (UINT64) fb.width * fb.height * fb.fmt->bpp * FB_BENCH_ITERS;
+
+    // System RAM source the same size as the screen, half transparent so the blend does real work
+    ram.width = fb.width;
+    ram.height = fb.height;
+    ram.pitch = fb.width;
+    ram.fmt = &fb_format_canonical;
+    ram.base = AllocatePool((UINTN) ram.pitch * ram.height * sizeof(UINT32));
+    if (!ram.base) {
+        Print(L"fb_bench: out of memory\n");
+        return;
+    }
+    fb_fill_rect(&ram, 0, 0, ram.width, ram.height, 0x80336699);
+
+    start = AsmReadTsc();
+    for (UINT32 i = 0; i < FB_BENCH_ITERS; i++) {
+        fb_fill_rect(&fb, 0, 0, fb.width, fb.height, i * 0x00010101);
+    }
+    Print(L"fb fill   %ld MB/s\n", fb_mbps(bytes, AsmReadTsc() - start, hz));
+
+    start = AsmReadTsc();
+    for (UINT32 i = 0; i < FB_BENCH_ITERS; i++) {
+        fb_copy_rect(&fb, 0, 0, &ram, 0, 0, fb.width, fb.height);
+    }
+    Print(L"fb copy   %ld MB/s\n", fb_mbps(bytes, AsmReadTsc() - start, hz));
+
+    start = AsmReadTsc();
+    for (UINT32 i = 0; i < FB_BENCH_ITERS; i++) {
+        fb_blit_scaled(&fb, 0, 0, fb.width, fb.height, &ram, 0, 0, ram.width / 2, ram.height / 2);
+    }
+    Print(L"fb scale  %ld MB/s\n", fb_mbps(bytes, AsmReadTsc() - start, hz));
+
+    // Blending needs matching formats, so it can only run against a BGRX screen
+    if (fb_same_format(fb.fmt, ram.fmt)) {
+        start = AsmReadTsc();
+        for (UINT32 i = 0; i < FB_BENCH_ITERS; i++) {
+            fb_blend_rect(&fb, 0, 0, &ram, 0, 0, fb.width, fb.height);
+        }
+        Print(L"fb blend  %ld MB/s\n", fb_mbps(bytes, AsmReadTsc() - start, hz));
+    }
+
+    FreePool(ram.base);
+}
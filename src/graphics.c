@@ -2,11 +2,88 @@
 
 #include <Uefi.h>
 #include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/DevicePathLib.h>
 
+#include <emmintrin.h>
+
+#include "arena.h"
+#include "config.h"
+#include "framebuffer.h"
 #include "graphics.h"
 #include "info.h"
+#include "log.h"
+#include "prof.h"
+
+EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx_proto = NULL;
+
+// Decoded QOI pixels are staged here a row (or FB_ROW_PIXELS of it) at a time before being converted out
+static UINT32 qoi_row[FB_ROW_PIXELS] __attribute__((aligned(16)));
+
+// Does the cached mode belong to this handle's display
+static BOOLEAN gop_cache_matches(EFI_HANDLE handle, const gop_cache_t *cache)
+{
+    EFI_DEVICE_PATH_PROTOCOL *dp = DevicePathFromHandle(handle);
+
+    if (!dp || !cache->dp_size || cache->dp_size > GOP_CACHE_DP_MAX || GetDevicePathSize(dp) != cache->dp_size) {
+        return FALSE;
+    }
+
+    return CompareMem(dp, cache->dp, cache->dp_size) == 0;
+}
+
+// One QueryMode to make sure the cached mode still is what we picked last time
+static BOOLEAN gop_cache_valid(EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx, const gop_cache_t *cache)
+{
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = NULL;
+    fb_format_t fmt;
+    EFI_STATUS status;
+    BOOLEAN valid;
+    UINTN size;
+
+    if (cache->mode >= gfx->Mode->MaxMode) {
+        return FALSE;
+    }
+
+    PROF_ENTER(PROF_GOP_QUERY_MODE);
+    status = gfx->QueryMode(gfx, cache->mode, &size, &info);
+    PROF_EXIT(PROF_GOP_QUERY_MODE);
+    if (EFI_ERROR(status)) {
+        return FALSE;
+    }
+
+    valid = info->HorizontalResolution == cache->hres && info->VerticalResolution == cache->vres &&
+            info->PixelFormat == cache->pixfmt &&
+            !EFI_ERROR(fb_format_init(info->PixelFormat, &info->PixelInformation, &fmt));
+
+    FreePool(info);
+
+    return valid;
+}
+
+// Only updates config in memory, config_commit() decides whether it needs writing
+static void gop_cache_save(EFI_HANDLE handle, UINT32 mode, const EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info)
+{
+    EFI_DEVICE_PATH_PROTOCOL *dp = DevicePathFromHandle(handle);
+    gop_cache_t *cache = &config.gop;
+    UINTN dp_size;
+
+    // Without a device path there is no telling next boot whether it is the same display
+    ZeroMem(cache, sizeof(*cache));
+    if (!dp || (dp_size = GetDevicePathSize(dp)) > GOP_CACHE_DP_MAX) {
+        return;
+    }
+
+    cache->mode = mode;
+    cache->hres = info->HorizontalResolution;
+    cache->vres = info->VerticalResolution;
+    cache->pixfmt = info->PixelFormat;
+    cache->dp_size = (UINT32) dp_size;
+    CopyMem(cache->dp, dp, dp_size);
+}
 
 /* TODO: collapse status->efi_error blocks maybe
 * TODO: do i need to free the info and gfx results?? info is callee allocated 
@@ -20,8 +97,9 @@ EFI_STATUS init_graphics(OUT gfx_info_t *gfx_info)
     UINT32 mode;
     EFI_HANDLE *handles = NULL;
     UINTN nr_handles;
+    BOOLEAN cached = FALSE;
 
-    Print(L"Entering init graphics, gfx_info: %X\n", gfx_info);
+    LOG(LOG_DEBUG, LOG_GFX_INIT, (UINTN) gfx_info);
 
     // old gnu-efi call
     //status = LibLocateHandle(ByProtocol, &gEfiGraphicsOutputProtocolGuid, NULL, &nr_handles, &handles);
@@ -31,14 +109,13 @@ EFI_STATUS init_graphics(OUT gfx_info_t *gfx_info)
     status = gBS->LocateHandle(ByProtocol, &gEfiGraphicsOutputProtocolGuid, NULL, &nr_handles, handles);
     if (status == EFI_BUFFER_TOO_SMALL) {
         nr_handles += SIZE_1KB;
-        handles = AllocateZeroPool(nr_handles);
+        handles = arena_alloc_zero(&arena_scratch, nr_handles);
+        if (!handles) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
         status = gBS->LocateHandle(ByProtocol, &gEfiGraphicsOutputProtocolGuid, NULL, &nr_handles, handles);
-        
         if (EFI_ERROR(status)) {
-            if (handles) {
-                FreePool(handles);
-                handles = NULL;
-            }
             return status; 
         }
 
@@ -60,26 +137,48 @@ EFI_STATUS init_graphics(OUT gfx_info_t *gfx_info)
             continue;
         }
 
-        status = find_mode(gfx, &mode);
-        if (EFI_ERROR(status)) {
-            Print(L"No mode found for handle %d\n", iter);
-            continue;
+        // Same display as last boot, one QueryMode confirms the cached mode instead of querying all of them
+        if (gop_cache_matches(handle, &config.gop) && gop_cache_valid(gfx, &config.gop)) {
+            mode = config.gop.mode;
+            cached = TRUE;
+            LOG(LOG_INFO, LOG_GFX_MODE_CACHED, mode);
+        } else {
+            PROF_ENTER(PROF_GFX_FIND_MODE);
+            status = find_mode(gfx, &mode);
+            PROF_EXIT(PROF_GFX_FIND_MODE);
+            if (EFI_ERROR(status)) {
+                LOG(LOG_WARN, LOG_GFX_NO_MODE, iter);
+                continue;
+            }
         }
 
+        PROF_ENTER(PROF_GOP_SET_MODE);
         status = gfx->SetMode(gfx, mode);
+        PROF_EXIT(PROF_GOP_SET_MODE);
         if (EFI_ERROR(status)) {
-            Print(L"Failed to set mode for handle %d mode %d\n", iter, mode);
+            LOG(LOG_ERROR, LOG_GFX_SET_MODE_FAILED, mode, iter, status);
             break;
         }
 
+        PROF_ENTER(PROF_GOP_QUERY_MODE);
         status = gfx->QueryMode(gfx, mode, &size, &info);
+        PROF_EXIT(PROF_GOP_QUERY_MODE);
         if (EFI_ERROR(status)) {
-            Print(L"Failed to read set mode for handle %d mode %d\n", iter, mode);
+            LOG(LOG_ERROR, LOG_GFX_QUERY_FAILED, mode, iter, status);
             if (info) {
                 FreePool(info);
                 info = NULL;
             }
             break;
+        }
+
+        // Pick the blitters for this layout once, a mode without them is no use to anything after us
+        status = fb_format_init(info->PixelFormat, &info->PixelInformation, &fb_format);
+        if (EFI_ERROR(status)) {
+            LOG(LOG_ERROR, LOG_GFX_BAD_FORMAT, mode, iter, info->PixelFormat);
+            FreePool(info);
+            info = NULL;
+            break;
         } else {
             // Copy out all data we care about to our gfx_info struct
             gfx_info->fb_hres = info->HorizontalResolution;
@@ -89,6 +188,13 @@ EFI_STATUS init_graphics(OUT gfx_info_t *gfx_info)
             gfx_info->fb_pixfmt = info->PixelFormat;
             gfx_info->fb_pixmask = info->PixelInformation;
             gfx_info->fb_pixline = info->PixelsPerScanLine;
+            gfx_proto = gfx;
+            gfx_info->fb_bpp = fb_format.bpp;
+            LOG(LOG_INFO, LOG_GFX_MODE_SET, mode, gfx_info->fb_hres, gfx_info->fb_vres, gfx_info->fb_pixfmt);
+
+            if (!cached) {
+                gop_cache_save(handle, mode, info);
+            }
 
             if (info) {
                 FreePool(info);
@@ -98,10 +204,6 @@ EFI_STATUS init_graphics(OUT gfx_info_t *gfx_info)
         }
     }
 
-    if (handles) {
-        FreePool(handles);
-    }
-
     return status;
 }
 
@@ -110,7 +212,7 @@ EFI_STATUS init_graphics_conf(OUT gfx_config_t *gfx_config)
     EFI_HANDLE  *gfx_handles;
     EFI_STATUS  status;
     UINT64      size;
-    UINTN       num_handles = 0
+    UINTN       num_handles = 0;
     gfx_config->num_protos = 0;
 
     CHAR16 *pxl_fmts[] = {
@@ -122,34 +224,39 @@ EFI_STATUS init_graphics_conf(OUT gfx_config_t *gfx_config)
     };
 
 
-    status = gBS->LocateHandleBuffer(ByProtocol, &GraphicsOutputProtocol, NULL, &num_handles, &gfx_handles);
+    status = gBS->LocateHandleBuffer(ByProtocol, &gEfiGraphicsOutputProtocolGuid, NULL, &num_handles, &gfx_handles);
     if (EFI_ERROR(status)) {
-        Print(L"GraphicsTable LocateHandleBuffer failed.\n");
+        LOG(LOG_ERROR, LOG_GFX_LOCATE_FAILED, status);
         return status;
     }
 
     // TODO: Finish writing the selection stuff
 
+    FreePool(gfx_handles);
+    return status;
 }
 
 /*
  * Iterate through the available modes and find whichever one makes best use of the display
- *
- * TODO: do I need to free all these info allocations? being able to use base_info and pointing it to a later orphaned info block seems to say yes
+ * Only modes the framebuffer code has blitters for are picked, EFI_UNSUPPORTED if there are none
  */
 EFI_STATUS find_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx, OUT UINT32 *mode)
 {
     EFI_STATUS status;
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *base_info;
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *base_info = NULL;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = NULL;
+    BOOLEAN found = FALSE;
+    fb_format_t fmt;
     UINTN size;
 
-    Print(L"Entering find mode, gfx: %X\n", gfx);
+    LOG(LOG_DEBUG, LOG_GFX_FIND_MODE, gfx->Mode->MaxMode, (UINTN) gfx);
 
     // Get the base mode for comparison against later
+    PROF_ENTER(PROF_GOP_QUERY_MODE);
     status = gfx->QueryMode(gfx, gfx->Mode->Mode, &size, &base_info);
+    PROF_EXIT(PROF_GOP_QUERY_MODE);
     if (EFI_ERROR(status)) {
-        Print(L"Query for mode %d failed\n", gfx->Mode->Mode);
+        LOG(LOG_ERROR, LOG_GFX_FIND_MODE_QUERY_FAILED, gfx->Mode->Mode, status);
         if (base_info) {
             FreePool(base_info);
             base_info = NULL;
@@ -157,27 +264,35 @@ EFI_STATUS find_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx, OUT UINT32 *mode)
         return status;
     }
 
-    // Set base values
-    *mode = gfx->Mode->Mode;
+    // Start from the current mode if we can draw to it, otherwise from the first mode we can
+    if (EFI_ERROR(fb_format_init(base_info->PixelFormat, &base_info->PixelInformation, &fmt))) {
+        FreePool(base_info);
+        base_info = NULL;
+    } else {
+        *mode = gfx->Mode->Mode;
+        found = TRUE;
+    }
 
     for (UINT32 iter = 0; iter < gfx->Mode->MaxMode; iter++) {
+        PROF_ENTER(PROF_GOP_QUERY_MODE);
         status = gfx->QueryMode(gfx, iter, &size, &info);
+        PROF_EXIT(PROF_GOP_QUERY_MODE);
         if (EFI_ERROR(status)) {
-            Print(L"Query for mode %d failed\n", iter);
+            LOG(LOG_ERROR, LOG_GFX_FIND_MODE_QUERY_FAILED, iter, status);
             if (info) FreePool(info);
+            info = NULL;
             break;
         }
 
-        // We want one of these pixel formats probably?
-        if (info->PixelFormat != PixelRedGreenBlueReserved8BitPerColor &&
-             info->PixelFormat != PixelBlueGreenRedReserved8BitPerColor) {
+        // Skip anything the framebuffer code has no blitters for
+        if (EFI_ERROR(fb_format_init(info->PixelFormat, &info->PixelInformation, &fmt))) {
             FreePool(info);
             info = NULL;
             continue;
         }
 
-        // Skip if this mode is greater than what we want
-        if (info->VerticalResolution > DESIRED_V_RES &&
+        // Skip if this mode is greater than what we want, unless it is the only one we can use so far
+        if (base_info && info->VerticalResolution > DESIRED_V_RES &&
              info->HorizontalResolution > DESIRED_H_RES) {
             FreePool(info);
             info = NULL;
@@ -188,46 +303,100 @@ EFI_STATUS find_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx, OUT UINT32 *mode)
         if (info->VerticalResolution == DESIRED_V_RES &&
              info->HorizontalResolution == DESIRED_H_RES) {
             *mode = iter;
+            found = TRUE;
             FreePool(info);
             info = NULL;
             break;
-        } else if (info->VerticalResolution > base_info->VerticalResolution) {
-            FreePool(base_info);
+        } else if (!base_info || info->VerticalResolution > base_info->VerticalResolution) {
+            if (base_info) {
+                FreePool(base_info);
+            }
             base_info = info;
+            *mode = iter;
+            found = TRUE;
+        } else {
+            FreePool(info);
         }
+        info = NULL;
     }
 
-    Print(L"Exiting find mode\n");
     if (base_info) {
         FreePool(base_info);
         base_info = NULL;
     }
 
-    return status;
+    // A query failing part way through still leaves whatever was picked before it usable
+    if (!found) {
+        return EFI_ERROR(status) ? status : EFI_UNSUPPORTED;
+    }
+
+    LOG(LOG_DEBUG, LOG_GFX_FIND_MODE_DONE, *mode);
+
+    return EFI_SUCCESS;
 }
 
 // test graphics, taken from some osdev post
-void draw_triangle(const gfx_info_t *gfx_info) {
-    UINT32 *loc = (UINT32 *)gfx_info->fb_base;
-    UINTN row, col;
+void draw_triangle(fb_surface_t *fb) {
+    UINTN row;
     UINT32 color = 0x00ff55ff;
     UINTN width = 100;
+    UINT32 x = fb->width / 2 - width / 2;
+    UINT32 y = fb->height / 2 - 25;
 
-    loc += (gfx_info->fb_hres * (gfx_info->fb_vres / 2 - 25) + (gfx_info->fb_hres / 2) - width / 2);
-
+    // Two scanlines per step, each step in by one pixel and two shorter
     for (row = 0; row < width / 2; row++) {
-        for (col = 0; col < width - row * 2; col++) {
-            *loc++ = color;
-        }
+        fb_fill_rect(fb, x + row, y + row * 2, width - row * 2, 2, color);
+    }
 
-        loc += (gfx_info->fb_hres - col);
-        
-        for (col = 0; col < width - row * 2; col++) {
-            *loc++ = color;
-        }
+    return;
+}
 
-        loc += (gfx_info->fb_hres - col + 1);
+/*
+ * Decode a QOI image with its top left corner at (x, y), clipped to the surface
+ * Rows are decoded into a staging buffer and converted straight into the surface's pixel format with streaming stores,
+ * so nothing is ever read back from video memory. Alpha is ignored, the image is drawn opaque
+ */
+EFI_STATUS draw_qoi(fb_surface_t *fb, UINT32 x, UINT32 y, const void *data, UINTN size)
+{
+    EFI_STATUS status;
+    qoi_state_t qs;
+    const UINT8 *p = (const UINT8 *) data + QOI_HEADER_SIZE;
+    const UINT8 *end = (const UINT8 *) data + size - QOI_END_SIZE;
+    UINT32 width;
+    UINT32 height;
+    UINT32 rows;
+
+    status = qoi_info(data, size, &width, &height);
+    if (EFI_ERROR(status)) {
+        return status;
     }
 
-    return;
+    if (x >= fb->width || y >= fb->height) {
+        return EFI_SUCCESS;
+    }
+
+    qoi_init(&qs);
+
+    // Rows past the bottom of the surface are never seen, stop decoding there
+    rows = MIN(height, fb->height - y);
+
+    for (UINT32 row = 0; row < rows; row++) {
+        UINT8 *out = (UINT8 *) fb->base + ((UINTN) (y + row) * fb->pitch + x) * fb->fmt->bpp;
+
+        for (UINT32 col = 0; col < width; col += FB_ROW_PIXELS) {
+            UINT32 span = MIN(FB_ROW_PIXELS, width - col);
+
+            p = qoi_decode_span(&qs, p, end, qoi_row, span);
+
+            // Columns off the right edge still have to be decoded to keep the stream in step
+            if (x + col < fb->width) {
+                UINT32 visible = MIN(span, fb->width - x - col);
+                fb->fmt->ops->convert_row(fb->fmt, out + (UINTN) col * fb->fmt->bpp, qoi_row, visible);
+            }
+        }
+    }
+
+    _mm_sfence();
+
+    return EFI_SUCCESS;
 }
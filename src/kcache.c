@@ -0,0 +1,128 @@
+/*
+ * Kernel image cache for warm reboots
+ *
+ * A cold boot reads the kernel file into its own page run and records the run's address and a hash of it.
+ * A warm reset leaves RAM alone, so the next boot claims the same pages with AllocateAddress and, if they
+ * still hash the same, parses the kernel from there instead of reading the file again
+ */
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "boot_services.h"
+#include "kcache.h"
+#include "log.h"
+
+#define KCACHE_PRIME_1  0x9E3779B185EBCA87ULL
+#define KCACHE_PRIME_2  0xC2B2AE3D27D4EB4FULL
+#define KCACHE_PRIME_3  0x165667B19E3779F9ULL
+
+// Unaligned 64 bit loads, the image can start anywhere in a buffer handed to kcache_hash
+typedef UINT64 __attribute__((may_alias, aligned(1))) kcache_u64_t;
+
+static inline UINT64 kcache_rotl(UINT64 x, UINT32 r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline UINT64 kcache_round(UINT64 h, UINT64 v)
+{
+    return kcache_rotl(h + v * KCACHE_PRIME_2, 31) * KCACHE_PRIME_1;
+}
+
+/*
+ * Four independent lanes over 32 bytes at a time so the multiplies overlap, then a final avalanche
+ * Catches memory that was reused or scribbled on, it is not meant to stand up to anyone forging an image
+ */
+UINT64 kcache_hash(const void *data, UINTN size)
+{
+    const UINT8 *p = data;
+    const UINT8 *end = p + size;
+    UINT64 h[4] = { KCACHE_PRIME_1 + KCACHE_PRIME_2, KCACHE_PRIME_2, 0, -KCACHE_PRIME_1 };
+    UINT64 acc;
+
+    for (; end - p >= 32; p += 32) {
+        h[0] = kcache_round(h[0], ((const kcache_u64_t *) p)[0]);
+        h[1] = kcache_round(h[1], ((const kcache_u64_t *) p)[1]);
+        h[2] = kcache_round(h[2], ((const kcache_u64_t *) p)[2]);
+        h[3] = kcache_round(h[3], ((const kcache_u64_t *) p)[3]);
+    }
+
+    acc = kcache_rotl(h[0], 1) + kcache_rotl(h[1], 7) + kcache_rotl(h[2], 12) + kcache_rotl(h[3], 18) + size;
+
+    for (; end - p >= 8; p += 8) {
+        acc = kcache_rotl(acc ^ kcache_round(0, *(const kcache_u64_t *) p), 27) * KCACHE_PRIME_1 + KCACHE_PRIME_3;
+    }
+
+    for (; p < end; p++) {
+        acc = kcache_rotl(acc ^ (*p * KCACHE_PRIME_3), 11) * KCACHE_PRIME_1;
+    }
+
+    acc ^= acc >> 33;
+    acc *= KCACHE_PRIME_2;
+    acc ^= acc >> 29;
+    acc *= KCACHE_PRIME_3;
+    acc ^= acc >> 32;
+
+    return acc;
+}
+
+// Page run of its own for the kernel file, outside the arenas so nothing else shares its pages
+void *kcache_alloc(UINTN size)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS base = 0;
+
+    status = bs->allocate_pages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(size), &base);
+    if (EFI_ERROR(status)) {
+        return NULL;
+    }
+
+    return (void *) (UINTN) base;
+}
+
+// The image a previous boot recorded, claimed and checked, NULL if anything about it doesn't match
+void *kcache_lookup(const kcache_t *cache, UINT64 size, const EFI_TIME *mtime)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS base = cache->base;
+    UINTN pages = EFI_SIZE_TO_PAGES(size);
+    UINT64 start = AsmReadTsc();
+
+    if (!cache->base) {
+        LOG(LOG_INFO, LOG_KCACHE_EMPTY);
+        return NULL;
+    }
+
+    if (cache->size != size || CompareMem(&cache->mtime, mtime, sizeof(EFI_TIME)) != 0) {
+        LOG(LOG_INFO, LOG_KCACHE_FILE_CHANGED, cache->size, size);
+        return NULL;
+    }
+
+    // Fails when firmware has used any of the pages this boot, which already rules the copy out
+    status = bs->allocate_pages(AllocateAddress, EfiLoaderData, pages, &base);
+    if (EFI_ERROR(status)) {
+        LOG(LOG_INFO, LOG_KCACHE_PAGES_TAKEN, cache->base, pages, status);
+        return NULL;
+    }
+
+    if (kcache_hash((void *) (UINTN) base, size) != cache->hash) {
+        bs->free_pages(base, pages);
+        LOG(LOG_INFO, LOG_KCACHE_HASH_MISMATCH, cache->base, AsmReadTsc() - start);
+        return NULL;
+    }
+
+    LOG(LOG_INFO, LOG_KCACHE_HIT, base, size, AsmReadTsc() - start);
+
+    return (void *) (UINTN) base;
+}
+
+// Remember image for the next boot, config_commit() only writes it out when it moved or changed
+void kcache_record(OUT kcache_t *cache, const void *image, UINT64 size, const EFI_TIME *mtime)
+{
+    cache->base = (UINTN) image;
+    cache->size = size;
+    cache->hash = kcache_hash(image, size);
+    CopyMem(&cache->mtime, mtime, sizeof(EFI_TIME));
+}
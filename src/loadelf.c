@@ -1,32 +1,65 @@
 #include <Uefi.h>
 #include <Library/UefiLib.h>
-#include <Library/MemoryAllocationLib.h>
-#include <Library/UefiRuntimeServicesTableLib.h>
-#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseMemoryLib.h>
 #include <Protocol/SimpleFileSystem.h>
 
 #include <elf.h>
 
+#include "arena.h"
+#include "boot_services.h"
 #include "info.h"
+#include "loadelf.h"
+#include "log.h"
 #include "util.h"
 
 /*
  * TODO:
  * * Implement relocations
- * * 
+ * *
  */
 
-EFI_STATUS EFIAPI elf_verify_hdr_mem(void *elf_bin) 
+// Forced inline so each public loader gets its own copy of the core with source and placement folded away
+#define ELF_INLINE static inline __attribute__((always_inline))
+
+typedef enum {
+    ELF_SOURCE_MEM,
+    ELF_SOURCE_FILE,
+} elf_source_t;
+
+typedef enum {
+    ELF_PLACE_FIXED,
+    ELF_PLACE_RELO,
+    ELF_PLACE_ALIGNED,
+} elf_place_t;
+
+// A PT_LOAD segment that passed validation, placed at offset from the start of the image's page run
+typedef struct {
+    UINT64  file_offset;
+    UINT64  filesz;
+    UINT64  memsz;
+    UINT64  offset;
+} elf_seg_t;
+
+typedef struct {
+    Elf64_Ehdr  hdr;
+    UINT64      start; // Page aligned lowest p_paddr or p_vaddr, depending on placement
+    UINT64      end;
+    UINT64      align;
+    UINT32      num_segs;
+    elf_seg_t   segs[ELF_MAX_LOADS];
+} elf_image_t;
+
+// Sanity check the ELF header, anything the loaders index with has to be sane too
+static EFI_STATUS elf_check_hdr(const Elf64_Ehdr *hdr)
 {
-    Elf64_Ehdr *hdr = (Elf64_Ehdr *) elf_bin;
-
-    // Sanity check the ELF header, e_machine value from Wikipedia for x86-64
     if (memcmp(&(hdr->e_ident[EI_MAG0]), ELFMAG, SELFMAG) != 0 ||
             hdr->e_ident[EI_CLASS] != ELFCLASS64 ||
-            hdr->e_ident[EI_DATA] != ELFDATANONE ||
+            hdr->e_ident[EI_DATA] != ELFDATA2LSB ||
             hdr->e_type != ET_DYN ||
-            hdr->e_machine != 0x3E ||
-            hdr->e_version != EV_CURRENT
+            hdr->e_machine != EM_X86_64 ||
+            hdr->e_version != EV_CURRENT ||
+            hdr->e_phentsize < sizeof(Elf64_Phdr) ||
+            hdr->e_phnum == 0
        ) {
         return EFI_LOAD_ERROR;
     }
@@ -34,235 +67,267 @@ EFI_STATUS EFIAPI elf_verify_hdr_mem(void *elf_bin)
     return EFI_SUCCESS;
 }
 
-// Parse the ELF in memory and load it into the desired memory sections
-// Returns the entry point address
-EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem(void *elf_bin)
+// Copy size bytes at offset in the image to dst, from memory this can't fail and the caller's check folds away
+ELF_INLINE EFI_STATUS elf_read(elf_source_t source, void *src, UINT64 offset, UINTN size, void *dst)
 {
-    Elf64_Ehdr *hdr = (Elf64_Ehdr *) elf_bin;
-    Elf64_Phdr *phdrs = (Elf64_Phdr *) ((UINT8 *) elf_bin + hdr->e_phoff);
-    Elf64_Phdr *phdr = NULL;
+    EFI_FILE *file = (EFI_FILE *) src;
+    UINTN read = size;
     EFI_STATUS status;
 
-    for (phdr = phdrs; 
-            (UINT8 *) phdr < (UINT8 *) phdrs + (hdr->e_phnum * hdr->e_phentsize); 
-            phdr = (Elf64_Phdr *) ((UINT8 *) phdr + hdr->e_phentsize)) {
-        switch (phdr->p_type) {
-            case PT_LOAD: {
-                // 4KB pages, get number of pages this segment takes, rounding up
-                UINT64 pages = (phdr->p_memsz + 4096 - 1) & (-4096);
-                EFI_PHYSICAL_ADDRESS segment = phdr->p_paddr;
-                status = gBS->AllocatePages(AllocateAddress, EfiLoaderData, pages, &segment);
-
-                if (EFI_ERROR(status)) {
-                    Print(L"Failed to allocate pages for elf load\n");
-                    return 0;
-                }
-
-                gBS->CopyMem((void *) segment, (void *) ((UINT8 *) elf_bin + phdr->p_offset), phdr->p_filesz);
-                break;
-            }
-        }
+    if (source == ELF_SOURCE_MEM) {
+        CopyMem(dst, (UINT8 *) src + offset, size);
+        return EFI_SUCCESS;
+    }
+
+    status = file->SetPosition(file, offset);
+    if (EFI_ERROR(status)) {
+        LOG(LOG_ERROR, LOG_ELF_SEEK_FAILED, offset, status);
+        return status;
     }
 
-    return (EFI_PHYSICAL_ADDRESS) hdr->e_entry;
+    status = file->Read(file, &read, dst);
+    if (!EFI_ERROR(status) && read != size) {
+        status = EFI_END_OF_FILE;
+    }
+    if (EFI_ERROR(status)) {
+        LOG(LOG_ERROR, LOG_ELF_READ_FAILED, size, status);
+    }
+
+    return status;
 }
 
-// Returns entry point address
-EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem_relo(void *elf_bin)
+/*
+ * All validation happens here, once, before anything is allocated: the header, the program header table
+ * and every PT_LOAD, whose file bytes have to lie within the image when its size is known
+ * What survives is a dense list of segments so the copy loop has nothing left to check
+ */
+ELF_INLINE EFI_STATUS elf_scan(elf_source_t source, elf_place_t place, void *src, UINTN size, OUT elf_image_t *img)
 {
-    Elf64_Ehdr *hdr = (Elf64_Ehdr *) elf_bin;
-    Elf64_Phdr *phdrs = (Elf64_Phdr *) ((UINT8 *) elf_bin + hdr->e_phoff);
-    UINT64 vsize = 0;
-    UINT64 vmin = -1; // UINT64_MAX
-    UINTN size;
+    Elf64_Ehdr *hdr = &img->hdr;
+    UINT8 *phdrs;
+    UINTN phsize;
     EFI_STATUS status;
 
-    for (UINT64 i = 0; i < hdr->e_phnum; i++) {
-        Elf64_Phdr *phdr = &phdrs[i];
-        if (phdr->p_type == PT_LOAD) {
-            if (vsize < (phdr->p_vaddr + phdr->p_memsz)) {
-                vsize = phdr->p_vaddr + phdr->p_memsz;
-            }
-
-            if (vmin > phdr->p_vaddr) {
-                vmin = phdr->p_vaddr;
-            }            
-        }
+    if (source == ELF_SOURCE_MEM && size < sizeof(Elf64_Ehdr)) {
+        LOG(LOG_ERROR, LOG_ELF_BAD_HEADER, 0, 0, size);
+        return EFI_LOAD_ERROR;
     }
 
-    UINT64 pages = (vsize - vmin + EFI_PAGE_MASK) >> EFI_PAGE_SHIFT;
-
-    EFI_PHYSICAL_ADDRESS allocmem = 0x400000; // Default ELF load base
-    status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, pages, &allocmem);
+    status = elf_read(source, src, 0, sizeof(Elf64_Ehdr), hdr);
     if (EFI_ERROR(status)) {
-        Print(L"Failed to allocate pages for elf load\n");
-        return 0;
+        return status;
     }
 
-    for (UINT64 i = 0; i < hdr->e_phnum; i++) {
-        Elf64_Phdr *phdr = &phdrs[i];
-        UINTN segsize = phdr->p_filesz;
-        EFI_PHYSICAL_ADDRESS segment = allocmem + phdr->p_vaddr;
+    phsize = (UINTN) hdr->e_phnum * hdr->e_phentsize;
+    if (EFI_ERROR(elf_check_hdr(hdr)) ||
+            (source == ELF_SOURCE_MEM && (hdr->e_phoff > size || phsize > size - hdr->e_phoff))) {
+        LOG(LOG_ERROR, LOG_ELF_BAD_HEADER, hdr->e_phnum, hdr->e_phentsize, hdr->e_phoff);
+        return EFI_LOAD_ERROR;
+    }
 
-        if (phdr->p_type == PT_LOAD) {
-            gBS->CopyMem((void *) segment, (void *) ((UINT8 *) elf_bin + phdr->p_offset), phdr->p_filesz);
+    if (source == ELF_SOURCE_MEM) {
+        phdrs = (UINT8 *) src + hdr->e_phoff;
+    } else {
+        phdrs = arena_alloc(&arena_scratch, phsize);
+        if (!phdrs) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        status = elf_read(source, src, hdr->e_phoff, phsize, phdrs);
+        if (EFI_ERROR(status)) {
+            return status;
         }
     }
 
-    return (EFI_PHYSICAL_ADDRESS) (allocmem + hdr->e_entry);
-}
+    img->start = MAX_UINT64;
+    img->end = 0;
+    img->align = EFI_PAGE_SIZE;
+    img->num_segs = 0;
 
-EFI_STATUS EFIAPI elf_verify_hdr_file(EFI_FILE *elf_file) 
-{
-    Elf64_Ehdr hdr;
-    UINT64 pos;
-    UINTN size;
+    // Stride by e_phentsize, newer ABIs may append fields to Elf64_Phdr
+    for (UINTN i = 0; i < hdr->e_phnum; i++) {
+        const Elf64_Phdr *phdr = (const Elf64_Phdr *) (phdrs + i * hdr->e_phentsize);
+        UINT64 addr = (place == ELF_PLACE_FIXED) ? phdr->p_paddr : phdr->p_vaddr;
+        elf_seg_t *seg;
 
-    // Get current position
-    elf_file->GetPosition(elf_file, &pos);
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+            continue;
+        }
 
-    // Read in header
-    size = sizeof(Elf64_Ehdr);
-    elf_file->Read(elf_file, &size, &hdr);
+        if (phdr->p_filesz > phdr->p_memsz || addr + phdr->p_memsz < addr ||
+                (source == ELF_SOURCE_MEM && (phdr->p_offset > size || phdr->p_filesz > size - phdr->p_offset))) {
+            LOG(LOG_ERROR, LOG_ELF_BAD_SEGMENT, i, phdr->p_offset, phdr->p_filesz, phdr->p_memsz);
+            return EFI_LOAD_ERROR;
+        }
 
-    // Reset position
-    elf_file->SetPosition(elf_file, pos);
+        if (img->num_segs == ELF_MAX_LOADS) {
+            LOG(LOG_ERROR, LOG_ELF_TOO_MANY_SEGMENTS, ELF_MAX_LOADS);
+            return EFI_UNSUPPORTED;
+        }
 
-    // Sanity check the ELF header
-    if (memcmp(&(hdr.e_ident[EI_MAG0]), ELFMAG, SELFMAG) != 0 ||
-            hdr.e_ident[EI_CLASS] != ELFCLASS64 ||
-            hdr.e_ident[EI_DATA] != ELFDATANONE ||
-            hdr.e_type != ET_DYN ||
-            hdr.e_machine != EM_X86_64 ||
-            hdr.e_version != EV_CURRENT
-       ) {
+        seg = &img->segs[img->num_segs++];
+        seg->file_offset = phdr->p_offset;
+        seg->filesz = phdr->p_filesz;
+        seg->memsz = phdr->p_memsz;
+        seg->offset = addr;
+
+        img->start = MIN(img->start, addr);
+        img->end = MAX(img->end, addr + phdr->p_memsz);
+
+        // Bogus alignments are ignored rather than rejected, they only matter to the aligned placement
+        if (phdr->p_align > img->align && (phdr->p_align & (phdr->p_align - 1)) == 0) {
+            img->align = MIN(phdr->p_align, ELF_MAX_ALIGN);
+        }
+    }
+
+    if (img->num_segs == 0) {
+        LOG(LOG_ERROR, LOG_ELF_BAD_HEADER, hdr->e_phnum, hdr->e_phentsize, hdr->e_phoff);
         return EFI_LOAD_ERROR;
     }
 
+    // The lowest segment lands at the start of the run, the rest keep their offsets from it
+    img->start &= ~(UINT64) EFI_PAGE_MASK;
+    for (UINT32 i = 0; i < img->num_segs; i++) {
+        img->segs[i].offset -= img->start;
+    }
+
     return EFI_SUCCESS;
 }
 
-// Returns entry point address
-EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file(EFI_FILE *elf_file)
+/*
+ * One page run for the whole image whatever the placement, so segments sharing a page don't collide
+ * The aligned run is over-allocated by the alignment and the slack on either side handed back. It is the
+ * load bias that gets aligned, so every address keeps its link time offset within an ELF_MAX_ALIGN page
+ */
+ELF_INLINE EFI_STATUS elf_place(elf_place_t place, const elf_image_t *img, OUT EFI_PHYSICAL_ADDRESS *base)
 {
-    Elf64_Ehdr hdr;
-    UINT64 pos;
-    Elf64_Phdr *phdrs = NULL;
-    Elf64_Phdr *phdr = NULL;
-    UINTN size;
+    UINTN pages = EFI_SIZE_TO_PAGES(img->end - img->start);
+    UINTN slack = EFI_SIZE_TO_PAGES(img->align) - 1;
+    UINT64 phase = img->start & (img->align - 1);
+    UINTN head;
+    EFI_PHYSICAL_ADDRESS mem = 0;
     EFI_STATUS status;
 
-    // Get current position
-    elf_file->GetPosition(elf_file, &pos);
-
-    // Read in header
-    size = sizeof(Elf64_Ehdr);
-    elf_file->Read(elf_file, &size, &hdr);
-
-    elf_file->SetPosition(elf_file, hdr.e_phoff);
-
-    size = hdr.e_phnum * hdr.e_phentsize;
-    phdrs = AllocateZeroPool(size);
-    elf_file->Read(elf_file, &size, phdrs); 
-
-    for (phdr = phdrs; 
-            (UINT8 *) phdr < (UINT8 *) phdrs + (hdr.e_phnum * hdr.e_phentsize); 
-            phdr = (Elf64_Phdr *) ((UINT8 *) phdr + hdr.e_phentsize)) {
-        switch (phdr->p_type) {
-            case PT_LOAD: {
-                // 4KB pages, get number of pages this segment takes, rounding up
-                UINT64 pages = (phdr->p_memsz + 4096 - 1) & (-4096);
-                EFI_PHYSICAL_ADDRESS segment = phdr->p_paddr;
-                UINTN lsz = 0;
-                status = gBS->AllocatePages(AllocateAddress, EfiLoaderData, pages, &segment);
-                
-                if (EFI_ERROR(status)) {
-                    Print(L"Failed to allocate pages for elf load\n");
-                    return 0;
-                }
-
-                elf_file->SetPosition(elf_file, phdr->p_offset);
-                lsz = phdr->p_filesz;
-                elf_file->Read(elf_file, &lsz, (void *) segment);
-                break;
+    if (place == ELF_PLACE_FIXED) {
+        *base = img->start;
+        status = bs->allocate_pages(AllocateAddress, EfiLoaderData, pages, base);
+    } else if (place == ELF_PLACE_RELO || slack == 0) {
+        status = bs->allocate_pages(AllocateAnyPages, EfiLoaderData, pages, base);
+    } else {
+        status = bs->allocate_pages(AllocateAnyPages, EfiLoaderData, pages + slack, &mem);
+        if (!EFI_ERROR(status)) {
+            *base = ALIGN_VALUE(mem - phase, img->align) + phase;
+            head = EFI_SIZE_TO_PAGES(*base - mem);
+            if (head) {
+                bs->free_pages(mem, head);
+            }
+            if (slack - head) {
+                bs->free_pages(*base + EFI_PAGES_TO_SIZE(pages), slack - head);
             }
         }
     }
 
-    // Reset position
-    elf_file->SetPosition(elf_file, pos);
+    if (EFI_ERROR(status)) {
+        LOG(LOG_ERROR, LOG_ELF_ALLOC_FAILED, pages, status);
+    }
 
-    return (EFI_PHYSICAL_ADDRESS) hdr.e_entry;
+    return status;
 }
 
-// Returns entry point address
-EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file_relo(EFI_FILE *elf_file)
+// Returns entry point address, 0 on failure
+ELF_INLINE EFI_PHYSICAL_ADDRESS elf_load(elf_source_t source, elf_place_t place, void *src, UINTN size)
 {
-    Elf64_Ehdr hdr;
-    UINT64 pos;
-    UINT64 vsize = 0;
-    UINT64 vmin = -1; // UINT64_MAX
-    UINTN size;
+    EFI_FILE *file = (EFI_FILE *) src;
+    elf_image_t img;
+    EFI_PHYSICAL_ADDRESS base = 0;
+    EFI_PHYSICAL_ADDRESS entry = 0;
+    UINT64 pos = 0;
     EFI_STATUS status;
 
-    // Get current position
-    elf_file->GetPosition(elf_file, &pos);
-
-    // Read in header
-    size = sizeof(Elf64_Ehdr);
-    elf_file->Read(elf_file, &size, &hdr);
-
-    elf_file->SetPosition(elf_file, hdr.e_phoff);
+    if (source == ELF_SOURCE_FILE) {
+        file->GetPosition(file, &pos);
+    }
 
-    Elf64_Phdr phdrs[hdr.e_phnum];
-    size = hdr.e_phnum * hdr.e_phentsize;
+    status = elf_scan(source, place, src, size, &img);
+    if (!EFI_ERROR(status)) {
+        status = elf_place(place, &img, &base);
+    }
 
-    elf_file->Read(elf_file, &size, &phdrs[0]); 
+    if (!EFI_ERROR(status)) {
+        for (UINT32 i = 0; i < img.num_segs; i++) {
+            const elf_seg_t *seg = &img.segs[i];
+            UINT8 *dst = (UINT8 *) (UINTN) (base + seg->offset);
 
-    for (UINT64 i = 0; i < hdr.e_phnum; i++) {
-        Elf64_Phdr *phdr = &phdrs[i];
-        if (phdr->p_type == PT_LOAD) {
-            if (vsize < (phdr->p_vaddr + phdr->p_memsz)) {
-                vsize = phdr->p_vaddr + phdr->p_memsz;
+            status = elf_read(source, src, seg->file_offset, seg->filesz, dst);
+            if (EFI_ERROR(status)) {
+                break;
             }
+            ZeroMem(dst + seg->filesz, seg->memsz - seg->filesz);
+        }
 
-            if (vmin > phdr->p_vaddr) {
-                vmin = phdr->p_vaddr;
-            }            
+        if (EFI_ERROR(status)) {
+            bs->free_pages(base, EFI_SIZE_TO_PAGES(img.end - img.start));
+        } else {
+            entry = base - img.start + img.hdr.e_entry;
+            LOG(LOG_INFO, LOG_ELF_LOADED, base, entry);
         }
     }
 
-    UINT64 pages = (vsize - vmin + EFI_PAGE_MASK) >> EFI_PAGE_SHIFT;
-
-    EFI_PHYSICAL_ADDRESS allocmem = 0x400000; // Default ELF load base
-    status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, pages, &allocmem);
-    if (EFI_ERROR(status)) {
-        Print(L"Failed to allocate pages for elf load\n");
-        return 0;
+    if (source == ELF_SOURCE_FILE) {
+        file->SetPosition(file, pos);
     }
 
-    for (UINT64 i = 0; i < hdr.e_phnum; i++) {
-        Elf64_Phdr *phdr = &phdrs[i];
-        UINTN segsize = phdr->p_filesz;
-        EFI_PHYSICAL_ADDRESS segment = allocmem + phdr->p_vaddr;
-
-        if (phdr->p_type == PT_LOAD) {
-            status = elf_file->SetPosition(elf_file, phdr->p_offset);
-            if (EFI_ERROR(status)) {
-                Print(L"Failed to set position for segment read\n");
-                return 0;
-            }
+    return entry;
+}
 
-            status = elf_file->Read(elf_file, &segsize, (EFI_PHYSICAL_ADDRESS *) segment);
-            if (EFI_ERROR(status)) {
-                Print(L"Failed to read elf segment data\n");
-                return 0;
-            }
-        }
+EFI_STATUS EFIAPI elf_verify_hdr_mem(void *elf_bin, UINTN size)
+{
+    if (size < sizeof(Elf64_Ehdr)) {
+        return EFI_LOAD_ERROR;
     }
 
-    // Reset position
+    return elf_check_hdr((Elf64_Ehdr *) elf_bin);
+}
+
+EFI_STATUS EFIAPI elf_verify_hdr_file(EFI_FILE *elf_file)
+{
+    Elf64_Ehdr hdr;
+    UINT64 pos;
+    EFI_STATUS status;
+
+    elf_file->GetPosition(elf_file, &pos);
+    status = elf_read(ELF_SOURCE_FILE, elf_file, 0, sizeof(Elf64_Ehdr), &hdr);
     elf_file->SetPosition(elf_file, pos);
 
-    return (EFI_PHYSICAL_ADDRESS) (allocmem + hdr.e_entry);
-}
\ No newline at end of file
+    return EFI_ERROR(status) ? EFI_LOAD_ERROR : elf_check_hdr(&hdr);
+}
+
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem(void *elf_bin, UINTN size)
+{
+    return elf_load(ELF_SOURCE_MEM, ELF_PLACE_FIXED, elf_bin, size);
+}
+
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem_relo(void *elf_bin, UINTN size)
+{
+    return elf_load(ELF_SOURCE_MEM, ELF_PLACE_RELO, elf_bin, size);
+}
+
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_mem_aligned(void *elf_bin, UINTN size)
+{
+    return elf_load(ELF_SOURCE_MEM, ELF_PLACE_ALIGNED, elf_bin, size);
+}
+
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file(EFI_FILE *elf_file)
+{
+    return elf_load(ELF_SOURCE_FILE, ELF_PLACE_FIXED, elf_file, 0);
+}
+
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file_relo(EFI_FILE *elf_file)
+{
+    return elf_load(ELF_SOURCE_FILE, ELF_PLACE_RELO, elf_file, 0);
+}
+
+EFI_PHYSICAL_ADDRESS EFIAPI elf_load_file_aligned(EFI_FILE *elf_file)
+{
+    return elf_load(ELF_SOURCE_FILE, ELF_PLACE_ALIGNED, elf_file, 0);
+}
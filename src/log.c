@@ -0,0 +1,261 @@
+// Binary log ring, the hot path stores a timestamp and a few integers and nothing else
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/PrintLib.h>
+#include <Library/SerialPortLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "info.h"
+#include "log.h"
+#include "stage.h"
+#include "util.h"
+
+log_ring_t *log_ring = NULL;
+
+static UINT32 log_sinks = 0;
+static EFI_EVENT log_timer = NULL;
+static BOOLEAN log_boot_services = TRUE;
+static BOOLEAN log_async = FALSE;
+static BOOLEAN log_error_seen = FALSE; // An error was logged, so everything gets flushed before handoff
+
+static const CHAR8 *log_levels[] = { "DBG", "INF", "WRN", "ERR" };
+
+static const CHAR8 *log_formats[LOG_NUM_CODES] = {
+    [LOG_GFX_INIT]                      = "gfx: init, gfx_info %lx",
+    [LOG_GFX_NO_MODE]                   = "gfx: no mode found for handle %ld",
+    [LOG_GFX_SET_MODE_FAILED]           = "gfx: failed to set mode %ld on handle %ld, status %lx",
+    [LOG_GFX_QUERY_FAILED]              = "gfx: failed to read back mode %ld on handle %ld, status %lx",
+    [LOG_GFX_BAD_FORMAT]                = "gfx: mode %ld on handle %ld has pixel format %ld, no blitters for it",
+    [LOG_GFX_MODE_SET]                  = "gfx: mode %ld set, %ldx%ld format %ld",
+    [LOG_GFX_MODE_CACHED]               = "gfx: using cached mode %ld",
+    [LOG_GFX_LOCATE_FAILED]             = "gfx: LocateHandleBuffer failed, status %lx",
+    [LOG_GFX_FIND_MODE]                 = "gfx: scanning %ld modes, gfx %lx",
+    [LOG_GFX_FIND_MODE_QUERY_FAILED]    = "gfx: query for mode %ld failed, status %lx",
+    [LOG_GFX_FIND_MODE_DONE]            = "gfx: picked mode %ld",
+    [LOG_ELF_ALLOC_FAILED]              = "elf: failed to allocate %ld pages, status %lx",
+    [LOG_ELF_SEEK_FAILED]               = "elf: failed to seek to segment at offset %lx, status %lx",
+    [LOG_ELF_READ_FAILED]               = "elf: failed to read %ld bytes of segment data, status %lx",
+    [LOG_ELF_LOADED]                    = "elf: loaded at %lx, entry %lx",
+    [LOG_ELF_BAD_HEADER]                = "elf: bad header, %ld program headers of %ld bytes at %lx",
+    [LOG_ELF_BAD_SEGMENT]               = "elf: bad segment %ld, offset %lx filesz %lx memsz %lx",
+    [LOG_ELF_TOO_MANY_SEGMENTS]         = "elf: more than %ld loadable segments",
+    [LOG_CFG_LOADED]                    = "cfg: read %ld bytes in %ld cycles",
+    [LOG_CFG_DEFAULTS]                  = "cfg: using defaults, status %lx size %ld, %ld cycles",
+    [LOG_CFG_UNCHANGED]                 = "cfg: %ld bytes unchanged, not written",
+    [LOG_CFG_WRITTEN]                   = "cfg: wrote %ld bytes in %ld cycles",
+    [LOG_CFG_WRITE_FAILED]              = "cfg: write failed, status %lx",
+    [LOG_KCACHE_EMPTY]                  = "kcache: nothing cached, reading the kernel",
+    [LOG_KCACHE_FILE_CHANGED]           = "kcache: kernel file changed (%ld bytes cached, %ld on disk), reading it",
+    [LOG_KCACHE_PAGES_TAKEN]            = "kcache: %lx (%ld pages) is in use, status %lx, reading the kernel",
+    [LOG_KCACHE_HASH_MISMATCH]          = "kcache: copy at %lx no longer matches (%ld cycles), reading the kernel",
+    [LOG_KCACHE_HIT]                    = "kcache: reusing kernel at %lx, %ld bytes, checked in %ld cycles",
+    [LOG_MANIFEST_PARSED]               = "manifest: %ld entries in %ld lines",
+    [LOG_MANIFEST_BAD_LINE]             = "manifest: line %ld doesn't parse",
+    [LOG_MANIFEST_FULL]                 = "manifest: line %ld is past the %ld entry limit",
+    [LOG_MODULE_LOADED]                 = "module: line %ld loaded at %lx, %ld bytes, read %ld",
+    [LOG_MODULE_LAZY]                   = "module: line %ld left on disk, %ld bytes",
+    [LOG_MODULE_BUNDLE]                 = "module: line %ld bundle, %ld members",
+    [LOG_MODULE_FAILED]                 = "module: line %ld failed to load, status %lx",
+    [LOG_SMBIOS_BAD_ENTRY]              = "smbios: entry point at %lx rejected, status %lx",
+    [LOG_SMBIOS_DECODED]                = "smbios: %ld.%ld table, %ld sockets, %ld memory devices",
+    [LOG_SMBIOS_FULL]                   = "smbios: %ld structures past the summary limits, dropped",
+    [LOG_TOPO_BUILT]                    = "topo: %ld packages, %ld cores, %ld cpus enabled, %ld LLC domains",
+    [LOG_TOPO_FULL]                     = "topo: %ld cpus past the table limit, dropped",
+    [LOG_RESERVE_BAD_LINE]              = "reserve: line %ld doesn't parse",
+    [LOG_RESERVE_FULL]                  = "reserve: line %ld is past the %ld limit",
+    [LOG_RESERVE_CLAIMED]               = "reserve: line %ld claimed %lx, %ld bytes on node %ld",
+    [LOG_RESERVE_FAILED]                = "reserve: line %ld couldn't claim %ld bytes, status %lx",
+    [LOG_ACPI_DIR_FULL]                 = "acpi: %ld tables past the %ld table directory, dropped",
+};
+
+static void EFIAPI log_timer_notify(EFI_EVENT event, VOID *context)
+{
+    log_flush();
+}
+
+/*
+ * Allocate the ring and pick where flushes go
+ * async flushes from a timer event every LOG_FLUSH_PERIOD_MS, otherwise records are only flushed when an
+ * error is logged or log_flush() is called. The ring is EfiLoaderData so it can be handed to the kernel
+ */
+EFI_STATUS log_init(UINT32 sinks, BOOLEAN async)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS mem = 0;
+    UINTN bytes = sizeof(log_ring_t) + LOG_RING_RECORDS * sizeof(log_record_t);
+
+    status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(bytes), &mem);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    log_ring = (log_ring_t *) (UINTN) mem;
+    log_ring->head = 0;
+    log_ring->flushed = 0;
+    log_ring->start_tsc = AsmReadTsc();
+    log_ring->tsc_hz = 0;
+    log_ring->mask = LOG_RING_RECORDS - 1;
+    log_ring->formats = log_formats;
+
+    if (sinks & LOG_SINK_SERIAL) {
+        if (RETURN_ERROR(SerialPortInitialize())) {
+            sinks &= ~LOG_SINK_SERIAL;
+        }
+    }
+    log_sinks = sinks;
+    log_async = async;
+
+    if (async) {
+        status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, log_timer_notify, NULL, &log_timer);
+        if (!EFI_ERROR(status)) {
+            status = gBS->SetTimer(log_timer, TimerPeriodic, EFI_TIMER_PERIOD_MILLISECONDS(LOG_FLUSH_PERIOD_MS));
+        }
+
+        // Still usable without the timer, it just flushes less often
+        if (EFI_ERROR(status) && log_timer) {
+            gBS->CloseEvent(log_timer);
+            log_timer = NULL;
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+void log_write(UINT8 level, UINT16 code, const UINT64 *args, UINTN nargs)
+{
+    log_record_t *rec;
+    UINT64 head;
+
+    if (!log_ring) {
+        return;
+    }
+
+    head = log_ring->head;
+    rec = &log_ring->records[head & log_ring->mask];
+    rec->tsc = AsmReadTsc();
+    rec->code = code;
+    rec->level = level;
+    rec->nargs = (UINT8) MIN(nargs, LOG_MAX_ARGS);
+    for (UINTN i = 0; i < rec->nargs; i++) {
+        rec->args[i] = args[i];
+    }
+
+    // Publish only once the record is complete, the timer flush may look at it any time after this
+    __atomic_store_n(&log_ring->head, head + 1, __ATOMIC_RELEASE);
+
+    if (level >= LOG_ERROR) {
+        log_error_seen = TRUE;
+        log_flush();
+    }
+}
+
+static void log_emit(const log_record_t *rec)
+{
+    CHAR8 line[LOG_LINE_MAX];
+    UINT64 usec = 0;
+    UINTN len;
+
+    if (log_ring->tsc_hz) {
+        usec = DivU64x64Remainder(MultU64x32(rec->tsc - log_ring->start_tsc, 1000), log_ring->tsc_hz / 1000, NULL);
+    }
+
+    len = AsciiSPrint(line, sizeof(line), "[%5ld.%06ld] %a ", usec / 1000000, usec % 1000000,
+            log_levels[rec->level & 3]);
+    if (rec->code < LOG_NUM_CODES) {
+        len += AsciiSPrint(line + len, sizeof(line) - len, log_formats[rec->code],
+                rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+    } else {
+        len += AsciiSPrint(line + len, sizeof(line) - len, "unknown log code %d", rec->code);
+    }
+
+    if (log_sinks & LOG_SINK_SERIAL) {
+        SerialPortWrite((UINT8 *) line, len);
+        SerialPortWrite((UINT8 *) "\r\n", 2);
+    }
+
+    if (log_sinks & LOG_SINK_CONOUT) {
+        AsciiPrint("%a\n", line);
+    }
+}
+
+// Reuse the stage timing calibration when it has run, tsc_frequency() stalls for 10ms
+static UINT64 log_tsc_hz()
+{
+    return stage_table.tsc_hz ? stage_table.tsc_hz : tsc_frequency();
+}
+
+// Format and send everything written since the last flush, oldest first
+void log_flush()
+{
+    EFI_TPL tpl = 0;
+    UINT64 head;
+
+    if (!log_ring || !log_sinks) {
+        return;
+    }
+
+    /*
+     * Keep the timer flush from running in the middle of this one. Errors can be logged from code already
+     * above TPL_CALLBACK where raising to it is invalid, the timer can't get in there anyway so stay put
+     */
+    if (log_timer) {
+        tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+        gBS->RestoreTPL(MAX(tpl, TPL_CALLBACK));
+    }
+
+    // Measured on the first flush rather than in log_init so boots that never flush don't pay for it
+    if (!log_ring->tsc_hz && log_boot_services) {
+        log_ring->tsc_hz = log_tsc_hz();
+    }
+
+    head = __atomic_load_n(&log_ring->head, __ATOMIC_ACQUIRE);
+
+    // Records overwritten before we got to them are gone, say how many
+    if (head - log_ring->flushed > (UINT64) log_ring->mask + 1) {
+        CHAR8 line[LOG_LINE_MAX];
+        UINT64 lost = head - log_ring->flushed - log_ring->mask - 1;
+        UINTN len = AsciiSPrint(line, sizeof(line), "log: %ld records lost", lost);
+
+        if (log_sinks & LOG_SINK_SERIAL) {
+            SerialPortWrite((UINT8 *) line, len);
+            SerialPortWrite((UINT8 *) "\r\n", 2);
+        }
+        if (log_sinks & LOG_SINK_CONOUT) {
+            AsciiPrint("%a\n", line);
+        }
+        log_ring->flushed = head - log_ring->mask - 1;
+    }
+
+    for (; log_ring->flushed < head; log_ring->flushed++) {
+        log_emit(&log_ring->records[log_ring->flushed & log_ring->mask]);
+    }
+
+    if (log_timer) {
+        gBS->RestoreTPL(tpl);
+    }
+}
+
+/*
+ * Stop the timer and drop ConOut before boot services go away, serial keeps working without them
+ * Only an async ring or a boot that logged an error gets its tail flushed here, otherwise the records are
+ * left for the kernel. tsc_hz is only filled in if something already measured it, 0 leaves that to the kernel
+ */
+void log_exit_boot_services()
+{
+    if (log_timer) {
+        gBS->CloseEvent(log_timer);
+        log_timer = NULL;
+    }
+
+    if (log_ring && !log_ring->tsc_hz) {
+        log_ring->tsc_hz = stage_table.tsc_hz;
+    }
+
+    if (log_async || log_error_seen) {
+        log_flush();
+    }
+    log_sinks &= ~LOG_SINK_CONOUT;
+    log_boot_services = FALSE;
+}
@@ -0,0 +1,209 @@
+/*
+ * LZ4 frame decoder, enough for frames written by the lz4 tool with --content-size
+ *
+ * Blocks are decoded straight into one output buffer, so linked blocks (matches reaching back into the
+ * previous block) need nothing extra. Block and content checksums are skipped, not verified
+ */
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "lz4.h"
+
+static inline UINT32 lz4_read32(const UINT8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32) p[3] << 24);
+}
+
+// Frame header, *header_size is how many bytes it took, *content_size is 0 when the frame doesn't say
+static EFI_STATUS lz4_header(const UINT8 *src, UINTN src_size, OUT UINTN *header_size, OUT UINT64 *content_size, OUT UINT8 *flg)
+{
+    UINTN len = 7;
+
+    if (src_size < len || lz4_read32(src) != LZ4_MAGIC) {
+        return EFI_UNSUPPORTED;
+    }
+
+    *flg = src[4];
+    if ((*flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION) {
+        return EFI_UNSUPPORTED;
+    }
+
+    *content_size = 0;
+    if (*flg & LZ4_FLG_CONTENT_SIZE) {
+        len += 8;
+        if (src_size < len) {
+            return EFI_UNSUPPORTED;
+        }
+        *content_size = lz4_read32(src + 6) | ((UINT64) lz4_read32(src + 10) << 32);
+    }
+
+    if (*flg & LZ4_FLG_DICT_ID) {
+        // Needs the dictionary to decode, nothing we load uses one
+        return EFI_UNSUPPORTED;
+    }
+
+    *header_size = len;
+
+    return EFI_SUCCESS;
+}
+
+// Decompressed size from the frame header, the frame has to carry it
+EFI_STATUS lz4_frame_size(const void *src, UINTN src_size, OUT UINT64 *size)
+{
+    EFI_STATUS status;
+    UINTN header_size;
+    UINT8 flg;
+
+    status = lz4_header(src, src_size, &header_size, size, &flg);
+    if (!EFI_ERROR(status) && !(flg & LZ4_FLG_CONTENT_SIZE)) {
+        status = EFI_UNSUPPORTED;
+    }
+
+    return status;
+}
+
+// One compressed block, out is where it starts in dst, returns the end of what it wrote or NULL if it is corrupt
+static UINT8 *lz4_decode_block(const UINT8 *p, const UINT8 *end, UINT8 *dst, UINT8 *out, UINT8 *dst_end)
+{
+    while (p < end) {
+        UINT8 token = *p++;
+        UINTN len = token >> 4;
+
+        if (len == 15) {
+            UINT8 b;
+
+            do {
+                if (p == end) {
+                    return NULL;
+                }
+                b = *p++;
+                len += b;
+            } while (b == 255);
+        }
+
+        if ((UINTN) (end - p) < len || (UINTN) (dst_end - out) < len) {
+            return NULL;
+        }
+        CopyMem(out, p, len);
+        out += len;
+        p += len;
+
+        // Last sequence is literals only
+        if (p == end) {
+            break;
+        }
+
+        {
+            UINTN offset;
+
+            if (end - p < 2) {
+                return NULL;
+            }
+            offset = p[0] | (p[1] << 8);
+            p += 2;
+
+            if (!offset || offset > (UINTN) (out - dst)) {
+                return NULL;
+            }
+
+            len = (token & 0xF) + LZ4_MIN_MATCH;
+            if ((token & 0xF) == 15) {
+                UINT8 b;
+
+                do {
+                    if (p == end) {
+                        return NULL;
+                    }
+                    b = *p++;
+                    len += b;
+                } while (b == 255);
+            }
+
+            if ((UINTN) (dst_end - out) < len) {
+                return NULL;
+            }
+
+            // Overlapping copies repeat the last offset bytes, so it has to go a byte at a time then
+            if (offset >= len) {
+                CopyMem(out, out - offset, len);
+                out += len;
+            } else {
+                const UINT8 *match = out - offset;
+
+                while (len--) {
+                    *out++ = *match++;
+                }
+            }
+        }
+    }
+
+    return out;
+}
+
+/*
+ * Decode a whole frame into dst, which has to be exactly the decompressed size
+ * Anything that would read or write out of bounds fails with EFI_COMPROMISED_DATA
+ */
+EFI_STATUS lz4_decode_frame(const void *src, UINTN src_size, OUT void *dst, UINTN dst_size)
+{
+    EFI_STATUS status;
+    const UINT8 *p = src;
+    const UINT8 *end = p + src_size;
+    UINT8 *out = dst;
+    UINT8 *dst_end = out + dst_size;
+    UINT64 content_size;
+    UINTN header_size;
+    UINT8 flg;
+
+    status = lz4_header(p, src_size, &header_size, &content_size, &flg);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    p += header_size;
+
+    while (TRUE) {
+        UINT32 block;
+        UINT32 len;
+
+        if (end - p < 4) {
+            return EFI_COMPROMISED_DATA;
+        }
+        block = lz4_read32(p);
+        p += 4;
+
+        // End mark
+        if (!block) {
+            break;
+        }
+
+        len = block & ~LZ4_BLOCK_UNCOMPRESSED;
+        if ((UINTN) (end - p) < len) {
+            return EFI_COMPROMISED_DATA;
+        }
+
+        if (block & LZ4_BLOCK_UNCOMPRESSED) {
+            if ((UINTN) (dst_end - out) < len) {
+                return EFI_COMPROMISED_DATA;
+            }
+            CopyMem(out, p, len);
+            out += len;
+        } else {
+            out = lz4_decode_block(p, p + len, dst, out, dst_end);
+            if (!out) {
+                return EFI_COMPROMISED_DATA;
+            }
+        }
+        p += len;
+
+        if (flg & LZ4_FLG_BLOCK_CHECKSUM) {
+            p += 4;
+        }
+    }
+
+    if (out != dst_end || (content_size && content_size != dst_size)) {
+        return EFI_COMPROMISED_DATA;
+    }
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,195 @@
+// Boot manifest parser, plain text so it can be edited on the ESP with anything
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "log.h"
+#include "manifest.h"
+
+static BOOLEAN manifest_space(CHAR8 c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Is the token [p, end) exactly word
+static BOOLEAN manifest_word(const CHAR8 *p, const CHAR8 *end, const CHAR8 *word)
+{
+    while (p < end && *word && *p == *word) {
+        p++;
+        word++;
+    }
+
+    return p == end && !*word;
+}
+
+// align=<n>[K|M|G], 0 if it isn't a power of two or doesn't parse
+static UINT64 manifest_align(const CHAR8 *p, const CHAR8 *end)
+{
+    UINT64 value = 0;
+
+    if (p == end) {
+        return 0;
+    }
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (*p - '0');
+        if (value > SIZE_1GB) {
+            return 0;
+        }
+    }
+
+    if (p < end) {
+        switch (*p++) {
+            case 'K': case 'k': value *= SIZE_1KB; break;
+            case 'M': case 'm': value *= SIZE_1MB; break;
+            case 'G': case 'g': value *= SIZE_1GB; break;
+            default: return 0;
+        }
+    }
+
+    if (p != end || !value || (value & (value - 1))) {
+        return 0;
+    }
+
+    return value;
+}
+
+static EFI_STATUS manifest_flag(const CHAR8 *p, const CHAR8 *end, manifest_entry_t *entry)
+{
+    if (manifest_word(p, end, "kernel")) {
+        entry->flags |= MODULE_KERNEL | MODULE_REQUIRED;
+    } else if (manifest_word(p, end, "required")) {
+        entry->flags |= MODULE_REQUIRED;
+    } else if (manifest_word(p, end, "lazy")) {
+        entry->flags |= MODULE_LAZY;
+    } else if (manifest_word(p, end, "compressed")) {
+        entry->flags |= MODULE_COMPRESSED;
+    } else if (manifest_word(p, end, "bundle")) {
+        entry->flags |= MODULE_BUNDLE;
+    } else if (end - p > 6 && CompareMem(p, "align=", 6) == 0) {
+        entry->align = manifest_align(p + 6, end);
+        if (!entry->align) {
+            return EFI_INVALID_PARAMETER;
+        }
+        entry->align = MAX(entry->align, EFI_PAGE_SIZE);
+    } else {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Fill manifest from the text of the file, entries keep file order
+ * A line that doesn't parse fails the whole manifest, a typo in a flag shouldn't quietly drop a required module
+ */
+EFI_STATUS manifest_parse(const CHAR8 *text, UINTN size, OUT manifest_t *manifest)
+{
+    const CHAR8 *end = text + size;
+    const CHAR8 *next;
+    UINT32 line = 0;
+
+    ZeroMem(manifest, sizeof(*manifest));
+
+    for (; text < end; text = next) {
+        const CHAR8 *eol = text;
+        const CHAR8 *p = text;
+        manifest_entry_t *entry;
+
+        while (eol < end && *eol != '\n') {
+            eol++;
+        }
+        next = eol + 1;
+        line++;
+
+        // Comments run to the end of the line
+        for (eol = text; eol < next - 1 && *eol != '#'; eol++) ;
+
+        while (p < eol && manifest_space(*p)) {
+            p++;
+        }
+
+        if (p == eol) {
+            continue;
+        }
+
+        if (manifest->num_entries == MANIFEST_MAX_ENTRIES) {
+            LOG(LOG_ERROR, LOG_MANIFEST_FULL, line, MANIFEST_MAX_ENTRIES);
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        entry = &manifest->entries[manifest->num_entries];
+        entry->line = line;
+        entry->align = EFI_PAGE_SIZE;
+
+        // Path, has to be absolute and fit with its NUL
+        {
+            UINTN len = 0;
+
+            while (p < eol && !manifest_space(*p)) {
+                if (len == MANIFEST_PATH_MAX - 1) {
+                    LOG(LOG_ERROR, LOG_MANIFEST_BAD_LINE, line);
+                    return EFI_INVALID_PARAMETER;
+                }
+                entry->path[len++] = *p++;
+            }
+
+            if (entry->path[0] != '\\') {
+                LOG(LOG_ERROR, LOG_MANIFEST_BAD_LINE, line);
+                return EFI_INVALID_PARAMETER;
+            }
+        }
+
+        // Comma separated flags, optional
+        while (p < eol && manifest_space(*p)) {
+            p++;
+        }
+
+        while (p < eol) {
+            const CHAR8 *flag = p;
+
+            while (p < eol && *p != ',' && !manifest_space(*p)) {
+                p++;
+            }
+
+            if (EFI_ERROR(manifest_flag(flag, p, entry))) {
+                LOG(LOG_ERROR, LOG_MANIFEST_BAD_LINE, line);
+                return EFI_INVALID_PARAMETER;
+            }
+
+            while (p < eol && (*p == ',' || manifest_space(*p))) {
+                p++;
+            }
+        }
+
+        // The kernel is read whole and parsed, none of the other ways of loading apply to it
+        if ((entry->flags & MODULE_KERNEL) && (entry->flags & (MODULE_LAZY | MODULE_COMPRESSED | MODULE_BUNDLE))) {
+            LOG(LOG_ERROR, LOG_MANIFEST_BAD_LINE, line);
+            return EFI_INVALID_PARAMETER;
+        }
+
+        if ((entry->flags & MODULE_BUNDLE) && (entry->flags & MODULE_COMPRESSED)) {
+            LOG(LOG_ERROR, LOG_MANIFEST_BAD_LINE, line);
+            return EFI_INVALID_PARAMETER;
+        }
+
+        manifest->num_entries++;
+    }
+
+    LOG(LOG_INFO, LOG_MANIFEST_PARSED, manifest->num_entries, line);
+
+    return EFI_SUCCESS;
+}
+
+// The first kernel entry, NULL when the manifest leaves the kernel to the default path
+const manifest_entry_t *manifest_kernel(const manifest_t *manifest)
+{
+    for (UINT32 i = 0; i < manifest->num_entries; i++) {
+        if (manifest->entries[i].flags & MODULE_KERNEL) {
+            return &manifest->entries[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,386 @@
+/*
+ * Manifest driven module loading
+ *
+ * Every module is found through one pass over each directory's listing, which also gives its size, so nothing
+ * is opened just to be sized. Reads then go in listing order: on FAT that is the order files were written,
+ * which on a freshly built image is the order their clusters sit on disk. Small modules are best put in a
+ * bundle, one tar archive read in a single transfer
+ */
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include <Guid/FileInfo.h>
+
+#include "arena.h"
+#include "boot_services.h"
+#include "log.h"
+#include "lz4.h"
+#include "manifest.h"
+#include "modules.h"
+#include "tar.h"
+#include "util.h"
+
+typedef struct {
+    const manifest_entry_t  *entry;
+    UINT64                  size; // From the directory listing
+    UINT32                  order; // Position over all directory listings, MAX_UINT32 if not found
+    BOOLEAN                 listed; // Its directory has been walked
+} module_plan_t;
+
+// ESP paths are ASCII in the manifest, out has room for MANIFEST_PATH_MAX characters
+void modules_efi_path(const CHAR8 *path, OUT CHAR16 *out)
+{
+    UINTN i;
+
+    for (i = 0; i < MANIFEST_PATH_MAX - 1 && path[i]; i++) {
+        out[i] = path[i];
+    }
+    out[i] = 0;
+}
+
+EFI_STATUS manifest_read(EFI_FILE *root, OUT manifest_t *manifest)
+{
+    EFI_STATUS status;
+    void *text = NULL;
+    UINTN size = 0;
+
+    status = efi_read_file(&arena_scratch, root, MANIFEST_PATH, &text, &size);
+    if (EFI_ERROR(status)) {
+        ZeroMem(manifest, sizeof(*manifest));
+        return status;
+    }
+
+    return manifest_parse(text, size, manifest);
+}
+
+// FAT names compare without case
+static BOOLEAN modules_name_eq(const CHAR16 *a, const CHAR8 *b)
+{
+    for (; *a && *b; a++, b++) {
+        CHAR16 ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : *a;
+        CHAR8 cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : *b;
+
+        if (ca != cb) {
+            return FALSE;
+        }
+    }
+
+    return !*a && !*b;
+}
+
+// Length of the directory part of path, the name starts one past it
+static UINTN modules_dir_len(const CHAR8 *path)
+{
+    UINTN len = 0;
+
+    for (UINTN i = 0; path[i]; i++) {
+        if (path[i] == '\\') {
+            len = i;
+        }
+    }
+
+    return len;
+}
+
+static BOOLEAN modules_same_dir(const CHAR8 *a, const CHAR8 *b)
+{
+    UINTN len = modules_dir_len(a);
+
+    return len == modules_dir_len(b) && CompareMem(a, b, len) == 0;
+}
+
+// Walk each directory the manifest names once, picking up the size and listing position of its modules
+static EFI_STATUS modules_locate(EFI_FILE *root, module_plan_t *plan, UINT32 num_plan)
+{
+    EFI_FILE_INFO *finfo = arena_alloc(&arena_scratch, MODULES_DIR_INFO_SIZE);
+    UINT32 order = 0;
+
+    if (!finfo) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (UINT32 i = 0; i < num_plan; i++) {
+        const CHAR8 *path = plan[i].entry->path;
+        UINTN dir_len = modules_dir_len(path);
+        CHAR16 dir_path[MANIFEST_PATH_MAX];
+        EFI_FILE *dir = NULL;
+
+        if (plan[i].listed) {
+            continue;
+        }
+
+        for (UINT32 j = i; j < num_plan; j++) {
+            if (modules_same_dir(path, plan[j].entry->path)) {
+                plan[j].listed = TRUE;
+            }
+        }
+
+        // Modules in the root directory have a dir_len of 0
+        modules_efi_path(path, dir_path);
+        dir_path[MAX(dir_len, 1)] = 0;
+
+        if (EFI_ERROR(root->Open(root, &dir, dir_path, EFI_FILE_MODE_READ, 0))) {
+            continue;
+        }
+
+        while (TRUE) {
+            UINTN size = MODULES_DIR_INFO_SIZE;
+
+            // A size of 0 is the end of the listing
+            if (EFI_ERROR(dir->Read(dir, &size, finfo)) || !size) {
+                break;
+            }
+
+            if (finfo->Attribute & EFI_FILE_DIRECTORY) {
+                continue;
+            }
+
+            for (UINT32 j = i; j < num_plan; j++) {
+                const CHAR8 *other = plan[j].entry->path;
+
+                if (plan[j].order == MAX_UINT32 && modules_same_dir(path, other) &&
+                        modules_name_eq(finfo->FileName, other + dir_len + 1)) {
+                    plan[j].order = order;
+                    plan[j].size = finfo->FileSize;
+                }
+            }
+            order++;
+        }
+
+        dir->Close(dir);
+    }
+
+    return EFI_SUCCESS;
+}
+
+static module_t *modules_add(module_info_t *info, const CHAR8 *name, UINTN name_len, UINT64 base, UINT64 size, UINT32 flags)
+{
+    module_t *mod;
+
+    if (info->num_modules == MODULES_MAX) {
+        return NULL;
+    }
+
+    mod = &info->modules[info->num_modules++];
+    CopyMem(mod->name, name, MIN(name_len, MODULE_NAME_MAX - 1));
+    mod->base = base;
+    mod->size = size;
+    mod->flags = flags;
+
+    return mod;
+}
+
+/*
+ * Page run with room for size bytes at an align boundary
+ * The slack allocated to get there is given back, the kernel can't tell it apart from the module otherwise
+ */
+static void *modules_alloc(UINT64 size, UINT64 align)
+{
+    EFI_PHYSICAL_ADDRESS mem = 0;
+    EFI_PHYSICAL_ADDRESS base;
+    UINTN pages = EFI_SIZE_TO_PAGES(MAX(size, 1));
+    UINTN slack = EFI_SIZE_TO_PAGES(align) - 1;
+    UINTN head;
+
+    if (EFI_ERROR(bs->allocate_pages(AllocateAnyPages, EfiLoaderData, pages + slack, &mem))) {
+        return NULL;
+    }
+
+    base = ALIGN_VALUE(mem, align);
+    head = EFI_SIZE_TO_PAGES(base - mem);
+    if (head) {
+        bs->free_pages(mem, head);
+    }
+    if (slack - head) {
+        bs->free_pages(base + EFI_PAGES_TO_SIZE(pages), slack - head);
+    }
+
+    return (void *) (UINTN) base;
+}
+
+static void modules_free(void *data, UINT64 size)
+{
+    bs->free_pages((EFI_PHYSICAL_ADDRESS) (UINTN) data, EFI_SIZE_TO_PAGES(MAX(size, 1)));
+}
+
+// Every regular file in the archive becomes a module pointing into it, members are only 512 byte aligned
+static EFI_STATUS modules_add_bundle(module_info_t *info, const manifest_entry_t *entry, UINT8 *data, UINT64 size)
+{
+    UINT8 *end = data + size;
+    UINT32 members = 0;
+
+    for (UINT8 *hdr = data; hdr && end - hdr >= TAR_BLOCK_SIZE; hdr = tar_next(hdr, end)) {
+        tar_header_t *th = (tar_header_t *) hdr;
+        UINT64 member_size = tar_size(th->size);
+        UINTN name_len = 0;
+
+        // Two zero blocks end the archive
+        if (!th->name[0]) {
+            break;
+        }
+
+        if ((th->typeflag[0] != '0' && th->typeflag[0] != 0) || member_size > (UINT64) (end - hdr - TAR_BLOCK_SIZE)) {
+            continue;
+        }
+
+        while (name_len < sizeof(th->name) && th->name[name_len]) {
+            name_len++;
+        }
+
+        if (!modules_add(info, th->name, name_len, (UINTN) hdr + TAR_BLOCK_SIZE, member_size, entry->flags)) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        members++;
+    }
+
+    LOG(LOG_INFO, LOG_MODULE_BUNDLE, entry->line, members);
+
+    return EFI_SUCCESS;
+}
+
+// Whole file into a fresh page run, compressed ones through a staging run that is given back after
+static EFI_STATUS modules_read(EFI_FILE *root, const module_plan_t *plan, module_info_t *info)
+{
+    EFI_STATUS status;
+    const manifest_entry_t *entry = plan->entry;
+    CHAR16 path[MANIFEST_PATH_MAX];
+    EFI_FILE *file = NULL;
+    EFI_PHYSICAL_ADDRESS staging = 0;
+    UINTN staging_pages = EFI_SIZE_TO_PAGES(MAX(plan->size, 1));
+    UINT64 size = plan->size;
+    UINTN read_size = size;
+    UINT32 num_modules = info->num_modules;
+    UINT8 *data;
+
+    if (entry->flags & MODULE_LAZY) {
+        if (!modules_add(info, entry->path, MANIFEST_PATH_MAX, 0, size, entry->flags)) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        LOG(LOG_INFO, LOG_MODULE_LAZY, entry->line, size);
+        return EFI_SUCCESS;
+    }
+
+    modules_efi_path(entry->path, path);
+    status = root->Open(root, &file, path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    if (entry->flags & MODULE_COMPRESSED) {
+        status = bs->allocate_pages(AllocateAnyPages, EfiLoaderData, staging_pages, &staging);
+        data = EFI_ERROR(status) ? NULL : (UINT8 *) (UINTN) staging;
+    } else {
+        data = modules_alloc(size, entry->align);
+    }
+
+    if (!data) {
+        file->Close(file);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    status = file->Read(file, &read_size, data);
+    file->Close(file);
+    if (!EFI_ERROR(status) && read_size != size) {
+        status = EFI_END_OF_FILE;
+    }
+
+    // The staging run goes back whatever happens, data is only ever the module's own run after this
+    if (entry->flags & MODULE_COMPRESSED) {
+        data = NULL;
+        if (!EFI_ERROR(status)) {
+            status = lz4_frame_size((void *) (UINTN) staging, read_size, &size);
+        }
+        if (!EFI_ERROR(status)) {
+            data = modules_alloc(size, entry->align);
+            status = data ? lz4_decode_frame((void *) (UINTN) staging, read_size, data, size) : EFI_OUT_OF_RESOURCES;
+        }
+        bs->free_pages(staging, staging_pages);
+    }
+
+    if (!EFI_ERROR(status)) {
+        if (entry->flags & MODULE_BUNDLE) {
+            status = modules_add_bundle(info, entry, data, size);
+        } else if (!modules_add(info, entry->path, MANIFEST_PATH_MAX, (UINTN) data, size, entry->flags)) {
+            status = EFI_BUFFER_TOO_SMALL;
+        } else {
+            LOG(LOG_INFO, LOG_MODULE_LOADED, entry->line, (UINTN) data, size, plan->order);
+        }
+    }
+
+    // Give the run back, along with any bundle members already pointing into it
+    if (EFI_ERROR(status)) {
+        info->num_modules = num_modules;
+        if (data) {
+            modules_free(data, size);
+        }
+    }
+
+    return status;
+}
+
+/*
+ * Load every module in the manifest (the kernel entry is left to efi_main()) and describe them in info
+ * A module that is missing or fails to load is skipped unless it is required, then loading stops with the error
+ */
+EFI_STATUS modules_load(EFI_FILE *root, const manifest_t *manifest, OUT module_info_t *info)
+{
+    EFI_STATUS status;
+    module_plan_t plan[MANIFEST_MAX_ENTRIES];
+    UINT32 num_plan = 0;
+
+    info->num_modules = 0;
+    info->modules = arena_alloc_zero(&arena_handoff, MODULES_MAX * sizeof(module_t));
+    if (!info->modules) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (UINT32 i = 0; i < manifest->num_entries; i++) {
+        if (!(manifest->entries[i].flags & MODULE_KERNEL)) {
+            plan[num_plan].entry = &manifest->entries[i];
+            plan[num_plan].size = 0;
+            plan[num_plan].order = MAX_UINT32;
+            plan[num_plan].listed = FALSE;
+            num_plan++;
+        }
+    }
+
+    status = modules_locate(root, plan, num_plan);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // Listing order, anything not found sorts last
+    for (UINT32 i = 1; i < num_plan; i++) {
+        module_plan_t tmp = plan[i];
+        UINT32 j = i;
+
+        while (j > 0 && plan[j - 1].order > tmp.order) {
+            plan[j] = plan[j - 1];
+            j--;
+        }
+
+        plan[j] = tmp;
+    }
+
+    for (UINT32 i = 0; i < num_plan; i++) {
+        const manifest_entry_t *entry = plan[i].entry;
+
+        if (plan[i].order == MAX_UINT32) {
+            status = EFI_NOT_FOUND;
+        } else {
+            status = modules_read(root, &plan[i], info);
+        }
+
+        if (EFI_ERROR(status)) {
+            LOG((entry->flags & MODULE_REQUIRED) ? LOG_ERROR : LOG_WARN, LOG_MODULE_FAILED, entry->line, status);
+            if (entry->flags & MODULE_REQUIRED) {
+                return status;
+            }
+        }
+    }
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,191 @@
+// PCI device inventory
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <IndustryStandard/Acpi.h>
+
+#include "arena.h"
+#include "info.h"
+#include "pci.h"
+
+// Segment/bus/dev/fn packed so that ordering the keys orders the devices
+static UINT64 pci_sort_key(const pci_device_t *dev)
+{
+    return ((UINT64) dev->segment << 16) | ((UINT64) dev->bus << 8) | ((UINT64) dev->dev << 3) | dev->fn;
+}
+
+// Pull every implemented BAR for a device out of the PciIo resource descriptors
+static UINT8 pci_read_bars(EFI_PCI_IO_PROTOCOL *pci, UINT8 max_bars, pci_bar_t *bars)
+{
+    UINT8 count = 0;
+
+    for (UINT8 bar = 0; bar < max_bars; bar++) {
+        EFI_ACPI_ADDRESS_SPACE_DESCRIPTOR *desc = NULL;
+        EFI_STATUS status;
+
+        status = pci->GetBarAttributes(pci, bar, NULL, (void **) &desc);
+        if (EFI_ERROR(status)) {
+            continue;
+        }
+
+        // Unimplemented BARs and the upper half of 64 bit BARs come back as an empty resource list
+        if (desc->Desc == ACPI_ADDRESS_SPACE_DESCRIPTOR && desc->AddrLen) {
+            pci_bar_t *out = &bars[count++];
+
+            out->base = desc->AddrRangeMin;
+            out->length = desc->AddrLen;
+            out->index = bar;
+            out->flags = 0;
+
+            if (desc->ResType == ACPI_ADDRESS_SPACE_TYPE_IO) {
+                out->flags |= PCI_BAR_IO;
+            } else {
+                if (desc->AddrSpaceGranularity == 64) {
+                    out->flags |= PCI_BAR_MEM64;
+                }
+
+                if ((desc->SpecificFlag & EFI_ACPI_MEMORY_RESOURCE_SPECIFIC_FLAG_CACHEABLE_PREFETCHABLE) ==
+                        EFI_ACPI_MEMORY_RESOURCE_SPECIFIC_FLAG_CACHEABLE_PREFETCHABLE) {
+                    out->flags |= PCI_BAR_PREFETCH;
+                }
+            }
+        }
+
+        FreePool(desc);
+    }
+
+    return count;
+}
+
+/*
+ * Build the device table from every PciIo handle the firmware has bound
+ * The result lives in the handoff arena so it is still there for the kernel after ExitBootServices
+ */
+EFI_STATUS pci_build_inventory(OUT pci_info_t *pci_info)
+{
+    EFI_STATUS status;
+    EFI_HANDLE *handles = NULL;
+    UINTN nr_handles = 0;
+    UINT32 num_bars = 0;
+
+    pci_info->num_devices = 0;
+    pci_info->num_bars = 0;
+    pci_info->devices = NULL;
+    pci_info->bars = NULL;
+
+    status = gBS->LocateHandleBuffer(ByProtocol, &gEfiPciIoProtocolGuid, NULL, &nr_handles, &handles);
+    if (status == EFI_NOT_FOUND) {
+        // No PCI at all is odd but not fatal
+        return EFI_SUCCESS;
+    } else if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    pci_info->devices = arena_alloc(&arena_handoff, nr_handles * sizeof(pci_device_t));
+    pci_info->bars = arena_alloc(&arena_handoff, nr_handles * PCI_CFG_MAX_BARS * sizeof(pci_bar_t));
+    if (!pci_info->devices || !pci_info->bars) {
+        // Whatever did get allocated stays in the arena, it is reported to the kernel with the rest
+        pci_info->devices = NULL;
+        pci_info->bars = NULL;
+        FreePool(handles);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (UINTN iter = 0; iter < nr_handles; iter++) {
+        EFI_PCI_IO_PROTOCOL *pci = NULL;
+        pci_device_t *dev = &pci_info->devices[pci_info->num_devices];
+        UINT8 cfg[PCI_CFG_HEADER_SIZE];
+        UINTN seg, bus, devnum, fn;
+
+        status = gBS->HandleProtocol(handles[iter], &gEfiPciIoProtocolGuid, (void **) &pci);
+        if (EFI_ERROR(status)) {
+            continue;
+        }
+
+        status = pci->GetLocation(pci, &seg, &bus, &devnum, &fn);
+        if (EFI_ERROR(status)) {
+            continue;
+        }
+
+        // One read for the whole standard header instead of a call per register
+        status = pci->Pci.Read(pci, EfiPciIoWidthUint32, 0, PCI_CFG_HEADER_SIZE / sizeof(UINT32), cfg);
+        if (EFI_ERROR(status)) {
+            continue;
+        }
+
+        dev->segment = (UINT16) seg;
+        dev->bus = (UINT8) bus;
+        dev->dev = (UINT8) devnum;
+        dev->fn = (UINT8) fn;
+        dev->vendor_id = *(UINT16 *) &cfg[0x00];
+        dev->device_id = *(UINT16 *) &cfg[0x02];
+        dev->revision = cfg[0x08];
+        dev->prog_if = cfg[0x09];
+        dev->subclass = cfg[0x0A];
+        dev->class_code = cfg[0x0B];
+        dev->header_type = cfg[0x0E] & PCI_HEADER_TYPE_MASK;
+        dev->reserved = 0;
+
+        // Bridges keep their bus numbers where type 0 headers keep the subsystem ids
+        if (dev->header_type == PCI_HEADER_TYPE_BRIDGE) {
+            dev->subsys_vendor_id = 0;
+            dev->subsys_id = 0;
+        } else {
+            dev->subsys_vendor_id = *(UINT16 *) &cfg[0x2C];
+            dev->subsys_id = *(UINT16 *) &cfg[0x2E];
+        }
+
+        dev->first_bar = (UINT16) num_bars;
+        dev->num_bars = pci_read_bars(pci,
+                (dev->header_type == PCI_HEADER_TYPE_BRIDGE) ? PCI_CFG_BRIDGE_BARS : PCI_CFG_MAX_BARS,
+                &pci_info->bars[num_bars]);
+        num_bars += dev->num_bars;
+
+        pci_info->num_devices++;
+    }
+
+    FreePool(handles);
+
+    // Handle order is whatever the firmware bound first, insertion sort is plenty for a few dozen devices
+    for (UINT32 i = 1; i < pci_info->num_devices; i++) {
+        pci_device_t tmp = pci_info->devices[i];
+        UINT64 key = pci_sort_key(&tmp);
+        UINT32 j = i;
+
+        while (j > 0 && pci_sort_key(&pci_info->devices[j - 1]) > key) {
+            pci_info->devices[j] = pci_info->devices[j - 1];
+            j--;
+        }
+
+        pci_info->devices[j] = tmp;
+    }
+
+    pci_info->num_bars = num_bars;
+
+    return EFI_SUCCESS;
+}
+
+void print_pci_inventory(pci_info_t *pci_info)
+{
+    Print(L"PCI devices: %d\n", pci_info->num_devices);
+
+    for (UINT32 i = 0; i < pci_info->num_devices; i++) {
+        pci_device_t *dev = &pci_info->devices[i];
+
+        Print(L"%04x:%02x:%02x.%x %04x:%04x class %02x%02x%02x\n",
+                dev->segment, dev->bus, dev->dev, dev->fn,
+                dev->vendor_id, dev->device_id,
+                dev->class_code, dev->subclass, dev->prog_if);
+
+        for (UINT8 b = 0; b < dev->num_bars; b++) {
+            pci_bar_t *bar = &pci_info->bars[dev->first_bar + b];
+
+            Print(L"  BAR%d %s %016lx-%016lx\n", bar->index, (bar->flags & PCI_BAR_IO) ? L"io " : L"mem",
+                    bar->base, bar->base + bar->length - 1);
+        }
+    }
+
+    return;
+}
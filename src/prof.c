@@ -0,0 +1,158 @@
+// Sampling profiler, a periodic timer event looks at the region stack kept by PROF_ENTER/PROF_EXIT
+
+#include <Uefi.h>
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/PrintLib.h>
+#include <Library/SerialPortLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+#include "prof.h"
+#include "util.h"
+
+prof_state_t prof;
+
+static EFI_EVENT prof_timer = NULL;
+
+static const CHAR8 *prof_names[PROF_COUNT] = {
+#define PROF(id, name) [PROF_##id] = name,
+#include "prof_list.h"
+#undef PROF
+};
+
+static CHAR8 prof_report[PROF_REPORT_MAX];
+
+/*
+ * Runs at TPL_NOTIFY out of the firmware's timer interrupt, so it interrupts loader code and firmware code
+ * below TPL_NOTIFY alike. Anything running at TPL_NOTIFY or above holds its samples back until it drops TPL
+ */
+static void EFIAPI prof_sample(EFI_EVENT event, VOID *context)
+{
+    UINT32 depth = MIN(__atomic_load_n(&prof.depth, __ATOMIC_ACQUIRE), PROF_MAX_DEPTH);
+    UINT64 now = AsmReadTsc();
+
+    if (!prof.samples) {
+        prof.first_tsc = now;
+    }
+    prof.last_tsc = now;
+    prof.samples++;
+
+    if (!depth) {
+        prof.unmarked++;
+        return;
+    }
+
+    prof.self[prof.stack[depth - 1]]++;
+
+    // A region nested inside itself is only counted once per sample
+    for (UINT32 i = 0; i < depth; i++) {
+        UINT32 j = 0;
+
+        while (j < i && prof.stack[j] != prof.stack[i]) {
+            j++;
+        }
+
+        if (j == i) {
+            prof.total[prof.stack[i]]++;
+        }
+    }
+}
+
+EFI_STATUS prof_start()
+{
+    EFI_STATUS status;
+
+    if (prof_timer) {
+        return EFI_SUCCESS;
+    }
+
+    status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY, prof_sample, NULL, &prof_timer);
+    if (EFI_ERROR(status)) {
+        prof_timer = NULL;
+        return status;
+    }
+
+    status = gBS->SetTimer(prof_timer, TimerPeriodic, EFI_TIMER_PERIOD_MICROSECONDS(PROF_PERIOD_US));
+    if (EFI_ERROR(status)) {
+        gBS->CloseEvent(prof_timer);
+        prof_timer = NULL;
+    }
+
+    return status;
+}
+
+// Has to happen before ExitBootServices, the timer goes away with boot services
+void prof_stop()
+{
+    if (prof_timer) {
+        gBS->CloseEvent(prof_timer);
+        prof_timer = NULL;
+    }
+}
+
+// Per mille of the samples, printed as a percentage with one decimal
+static UINTN prof_permille(UINT64 count)
+{
+    return prof.samples ? (UINTN) DivU64x64Remainder(MultU64x32(count, 1000), prof.samples, NULL) : 0;
+}
+
+/*
+ * Format the histogram and send it to serial, and to PROF_DUMP_PATH if root is given
+ * Regions are listed in prof_list.h order, self is time with the region innermost, total includes what it called
+ */
+EFI_STATUS prof_dump(EFI_FILE *root)
+{
+    EFI_STATUS status;
+    EFI_FILE *file = NULL;
+    UINT64 period_us = 0;
+    UINTN len;
+
+    if (prof.samples > 1) {
+        period_us = DivU64x64Remainder(MultU64x32(prof.last_tsc - prof.first_tsc, 1000),
+                tsc_frequency() / 1000, NULL) / (prof.samples - 1);
+    }
+
+    len = AsciiSPrint(prof_report, sizeof(prof_report),
+            "prof: %ld samples, every %ldus (asked for %dus), %ld unmarked\r\n"
+            "prof: %-24a %8a %6a %8a %6a\r\n",
+            prof.samples, period_us, PROF_PERIOD_US, prof.unmarked, "region", "self", "%", "total", "%");
+
+    for (UINTN i = 0; i < PROF_COUNT; i++) {
+        UINTN self = prof_permille(prof.self[i]);
+        UINTN total = prof_permille(prof.total[i]);
+
+        if (!prof.total[i]) {
+            continue;
+        }
+
+        len += AsciiSPrint(prof_report + len, sizeof(prof_report) - len,
+                "prof: %-24a %8ld %4ld.%ld %8ld %4ld.%ld\r\n",
+                prof_names[i], prof.self[i], self / 10, self % 10, prof.total[i], total / 10, total % 10);
+    }
+
+    if (!RETURN_ERROR(SerialPortInitialize())) {
+        SerialPortWrite((UINT8 *) prof_report, len);
+    }
+
+    if (!root) {
+        return EFI_SUCCESS;
+    }
+
+    // Replace whatever the last boot left, a shorter report would otherwise keep its tail
+    status = root->Open(root, &file, PROF_DUMP_PATH, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+    if (!EFI_ERROR(status)) {
+        file->Delete(file);
+        file = NULL;
+    }
+
+    status = root->Open(root, &file, PROF_DUMP_PATH,
+            EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = file->Write(file, &len, prof_report);
+    file->Close(file);
+
+    return status;
+}
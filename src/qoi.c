@@ -0,0 +1,96 @@
+// QOI image decoding
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "qoi.h"
+
+static inline UINT32 qoi_read32(const UINT8 *p)
+{
+    return ((UINT32) p[0] << 24) | ((UINT32) p[1] << 16) | ((UINT32) p[2] << 8) | p[3];
+}
+
+static inline UINT32 qoi_hash(UINT32 px)
+{
+    return (((px >> 16) & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + (px & 0xFF) * 7 + (px >> 24) * 11) & 63;
+}
+
+void qoi_init(OUT qoi_state_t *qs)
+{
+    ZeroMem(qs->index, sizeof(qs->index));
+    qs->px = 0xFF000000;
+    qs->run = 0;
+}
+
+EFI_STATUS qoi_info(const void *data, UINTN size, OUT UINT32 *width, OUT UINT32 *height)
+{
+    const UINT8 *in = (const UINT8 *) data;
+
+    if (size < QOI_HEADER_SIZE + QOI_END_SIZE || qoi_read32(in) != QOI_MAGIC) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    *width = qoi_read32(in + 4);
+    *height = qoi_read32(in + 8);
+    if (!*width || !*height || *height >= QOI_MAX_PIXELS / *width) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Decode count pixels into out as canonical 0xAARRGGBB
+ * Running out of data repeats the last pixel rather than failing, same as the reference decoder
+ */
+const UINT8 *qoi_decode_span(qoi_state_t *qs, const UINT8 *p, const UINT8 *end, UINT32 *out, UINTN count)
+{
+    UINT32 px = qs->px;
+
+    for (UINTN i = 0; i < count; i++) {
+        UINT8 op;
+
+        if (qs->run) {
+            qs->run--;
+            out[i] = px;
+            continue;
+        }
+
+        if (p >= end) {
+            out[i] = px;
+            continue;
+        }
+
+        op = *p++;
+        if (op == QOI_OP_RGB) {
+            px = (px & 0xFF000000) | ((UINT32) p[0] << 16) | ((UINT32) p[1] << 8) | p[2];
+            p += 3;
+        } else if (op == QOI_OP_RGBA) {
+            px = ((UINT32) p[3] << 24) | ((UINT32) p[0] << 16) | ((UINT32) p[1] << 8) | p[2];
+            p += 4;
+        } else if ((op & QOI_MASK_2) == QOI_OP_INDEX) {
+            px = qs->index[op];
+        } else if ((op & QOI_MASK_2) == QOI_OP_DIFF) {
+            UINT8 r = (UINT8) ((px >> 16) + ((op >> 4) & 3) - 2);
+            UINT8 g = (UINT8) ((px >> 8) + ((op >> 2) & 3) - 2);
+            UINT8 b = (UINT8) (px + (op & 3) - 2);
+            px = (px & 0xFF000000) | ((UINT32) r << 16) | ((UINT32) g << 8) | b;
+        } else if ((op & QOI_MASK_2) == QOI_OP_LUMA) {
+            INT32 dg = (op & 0x3F) - 32;
+            UINT8 r = (UINT8) ((px >> 16) + dg - 8 + ((*p >> 4) & 0x0F));
+            UINT8 g = (UINT8) ((px >> 8) + dg);
+            UINT8 b = (UINT8) (px + dg - 8 + (*p & 0x0F));
+            p++;
+            px = (px & 0xFF000000) | ((UINT32) r << 16) | ((UINT32) g << 8) | b;
+        } else {
+            qs->run = op & 0x3F;
+        }
+
+        qs->index[qoi_hash(px)] = px;
+        out[i] = px;
+    }
+
+    qs->px = px;
+
+    return p;
+}
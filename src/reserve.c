@@ -0,0 +1,455 @@
+// Claim large aligned contiguous regions while the memory map is still unfragmented, listed in the handoff
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "arena.h"
+#include "boot_services.h"
+#include "info.h"
+#include "log.h"
+#include "reserve.h"
+#include "uefi_acpi.h"
+
+static BOOLEAN reserve_space(CHAR8 c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Decimal [p, end) no bigger than max, with a K/M/G suffix if scaled
+static BOOLEAN reserve_number(const CHAR8 *p, const CHAR8 *end, BOOLEAN scaled, UINT64 max, OUT UINT64 *value)
+{
+    UINT64 unit = 1;
+
+    *value = 0;
+    if (p == end) {
+        return FALSE;
+    }
+
+    if (scaled) {
+        switch (end[-1]) {
+            case 'K': case 'k': unit = SIZE_1KB; end--; break;
+            case 'M': case 'm': unit = SIZE_1MB; end--; break;
+            case 'G': case 'g': unit = SIZE_1GB; end--; break;
+        }
+    }
+
+    if (p == end) {
+        return FALSE;
+    }
+
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return FALSE;
+        }
+        *value = *value * 10 + (*p - '0');
+        if (*value > max) {
+            return FALSE;
+        }
+    }
+
+    // Checked before multiplying, the product could wrap back under max
+    if (*value > max / unit) {
+        return FALSE;
+    }
+    *value *= unit;
+
+    return TRUE;
+}
+
+// Is [p, end) key=<something>, p is moved past the '=' if so
+static BOOLEAN reserve_key(const CHAR8 **p, const CHAR8 *end, const CHAR8 *key, UINTN len)
+{
+    if ((UINTN) (end - *p) <= len || CompareMem(*p, key, len) != 0) {
+        return FALSE;
+    }
+
+    *p += len;
+
+    return TRUE;
+}
+
+static EFI_STATUS reserve_flag(const CHAR8 *p, const CHAR8 *end, reserve_entry_t *entry)
+{
+    UINT64 value;
+
+    if (end - p == 8 && CompareMem(p, "required", 8) == 0) {
+        entry->flags |= RESERVE_REQUIRED;
+    } else if (end - p == 5 && CompareMem(p, "dma32", 5) == 0) {
+        entry->flags |= RESERVE_DMA32;
+    } else if (reserve_key(&p, end, "node=", 5)) {
+        if (!reserve_number(p, end, FALSE, MAX_UINT32 - 1, &value)) {
+            return EFI_INVALID_PARAMETER;
+        }
+        entry->node = (UINT32) value;
+    } else if (reserve_key(&p, end, "type=", 5)) {
+        if (!reserve_number(p, end, FALSE, MAX_UINT32, &value)) {
+            return EFI_INVALID_PARAMETER;
+        }
+        entry->type = (UINT32) value;
+    } else if (reserve_key(&p, end, "align=", 6)) {
+        if (!reserve_number(p, end, TRUE, RESERVE_MAX_SIZE, &value) || !value || (value & (value - 1))) {
+            return EFI_INVALID_PARAMETER;
+        }
+        entry->align = MAX(value, EFI_PAGE_SIZE);
+    } else {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// [<count>x]<size>
+static EFI_STATUS reserve_amount(const CHAR8 *p, const CHAR8 *end, reserve_entry_t *entry)
+{
+    const CHAR8 *x = p;
+    UINT64 count = 1;
+
+    while (x < end && *x != 'x' && *x != 'X') {
+        x++;
+    }
+
+    if (x < end) {
+        if (!reserve_number(p, x, FALSE, RESERVE_MAX_REGIONS, &count) || !count) {
+            return EFI_INVALID_PARAMETER;
+        }
+        p = x + 1;
+    }
+
+    if (!reserve_number(p, end, TRUE, RESERVE_MAX_SIZE, &entry->size) || !entry->size ||
+            (entry->size & EFI_PAGE_MASK)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    entry->count = (UINT32) count;
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Fill config from the text of the file, same line rules as the boot manifest
+ * A line that doesn't parse fails the whole file, a typo shouldn't quietly drop a required region
+ */
+EFI_STATUS reserve_parse(const CHAR8 *text, UINTN size, OUT reserve_config_t *config)
+{
+    const CHAR8 *end = text + size;
+    const CHAR8 *next;
+    UINT32 line = 0;
+
+    ZeroMem(config, sizeof(*config));
+
+    for (; text < end; text = next) {
+        const CHAR8 *eol = text;
+        const CHAR8 *p = text;
+        const CHAR8 *token;
+        reserve_entry_t *entry;
+
+        while (eol < end && *eol != '\n') {
+            eol++;
+        }
+        next = eol + 1;
+        line++;
+
+        // Comments run to the end of the line
+        for (eol = text; eol < next - 1 && *eol != '#'; eol++) ;
+
+        while (p < eol && reserve_space(*p)) {
+            p++;
+        }
+
+        if (p == eol) {
+            continue;
+        }
+
+        if (config->num_entries == RESERVE_MAX_ENTRIES) {
+            LOG(LOG_ERROR, LOG_RESERVE_FULL, line, RESERVE_MAX_ENTRIES);
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        entry = &config->entries[config->num_entries];
+        entry->line = line;
+        entry->node = RESERVE_NODE_ANY;
+
+        for (token = p; p < eol && !reserve_space(*p); p++) ;
+        if (EFI_ERROR(reserve_amount(token, p, entry))) {
+            LOG(LOG_ERROR, LOG_RESERVE_BAD_LINE, line);
+            return EFI_INVALID_PARAMETER;
+        }
+
+        // Comma separated flags, optional
+        while (p < eol && reserve_space(*p)) {
+            p++;
+        }
+
+        while (p < eol) {
+            for (token = p; p < eol && *p != ',' && !reserve_space(*p); p++) ;
+
+            if (EFI_ERROR(reserve_flag(token, p, entry))) {
+                LOG(LOG_ERROR, LOG_RESERVE_BAD_LINE, line);
+                return EFI_INVALID_PARAMETER;
+            }
+
+            while (p < eol && (*p == ',' || reserve_space(*p))) {
+                p++;
+            }
+        }
+
+        // Natural alignment, the lowest set bit of the size
+        if (!entry->align) {
+            entry->align = MIN(entry->size & (~entry->size + 1), SIZE_1GB);
+        }
+
+        if (config->num_regions + entry->count > RESERVE_MAX_REGIONS) {
+            LOG(LOG_ERROR, LOG_RESERVE_FULL, line, RESERVE_MAX_REGIONS);
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        config->num_regions += entry->count;
+        config->num_entries++;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Next enabled SRAT memory affinity structure after prev (NULL for the first), NULL at the end
+ * hotplug picks the hot-pluggable ones instead of those usable for good
+ */
+static const acpi_srat_memory_t *reserve_srat_next(const acpi_srat_t *srat, const acpi_srat_memory_t *prev,
+        BOOLEAN hotplug)
+{
+    UINT32 want = ACPI_SRAT_MEMORY_ENABLED | (hotplug ? ACPI_SRAT_MEMORY_HOTPLUG : 0);
+    const UINT8 *end = (const UINT8 *) srat + srat->header.length;
+    const UINT8 *p = prev ? (const UINT8 *) prev + prev->length : (const UINT8 *) (srat + 1);
+
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        const acpi_srat_memory_t *mem = (const acpi_srat_memory_t *) p;
+
+        // Hot-pluggable memory can be taken away again, nothing long lived goes there
+        if (mem->type == ACPI_SRAT_MEMORY && mem->length >= sizeof(acpi_srat_memory_t) &&
+                (mem->flags & (ACPI_SRAT_MEMORY_ENABLED | ACPI_SRAT_MEMORY_HOTPLUG)) == want) {
+            return mem;
+        }
+
+        p += p[1];
+    }
+
+    return NULL;
+}
+
+// Proximity domain holding address, RESERVE_NODE_ANY if the SRAT doesn't say
+UINT32 reserve_node(const acpi_srat_t *srat, EFI_PHYSICAL_ADDRESS address)
+{
+    const acpi_srat_memory_t *mem = NULL;
+
+    while (srat && (mem = reserve_srat_next(srat, mem, FALSE))) {
+        if (address >= mem->base && address - mem->base < mem->size) {
+            return mem->domain;
+        }
+    }
+
+    return RESERVE_NODE_ANY;
+}
+
+// Highest aligned base that fits size in [lo, hi), kept in best if it beats what's there, nothing below 1MB
+static void reserve_fit(UINT64 lo, UINT64 hi, const reserve_entry_t *entry, BOOLEAN *found, UINT64 *best)
+{
+    UINT64 base;
+
+    if (entry->flags & RESERVE_DMA32) {
+        hi = MIN(hi, BASE_4GB);
+    }
+    lo = MAX(lo, BASE_1MB);
+
+    if (hi <= lo || hi - lo < entry->size) {
+        return;
+    }
+
+    base = (hi - entry->size) & ~(entry->align - 1);
+    if (base >= lo && (!*found || base > *best)) {
+        *found = TRUE;
+        *best = base;
+    }
+}
+
+// Fit in [lo, hi) around every hot-pluggable SRAT range, lowest first
+static void reserve_fit_stable(UINT64 lo, UINT64 hi, const acpi_srat_t *srat, const reserve_entry_t *entry,
+        BOOLEAN *found, UINT64 *best)
+{
+    const acpi_srat_memory_t *mem;
+
+    while (lo < hi) {
+        UINT64 cut_lo = hi;
+        UINT64 cut_hi = hi;
+
+        mem = NULL;
+        while (srat && (mem = reserve_srat_next(srat, mem, TRUE))) {
+            if (mem->base < hi && mem->base + mem->size > lo && mem->base < cut_lo) {
+                cut_lo = mem->base;
+                cut_hi = mem->base + mem->size;
+            }
+        }
+
+        reserve_fit(lo, MAX(cut_lo, lo), entry, found, best);
+        lo = cut_hi;
+    }
+}
+
+static void reserve_fit_run(UINT64 lo, UINT64 hi, const acpi_srat_t *srat, const reserve_entry_t *entry,
+        BOOLEAN local, BOOLEAN *found, UINT64 *best)
+{
+    const acpi_srat_memory_t *mem = NULL;
+
+    if (!local) {
+        reserve_fit_stable(lo, hi, srat, entry, found, best);
+        return;
+    }
+
+    while ((mem = reserve_srat_next(srat, mem, FALSE))) {
+        if (mem->domain == entry->node) {
+            reserve_fit(MAX(lo, mem->base), MIN(hi, mem->base + mem->size), entry, found, best);
+        }
+    }
+}
+
+/*
+ * Pick where one region of entry goes, the highest fit so low memory stays free for whatever needs it
+ * Back to back free descriptors are treated as one run, firmware splits free memory by attributes too
+ * local restricts the search to entry->node's SRAT ranges, hot-pluggable ones are never used either way
+ */
+EFI_STATUS reserve_find(const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size, const acpi_srat_t *srat,
+        const reserve_entry_t *entry, BOOLEAN local, OUT EFI_PHYSICAL_ADDRESS *base)
+{
+    UINT64 run_lo = 0;
+    UINT64 run_hi = 0;
+    BOOLEAN found = FALSE;
+
+    if (local && (!srat || entry->node == RESERVE_NODE_ANY)) {
+        return EFI_NOT_FOUND;
+    }
+
+    for (UINTN offset = 0; offset + desc_size <= map_size; offset += desc_size) {
+        const EFI_MEMORY_DESCRIPTOR *desc = (const EFI_MEMORY_DESCRIPTOR *) ((const UINT8 *) map + offset);
+        UINT64 start = desc->PhysicalStart;
+
+        if (desc->Type != EfiConventionalMemory) {
+            continue;
+        }
+
+        if (start != run_hi) {
+            reserve_fit_run(run_lo, run_hi, srat, entry, local, &found, base);
+            run_lo = start;
+        }
+        run_hi = start + EFI_PAGES_TO_SIZE(desc->NumberOfPages);
+    }
+    reserve_fit_run(run_lo, run_hi, srat, entry, local, &found, base);
+
+    return found ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+// Claim one region of entry against a fresh memory map, map has room for capacity bytes
+static EFI_STATUS reserve_claim_one(const reserve_entry_t *entry, const acpi_srat_t *srat,
+        EFI_MEMORY_DESCRIPTOR *map, UINTN capacity, reserve_info_t *info)
+{
+    reserve_region_t *region;
+    EFI_PHYSICAL_ADDRESS base = 0;
+    EFI_STATUS status;
+    UINTN map_size = capacity;
+    UINTN map_key;
+    UINTN desc_size;
+    UINT32 desc_version;
+    UINT32 flags = entry->flags;
+
+    status = bs->get_memory_map(&map_size, map, &map_key, &desc_size, &desc_version);
+    if (!EFI_ERROR(status)) {
+        status = reserve_find(map, map_size, desc_size, srat, entry, TRUE, &base);
+        if (EFI_ERROR(status)) {
+            status = reserve_find(map, map_size, desc_size, srat, entry, FALSE, &base);
+            flags |= (srat && entry->node != RESERVE_NODE_ANY) ? RESERVE_REMOTE : 0;
+        }
+    }
+
+    if (!EFI_ERROR(status)) {
+        status = bs->allocate_pages(AllocateAddress, (EFI_MEMORY_TYPE) RESERVE_MEMORY_TYPE,
+                EFI_SIZE_TO_PAGES(entry->size), &base);
+    }
+
+    if (EFI_ERROR(status)) {
+        LOG((entry->flags & RESERVE_REQUIRED) ? LOG_ERROR : LOG_WARN, LOG_RESERVE_FAILED,
+                entry->line, entry->size, status);
+        info->num_failed++;
+        return (entry->flags & RESERVE_REQUIRED) ? status : EFI_SUCCESS;
+    }
+
+    region = &info->regions[info->num_regions++];
+    region->base = base;
+    region->size = entry->size;
+    region->align = entry->align;
+    region->type = entry->type;
+    region->node = reserve_node(srat, base);
+    region->flags = flags;
+    region->line = entry->line;
+    info->total += entry->size;
+
+    LOG(LOG_INFO, LOG_RESERVE_CLAIMED, entry->line, base, entry->size, region->node);
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Claim every region config asks for, srat (NULL if there is none) steers node= regions to their node
+ * Entries go largest alignment first, then largest size, so small regions can't split the ranges big ones need
+ * Fails only when a required region can't be had, the regions claimed so far stay claimed
+ */
+EFI_STATUS reserve_claim(const reserve_config_t *config, const acpi_srat_t *srat, OUT reserve_info_t *info)
+{
+    EFI_MEMORY_DESCRIPTOR *map;
+    EFI_STATUS status;
+    BOOLEAN done[RESERVE_MAX_ENTRIES] = { 0 };
+    UINTN capacity = 0;
+    UINTN map_key;
+    UINTN desc_size;
+    UINT32 desc_version;
+
+    ZeroMem(info, sizeof(*info));
+
+    if (!config->num_entries) {
+        return EFI_SUCCESS;
+    }
+
+    // Each claim splits a descriptor or two, room for all of them is taken up front
+    status = bs->get_memory_map(&capacity, NULL, &map_key, &desc_size, &desc_version);
+    if (EFI_ERROR(status) && status != EFI_BUFFER_TOO_SMALL) {
+        return status;
+    }
+    capacity += (2 * config->num_regions + 4) * desc_size;
+
+    map = arena_alloc(&arena_scratch, capacity);
+    if (!map) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (UINT32 n = 0; n < config->num_entries; n++) {
+        const reserve_entry_t *entry = NULL;
+        UINT32 pick = 0;
+
+        for (UINT32 i = 0; i < config->num_entries; i++) {
+            const reserve_entry_t *e = &config->entries[i];
+
+            if (!done[i] && (!entry || e->align > entry->align || (e->align == entry->align && e->size > entry->size))) {
+                entry = e;
+                pick = i;
+            }
+        }
+        done[pick] = TRUE;
+
+        for (UINT32 k = 0; k < entry->count; k++) {
+            status = reserve_claim_one(entry, srat, map, capacity, info);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+        }
+    }
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,356 @@
+// SMBIOS processor, cache and memory decoding for the boot handoff
+
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "info.h"
+#include "log.h"
+#include "smbios.h"
+
+// Bytes summed into the 2.1 intermediate checksum, from "_DMI_" to the end of the entry point
+#define SMBIOS_INTERMEDIATE_LENGTH  15
+
+static UINT8 smbios_checksum(const void *data, UINTN length)
+{
+    const UINT8 *p = data;
+    UINT8 sum = 0;
+
+    for (UINTN i = 0; i < length; i++) {
+        sum += p[i];
+    }
+
+    return sum;
+}
+
+/*
+ * Check either entry point flavour and return where the structure table is
+ * For 3.0 the length is only an upper bound, the walk stops at the end-of-table structure
+ */
+EFI_STATUS smbios_validate_entry(const void *entry, OUT EFI_PHYSICAL_ADDRESS *table, OUT UINT32 *length)
+{
+    const smbios3_entry_t *entry3 = entry;
+    const smbios_entry_t *entry2 = entry;
+
+    if (CompareMem(entry3->anchor, "_SM3_", 5) == 0) {
+        if (entry3->length < sizeof(smbios3_entry_t) || smbios_checksum(entry3, entry3->length)) {
+            return EFI_COMPROMISED_DATA;
+        }
+
+        *table = entry3->table_address;
+        *length = entry3->table_max_size;
+    } else if (CompareMem(entry2->anchor, "_SM_", 4) == 0) {
+        if (entry2->length < sizeof(smbios_entry_t) || smbios_checksum(entry2, entry2->length) ||
+                CompareMem(entry2->intermediate_anchor, "_DMI_", 5) != 0 ||
+                smbios_checksum(entry2->intermediate_anchor, SMBIOS_INTERMEDIATE_LENGTH)) {
+            return EFI_COMPROMISED_DATA;
+        }
+
+        *table = entry2->table_address;
+        *length = entry2->table_length;
+    } else {
+        return EFI_UNSUPPORTED;
+    }
+
+    return (*table && *length) ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+// Copy string number index (1 based, 0 is no string) out of a structure's string set, trailing padding dropped
+static void smbios_string(const CHAR8 *strings, const CHAR8 *end, UINT8 index, CHAR8 *out, UINTN size)
+{
+    UINTN len = 0;
+
+    while (index > 1 && strings < end) {
+        while (strings < end && *strings) {
+            strings++;
+        }
+        strings++;
+        index--;
+    }
+
+    if (index == 1) {
+        while (strings + len < end && strings[len] && len < size - 1) {
+            out[len] = strings[len];
+            len++;
+        }
+    }
+
+    while (len && out[len - 1] == ' ') {
+        len--;
+    }
+    out[len] = 0;
+}
+
+// 16 bit cache sizes count 1KB or 64KB units depending on the top bit, the 32 bit ones likewise in bit 31
+static UINT64 smbios_cache_bytes(UINT16 size, UINT32 size2, BOOLEAN has_size2)
+{
+    if (size == 0xFFFF && has_size2) {
+        return (UINT64) (size2 & 0x7FFFFFFF) * ((size2 & 0x80000000) ? SIZE_64KB : SIZE_1KB);
+    }
+
+    return (UINT64) (size & 0x7FFF) * ((size & 0x8000) ? SIZE_64KB : SIZE_1KB);
+}
+
+static void smbios_add_processor(smbios_info_t *info, const smbios_processor_t *proc,
+        const CHAR8 *strings, const CHAR8 *end)
+{
+    smbios_cpu_t *cpu;
+
+    info->num_sockets++;
+    if (info->num_cpus == SMBIOS_MAX_CPUS) {
+        info->dropped++;
+        return;
+    }
+
+    cpu = &info->cpus[info->num_cpus++];
+
+    smbios_string(strings, end, proc->socket, cpu->socket, sizeof(cpu->socket));
+    smbios_string(strings, end, proc->version, cpu->version, sizeof(cpu->version));
+    cpu->id = proc->id;
+    cpu->family = (proc->family == 0xFE) ? proc->family2 : proc->family;
+    cpu->max_speed = proc->max_speed;
+    cpu->current_speed = proc->current_speed;
+    cpu->populated = (proc->status & 0x40) ? 1 : 0;
+    cpu->cpu_status = proc->status & 0x07;
+
+    // 0xFF in the 8 bit counts means look at the 16 bit ones, which are 0 on tables older than 3.0
+    cpu->cores = (proc->core_count == 0xFF && proc->core_count2) ? proc->core_count2 : proc->core_count;
+    cpu->cores_enabled = (proc->core_enabled == 0xFF && proc->core_enabled2) ?
+            proc->core_enabled2 : proc->core_enabled;
+    cpu->threads = (proc->thread_count == 0xFF && proc->thread_count2) ? proc->thread_count2 : proc->thread_count;
+
+    if (cpu->populated) {
+        info->num_populated++;
+        info->num_cores += cpu->cores_enabled ? cpu->cores_enabled : cpu->cores;
+        info->num_threads += cpu->threads;
+    }
+}
+
+static void smbios_add_cache(smbios_info_t *info, const smbios_cache_entry_t *entry,
+        const CHAR8 *strings, const CHAR8 *end)
+{
+    BOOLEAN has_size2 = entry->header.length >= sizeof(smbios_cache_entry_t);
+    smbios_cache_t *cache;
+
+    if (info->num_caches == SMBIOS_MAX_CACHES) {
+        info->dropped++;
+        return;
+    }
+
+    cache = &info->caches[info->num_caches++];
+
+    smbios_string(strings, end, entry->socket, cache->socket, sizeof(cache->socket));
+    cache->size = smbios_cache_bytes(entry->installed_size, entry->installed_size2, has_size2);
+    cache->max_size = smbios_cache_bytes(entry->max_size, entry->max_size2, has_size2);
+    cache->level = (entry->configuration & 0x07) + 1;
+    cache->enabled = (entry->configuration & 0x80) ? 1 : 0;
+    cache->type = entry->system_type;
+    cache->associativity = entry->associativity;
+    cache->handle = entry->header.handle;
+}
+
+static void smbios_add_memory_device(smbios_info_t *info, const smbios_memory_device_t *dev,
+        const CHAR8 *strings, const CHAR8 *end)
+{
+    smbios_dimm_t *dimm;
+
+    if (info->num_dimms == SMBIOS_MAX_DIMMS) {
+        info->dropped++;
+        return;
+    }
+
+    dimm = &info->dimms[info->num_dimms++];
+
+    smbios_string(strings, end, dev->locator, dimm->locator, sizeof(dimm->locator));
+    smbios_string(strings, end, dev->bank_locator, dimm->bank, sizeof(dimm->bank));
+    smbios_string(strings, end, dev->part_number, dimm->part_number, sizeof(dimm->part_number));
+
+    // 0 is an empty slot and 0xFFFF unknown, 0x7FFF moves the size to the 32 bit MB field
+    if (dev->size == 0x7FFF) {
+        dimm->size = (UINT64) (dev->extended_size & 0x7FFFFFFF) * SIZE_1MB;
+    } else if (dev->size != 0xFFFF) {
+        dimm->size = (UINT64) (dev->size & 0x7FFF) * ((dev->size & 0x8000) ? SIZE_1KB : SIZE_1MB);
+    }
+
+    // 0xFFFF moves the speed to the 32 bit fields added in 3.3
+    dimm->speed = (dev->speed == 0xFFFF) ? (UINT16) MIN(dev->extended_speed, 0xFFFE) : dev->speed;
+    dimm->configured_speed = (dev->configured_speed == 0xFFFF) ?
+            (UINT16) MIN(dev->extended_configured_speed, 0xFFFE) : dev->configured_speed;
+    dimm->data_width = (dev->data_width == 0xFFFF) ? 0 : dev->data_width;
+    dimm->type = dev->type;
+    dimm->form_factor = dev->form_factor;
+    dimm->rank = dev->attributes & 0x0F;
+
+    info->dimm_bytes += dimm->size;
+}
+
+static void smbios_add_mapped_range(smbios_info_t *info, const smbios_mapped_range_t *entry)
+{
+    UINT64 start;
+    UINT64 end;
+
+    if (entry->start == 0xFFFFFFFF) {
+        start = entry->extended_start;
+        end = entry->extended_end;
+    } else {
+        start = (UINT64) entry->start * SIZE_1KB;
+        end = (UINT64) entry->end * SIZE_1KB + SIZE_1KB - 1;
+    }
+
+    if (end < start) {
+        return;
+    }
+
+    if (info->num_ranges == SMBIOS_MAX_RANGES) {
+        info->dropped++;
+        return;
+    }
+
+    info->ranges[info->num_ranges].base = start;
+    info->ranges[info->num_ranges].size = end - start + 1;
+    info->mapped_bytes += end - start + 1;
+    info->num_ranges++;
+}
+
+// Turn the L1/L2/L3 handles each socket points at into indices into info->caches
+static void smbios_link_caches(smbios_info_t *info, const UINT16 handles[][3])
+{
+    for (UINT32 i = 0; i < info->num_cpus; i++) {
+        for (UINT32 level = 0; level < 3; level++) {
+            if (handles[i][level] == SMBIOS_HANDLE_NONE) {
+                continue;
+            }
+
+            for (UINT32 j = 0; j < info->num_caches; j++) {
+                if (info->caches[j].handle == handles[i][level]) {
+                    info->cpus[i].cache[level] = j + 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Walk the structure table once, decoding types 4, 7, 17 and 19 and skipping the rest
+ * Each structure is copied into a zeroed full-size layout first, so fields a shorter (older) structure
+ * doesn't have read as zero. A structure running past length ends the walk with EFI_COMPROMISED_DATA,
+ * what was decoded up to there is kept
+ */
+EFI_STATUS smbios_decode(const void *table, UINT32 length, OUT smbios_info_t *info)
+{
+    const UINT8 *p = table;
+    const UINT8 *end = p + length;
+    UINT16 handles[SMBIOS_MAX_CPUS][3];
+    union {
+        smbios_header_t         header;
+        smbios_processor_t      processor;
+        smbios_cache_entry_t    cache;
+        smbios_memory_device_t  memory_device;
+        smbios_mapped_range_t   mapped_range;
+    } s;
+    EFI_STATUS status = EFI_SUCCESS;
+
+    // Tables older than 2.2 may not have an end-of-table structure and just stop at length
+    while (p < end) {
+        const smbios_header_t *header = (const smbios_header_t *) p;
+        const CHAR8 *strings;
+        const CHAR8 *next;
+
+        if (p + sizeof(smbios_header_t) > end) {
+            status = EFI_COMPROMISED_DATA;
+            break;
+        }
+
+        strings = (const CHAR8 *) p + header->length;
+        next = strings;
+        if (header->length < sizeof(smbios_header_t) || strings > (const CHAR8 *) end) {
+            status = EFI_COMPROMISED_DATA;
+            break;
+        }
+
+        // The string set ends in a double NUL, which is all there is when the structure has no strings
+        while (next + 1 < (const CHAR8 *) end && (next[0] || next[1])) {
+            next++;
+        }
+        if (next + 1 >= (const CHAR8 *) end) {
+            status = EFI_COMPROMISED_DATA;
+            break;
+        }
+
+        if (header->type == SMBIOS_TYPE_END) {
+            break;
+        }
+
+        ZeroMem(&s, sizeof(s));
+        CopyMem(&s, p, MIN(header->length, sizeof(s)));
+
+        switch (header->type) {
+        case SMBIOS_TYPE_PROCESSOR:
+            // Cache handles are resolved once every type 7 has been seen, 2.0 tables don't have them
+            if (info->num_cpus < SMBIOS_MAX_CPUS) {
+                BOOLEAN linked = header->length >= OFFSET_OF(smbios_processor_t, serial_number);
+
+                handles[info->num_cpus][0] = linked ? s.processor.l1_handle : SMBIOS_HANDLE_NONE;
+                handles[info->num_cpus][1] = linked ? s.processor.l2_handle : SMBIOS_HANDLE_NONE;
+                handles[info->num_cpus][2] = linked ? s.processor.l3_handle : SMBIOS_HANDLE_NONE;
+            }
+            smbios_add_processor(info, &s.processor, strings, next);
+            break;
+        case SMBIOS_TYPE_CACHE:
+            smbios_add_cache(info, &s.cache, strings, next);
+            break;
+        case SMBIOS_TYPE_MEMORY_DEVICE:
+            smbios_add_memory_device(info, &s.memory_device, strings, next);
+            break;
+        case SMBIOS_TYPE_MAPPED_RANGE:
+            smbios_add_mapped_range(info, &s.mapped_range);
+            break;
+        }
+
+        p = (const UINT8 *) next + 2;
+    }
+
+    smbios_link_caches(info, (const UINT16 (*)[3]) handles);
+
+    return status;
+}
+
+// Fill info from the entry point found in the configuration table, info is zeroed either way
+EFI_STATUS smbios_build_info(const void *entry, OUT smbios_info_t *info)
+{
+    EFI_PHYSICAL_ADDRESS table;
+    UINT32 length;
+    EFI_STATUS status;
+
+    ZeroMem(info, sizeof(smbios_info_t));
+
+    if (!entry) {
+        return EFI_NOT_FOUND;
+    }
+
+    status = smbios_validate_entry(entry, &table, &length);
+    if (EFI_ERROR(status)) {
+        LOG(LOG_WARN, LOG_SMBIOS_BAD_ENTRY, (UINTN) entry, status);
+        return status;
+    }
+
+    if (CompareMem(entry, "_SM3_", 5) == 0) {
+        info->major = ((const smbios3_entry_t *) entry)->major;
+        info->minor = ((const smbios3_entry_t *) entry)->minor;
+    } else {
+        info->major = ((const smbios_entry_t *) entry)->major;
+        info->minor = ((const smbios_entry_t *) entry)->minor;
+    }
+    info->table = table;
+    info->table_length = length;
+
+    status = smbios_decode((const void *) (UINTN) table, length, info);
+
+    LOG(EFI_ERROR(status) ? LOG_WARN : LOG_INFO, LOG_SMBIOS_DECODED, info->major, info->minor,
+            info->num_sockets, info->num_dimms);
+    if (info->dropped) {
+        LOG(LOG_WARN, LOG_SMBIOS_FULL, info->dropped);
+    }
+
+    return status;
+}
@@ -0,0 +1,73 @@
+// Boot stage timestamps and the per-boot history kept in an EFI variable
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+
+#include "info.h"
+#include "stage.h"
+#include "util.h"
+
+stage_table_t stage_table = { .num_stages = STAGE_COUNT };
+
+// Static so the history can be updated after ExitBootServices, where there is no pool to allocate from
+static stage_history_t stage_history;
+static EFI_GUID stage_history_guid = STAGE_HISTORY_GUID;
+
+_Static_assert(STAGE_COUNT <= STAGE_MAX, "stage_table_t has no room for every stage");
+_Static_assert(sizeof(stage_history_t) <= EFI_MAXIMUM_VARIABLE_SIZE, "stage history doesn't fit in one variable");
+_Static_assert(STAGE_HISTORY_MAGIC == SIGNATURE_32('U', 'B', 'S', 'T'), "stage history magic isn't \"UBST\"");
+
+// Needs Stall, so call it before ExitBootServices
+void stage_calibrate()
+{
+    stage_table.tsc_hz = tsc_frequency();
+}
+
+/*
+ * Append this boot's stage durations to the history variable
+ * Runs after SetVirtualAddressMap so the last two stages are included, which only works because
+ * runtime services are mapped 1:1 and gRT is still usable at its physical address
+ */
+EFI_STATUS stage_history_commit()
+{
+    EFI_STATUS status;
+    UINTN size = sizeof(stage_history);
+    UINT32 next;
+    UINT64 prev = 0;
+
+    if (!stage_table.tsc_hz) {
+        return EFI_NOT_READY;
+    }
+
+    status = gRT->GetVariable(STAGE_HISTORY_VAR, &stage_history_guid, NULL, &size, &stage_history);
+    if (EFI_ERROR(status) || size != sizeof(stage_history) || stage_history.magic != STAGE_HISTORY_MAGIC ||
+            stage_history.version != STAGE_HISTORY_VERSION || stage_history.num_stages != STAGE_COUNT ||
+            stage_history.next >= STAGE_HISTORY_BOOTS) {
+        ZeroMem(&stage_history, sizeof(stage_history));
+        stage_history.magic = STAGE_HISTORY_MAGIC;
+        stage_history.version = STAGE_HISTORY_VERSION;
+        stage_history.num_stages = STAGE_COUNT;
+    }
+
+    next = stage_history.next;
+    for (UINT32 i = 0; i < STAGE_COUNT; i++) {
+        stage_history.usec[next][i] = 0;
+        if (!stage_table.tsc[i]) {
+            continue;
+        }
+
+        if (prev) {
+            stage_history.usec[next][i] = (UINT32) DivU64x64Remainder(MultU64x32(stage_table.tsc[i] - prev, 1000000), stage_table.tsc_hz, NULL);
+        }
+        prev = stage_table.tsc[i];
+    }
+
+    stage_history.next = (stage_history.next + 1) % STAGE_HISTORY_BOOTS;
+    stage_history.count = MIN(stage_history.count + 1, STAGE_HISTORY_BOOTS);
+
+    return gRT->SetVariable(STAGE_HISTORY_VAR, &stage_history_guid,
+            EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,
+            sizeof(stage_history), &stage_history);
+}
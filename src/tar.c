@@ -1,53 +1,57 @@
 #include "tar.h"
 #include "stdint.h"
 
+// Stops at the terminating NUL like strncmp, header names are NUL padded but lookup names aren't
 unsigned int tar_strncmp(const char *s1, const char *s2, UINTN n)
 {
     while (n--) {
-        if (*s1++ != *s2++) {
-            return *(unsigned char *) (s1 - 1) - *(unsigned char *) (s2 - 1);
+        if (*s1 != *s2) {
+            return *(unsigned char *) s1 - *(unsigned char *) s2;
         }
+
+        if (!*s1) {
+            break;
+        }
+
+        s1++;
+        s2++;
     }
 
     return 0;
 }
 
+// Size is up to 11 octal digits, ended early by a NUL or space in some archives
 unsigned int tar_size(const char *insize)
 {
     unsigned int size = 0;
-    unsigned int i = 0;
-    unsigned int count = 1;
 
-    for (i = 11; 1 > 0; i--, count *= 8) {
-        size += ((insize[i - 1] - '0') * count);
+    for (unsigned int i = 0; i < 11 && insize[i] >= '0' && insize[i] <= '7'; i++) {
+        size = size * 8 + (insize[i] - '0');
     }
 
     return size;
 }
 
-uint8_t *tar_get_fileaddr(uint8_t *address, char *filename, uint8_t *max_addr)
+// Header of the entry after the one at address, NULL once that would be at or past max_addr
+uint8_t *tar_next(uint8_t *address, uint8_t *max_addr)
 {
-    tar_header_t *hdr;
-    uint64_t size;
-    uint8_t *found = NULL;
-
-    while(1) {
-        hdr = (tar_header_t *) address;
-        if (!tar_strncmp(hdr->name, filename, 100)) {
-            found = address;
-            break;
-        }
+    uint64_t size = tar_size(((tar_header_t *) address)->size);
 
-        size = tar_size(hdr->size);
-        address += ((size / 512) + 1) * 512;
+    // Header block plus the data rounded up to whole blocks
+    address += (1 + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE) * TAR_BLOCK_SIZE;
 
-        if (size % 512) {
-            address += 512;
-        }
+    return (address < max_addr) ? address : NULL;
+}
 
-        if (max_addr <= address) {
-            break;
+uint8_t *tar_get_fileaddr(uint8_t *address, char *filename, uint8_t *max_addr)
+{
+    while (address) {
+        if (!tar_strncmp(((tar_header_t *) address)->name, filename, 100)) {
+            return address;
         }
+
+        address = tar_next(address, max_addr);
     }
-    return found;
+
+    return NULL;
 }
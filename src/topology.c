@@ -0,0 +1,323 @@
+// CPU topology table for the handoff, so the kernel can lay out scheduling domains before starting any AP
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "info.h"
+#include "log.h"
+#include "topology.h"
+#include "uefi_acpi.h"
+
+// Smallest shift with 1 << shift >= count, how many APIC ID bits count IDs take
+static UINT8 topo_shift(UINT32 count)
+{
+    UINT8 shift = 0;
+
+    while (shift < 32 && (1ULL << shift) < count) {
+        shift++;
+    }
+
+    return shift;
+}
+
+static UINT32 topo_slot(topo_info_t *topo, UINT32 apic_id)
+{
+    UINT32 slot = TOPO_HASH(apic_id);
+
+    while (topo->slots[slot] && topo->cpus[topo->slots[slot] - 1].apic_id != apic_id) {
+        slot = (slot + 1) & (TOPO_SLOTS - 1);
+    }
+
+    return slot;
+}
+
+topo_cpu_t *topo_find_cpu(topo_info_t *topo, UINT32 apic_id)
+{
+    UINT32 slot = topo_slot(topo, apic_id);
+
+    return topo->slots[slot] ? &topo->cpus[topo->slots[slot] - 1] : NULL;
+}
+
+// The same processor can turn up in an xAPIC entry, an x2APIC entry and from MP services, its flags are merged
+static void topo_add_cpu(topo_info_t *topo, UINT32 apic_id, UINT32 acpi_uid, UINT8 flags)
+{
+    UINT32 slot = topo_slot(topo, apic_id);
+    topo_cpu_t *cpu;
+
+    if (topo->slots[slot]) {
+        cpu = &topo->cpus[topo->slots[slot] - 1];
+        cpu->flags |= flags;
+        if (cpu->acpi_uid == TOPO_UID_NONE) {
+            cpu->acpi_uid = acpi_uid;
+        }
+        return;
+    }
+
+    if (topo->num_cpus == TOPO_MAX_CPUS) {
+        topo->dropped++;
+        return;
+    }
+
+    cpu = &topo->cpus[topo->num_cpus++];
+    cpu->apic_id = apic_id;
+    cpu->acpi_uid = acpi_uid;
+    cpu->flags = flags;
+    topo->slots[slot] = topo->num_cpus;
+}
+
+/*
+ * APIC ID layout and cache sharing as the BSP sees them, the same layout holds for every package
+ * Leaf 0x1F is preferred over 0xB since its module/die levels can sit between core and package
+ */
+EFI_STATUS topo_read_cpuid(topo_info_t *topo)
+{
+    UINT32 max_leaf, max_ext, cache_leaf;
+    UINT32 eax, ebx, ecx, edx;
+    UINT32 vendor[3];
+    UINT32 leaf = 0;
+
+    AsmCpuid(CPUID_VENDOR, &max_leaf, &vendor[0], &vendor[2], &vendor[1]);
+    AsmCpuid(CPUID_EXTENDED_MAX, &max_ext, NULL, NULL, NULL);
+
+    // A leaf with no SMT level in subleaf 0 is unimplemented even when max_leaf covers it
+    if (max_leaf >= CPUID_V2_EXTENDED_TOPOLOGY) {
+        AsmCpuidEx(CPUID_V2_EXTENDED_TOPOLOGY, 0, NULL, &ebx, NULL, NULL);
+        leaf = (ebx & 0xFFFF) ? CPUID_V2_EXTENDED_TOPOLOGY : 0;
+    }
+    if (!leaf && max_leaf >= CPUID_EXTENDED_TOPOLOGY) {
+        AsmCpuidEx(CPUID_EXTENDED_TOPOLOGY, 0, NULL, &ebx, NULL, NULL);
+        leaf = (ebx & 0xFFFF) ? CPUID_EXTENDED_TOPOLOGY : 0;
+    }
+
+    if (leaf) {
+        // The shift of the last level is the package shift, whatever levels sit in between
+        for (UINT32 sub = 0; sub < 8; sub++) {
+            AsmCpuidEx(leaf, sub, &eax, &ebx, &ecx, &edx);
+            if (((ecx >> 8) & 0xFF) == CPUID_TOPOLOGY_INVALID) {
+                break;
+            }
+            if (((ecx >> 8) & 0xFF) == CPUID_TOPOLOGY_SMT) {
+                topo->smt_shift = eax & 0x1F;
+            }
+            topo->package_shift = eax & 0x1F;
+        }
+        topo->sources |= (leaf == CPUID_V2_EXTENDED_TOPOLOGY) ? TOPO_SOURCE_CPUID_1F : TOPO_SOURCE_CPUID_B;
+    } else {
+        UINT32 logical;
+        UINT32 cores = 1;
+
+        // Leaf 1 has the logical processors per package when HTT is set, leaf 4 the cores per package
+        AsmCpuid(CPUID_FEATURES, NULL, &ebx, NULL, &edx);
+        logical = (edx & (1 << 28)) ? (ebx >> 16) & 0xFF : 1;
+
+        if (max_leaf >= CPUID_CACHE_PARAMS) {
+            AsmCpuidEx(CPUID_CACHE_PARAMS, 0, &eax, NULL, NULL, NULL);
+            cores = (eax & 0x1F) ? (eax >> 26) + 1 : 1;
+        }
+
+        topo->package_shift = topo_shift(logical);
+        topo->smt_shift = topo->package_shift - MIN(topo_shift(cores), topo->package_shift);
+        topo->sources |= TOPO_SOURCE_CPUID_LEGACY;
+    }
+
+    // AMD describes its caches in the same format under an extended leaf, leaf 4 is reserved there
+    if (CompareMem(vendor, "AuthenticAMD", 12) == 0 || CompareMem(vendor, "HygonGenuine", 12) == 0) {
+        cache_leaf = (max_ext >= CPUID_AMD_CACHE_PARAMS) ? CPUID_AMD_CACHE_PARAMS : 0;
+    } else {
+        cache_leaf = (max_leaf >= CPUID_CACHE_PARAMS) ? CPUID_CACHE_PARAMS : 0;
+    }
+
+    for (UINT32 sub = 0; cache_leaf && topo->num_caches < TOPO_MAX_CACHES; sub++) {
+        topo_cache_t *cache = &topo->caches[topo->num_caches];
+
+        AsmCpuidEx(cache_leaf, sub, &eax, &ebx, &ecx, &edx);
+        if (!(eax & 0x1F)) {
+            break;
+        }
+
+        cache->type = eax & 0x1F;
+        cache->level = (eax >> 5) & 0x07;
+        cache->share_shift = topo_shift(((eax >> 14) & 0xFFF) + 1);
+        cache->ways = ((ebx >> 22) & 0x3FF) + 1;
+        cache->line_size = (ebx & 0xFFF) + 1;
+        cache->sets = ecx + 1;
+        cache->size = cache->ways * (((ebx >> 12) & 0x3FF) + 1) * cache->line_size * cache->sets;
+        topo->num_caches++;
+
+        // Caches are listed from L1 up, the last unified one is the LLC
+        if (cache->type == 3) {
+            topo->llc_shift = cache->share_shift;
+        }
+    }
+
+    return (leaf || topo->num_caches) ? EFI_SUCCESS : EFI_UNSUPPORTED;
+}
+
+/*
+ * Add every processor the MADT lists as enabled or online capable, in table order
+ * Entries with neither flag must not be used by the OS and are left out
+ */
+EFI_STATUS topo_add_madt(topo_info_t *topo, const acpi_madt_t *madt)
+{
+    const UINT8 *p = (const UINT8 *) (madt + 1);
+    const UINT8 *end = (const UINT8 *) madt + madt->header.length;
+
+    if (madt->header.length < sizeof(acpi_madt_t)) {
+        return EFI_COMPROMISED_DATA;
+    }
+
+    while (p + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t *entry = (const acpi_madt_entry_t *) p;
+
+        if (entry->length < sizeof(acpi_madt_entry_t) || p + entry->length > end) {
+            return EFI_COMPROMISED_DATA;
+        }
+
+        if (entry->type == ACPI_MADT_LOCAL_APIC && entry->length >= sizeof(acpi_madt_local_apic_t)) {
+            const acpi_madt_local_apic_t *lapic = (const acpi_madt_local_apic_t *) p;
+
+            if (lapic->flags & (ACPI_MADT_ENABLED | ACPI_MADT_ONLINE_CAPABLE)) {
+                topo_add_cpu(topo, lapic->apic_id, lapic->acpi_uid,
+                        (lapic->flags & ACPI_MADT_ENABLED) ? TOPO_CPU_ENABLED : TOPO_CPU_ONLINE_CAPABLE);
+            }
+        } else if (entry->type == ACPI_MADT_LOCAL_X2APIC && entry->length >= sizeof(acpi_madt_x2apic_t)) {
+            const acpi_madt_x2apic_t *x2apic = (const acpi_madt_x2apic_t *) p;
+
+            if (x2apic->flags & (ACPI_MADT_ENABLED | ACPI_MADT_ONLINE_CAPABLE)) {
+                topo_add_cpu(topo, x2apic->x2apic_id, x2apic->acpi_uid, TOPO_CPU_X2APIC |
+                        ((x2apic->flags & ACPI_MADT_ENABLED) ? TOPO_CPU_ENABLED : TOPO_CPU_ONLINE_CAPABLE));
+            }
+        }
+
+        p += entry->length;
+    }
+
+    topo->sources |= TOPO_SOURCE_MADT;
+
+    return EFI_SUCCESS;
+}
+
+// Merge in what MP services knows, which cpu is the BSP and which passed self test
+EFI_STATUS topo_add_mp(topo_info_t *topo, EFI_MP_SERVICES_PROTOCOL *mps)
+{
+    EFI_PROCESSOR_INFORMATION info;
+    EFI_STATUS status;
+    UINTN num_cpus;
+    UINTN num_enabled;
+
+    status = mps->GetNumberOfProcessors(mps, &num_cpus, &num_enabled);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    for (UINTN i = 0; i < num_cpus; i++) {
+        UINT8 flags = TOPO_CPU_MP;
+
+        status = mps->GetProcessorInfo(mps, i, &info);
+        if (EFI_ERROR(status)) {
+            continue;
+        }
+
+        flags |= (info.StatusFlag & PROCESSOR_AS_BSP_BIT) ? TOPO_CPU_BSP : 0;
+        flags |= (info.StatusFlag & PROCESSOR_ENABLED_BIT) ? TOPO_CPU_ENABLED : 0;
+        flags |= (info.StatusFlag & PROCESSOR_HEALTH_STATUS_BIT) ? TOPO_CPU_HEALTHY : 0;
+        topo_add_cpu(topo, (UINT32) info.ProcessorId, TOPO_UID_NONE, flags);
+    }
+
+    topo->sources |= TOPO_SOURCE_MP;
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Split each APIC ID into package/core/thread and number cores, LLC domains and cache instances
+ * Numbering walks the cpus in APIC ID order, the MADT is close to sorted already so insertion sort is cheap
+ */
+void topo_finish(topo_info_t *topo)
+{
+    UINT16 order[TOPO_MAX_CPUS];
+    UINT32 core_bits = topo->package_shift - MIN(topo->smt_shift, topo->package_shift);
+    UINT32 package_key = MAX_UINT32, core_key = MAX_UINT32, llc_key = MAX_UINT32;
+    UINT32 cache_keys[TOPO_MAX_CACHES];
+
+    for (UINT32 i = 0; i < topo->num_cpus; i++) {
+        UINT32 apic_id = topo->cpus[i].apic_id;
+        UINT32 j = i;
+
+        while (j && topo->cpus[order[j - 1]].apic_id > apic_id) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    SetMem(cache_keys, sizeof(cache_keys), 0xFF);
+    topo->num_enabled = topo->num_packages = topo->num_cores = topo->num_llcs = 0;
+    for (UINT32 c = 0; c < topo->num_caches; c++) {
+        topo->caches[c].num_instances = 0;
+    }
+
+    for (UINT32 i = 0; i < topo->num_cpus; i++) {
+        topo_cpu_t *cpu = &topo->cpus[order[i]];
+        UINT64 apic_id = cpu->apic_id;
+
+        cpu->package = (UINT16) (apic_id >> topo->package_shift);
+        cpu->core = (UINT16) ((apic_id >> topo->smt_shift) & ((1ULL << core_bits) - 1));
+        cpu->thread = (UINT16) (apic_id & ((1ULL << topo->smt_shift) - 1));
+
+        if ((apic_id >> topo->package_shift) != package_key) {
+            package_key = apic_id >> topo->package_shift;
+            topo->num_packages++;
+        }
+        if ((apic_id >> topo->smt_shift) != core_key) {
+            core_key = apic_id >> topo->smt_shift;
+            topo->num_cores++;
+        }
+        if ((apic_id >> topo->llc_shift) != llc_key) {
+            llc_key = apic_id >> topo->llc_shift;
+            topo->num_llcs++;
+        }
+        cpu->core_index = topo->num_cores - 1;
+        cpu->llc = topo->num_llcs - 1;
+
+        for (UINT32 c = 0; c < topo->num_caches; c++) {
+            if ((apic_id >> topo->caches[c].share_shift) != cache_keys[c]) {
+                cache_keys[c] = apic_id >> topo->caches[c].share_shift;
+                topo->caches[c].num_instances++;
+            }
+        }
+
+        if (cpu->flags & TOPO_CPU_ENABLED) {
+            topo->num_enabled++;
+        }
+    }
+}
+
+// Fill topo from CPUID, the MADT in dir and mps if there is one, topo is zeroed first
+EFI_STATUS topo_build_info(acpi_dir_t *dir, EFI_MP_SERVICES_PROTOCOL *mps, OUT topo_info_t *topo)
+{
+    acpi_table_t *madt = acpi_find_table(dir, ACPI_SIG_MADT);
+    EFI_STATUS status = EFI_SUCCESS;
+
+    ZeroMem(topo, sizeof(topo_info_t));
+
+    topo_read_cpuid(topo);
+
+    if (madt && madt->valid) {
+        status = topo_add_madt(topo, (const acpi_madt_t *) (UINTN) madt->address);
+    }
+
+    if (mps && !EFI_ERROR(topo_add_mp(topo, mps))) {
+        status = EFI_SUCCESS;
+    }
+
+    topo_finish(topo);
+
+    LOG(LOG_INFO, LOG_TOPO_BUILT, topo->num_packages, topo->num_cores, topo->num_enabled, topo->num_llcs);
+    if (topo->dropped) {
+        LOG(LOG_WARN, LOG_TOPO_FULL, topo->dropped);
+    }
+
+    return topo->num_cpus ? status : EFI_NOT_FOUND;
+}
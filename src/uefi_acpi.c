@@ -2,12 +2,67 @@
 
 #include <Uefi.h>
 #include <Library/UefiLib.h>
-#include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
 
+#include <emmintrin.h>
+
+#include "arena.h"
+#include "boot_services.h"
 #include "info.h"
+#include "log.h"
 #include "uefi_acpi.h"
 
+// One piece of a table being summed, large tables are split into several
+typedef struct {
+    UINT8   *data;
+    UINTN   length;
+    UINT32  table;
+    UINT8   sum;
+    UINT64  cycles;
+} acpi_csum_chunk_t;
+
+typedef struct {
+    acpi_csum_chunk_t   *chunks;
+    UINTN               num_chunks;
+    UINTN               next; // Next chunk to claim, shared between all processors
+    UINT32              cpus;
+} acpi_csum_job_t;
+
+/*
+ * Byte sum of a buffer, only the low 8 bits matter for ACPI
+ * psadbw against zero adds up 8 bytes into each 64 bit lane, so the wide loop never overflows
+ */
+static UINT8 acpi_sum_bytes(const UINT8 *data, UINTN length)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    UINT64 sum;
+    UINTN i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i)), zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i + 16)), zero));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i + 32)), zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i + 48)), zero));
+    }
+
+    for (; i + 16 <= length; i += 16) {
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (data + i)), zero));
+    }
+
+    acc0 = _mm_add_epi64(acc0, acc1);
+    sum = (UINT64) _mm_cvtsi128_si64(acc0) + (UINT64) _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc0, acc0));
+
+    for (; i < length; i++) {
+        sum += data[i];
+    }
+
+    return (UINT8) sum;
+}
+
 EFI_STATUS validate_acpi_table(void *acpi_table) 
 {
     UINT8 rsdp_version = 255;
@@ -31,35 +86,306 @@ EFI_STATUS validate_acpi_table(void *acpi_table)
         return EFI_INVALID_PARAMETER;
     }
 
-    // First checksum the acpi 1.0 portion
-    {
-        UINT8 *byte = (UINT8 *) acpi_table;
-        UINT64 sum = 0;
-        for (UINT32 i = 0; i < sizeof(rsdp_descriptor_t); i++) {
-            sum += byte[i];
-        }
-
-        // We only care about the last byte of the sum, it must equal 0
-        if ((sum & 0xFF) != 0) {
-            return EFI_INVALID_PARAMETER;
-        }
+    // First checksum the acpi 1.0 portion, we only care about the last byte of the sum, it must equal 0
+    if (acpi_sum_bytes((UINT8 *) acpi_table, sizeof(rsdp_descriptor_t)) != 0) {
+        return EFI_INVALID_PARAMETER;
     }
 
     // ACPI 1.0 checksum passed, check v2 if we need to
     // v2 checksum is the same process as v1, just starting from the acpi v2 fields
     if (rsdp_version == 2) {
         rsdp_descriptor20_t *desc = (rsdp_descriptor20_t *) acpi_table;
-        UINT8 *byte = (UINT8 *) &(desc->length);
-        UINT64 sum = 0;
-        for (UINT32 i = 0; i < (sizeof(rsdp_descriptor20_t) - sizeof(rsdp_descriptor_t)); i++) {
-            sum += byte[i];
+        if (acpi_sum_bytes((UINT8 *) &(desc->length), sizeof(rsdp_descriptor20_t) - sizeof(rsdp_descriptor_t)) != 0) {
+            return EFI_INVALID_PARAMETER;
         }
+    }
 
-        // Same as acpi v1, we only care about the last byte of the sum, must be equal to 0
-        if ((sum & 0xFF) != 0) {
-            return EFI_INVALID_PARAMETER;
+    return EFI_SUCCESS;
+}
+
+// Find the slot for a signature, either the one already holding it or the first empty slot on its probe sequence
+static UINT32 acpi_dir_slot(acpi_dir_t *dir, UINT32 signature)
+{
+    UINT32 slot = ACPI_DIR_HASH(signature);
+
+    // There are always more slots than tables, so this finds an empty slot eventually
+    while (dir->slots[slot] && dir->tables[dir->slots[slot] - 1].signature != signature) {
+        slot = (slot + 1) & (ACPI_DIR_SLOTS - 1);
+    }
+
+    return slot;
+}
+
+// Record a table in the directory and hook it into the signature index
+static EFI_STATUS acpi_dir_add(acpi_dir_t *dir, EFI_PHYSICAL_ADDRESS address)
+{
+    acpi_sdt_header_t *hdr = (acpi_sdt_header_t *) address;
+    acpi_table_t *table;
+    UINT32 slot;
+    UINT8 idx;
+
+    if (!hdr || hdr->length < sizeof(acpi_sdt_header_t)) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    // Some firmware lists the same table twice, only keep the first
+    for (UINT32 i = 0; i < dir->num_tables; i++) {
+        if (dir->tables[i].fw_address == address) {
+            return EFI_SUCCESS;
+        }
+    }
+
+    if (dir->num_tables >= ACPI_DIR_MAX_TABLES) {
+        dir->dropped++;
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    table = &dir->tables[dir->num_tables++];
+    table->signature = hdr->signature;
+    table->length = hdr->length;
+    table->revision = hdr->revision;
+    table->next = 0;
+    table->address = address;
+    table->fw_address = address;
+
+    // First of its signature goes in the slot, repeats (SSDTs) are chained on the end
+    slot = acpi_dir_slot(dir, hdr->signature);
+    idx = dir->slots[slot];
+    if (!idx) {
+        dir->slots[slot] = dir->num_tables;
+    } else {
+        while (dir->tables[idx - 1].next) {
+            idx = dir->tables[idx - 1].next;
+        }
+        dir->tables[idx - 1].next = dir->num_tables;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Copy every table back to back into one EfiACPIReclaimMemory block and point the directory at the copies
+static EFI_STATUS acpi_pack_tables(acpi_dir_t *dir)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS base = 0;
+    UINTN size = 0;
+    UINTN offset = 0;
+
+    for (UINT32 i = 0; i < dir->num_tables; i++) {
+        size += ALIGN_VALUE(dir->tables[i].length, 16);
+    }
+
+    status = bs->allocate_pages(AllocateAnyPages, EfiACPIReclaimMemory, EFI_SIZE_TO_PAGES(size), &base);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    for (UINT32 i = 0; i < dir->num_tables; i++) {
+        acpi_table_t *table = &dir->tables[i];
+
+        CopyMem((void *) (base + offset), (void *) table->fw_address, table->length);
+        table->address = base + offset;
+        offset += ALIGN_VALUE(table->length, 16);
+    }
+
+    dir->packed_base = base;
+    dir->packed_size = size;
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Walk the XSDT (or RSDT on ACPI 1.0) once and index every table by signature
+ * If pack is set the tables are also copied into one contiguous reclaimable block
+ */
+EFI_STATUS acpi_build_dir(void *rsdp, OUT acpi_dir_t *dir, BOOLEAN pack)
+{
+    rsdp_descriptor20_t *desc = (rsdp_descriptor20_t *) rsdp;
+    acpi_sdt_header_t *sdt;
+    UINT8 *entries;
+    UINTN entry_size;
+    UINTN num_entries;
+    EFI_STATUS status;
+
+    if (!rsdp || !dir) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    SetMem(dir, sizeof(acpi_dir_t), 0);
+
+    if (desc->rsdp_descriptor10.revision >= 2 && desc->xsdt_address) {
+        sdt = (acpi_sdt_header_t *) desc->xsdt_address;
+        entry_size = sizeof(UINT64);
+    } else {
+        sdt = (acpi_sdt_header_t *) (UINTN) desc->rsdp_descriptor10.rsdt_address;
+        entry_size = sizeof(UINT32);
+    }
+
+    // Everything else hangs off the XSDT, don't follow its pointers unless it checks out
+    if (!sdt || sdt->length < sizeof(acpi_sdt_header_t) || acpi_sum_bytes((UINT8 *) sdt, sdt->length) != 0) {
+        return EFI_INVALID_PARAMETER;
+    }
+
+    entries = (UINT8 *) sdt + sizeof(acpi_sdt_header_t);
+    num_entries = (sdt->length - sizeof(acpi_sdt_header_t)) / entry_size;
+
+    for (UINTN i = 0; i < num_entries; i++) {
+        EFI_PHYSICAL_ADDRESS address = 0;
+        acpi_sdt_header_t *hdr;
+
+        // XSDT entries are only 4 byte aligned, copy them out rather than dereferencing
+        CopyMem(&address, entries + i * entry_size, entry_size);
+
+        // A full directory only drops the table, the ones already indexed are still worth booting with
+        status = acpi_dir_add(dir, address);
+        if (EFI_ERROR(status)) {
+            continue;
+        }
+
+        // The DSDT is only reachable through the FADT, prefer the 64 bit pointer when the table has one
+        hdr = (acpi_sdt_header_t *) address;
+        if (hdr->signature == ACPI_SIG_FADT) {
+            EFI_PHYSICAL_ADDRESS dsdt = 0;
+
+            if (hdr->length >= ACPI_FADT_XDSDT_OFFSET + sizeof(UINT64)) {
+                CopyMem(&dsdt, (UINT8 *) hdr + ACPI_FADT_XDSDT_OFFSET, sizeof(UINT64));
+            }
+
+            if (!dsdt) {
+                CopyMem(&dsdt, (UINT8 *) hdr + ACPI_FADT_DSDT_OFFSET, sizeof(UINT32));
+            }
+
+            acpi_dir_add(dir, dsdt);
+        }
+    }
+
+    if (dir->dropped) {
+        LOG(LOG_WARN, LOG_ACPI_DIR_FULL, dir->dropped, ACPI_DIR_MAX_TABLES);
+    }
+
+    if (pack) {
+        return acpi_pack_tables(dir);
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Returns the first table with the given signature, follow next for any others
+acpi_table_t *acpi_find_table(acpi_dir_t *dir, UINT32 signature)
+{
+    UINT32 slot = acpi_dir_slot(dir, signature);
+
+    if (!dir->slots[slot]) {
+        return NULL;
+    }
+
+    return &dir->tables[dir->slots[slot] - 1];
+}
+
+// Run on every processor, each one claims chunks until there are none left
+static VOID EFIAPI acpi_csum_worker(VOID *arg)
+{
+    acpi_csum_job_t *job = (acpi_csum_job_t *) arg;
+    UINTN idx;
+
+    __atomic_fetch_add(&job->cpus, 1, __ATOMIC_RELAXED);
+
+    while ((idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->num_chunks) {
+        acpi_csum_chunk_t *chunk = &job->chunks[idx];
+        UINT64 start = AsmReadTsc();
+
+        chunk->sum = acpi_sum_bytes(chunk->data, chunk->length);
+        chunk->cycles = AsmReadTsc() - start;
+    }
+}
+
+/*
+ * Checksum every table in the directory and record the result in each entry
+ * Tables of ACPI_CSUM_PARALLEL_MIN or more are split into ACPI_CSUM_CHUNK_SIZE pieces,
+ * if mps is given the APs pick up chunks alongside the BSP
+ * Bad tables are only flagged, it is up to the kernel what to do with them
+ */
+EFI_STATUS acpi_checksum_dir(acpi_dir_t *dir, EFI_MP_SERVICES_PROTOCOL *mps)
+{
+    EFI_STATUS status;
+    EFI_EVENT done = NULL;
+    acpi_csum_job_t job;
+    UINT8 sums[ACPI_DIR_MAX_TABLES];
+    UINT64 start = AsmReadTsc();
+
+    job.num_chunks = 0;
+    job.next = 0;
+    job.cpus = 0;
+
+    for (UINT32 i = 0; i < dir->num_tables; i++) {
+        UINT32 length = dir->tables[i].length;
+        job.num_chunks += (length < ACPI_CSUM_PARALLEL_MIN) ? 1 : (length + ACPI_CSUM_CHUNK_SIZE - 1) / ACPI_CSUM_CHUNK_SIZE;
+    }
+
+    job.chunks = arena_alloc_zero(&arena_scratch, job.num_chunks * sizeof(acpi_csum_chunk_t));
+    if (!job.chunks) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // Small tables are a single chunk, large ones are cut up so several processors can share them
+    {
+        UINTN idx = 0;
+
+        for (UINT32 i = 0; i < dir->num_tables; i++) {
+            acpi_table_t *table = &dir->tables[i];
+            UINTN chunk_size = (table->length < ACPI_CSUM_PARALLEL_MIN) ? table->length : ACPI_CSUM_CHUNK_SIZE;
+
+            for (UINTN off = 0; off < table->length; off += chunk_size) {
+                job.chunks[idx].data = (UINT8 *) table->address + off;
+                job.chunks[idx].length = MIN(chunk_size, table->length - off);
+                job.chunks[idx].table = i;
+                idx++;
+            }
+        }
+    }
+
+    // Only bother waking the APs when there is something to split
+    if (mps && job.num_chunks > dir->num_tables) {
+        status = gBS->CreateEvent(0, TPL_NOTIFY, NULL, NULL, &done);
+        if (!EFI_ERROR(status)) {
+            status = mps->StartupAllAPs(mps, acpi_csum_worker, FALSE, done, 0, &job, NULL);
+            if (EFI_ERROR(status)) {
+                gBS->CloseEvent(done);
+                done = NULL;
+            }
         }
     }
 
+    acpi_csum_worker(&job);
+
+    if (done) {
+        UINTN index;
+        gBS->WaitForEvent(1, &done, &index);
+        gBS->CloseEvent(done);
+    }
+
+    // Fold the chunk results back into their tables
+    SetMem(sums, sizeof(sums), 0);
+    for (UINT32 i = 0; i < dir->num_tables; i++) {
+        dir->tables[i].csum_cycles = 0;
+    }
+
+    for (UINTN i = 0; i < job.num_chunks; i++) {
+        acpi_csum_chunk_t *chunk = &job.chunks[i];
+        sums[chunk->table] += chunk->sum;
+        dir->tables[chunk->table].csum_cycles += chunk->cycles;
+    }
+
+    dir->num_invalid = 0;
+    for (UINT32 i = 0; i < dir->num_tables; i++) {
+        dir->tables[i].valid = (sums[i] == 0);
+        if (!dir->tables[i].valid) {
+            dir->num_invalid++;
+        }
+    }
+
+    dir->csum_cpus = job.cpus;
+    dir->csum_cycles = AsmReadTsc() - start;
+
     return EFI_SUCCESS;
-}
\ No newline at end of file
+}
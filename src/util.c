@@ -2,7 +2,13 @@
 #include <Library/UefiLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseLib.h>
 
+#include <Guid/FileInfo.h>
+
+#include "arena.h"
+#include "boot_services.h"
 #include "util.h"
 
 const CHAR16 *mem_types[] = {
@@ -79,6 +85,21 @@ void print_memory_map(mem_map_t *mem_map)
     return;
 }
 
+// Same as above but one line per entry on the framebuffer console, usable once boot services are gone
+void print_memory_map_console(fb_console_t *con, mem_map_t *mem_map)
+{
+    EFI_MEMORY_DESCRIPTOR *cur = mem_map->memory_map;
+
+    fb_console_printf(con, "Memory map: %ld entries, key %ld\n", mem_map->num_entries, mem_map->map_key);
+
+    for (UINTN i = 0; i < mem_map->num_entries; i++) {
+        fb_console_printf(con, "%016lx-%016lx %-24s attr 0x%lx\n", cur->PhysicalStart,
+                cur->PhysicalStart + EFI_PAGES_TO_SIZE(cur->NumberOfPages), mem_type_to_str(cur->Type), cur->Attribute);
+
+        cur = (void *) cur + mem_map->desc_size;
+    }
+}
+
 void efi_waitforkey()
 {
     EFI_INPUT_KEY key;
@@ -88,6 +109,21 @@ void efi_waitforkey()
     while ((status = gST->ConIn->ReadKeyStroke(gST->ConIn, &key)) == EFI_NOT_READY) ;
 }
 
+// TSC ticks per second, measured against a 10ms Stall the first time it is asked for
+UINT64 tsc_frequency()
+{
+    static UINT64 hz = 0;
+    UINT64 start;
+
+    if (!hz) {
+        start = AsmReadTsc();
+        gBS->Stall(10000);
+        hz = (AsmReadTsc() - start) * 100;
+    }
+
+    return hz;
+}
+
 EFI_STATUS efivar_set(CHAR16 *name, UINTN *size, VOID *data, BOOLEAN persist)
 {
     UINT32 attr = EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS;
@@ -133,3 +169,82 @@ EFI_STATUS efivar_get(CHAR16 *name, OUT UINTN *size, OUT VOID **data)
     return status;
 }
 
+// Read a whole file into arena memory, it lives as long as the arena does
+EFI_STATUS efi_read_file(arena_t *arena, EFI_FILE *root, CHAR16 *path, OUT VOID **data, OUT UINTN *size)
+{
+    EFI_STATUS status;
+    EFI_FILE *file = NULL;
+    EFI_FILE_INFO *finfo = NULL;
+    EFI_GUID file_info_guid = EFI_FILE_INFO_ID;
+    UINTN info_size = 0;
+
+    *data = NULL;
+    *size = 0;
+
+    status = root->Open(root, &file, path, EFI_FILE_MODE_READ, EFI_FILE_READ_ONLY);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = file->GetInfo(file, &file_info_guid, &info_size, NULL);
+    if (status == EFI_BUFFER_TOO_SMALL) {
+        finfo = arena_alloc(arena, info_size);
+        if (!finfo) {
+            status = EFI_OUT_OF_RESOURCES;
+        } else {
+            status = file->GetInfo(file, &file_info_guid, &info_size, finfo);
+        }
+    }
+
+    if (!EFI_ERROR(status)) {
+        *size = finfo->FileSize;
+        *data = arena_alloc(arena, *size);
+        if (!*data) {
+            status = EFI_OUT_OF_RESOURCES;
+        } else {
+            status = file->Read(file, size, *data);
+        }
+
+        // A short read would hand back a truncated file as if it were whole
+        if (!EFI_ERROR(status) && *size != finfo->FileSize) {
+            status = EFI_END_OF_FILE;
+        }
+    }
+
+    if (EFI_ERROR(status)) {
+        *data = NULL;
+    }
+    file->Close(file);
+
+    return status;
+}
+
+/*
+ * Read the memory map into mem_map, *capacity is the size of the buffer it already has
+ * The first call takes the buffer from the handoff arena, later calls reuse it so they don't change the map themselves
+ */
+EFI_STATUS efi_read_memory_map(IN OUT mem_map_t *mem_map, IN OUT UINTN *capacity)
+{
+    EFI_STATUS status;
+    UINTN size = *capacity;
+
+    status = bs->get_memory_map(&size, mem_map->memory_map, &mem_map->map_key, &mem_map->desc_size, &mem_map->desc_version);
+    if (status == EFI_BUFFER_TOO_SMALL) {
+        // Taking the buffer can add an entry or two of its own, the headroom covers them
+        size += SIZE_1KB;
+        mem_map->memory_map = arena_alloc(&arena_handoff, size);
+        if (!mem_map->memory_map) {
+            *capacity = 0;
+            return EFI_OUT_OF_RESOURCES;
+        }
+        *capacity = size;
+
+        status = bs->get_memory_map(&size, mem_map->memory_map, &mem_map->map_key, &mem_map->desc_size, &mem_map->desc_version);
+    }
+
+    if (!EFI_ERROR(status)) {
+        mem_map->num_entries = size / mem_map->desc_size;
+    }
+
+    return status;
+}